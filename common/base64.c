@@ -1,17 +1,55 @@
 #include <string.h>
 #include <stdlib.h>
+#include <config.h>
 #include "base64.h"
 
 /*
  * http://freecode-freecode.blogspot.com/2008/02/base64c.html
+ *
+ * the vectorized kernels follow the algorithms from
+ * http://0x80.pl/notesen/2016-01-12-sse-base64-encoding.html and
+ * http://0x80.pl/notesen/2016-01-17-sse-base64-decoding.html
  */
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(HAVE_IMMINTRIN_H) && defined(__GNUC__)
+#define GM_BASE64_SIMD 1
+#include <immintrin.h>
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+#define AVX2_TARGET  __attribute__((target("avx2")))
+#endif
 
 /**
  * characters used for Base64 encoding
  */
 const char *BASE64_CHARS = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
+/**
+ * values of all base64 characters, -1 for invalid characters
+ */
+static const signed char BASE64_VALUES[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+/**
+ * implementation used for encoding and decoding, detected on first use
+ */
+static int base64_backend = -1;
+
 /**
  * encode three bytes using base64 (RFC 3548)
  *
@@ -19,18 +57,180 @@ const char *BASE64_CHARS = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz
  * @param result buffer of four characters where the result is stored
  */
 void _base64_encode_triple(unsigned char triple[3], char result[4]) {
-    int tripleValue, i;
+    result[0] = BASE64_CHARS[triple[0] >> 2];
+    result[1] = BASE64_CHARS[((triple[0] & 0x03) << 4) | (triple[1] >> 4)];
+    result[2] = BASE64_CHARS[((triple[1] & 0x0f) << 2) | (triple[2] >> 6)];
+    result[3] = BASE64_CHARS[triple[2] & 0x3f];
+}
 
-    tripleValue = triple[0];
-    tripleValue *= 256;
-    tripleValue += triple[1];
-    tripleValue *= 256;
-    tripleValue += triple[2];
+#ifdef GM_BASE64_SIMD
+/**
+ * spread 12 bytes into 16 sextets, one per byte
+ */
+SSSE3_TARGET
+static __m128i _base64_ssse3_enc_reshuffle(__m128i in) {
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003F03F0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
 
-    for (i=0; i<4; i++) {
-        result[3-i] = BASE64_CHARS[tripleValue%64];
-        tripleValue /= 64;
+/**
+ * translate 16 sextets into base64 characters
+ */
+SSSE3_TARGET
+static __m128i _base64_ssse3_enc_translate(__m128i in) {
+    const __m128i lut = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    __m128i indices   = _mm_subs_epu8(in, _mm_set1_epi8(51));
+    __m128i mask      = _mm_cmpgt_epi8(in, _mm_set1_epi8(25));
+    indices = _mm_sub_epi8(indices, mask);
+    return _mm_add_epi8(in, _mm_shuffle_epi8(lut, indices));
+}
+
+/**
+ * encode 12 bytes per round, returns number of bytes consumed
+ */
+SSSE3_TARGET
+static size_t _base64_ssse3_encode(const unsigned char *source, size_t sourcelen, char *target) {
+    size_t done = 0;
+    while (sourcelen - done >= 16) {
+        __m128i str = _mm_loadu_si128((const __m128i *)(source+done));
+        str = _base64_ssse3_enc_translate(_base64_ssse3_enc_reshuffle(str));
+        _mm_storeu_si128((__m128i *)target, str);
+        target += 16;
+        done   += 12;
+    }
+    return done;
+}
+
+/**
+ * encode 24 bytes per round, returns number of bytes consumed
+ */
+AVX2_TARGET
+static size_t _base64_avx2_encode(const unsigned char *source, size_t sourcelen, char *target) {
+    const __m256i shuf = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                         10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i lut  = _mm256_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+                                          65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    size_t done = 0;
+    while (sourcelen - done >= 28) {
+        __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(source+done))),
+                                             _mm_loadu_si128((const __m128i *)(source+done+12)), 1);
+        in = _mm256_shuffle_epi8(in, shuf);
+        __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        in = _mm256_or_si256(t1, t3);
+        __m256i indices = _mm256_subs_epu8(in, _mm256_set1_epi8(51));
+        __m256i mask    = _mm256_cmpgt_epi8(in, _mm256_set1_epi8(25));
+        indices = _mm256_sub_epi8(indices, mask);
+        in = _mm256_add_epi8(in, _mm256_shuffle_epi8(lut, indices));
+        _mm256_storeu_si256((__m256i *)target, in);
+        target += 32;
+        done   += 24;
+    }
+    return done;
+}
+
+/**
+ * decode 16 characters per round until the first invalid character,
+ * returns number of characters consumed
+ */
+SSSE3_TARGET
+static size_t _base64_ssse3_decode(const char *source, size_t sourcelen, unsigned char *target, size_t targetlen) {
+    const __m128i lut_lo   = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi   = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2F  = _mm_set1_epi8(0x2F);
+    size_t done = 0;
+    while (sourcelen - done >= 16 && targetlen >= 16) {
+        __m128i str = _mm_loadu_si128((const __m128i *)(source+done));
+        __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2F);
+        __m128i lo_nibbles = _mm_and_si128(str, mask_2F);
+        __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+        __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0)
+            break;
+        __m128i eq_2F = _mm_cmpeq_epi8(str, mask_2F);
+        __m128i roll  = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2F, hi_nibbles));
+        str = _mm_add_epi8(str, roll);
+        str = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+        str = _mm_madd_epi16(str, _mm_set1_epi32(0x00011000));
+        str = _mm_shuffle_epi8(str, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        _mm_storeu_si128((__m128i *)target, str);
+        target    += 12;
+        targetlen -= 12;
+        done      += 16;
     }
+    return done;
+}
+
+/**
+ * decode 32 characters per round until the first invalid character,
+ * returns number of characters consumed
+ */
+AVX2_TARGET
+static size_t _base64_avx2_decode(const char *source, size_t sourcelen, unsigned char *target, size_t targetlen) {
+    const __m256i lut_lo   = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                              0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                              0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                              0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi   = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                              0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                              0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                              0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2F  = _mm256_set1_epi8(0x2F);
+    const __m256i pack     = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                              2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    size_t done = 0;
+    while (sourcelen - done >= 32 && targetlen >= 32) {
+        __m256i str = _mm256_loadu_si256((const __m256i *)(source+done));
+        __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2F);
+        __m256i lo_nibbles = _mm256_and_si256(str, mask_2F);
+        __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+        if (!_mm256_testz_si256(lo, hi))
+            break;
+        __m256i eq_2F = _mm256_cmpeq_epi8(str, mask_2F);
+        __m256i roll  = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2F, hi_nibbles));
+        str = _mm256_add_epi8(str, roll);
+        str = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+        str = _mm256_madd_epi16(str, _mm256_set1_epi32(0x00011000));
+        str = _mm256_shuffle_epi8(str, pack);
+        str = _mm256_permutevar8x32_epi32(str, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256((__m256i *)target, str);
+        target    += 24;
+        targetlen -= 24;
+        done      += 32;
+    }
+    return done;
+}
+#endif
+
+/**
+ * select the base64 implementation
+ *
+ * @param backend the preferred implementation
+ * @return the implementation in use
+ */
+int base64_set_backend(int backend) {
+    int supported = GM_BASE64_SCALAR;
+#ifdef GM_BASE64_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3"))
+        supported = GM_BASE64_SSSE3;
+    if (__builtin_cpu_supports("avx2"))
+        supported = GM_BASE64_AVX2;
+#endif
+    base64_backend = backend < supported ? backend : supported;
+    return base64_backend;
 }
 
 /**
@@ -47,6 +247,21 @@ int base64_encode(unsigned char *source, size_t sourcelen, char *target, size_t
     if ((sourcelen+2)/3*4 > targetlen-1)
         return 0;
 
+#ifdef GM_BASE64_SIMD
+    {
+        size_t done = 0;
+        if (base64_backend < 0)
+            base64_set_backend(GM_BASE64_AVX2);
+        if (base64_backend == GM_BASE64_AVX2)
+            done = _base64_avx2_encode(source, sourcelen, target);
+        if (base64_backend >= GM_BASE64_SSSE3)
+            done += _base64_ssse3_encode(source+done, sourcelen-done, target+done/3*4);
+        source    += done;
+        target    += done/3*4;
+        sourcelen -= done;
+    }
+#endif
+
     /* encode all full triples */
     while (sourcelen >= 3) {
         _base64_encode_triple(source, target);
@@ -81,17 +296,7 @@ int base64_encode(unsigned char *source, size_t sourcelen, char *target, size_t
  * @return the value in case of success (0-63), -1 on failure
  */
 int _base64_char_value(char base64char) {
-    if (base64char >= 'A' && base64char <= 'Z')
-        return base64char-'A';
-    if (base64char >= 'a' && base64char <= 'z')
-        return base64char-'a'+26;
-    if (base64char >= '0' && base64char <= '9')
-        return base64char-'0'+2*26;
-    if (base64char == '+')
-        return 2*26+10;
-    if (base64char == '/')
-        return 2*26+11;
-    return -1;
+    return BASE64_VALUES[(unsigned char)base64char];
 }
 
 /**
@@ -157,46 +362,91 @@ int _base64_decode_triple(char quadruple[4], unsigned char *result) {
  * @return length of converted data on success, -1 otherwise
  */
 size_t base64_decode(char *source, unsigned char *target, size_t targetlen) {
-    char *src, *tmpptr;
-    char quadruple[4], tmpresult[3];
+    return base64_decode_len(source, strlen(source), target, targetlen);
+}
+
+/**
+ * decode base64 encoded data of given length
+ *
+ * @param source the encoded data
+ * @param sourcelen length of the encoded data
+ * @param target pointer to the target buffer
+ * @param targetlen length of the target buffer
+ * @return length of converted data on success, -1 otherwise
+ */
+size_t base64_decode_len(const char *source, size_t sourcelen, unsigned char *target, size_t targetlen) {
+    const unsigned char *src = (const unsigned char *)source;
+    const unsigned char *end = src + sourcelen;
+    char quadruple[4];
+    unsigned char tmpresult[3];
     int i, tmplen = 3;
     size_t converted = 0;
+    int vectorize = 1;
 
-    /* concatinate '===' to the source to handle unpadded base64 data */
-    src = (char *)malloc(strlen(source)+5);
-    if (src == NULL)
-        return -1;
-    strcpy(src, source);
-    strcat(src, "====");
-    tmpptr = src;
+#ifdef GM_BASE64_SIMD
+    if (base64_backend < 0)
+        base64_set_backend(GM_BASE64_AVX2);
+#endif
 
     /* convert as long as we get a full result */
     while (tmplen == 3) {
-        /* get 4 characters to convert */
+#ifdef GM_BASE64_SIMD
+        /* decode large chunks of valid characters at once */
+        if (vectorize && base64_backend >= GM_BASE64_SSSE3) {
+            size_t done = 0;
+            if (base64_backend == GM_BASE64_AVX2)
+                done = _base64_avx2_decode((const char *)src, end-src, target, targetlen);
+            done += _base64_ssse3_decode((const char *)src+done, end-src-done, target+done/4*3, targetlen-done/4*3);
+            src       += done;
+            target    += done/4*3;
+            targetlen -= done/4*3;
+            converted += done/4*3;
+        }
+#endif
+        vectorize = 0;
+
+        /* fast path for four valid characters */
+        if (end - src >= 4) {
+            int a = BASE64_VALUES[src[0]], b = BASE64_VALUES[src[1]], c = BASE64_VALUES[src[2]], d = BASE64_VALUES[src[3]];
+            if ((a | b | c | d) >= 0) {
+                if (targetlen < 3)
+                    return -1;
+                target[0] = (unsigned char)((a << 2) | (b >> 4));
+                target[1] = (unsigned char)((b << 4) | (c >> 2));
+                target[2] = (unsigned char)((c << 6) | d);
+                src       += 4;
+                target    += 3;
+                targetlen -= 3;
+                converted += 3;
+                continue;
+            }
+        }
+
+        /* get 4 characters to convert, the end of the data counts as padding */
         for (i=0; i<4; i++) {
-            /* skip invalid characters - we won't reach the end */
-            while (*tmpptr != '=' && _base64_char_value(*tmpptr)<0)
-                tmpptr++;
+            /* skip invalid characters */
+            while (src < end && *src != '=' && BASE64_VALUES[*src] < 0)
+                src++;
 
-            quadruple[i] = *(tmpptr++);
+            quadruple[i] = src < end ? (char)*(src++) : '=';
         }
 
         /* convert the characters */
-        tmplen = _base64_decode_triple(quadruple, (unsigned char*)tmpresult);
+        tmplen = _base64_decode_triple(quadruple, tmpresult);
 
         /* check if the fit in the result buffer */
-        if ((int)targetlen < tmplen) {
-            free(src);
+        if ((int)targetlen < tmplen)
             return -1;
-        }
 
         /* put the partial result in the result buffer */
         memcpy(target, tmpresult, tmplen);
         target += tmplen;
         targetlen -= tmplen;
         converted += tmplen;
+
+        /* try vectorized decoding again after skipping invalid characters */
+        vectorize = 1;
     }
 
-    free(src);
     return converted;
 }
@@ -0,0 +1,564 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "config.h"
+#include "check_async.h"
+#include "check_utils.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+/* epoll events carry the slot number and what happened */
+#define GM_ASYNC_STDOUT     0
+#define GM_ASYNC_STDERR     1
+#define GM_ASYNC_EXIT       2
+#define GM_ASYNC_EXTERN     3
+#define GM_ASYNC_TAG(slot, kind) (((uint64_t)(slot) << 2) | (kind))
+
+#define GM_ASYNC_KILL_WAIT  1       /* seconds between SIGTERM, SIGKILL and giving up */
+#define GM_ASYNC_EVENTS     64      /* events per epoll_wait */
+
+static int async_have_pidfd = -1;
+
+
+/* get a pidfd for the plugin, -1 if the kernel does not support it */
+static int async_pidfd_open(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    pid = pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+/* add file descriptor to the epoll set */
+static int async_add_fd(gm_async_t * async, int fd, int slot, int kind) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = EPOLLIN;
+    ev.data.u64 = GM_ASYNC_TAG(slot, kind);
+    if(epoll_ctl(async->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        gm_log( GM_LOG_ERROR, "epoll_ctl failed: %s\n", strerror(errno) );
+        return GM_ERROR;
+    }
+    return GM_OK;
+}
+
+
+/* notice plugin exits by SIGCHLD, used when there are no pidfds */
+static int async_watch_sigchld(gm_async_t * async) {
+    sigset_t mask;
+
+    if(async->sigfd >= 0)
+        return GM_OK;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    async->sigfd = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC);
+    if(async->sigfd < 0) {
+        gm_log( GM_LOG_ERROR, "cannot create signalfd: %s\n", strerror(errno) );
+        return GM_ERROR;
+    }
+    return async_add_fd(async, async->sigfd, async->max, GM_ASYNC_EXIT);
+}
+
+
+/* create check runner */
+gm_async_t * mod_gm_async_create(int max, gm_async_done_fn done, void * data) {
+    gm_async_t * async;
+    int x;
+
+    if(max < 1)
+        max = 1;
+    if(max > GM_MAX_CONCURRENT_CHECKS)
+        max = GM_MAX_CONCURRENT_CHECKS;
+
+    async       = gm_malloc(sizeof(gm_async_t));
+    async->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(async->epfd < 0) {
+        gm_log( GM_LOG_ERROR, "cannot create epoll instance: %s\n", strerror(errno) );
+        free(async);
+        return NULL;
+    }
+    async->sigfd   = -1;
+    async->max     = max;
+    async->running = 0;
+    async->done    = done;
+    async->data    = data;
+    async->checks  = gm_calloc(max, sizeof(gm_async_check_t));
+    for(x = 0; x < max; x++) {
+        async->checks[x].pidfd = -1;
+        async->checks[x].fd[0] = -1;
+        async->checks[x].fd[1] = -1;
+    }
+    return async;
+}
+
+
+/* close all file descriptors of a check and free the slot */
+static void async_release(gm_async_t * async, gm_async_check_t * chk) {
+    int x;
+    for(x = 0; x < 2; x++) {
+        if(chk->fd[x] >= 0)
+            close(chk->fd[x]);
+        free(chk->buf[x]);
+    }
+    if(chk->pidfd >= 0)
+        close(chk->pidfd);
+    memset(chk, 0, sizeof(gm_async_check_t));
+    chk->pidfd = -1;
+    chk->fd[0] = -1;
+    chk->fd[1] = -1;
+    async->running--;
+}
+
+
+/* kill the process group of a check and wait for it */
+static void async_kill(gm_async_check_t * chk) {
+    if(chk->exited)
+        return;
+    kill(-chk->pid, SIGKILL);
+    kill(chk->pid, SIGKILL);
+    waitpid(chk->pid, &chk->status, 0);
+    chk->exited = 1;
+}
+
+
+/* free check runner */
+void mod_gm_async_free(gm_async_t * async) {
+    int x;
+
+    if(async == NULL)
+        return;
+
+    for(x = 0; x < async->max; x++) {
+        if(async->checks[x].job == NULL)
+            continue;
+        async_kill(&async->checks[x]);
+        free_job(async->checks[x].job);
+        async_release(async, &async->checks[x]);
+    }
+    if(async->sigfd >= 0)
+        close(async->sigfd);
+    close(async->epfd);
+    free(async->checks);
+    free(async);
+}
+
+
+/* hand finished job to the callback */
+static void async_done(gm_async_t * async, gm_job_t * job) {
+    gettimeofday(&job->finish_time, NULL);
+    set_job_string(job, &job->source, "Mod-Gearman Worker @ %s", mod_gm_opt->identifier);
+
+    async->done(job, async->data);
+}
+
+
+/* replace the plugin by the command line, runs in the forked child */
+static void async_exec(char * command_line, int out, int err) {
+    char *argv[MAX_CMD_ARGS];
+    sigset_t mask;
+    int x;
+
+    /* become the process group leader, so timeouts kill the whole plugin */
+    setpgid(0, 0);
+
+    /* remove all custom signal handler */
+    sigfillset(&mask);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    signal(SIGPIPE, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+
+    if(dup2(out, STDOUT_FILENO) < 0 || dup2(err, STDERR_FILENO) < 0)
+        _exit(STATE_UNKNOWN);
+
+    /* mark all filehandles to close on exec */
+    for(x = 3; x <= 64; x++)
+        fcntl(x, F_SETFD, FD_CLOEXEC);
+
+    /* use the fast execvp when there are no shell characters */
+    if((*command_line == '/' || *command_line == '.') && strpbrk(command_line,"!$^&*()~[]\\|{};<>?`\"'") == NULL) {
+        parse_command_line(command_line, argv);
+        if(argv[0])
+            execvp(argv[0], argv);
+    } else {
+        execl("/bin/sh", "sh", "-c", command_line, (char *)NULL);
+    }
+    if(errno == ENOENT)
+        _exit(127);
+    if(errno == EACCES)
+        _exit(126);
+    _exit(STATE_UNKNOWN);
+}
+
+
+/* start check */
+int mod_gm_async_start(gm_async_t * async, gm_job_t * job) {
+    gm_async_check_t * chk = NULL;
+    char * error = NULL;
+    int out[2], err[2], x;
+    pid_t pid;
+
+    for(x = 0; x < async->max; x++) {
+        if(async->checks[x].job == NULL) {
+            chk = &async->checks[x];
+            break;
+        }
+    }
+    if(chk == NULL)
+        return GM_ERROR;
+
+    gm_log( GM_LOG_TRACE, "mod_gm_async_start(%d, %s)\n", job->timeout, job->command_line );
+
+    if(job->timeout <= 0)
+        job->timeout = mod_gm_opt->job_timeout;
+    if(job->start_time.tv_sec == 0)
+        gettimeofday(&job->start_time, NULL);
+
+    if(verify_restricted_path(job->command_line, &error) != GM_OK) {
+        set_plugin_result(job, GM_EXIT_UNKNOWN, error, gm_strdup(""), mod_gm_opt->identifier);
+        async_done(async, job);
+        return GM_OK;
+    }
+
+    /* without pidfds, SIGCHLD must be caught before the plugin can exit */
+    if(async_have_pidfd != 1 && async_watch_sigchld(async) != GM_OK)
+        pid = -1;
+    else if(pipe2(out, O_CLOEXEC) != 0)
+        pid = -1;
+    else if(pipe2(err, O_CLOEXEC) != 0) {
+        close(out[0]);
+        close(out[1]);
+        pid = -1;
+    }
+    else {
+        pid = fork();
+        if(pid == 0)
+            async_exec(job->command_line, out[1], err[1]);
+        close(out[1]);
+        close(err[1]);
+        if(pid == -1) {
+            close(out[0]);
+            close(err[0]);
+        }
+    }
+
+    if(pid == -1) {
+        gm_log( GM_LOG_ERROR, "cannot start check: %s\n", strerror(errno) );
+        set_job_string(job, &job->output, "(Error On Fork)");
+        job->return_code = 3;
+        async_done(async, job);
+        return GM_OK;
+    }
+
+    gm_log( GM_LOG_TRACE, "started check with pid: %d\n", pid);
+
+    async->running++;
+    chk->job    = job;
+    chk->pid    = pid;
+    chk->fd[0]  = out[0];
+    chk->fd[1]  = err[0];
+    gettimeofday(&chk->deadline, NULL);
+    chk->deadline.tv_sec += job->timeout;
+    for(x = 0; x < 2; x++) {
+        fcntl(chk->fd[x], F_SETFL, fcntl(chk->fd[x], F_GETFL) | O_NONBLOCK);
+        async_add_fd(async, chk->fd[x], chk - async->checks, x);
+    }
+
+    chk->pidfd = async_pidfd_open(pid);
+    if(chk->pidfd >= 0) {
+        async_have_pidfd = 1;
+        async_add_fd(async, chk->pidfd, chk - async->checks, GM_ASYNC_EXIT);
+    } else {
+        async_have_pidfd = 0;
+    }
+
+    return GM_OK;
+}
+
+
+/* watch additional file descriptor */
+int mod_gm_async_watch(gm_async_t * async, int fd) {
+    return async_add_fd(async, fd, async->max, GM_ASYNC_EXTERN);
+}
+
+
+/* read available plugin output */
+static void async_read(gm_async_check_t * chk, int x) {
+    int n;
+
+    while(1) {
+        n = read_pipe_data(chk->fd[x], &chk->buf[x], &chk->len[x], &chk->size[x], mod_gm_opt->max_output_size);
+        if(n < 0 && errno == EAGAIN)
+            return;
+        if(n <= 0) {
+            /* closing also removes it from the epoll set */
+            close(chk->fd[x]);
+            chk->fd[x] = -1;
+            return;
+        }
+
+        /* stop reading and kill the plugin when it exceeds the output limit */
+        if(chk->len[x] >= mod_gm_opt->max_output_size) {
+            gm_log( GM_LOG_INFO, "plugin output exceeds %d bytes, killing plugin %d\n", mod_gm_opt->max_output_size, chk->pid );
+            for(x = 0; x < 2; x++) {
+                if(chk->fd[x] >= 0)
+                    close(chk->fd[x]);
+                chk->fd[x] = -1;
+            }
+            async_kill(chk);
+            return;
+        }
+    }
+}
+
+
+/* collect exit status if the plugin has exited */
+static void async_reap(gm_async_check_t * chk) {
+    pid_t rc;
+
+    if(chk->exited)
+        return;
+
+    rc = waitpid(chk->pid, &chk->status, WNOHANG);
+    if(rc == 0 || (rc < 0 && errno == EINTR))
+        return;
+    if(rc < 0)
+        chk->status = -1;
+    chk->exited = 1;
+    gm_log( GM_LOG_TRACE, "finished check from pid: %d with status: %d\n", chk->pid, chk->status);
+
+    if(chk->pidfd >= 0) {
+        close(chk->pidfd);
+        chk->pidfd = -1;
+    }
+}
+
+
+/* convert output and exit code and pass the job on */
+static void async_finish(gm_async_t * async, gm_async_check_t * chk) {
+    gm_job_t * job = chk->job;
+    char * output, * error;
+
+    output = gm_escape_newlines(chk->buf[0] != NULL ? chk->buf[0] : "", GM_DISABLED);
+    error  = gm_escape_newlines(chk->buf[1] != NULL ? chk->buf[1] : "", GM_ENABLED);
+    set_plugin_result(job, chk->status, output, error, mod_gm_opt->identifier);
+
+    if(chk->killed) {
+        job->return_code   = mod_gm_opt->timeout_return;
+        job->early_timeout = 1;
+        if ( !strcmp( job->type, "service" ) ) {
+            set_job_string(job, &job->output, "(Service Check Timed Out On Worker: %s)", mod_gm_opt->identifier);
+        }
+        else {
+            set_job_string(job, &job->output, "(Host Check Timed Out On Worker: %s)", mod_gm_opt->identifier);
+        }
+    }
+
+    async_release(async, chk);
+    async_done(async, job);
+}
+
+
+/* kill plugins which run into their timeout */
+static void async_timeout(gm_async_check_t * chk, struct timeval * now) {
+    gm_job_t * job = chk->job;
+
+    if(timercmp(now, &chk->deadline, <))
+        return;
+
+    chk->deadline = *now;
+    chk->deadline.tv_sec += GM_ASYNC_KILL_WAIT;
+    chk->killed++;
+
+    if(chk->killed == 1) {
+        if ( !strcmp( job->type, "service" ) ) {
+            gm_log( GM_LOG_INFO, "timeout (%is) hit for servicecheck: %s - %s\n", job->timeout, job->host_name, job->service_description);
+        }
+        else {
+            gm_log( GM_LOG_INFO, "timeout (%is) hit for hostcheck: %s\n", job->timeout, job->host_name);
+        }
+        gm_log( GM_LOG_TRACE, "send SIGTERM to %d\n", chk->pid);
+        kill(-chk->pid, SIGTERM);
+        kill(chk->pid, SIGTERM);
+    }
+    else if(chk->killed == 2) {
+        gm_log( GM_LOG_TRACE, "send SIGKILL to %d\n", chk->pid);
+        kill(-chk->pid, SIGKILL);
+        kill(chk->pid, SIGKILL);
+    }
+    else {
+        /* something outside of the process group keeps the pipes open */
+        async_reap(chk);
+        chk->exited = 1;
+        if(chk->fd[0] >= 0)
+            close(chk->fd[0]);
+        if(chk->fd[1] >= 0)
+            close(chk->fd[1]);
+        chk->fd[0] = -1;
+        chk->fd[1] = -1;
+    }
+}
+
+
+/* milliseconds until the next timeout action */
+static int async_next_timeout(gm_async_t * async, int timeout) {
+    struct timeval now, diff;
+    int x, ms;
+
+    gettimeofday(&now, NULL);
+    for(x = 0; x < async->max; x++) {
+        if(async->checks[x].job == NULL)
+            continue;
+        if(timercmp(&async->checks[x].deadline, &now, <))
+            return 0;
+        timersub(&async->checks[x].deadline, &now, &diff);
+        ms = diff.tv_sec * 1000 + diff.tv_usec / 1000 + 1;
+        if(timeout < 0 || ms < timeout)
+            timeout = ms;
+    }
+    return timeout;
+}
+
+
+/* wait for events and finish checks */
+int mod_gm_async_wait(gm_async_t * async, int timeout) {
+    struct epoll_event events[GM_ASYNC_EVENTS];
+    struct signalfd_siginfo info;
+    struct timeval now;
+    gm_async_check_t * chk;
+    int n, x, slot, kind, finished = 0;
+
+    n = epoll_wait(async->epfd, events, GM_ASYNC_EVENTS, async_next_timeout(async, timeout));
+    if(n < 0 && errno != EINTR)
+        gm_log( GM_LOG_ERROR, "epoll_wait failed: %s\n", strerror(errno) );
+
+    for(x = 0; x < n; x++) {
+        slot = events[x].data.u64 >> 2;
+        kind = events[x].data.u64 & 3;
+        if(slot >= async->max) {
+            /* SIGCHLD, the exit is picked up below */
+            if(kind == GM_ASYNC_EXIT)
+                while(read(async->sigfd, &info, sizeof(info)) > 0)
+                    ;
+            continue;
+        }
+        chk = &async->checks[slot];
+        if(chk->job == NULL)
+            continue;
+        if(kind == GM_ASYNC_EXIT)
+            async_reap(chk);
+        else if(chk->fd[kind] >= 0)
+            async_read(chk, kind);
+    }
+
+    gettimeofday(&now, NULL);
+    for(x = 0; x < async->max; x++) {
+        chk = &async->checks[x];
+        if(chk->job == NULL)
+            continue;
+        if(chk->pidfd < 0)
+            async_reap(chk);
+        if(!chk->exited || chk->fd[0] >= 0 || chk->fd[1] >= 0)
+            async_timeout(chk, &now);
+        if(chk->exited && chk->fd[0] < 0 && chk->fd[1] < 0) {
+            async_finish(async, chk);
+            finished++;
+        }
+    }
+
+    return finished;
+}
+
+
+/* kill all checks */
+void mod_gm_async_abort(gm_async_t * async, int sig) {
+    int x;
+
+    for(x = 0; x < async->max; x++) {
+        if(async->checks[x].job == NULL)
+            continue;
+        async_kill(&async->checks[x]);
+        if(sig != SIGINT)
+            send_failed_result(async->checks[x].job, sig);
+        free_job(async->checks[x].job);
+        async_release(async, &async->checks[x]);
+    }
+}
+
+#else
+
+/* epoll is linux only, the worker falls back to one check at a time */
+gm_async_t * mod_gm_async_create(int max, gm_async_done_fn done, void * data) {
+    max  = max;
+    done = done;
+    data = data;
+    gm_log( GM_LOG_ERROR, "concurrent checks are not supported on this platform\n" );
+    return NULL;
+}
+
+/* free check runner */
+void mod_gm_async_free(gm_async_t * async) {
+    free(async);
+}
+
+/* start check */
+int mod_gm_async_start(gm_async_t * async, gm_job_t * job) {
+    gm_log( GM_LOG_TRACE, "mod_gm_async_start(%p, %p)\n", async, job );
+    return GM_ERROR;
+}
+
+/* watch additional file descriptor */
+int mod_gm_async_watch(gm_async_t * async, int fd) {
+    gm_log( GM_LOG_TRACE, "mod_gm_async_watch(%p, %d)\n", async, fd );
+    return GM_ERROR;
+}
+
+/* wait for events and finish checks */
+int mod_gm_async_wait(gm_async_t * async, int timeout) {
+    gm_log( GM_LOG_TRACE, "mod_gm_async_wait(%p, %d)\n", async, timeout );
+    return 0;
+}
+
+/* kill all checks */
+void mod_gm_async_abort(gm_async_t * async, int sig) {
+    gm_log( GM_LOG_TRACE, "mod_gm_async_abort(%p, %d)\n", async, sig );
+}
+
+#endif
@@ -0,0 +1,267 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* include header */
+#include "config.h"
+#include "check_spawn.h"
+#include "check_utils.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+static pid_t spawn_plugin(char * command_line, char ** env, int out, int err);
+static int spawn_pidfd(pid_t pid);
+static int spawn_elapsed(struct timeval * start);
+
+
+/* run a check and wait for it */
+int spawn_check(char * command_line, int timeout, char ** env, char ** plugin_output, char ** plugin_error, int * timed_out) {
+    struct pollfd fds[3];
+    struct timeval start;
+    char * buf[2] = { NULL, NULL };
+    int len[2]  = { 0, 0 };
+    int size[2] = { 0, 0 };
+    int pipe_stdout[2], pipe_stderr[2];
+    int x, nfds, status, remaining, deadline;
+    int killed = FALSE, exited = FALSE;
+    pid_t pid;
+
+    gm_log( GM_LOG_TRACE, "spawn_check(%d, %s)\n", timeout, command_line );
+
+    *timed_out = FALSE;
+
+    if(pipe2(pipe_stdout, O_CLOEXEC) != 0) {
+        gm_log( GM_LOG_ERROR, "error creating pipe: %s\n", strerror(errno));
+        return -1;
+    }
+    if(pipe2(pipe_stderr, O_CLOEXEC) != 0) {
+        gm_log( GM_LOG_ERROR, "error creating pipe: %s\n", strerror(errno));
+        close(pipe_stdout[0]);
+        close(pipe_stdout[1]);
+        return -1;
+    }
+
+    gettimeofday(&start, NULL);
+    pid = spawn_plugin(command_line, env, pipe_stdout[1], pipe_stderr[1]);
+    close(pipe_stdout[1]);
+    close(pipe_stderr[1]);
+
+    fds[0].fd = pipe_stdout[0];
+    fds[1].fd = pipe_stderr[0];
+    if(pid <= 0) {
+        close(fds[0].fd);
+        close(fds[1].fd);
+        *plugin_output = gm_strdup("");
+        *plugin_error  = gm_strdup("");
+        /* same exit codes as a shell for plugins which cannot be started */
+        if(pid == -ENOENT)
+            return(127 << 8);
+        if(pid == -EACCES)
+            return(126 << 8);
+        return -1;
+    }
+    gm_log( GM_LOG_TRACE, "started check with pid: %d\n", pid);
+
+    /* the pidfd wakes us up when the plugin exits */
+    fds[2].fd      = spawn_pidfd(pid);
+    fds[2].events  = POLLIN;
+
+    /* read stdout and stderr at the same time, so no pipe fills up */
+    deadline = timeout * 1000;
+    while(1) {
+        nfds = 0;
+        for(x = 0; x < 2; x++) {
+            fds[x].events  = POLLIN;
+            fds[x].revents = 0;
+            if(fds[x].fd >= 0)
+                nfds++;
+        }
+
+        /* both pipes are closed, collect the exit status */
+        if(nfds == 0 && !exited && waitpid(pid, &status, WNOHANG) == pid)
+            exited = TRUE;
+        if(nfds == 0 && exited)
+            break;
+
+        remaining = deadline - spawn_elapsed(&start);
+        if(remaining <= 0) {
+            if(!killed) {
+                gm_log( GM_LOG_TRACE, "send SIGTERM to %d\n", pid);
+                kill(-pid, SIGTERM);
+                killed     = TRUE;
+                *timed_out = TRUE;
+                deadline  += GM_SPAWN_KILL_WAIT;
+                continue;
+            }
+            gm_log( GM_LOG_TRACE, "send SIGKILL to %d\n", pid);
+            kill(-pid, SIGKILL);
+            if(!exited && waitpid(pid, &status, 0) != pid)
+                status = -1;
+            break;
+        }
+
+        /* plugin closed its output but did not exit yet, poll for its exit without pidfd */
+        if(nfds == 0 && fds[2].fd < 0) {
+            poll(NULL, 0, remaining < 1 ? remaining : 1);
+            continue;
+        }
+
+        fds[2].revents = 0;
+        if(poll(fds, 3, remaining) < 0 && errno != EINTR) {
+            gm_log( GM_LOG_ERROR, "poll error: %s\n", strerror(errno));
+            kill(-pid, SIGKILL);
+            if(!exited && waitpid(pid, &status, 0) != pid)
+                status = -1;
+            break;
+        }
+
+        /* plugin exited, forked childs may still write to the pipes */
+        if(fds[2].revents != 0 && waitpid(pid, &status, WNOHANG) == pid) {
+            exited = TRUE;
+            close(fds[2].fd);
+            fds[2].fd = -1;
+        }
+        for(x = 0; x < 2; x++) {
+            if(fds[x].fd >= 0 && fds[x].revents != 0) {
+                if(read_pipe_data(fds[x].fd, &buf[x], &len[x], &size[x], mod_gm_opt->max_output_size) <= 0) {
+                    close(fds[x].fd);
+                    fds[x].fd = -1;
+                }
+            }
+        }
+
+        /* stop reading and kill the plugin when it exceeds the output limit */
+        if(len[0] >= mod_gm_opt->max_output_size || len[1] >= mod_gm_opt->max_output_size) {
+            gm_log( GM_LOG_INFO, "plugin output exceeds %d bytes, killing plugin %d\n", mod_gm_opt->max_output_size, pid );
+            kill(-pid, SIGKILL);
+            if(!exited && waitpid(pid, &status, 0) != pid)
+                status = -1;
+            break;
+        }
+    }
+
+    for(x = 0; x < 3; x++) {
+        if(fds[x].fd >= 0)
+            close(fds[x].fd);
+    }
+    gm_log( GM_LOG_TRACE, "finished check from pid: %d with status: %d\n", pid, status);
+
+    *plugin_output = gm_escape_newlines(buf[0] != NULL ? buf[0] : "", GM_DISABLED);
+    *plugin_error  = gm_escape_newlines(buf[1] != NULL ? buf[1] : "", GM_ENABLED);
+    free(buf[0]);
+    free(buf[1]);
+
+    return status;
+}
+
+
+/* start the plugin, returns its pid or the negative errno */
+static pid_t spawn_plugin(char * command_line, char ** env, int out, int err) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t mask;
+    char *argv[MAX_CMD_ARGS];
+    char *cmd = NULL;
+    pid_t pid;
+    int rc;
+
+    /* use the fast exec when there are no shell characters */
+    if((*command_line == '/' || *command_line == '.') && strpbrk(command_line,"!$^&*()~[]\\|{};<>?`\"'") == NULL) {
+        gm_log( GM_LOG_TRACE, "using spawn, no shell characters found\n" );
+        cmd = gm_strdup(command_line);
+        parse_command_line(cmd, argv);
+        if(!argv[0]) {
+            free(cmd);
+            return -ENOENT;
+        }
+    } else {
+        gm_log( GM_LOG_TRACE, "using spawn with shell, found shell characters\n" );
+        argv[0] = "/bin/sh";
+        argv[1] = "-c";
+        argv[2] = command_line;
+        argv[3] = NULL;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err, STDERR_FILENO);
+
+    /* become the process group leader, so timeouts kill the whole plugin */
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setpgroup(&attr, 0);
+
+    /* remove all custom signal handler */
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    sigfillset(&mask);
+    sigdelset(&mask, SIGKILL);
+    sigdelset(&mask, SIGSTOP);
+    posix_spawnattr_setsigdefault(&attr, &mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    rc = posix_spawn(&pid, argv[0], &actions, &attr, argv, env != NULL ? env : environ);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    /* argv points into cmd */
+    if(rc != 0) {
+        gm_log( GM_LOG_DEBUG, "spawning %s failed: %s\n", argv[0], strerror(rc));
+        free(cmd);
+        return -rc;
+    }
+    free(cmd);
+
+    return pid;
+}
+
+
+/* get a pidfd for the plugin, -1 if the kernel does not support it */
+static int spawn_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    int fd = syscall(SYS_pidfd_open, pid, 0);
+    if(fd >= 0)
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+#else
+    pid = pid;
+    return -1;
+#endif
+}
+
+
+/* milliseconds since start */
+static int spawn_elapsed(struct timeval * start) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (int)((now.tv_sec - start->tv_sec) * 1000 + (now.tv_usec - start->tv_usec) / 1000);
+}
@@ -27,9 +27,19 @@
 #include "epn_utils.h"
 #include "gearman_utils.h"
 #include "popenRWE.h"
+#include "check_spawn.h"
+#include <poll.h>
+#include <pthread.h>
+
+extern char **environ;
 
 pid_t current_child_pid = 0;
 
+/* the forked child does not exec, so close-on-exec does not help against
+ * pipes of other threads. No check may fork while the write end of
+ * another check is open in the worker. */
+static pthread_mutex_t fork_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /* convert number to signal name */
 char *nr2signal(int sig) {
     char * signame = NULL;
@@ -90,42 +100,46 @@ char *extract_check_result(FILE *fp, int trimmed) {
 }
 
 
+/* verify restricted paths
+ * make sure our command does not contain any bash special characters
+ * and starts with one of the allowed paths
+ */
+int verify_restricted_path(char *processed_command, char **ret) {
+    int i;
+
+    if(!mod_gm_opt->restrict_path_num)
+        return(GM_OK);
+
+    if(*processed_command != '/') {
+        gm_asprintf(ret, "ERROR: restricted paths in affect, but command does not start with an absolute path: %.*s...\n", 8, processed_command);
+        return(GM_ERROR);
+    }
+    if(strpbrk(processed_command,mod_gm_opt->restrict_command_characters) != NULL) {
+        gm_asprintf(ret, "ERROR: restricted paths in affect, but command contains forbidden character(s): %.*s...\n", 8, processed_command);
+        return(GM_ERROR);
+    }
+    for(i=0;i<mod_gm_opt->restrict_path_num;i++) {
+        if(starts_with(mod_gm_opt->restrict_path[i], processed_command)) {
+            return(GM_OK);
+        }
+    }
+    gm_asprintf(ret, "ERROR: command does not start with any of the restricted paths: %.*s...\n", 8, processed_command);
+    return(GM_ERROR);
+}
+
+
 /* run a check */
 int run_check(char *processed_command, char **ret, char **err) {
     char *argv[MAX_CMD_ARGS];
-    FILE *fp;
     pid_t pid;
     int pipe_stdout[2], pipe_stderr[2], pipe_rwe[3];
     int retval;
-    int i;
-    int restricted_ok = FALSE;
     sigset_t mask;
 
-    /* verify restricted paths
-     * make sure our command does not contain any bash special characters
-     * and starts with one of the allowed paths
-     */
-    if(mod_gm_opt->restrict_path_num) {
-        if(*processed_command != '/') {
-            *err = gm_strdup("");
-            gm_asprintf(ret, "ERROR: restricted paths in affect, but command does not start with an absolute path: %.*s...\n", 8, processed_command);
-            return(GM_EXIT_UNKNOWN);
-        }
-        if(strpbrk(processed_command,mod_gm_opt->restrict_command_characters) != NULL) {
-            *err = gm_strdup("");
-            gm_asprintf(ret, "ERROR: restricted paths in affect, but command contains forbidden character(s): %.*s...\n", 8, processed_command);
-            return(GM_EXIT_UNKNOWN);
-        }
-        for(i=0;i<mod_gm_opt->restrict_path_num;i++) {
-            if(starts_with(mod_gm_opt->restrict_path[i], processed_command)) {
-                restricted_ok = TRUE;
-            }
-        }
-        if(!restricted_ok) {
-            *err = gm_strdup("");
-            gm_asprintf(ret, "ERROR: command does not start with any of the restricted paths: %.*s...\n", 8, processed_command);
-            return(GM_EXIT_UNKNOWN);
-        }
+    /* verify restricted paths */
+    if(verify_restricted_path(processed_command, ret) != GM_OK) {
+        *err = gm_strdup("");
+        return(GM_EXIT_UNKNOWN);
     }
 
 #ifdef EMBEDDEDPERL
@@ -148,11 +162,11 @@ int run_check(char *processed_command, char **ret, char **err) {
         if(!argv[0])
             _exit(STATE_UNKNOWN);
 
-        if(pipe(pipe_stdout)) {
+        if(pipe2(pipe_stdout, O_CLOEXEC)) {
             gm_log( GM_LOG_ERROR, "error creating pipe: %s\n", strerror(errno));
             _exit(STATE_UNKNOWN);
         }
-        if(pipe(pipe_stderr)) {
+        if(pipe2(pipe_stderr, O_CLOEXEC)) {
             gm_log( GM_LOG_ERROR, "error creating pipe: %s\n", strerror(errno));
             _exit(STATE_UNKNOWN);
         }
@@ -186,26 +200,9 @@ int run_check(char *processed_command, char **ret, char **err) {
         }
 
         /* parent */
-        /* prepare stdout pipe reading */
         close(pipe_stdout[1]);
-        fp=fdopen(pipe_stdout[0],"r");
-        if(!fp){
-            gm_log( GM_LOG_ERROR, "fdopen error\n");
-            _exit(STATE_UNKNOWN);
-        }
-        *ret = extract_check_result(fp, GM_DISABLED);
-        fclose(fp);
-
-        /* prepare stderr pipe reading */
         close(pipe_stderr[1]);
-        fp=fdopen(pipe_stderr[0],"r");
-        if(!fp){
-            gm_log( GM_LOG_ERROR, "fdopen error\n");
-            _exit(STATE_UNKNOWN);
-        }
-        *err = extract_check_result(fp, GM_ENABLED);
-        fclose(fp);
-
+        read_plugin_output(pid, pipe_stdout[0], pipe_stderr[0], ret, err, mod_gm_opt->max_output_size);
         close(pipe_stdout[0]);
         close(pipe_stderr[0]);
         if(waitpid(pid,&retval,0)!=pid)
@@ -216,24 +213,13 @@ int run_check(char *processed_command, char **ret, char **err) {
         gm_log( GM_LOG_TRACE, "using popen, found shell characters\n" );
         current_child_pid = getpid();
         pid = popenRWE(pipe_rwe, processed_command);
-
-        /* extract check result */
-        fp=fdopen(pipe_rwe[1],"r");
-        if(!fp){
-            gm_log( GM_LOG_ERROR, "fdopen error\n");
+        if(pid < 0) {
+            gm_log( GM_LOG_ERROR, "popen error: %s\n", strerror(errno));
             _exit(STATE_UNKNOWN);
         }
-        *ret = extract_check_result(fp, GM_DISABLED);
-        fclose(fp);
 
-        /* extract check stderr */
-        fp=fdopen(pipe_rwe[2],"r");
-        if(!fp){
-            gm_log( GM_LOG_ERROR, "fdopen error\n");
-            _exit(STATE_UNKNOWN);
-        }
-        *err = extract_check_result(fp, GM_ENABLED);
-        fclose(fp);
+        /* extract check result and stderr */
+        read_plugin_output(pid, pipe_rwe[1], pipe_rwe[2], ret, err, mod_gm_opt->max_output_size);
 
         /* close the process */
         retval=pcloseRWE(pid, pipe_rwe);
@@ -243,17 +229,47 @@ int run_check(char *processed_command, char **ret, char **err) {
 }
 
 
+/* environment for the plugin, the variables of the job replace those of the worker */
+char ** job_environment(gm_job_t * job) {
+    char ** env;
+    size_t len;
+    int num = 0, n = 0, x, y;
+
+    if(job->env[0] == NULL)
+        return NULL;
+
+    while(environ[num] != NULL)
+        num++;
+    env = gm_malloc((num + GM_JOB_ENV_SIZE + 1) * sizeof(char *));
+    for(x = 0; x < num; x++) {
+        for(y = 0; job->env[y] != NULL; y++) {
+            len = strcspn(job->env[y], "=") + 1;
+            if(!strncmp(environ[x], job->env[y], len))
+                break;
+        }
+        if(job->env[y] == NULL)
+            env[n++] = environ[x];
+    }
+    for(y = 0; job->env[y] != NULL; y++)
+        env[n++] = job->env[y];
+    env[n] = NULL;
+
+    return env;
+}
+
+
 /* execute this command with given timeout */
 int execute_safe_command(gm_job_t * exec_job, int fork_exec, char * identifier) {
     int pipe_stdout[2] , pipe_stderr[2];
     int return_code;
     int pclose_result;
     int x;
-    char *plugin_output, *plugin_error, *bufdup;
-    char source[GM_BUFFERSIZE];
+    int spawned   = FALSE;
+    int timed_out = FALSE;
+    char *plugin_output, *plugin_error;
+    char **env, **worker_env;
     struct timeval start_time,end_time;
     pid_t pid    = 0;
-    source[0]    = '\x0';
 
     gm_log( GM_LOG_TRACE, "execute_safe_command(%d, %s)\n", exec_job->timeout, exec_job->command_line );
 
@@ -269,27 +285,51 @@ int execute_safe_command(gm_job_t * exec_job, int fork_exec, char * identifier)
         exec_job->start_time = start_time;
     }
 
+    /* job variables are passed to the plugin only, other threads may run plugins at the same time */
+    env = job_environment(exec_job);
+
+    /* start the plugin directly, embedded perl plugins need a forked worker */
+    spawned = mod_gm_opt->spawn_checks == GM_ENABLED;
+#ifdef EMBEDDEDPERL
+    if(mod_gm_opt->enable_embedded_perl == GM_ENABLED)
+        spawned = FALSE;
+#endif
+    if(spawned) {
+        if(verify_restricted_path(exec_job->command_line, &plugin_output) != GM_OK) {
+            plugin_error = gm_strdup("");
+            return_code  = GM_EXIT_UNKNOWN;
+        } else {
+            return_code = spawn_check(exec_job->command_line, exec_job->timeout, env, &plugin_output, &plugin_error, &timed_out);
+        }
+        set_plugin_result(exec_job, return_code, plugin_output, plugin_error, identifier);
+    }
+
     /* fork a child process */
-    if(fork_exec == GM_ENABLED) {
-        if(pipe(pipe_stdout) != 0)
+    else if(fork_exec == GM_ENABLED) {
+        pthread_mutex_lock(&fork_mutex);
+        if(pipe2(pipe_stdout, O_CLOEXEC) != 0)
             perror("pipe stdout");
-        if(pipe(pipe_stderr) != 0)
+        if(pipe2(pipe_stderr, O_CLOEXEC) != 0)
             perror("pipe stderr");
 
         pid=fork();
 
         /*fork error */
         if( pid == -1 ) {
-            if(exec_job->output != NULL)
-                free(exec_job->output);
-            exec_job->output      = gm_strdup("(Error On Fork)");
+            pthread_mutex_unlock(&fork_mutex);
+            close(pipe_stdout[0]);
+            close(pipe_stdout[1]);
+            close(pipe_stderr[0]);
+            close(pipe_stderr[1]);
+            set_job_string(exec_job, &exec_job->output, "(Error On Fork)");
             exec_job->return_code = 3;
+            free(env);
             return(GM_ERROR);
         }
     }
 
     /* we are in the child process */
-    if( fork_exec == GM_DISABLED || pid == 0 ) {
+    if( !spawned && ( fork_exec == GM_DISABLED || pid == 0 ) ) {
 
         /* become the process group leader */
         setpgid(0,0);
@@ -302,9 +342,13 @@ int execute_safe_command(gm_job_t * exec_job, int fork_exec, char * identifier)
         signal(SIGALRM, check_alarm_handler);
         alarm(exec_job->timeout);
 
-        /* run the plugin check command */
+        /* run the plugin check command, without fork the worker is single threaded and gets its environment back */
+        worker_env = environ;
+        if(env != NULL)
+            environ = env;
         pclose_result = run_check(exec_job->command_line, &plugin_output, &plugin_error);
         return_code   = pclose_result;
+        environ = worker_env;
 
         if(fork_exec == GM_ENABLED) {
             if(write(pipe_stdout[1], plugin_output, strlen(plugin_output)+1) <= 0)
@@ -327,64 +371,22 @@ int execute_safe_command(gm_job_t * exec_job, int fork_exec, char * identifier)
     }
 
     /* we are the parent */
-    if( fork_exec == GM_DISABLED || pid > 0 ){
+    if( !spawned && ( fork_exec == GM_DISABLED || pid > 0 ) ){
 
         if( fork_exec == GM_ENABLED) {
             gm_log( GM_LOG_TRACE, "started check with pid: %d\n", pid);
 
             close(pipe_stdout[1]);
             close(pipe_stderr[1]);
+            pthread_mutex_unlock(&fork_mutex);
 
+            /* read before waiting, large outputs would block the child otherwise.
+             * Output is already escaped and limited by the child */
+            read_pipes(pid, pipe_stdout[0], pipe_stderr[0], &plugin_output, &plugin_error, 0);
             waitpid(pid, &return_code, 0);
             gm_log( GM_LOG_TRACE, "finished check from pid: %d with status: %d\n", pid, return_code);
-            /* get all lines of plugin output */
-            plugin_output = gm_malloc(GM_BUFFERSIZE);
-            plugin_output[0]='\x0';
-            plugin_error  = gm_malloc(GM_BUFFERSIZE);
-            plugin_error[0]='\x0';
-            read_pipe(&plugin_output, pipe_stdout[0]);
-            read_pipe(&plugin_error, pipe_stderr[0]);
-        }
-        return_code = real_exit_code(return_code);
-
-        /* file not executable? */
-        if(return_code == 126) {
-            return_code = STATE_CRITICAL;
-            free(plugin_output);
-            gm_asprintf(&plugin_output, "CRITICAL: Return code of 126 is out of bounds. Make sure the plugin you're trying to run is executable. (worker: %s)", identifier);
-        }
-        /* file not found errors? */
-        else if(return_code == 127) {
-            return_code = STATE_CRITICAL;
-            free(plugin_output);
-            gm_asprintf(&plugin_output, "CRITICAL: Return code of 127 is out of bounds. Make sure the plugin you're trying to run actually exists. (worker: %s)", identifier);
-        }
-        /* signaled */
-        else if(return_code >= 128 && return_code < 144) {
-            char * signame = nr2signal((int)(return_code-128));
-            bufdup = gm_strdup(plugin_output);
-            free(plugin_output);
-            gm_asprintf(&plugin_output, "CRITICAL: Return code of %d is out of bounds. Plugin exited by signal %s. (worker: %s)\\n%s", (int)(return_code), signame, identifier, bufdup);
-            return_code = STATE_CRITICAL;
-            free(bufdup);
-            free(signame);
-        }
-        /* other error codes > 3 */
-        else if(return_code > 3) {
-            gm_log( GM_LOG_DEBUG, "check exited with exit code > 3. Exit: %d\n", (int)(return_code));
-            gm_log( GM_LOG_DEBUG, "stdout: %s\n", plugin_output);
-            bufdup = gm_strdup(plugin_output);
-            free(plugin_output);
-            gm_asprintf(&plugin_output, "CRITICAL: Return code of %d is out of bounds. (worker: %s)\\n%s", (int)(return_code), identifier, bufdup);
-            free(bufdup);
-            if(return_code != 25 && mod_gm_opt->workaround_rc_25 == GM_DISABLED) {
-                return_code = STATE_CRITICAL;
-            }
         }
-
-        exec_job->output      = plugin_output;
-        exec_job->error       = plugin_error;
-        exec_job->return_code = return_code;
+        set_plugin_result(exec_job, return_code, plugin_output, plugin_error, identifier);
         if( fork_exec == GM_ENABLED) {
             close(pipe_stdout[0]);
             close(pipe_stderr[0]);
@@ -393,33 +395,140 @@ int execute_safe_command(gm_job_t * exec_job, int fork_exec, char * identifier)
     alarm(0);
     current_child_pid = 0;
     pid               = 0;
+    free(env);
 
     /* record check result info */
     gettimeofday(&end_time, NULL);
     exec_job->finish_time = end_time;
 
     /* did we have a timeout? */
-    if(exec_job->timeout < ((int)end_time.tv_sec - (int)exec_job->start_time.tv_sec)) {
+    if(timed_out || exec_job->timeout < ((int)end_time.tv_sec - (int)exec_job->start_time.tv_sec)) {
         exec_job->return_code   = mod_gm_opt->timeout_return;
         exec_job->early_timeout = 1;
-        free(exec_job->output);
         if ( !strcmp( exec_job->type, "service" ) ) {
-            gm_asprintf(&exec_job->output, "(Service Check Timed Out On Worker: %s)", identifier);
+            set_job_string(exec_job, &exec_job->output, "(Service Check Timed Out On Worker: %s)", identifier);
         }
         else {
-            gm_asprintf(&exec_job->output, "(Host Check Timed Out On Worker: %s)", identifier);
+            set_job_string(exec_job, &exec_job->output, "(Host Check Timed Out On Worker: %s)", identifier);
         }
     }
 
-    snprintf( source, sizeof( source )-1, "Mod-Gearman Worker @ %s", identifier);
-    if(exec_job->source != NULL)
-        free(exec_job->source);
-    exec_job->source = gm_strdup(source);
+    set_job_string(exec_job, &exec_job->source, "Mod-Gearman Worker @ %s", identifier);
 
     return(GM_OK);
 }
 
 
+/* read stdout and stderr of a plugin and escape newlines */
+int read_plugin_output(pid_t pid, int fd_out, int fd_err, char **plugin_output, char **plugin_error, int limit) {
+    char *output, *error;
+    int rc;
+
+    rc = read_pipes(pid, fd_out, fd_err, &output, &error, limit);
+    *plugin_output = gm_escape_newlines(output, GM_DISABLED);
+    *plugin_error  = gm_escape_newlines(error, GM_ENABLED);
+    free(output);
+    free(error);
+
+    return(rc);
+}
+
+
+/* read stdout and stderr at the same time until both are closed,
+ * the plugin gets killed when it exceeds the output limit */
+int read_pipes(pid_t pid, int fd_out, int fd_err, char **output, char **error, int limit) {
+    struct pollfd fds[2];
+    char * buf[2] = { NULL, NULL };
+    int len[2]  = { 0, 0 };
+    int size[2] = { 0, 0 };
+    int x, rc = GM_OK;
+
+    fds[0].fd = fd_out;
+    fds[1].fd = fd_err;
+    while(fds[0].fd >= 0 || fds[1].fd >= 0) {
+        for(x = 0; x < 2; x++) {
+            fds[x].events  = POLLIN;
+            fds[x].revents = 0;
+        }
+        if(poll(fds, 2, -1) < 0) {
+            if(errno == EINTR)
+                continue;
+            gm_log( GM_LOG_ERROR, "poll error: %s\n", strerror(errno));
+            break;
+        }
+        for(x = 0; x < 2; x++) {
+            if(fds[x].fd < 0 || fds[x].revents == 0)
+                continue;
+            if(read_pipe_data(fds[x].fd, &buf[x], &len[x], &size[x], limit) <= 0)
+                fds[x].fd = -1;
+        }
+
+        /* stop reading instead of draining the plugin forever */
+        if(limit > 0 && (len[0] >= limit || len[1] >= limit)) {
+            gm_log( GM_LOG_INFO, "plugin output exceeds %d bytes, killing plugin %d\n", limit, pid );
+            kill(pid, SIGKILL);
+            rc = GM_ERROR;
+            break;
+        }
+    }
+
+    *output = buf[0] != NULL ? buf[0] : gm_strdup("");
+    *error  = buf[1] != NULL ? buf[1] : gm_strdup("");
+
+    return(rc);
+}
+
+
+/* set output and exit code of a finished plugin, takes ownership of the output buffers */
+void set_plugin_result(gm_job_t * exec_job, int return_code, char * plugin_output, char * plugin_error, char * identifier) {
+
+    return_code = real_exit_code(return_code);
+
+    /* previous output is overwritten, not freed */
+    exec_job->output = NULL;
+    exec_job->error  = NULL;
+
+    /* file not executable? */
+    if(return_code == 126) {
+        return_code = STATE_CRITICAL;
+        set_job_string(exec_job, &exec_job->output, "CRITICAL: Return code of 126 is out of bounds. Make sure the plugin you're trying to run is executable. (worker: %s)", identifier);
+        free(plugin_output);
+    }
+    /* file not found errors? */
+    else if(return_code == 127) {
+        return_code = STATE_CRITICAL;
+        set_job_string(exec_job, &exec_job->output, "CRITICAL: Return code of 127 is out of bounds. Make sure the plugin you're trying to run actually exists. (worker: %s)", identifier);
+        free(plugin_output);
+    }
+    /* signaled */
+    else if(return_code >= 128 && return_code < 144) {
+        char * signame = nr2signal((int)(return_code-128));
+        set_job_string(exec_job, &exec_job->output, "CRITICAL: Return code of %d is out of bounds. Plugin exited by signal %s. (worker: %s)\\n%s", (int)(return_code), signame, identifier, plugin_output);
+        return_code = STATE_CRITICAL;
+        free(plugin_output);
+        free(signame);
+    }
+    /* other error codes > 3 */
+    else if(return_code > 3) {
+        gm_log( GM_LOG_DEBUG, "check exited with exit code > 3. Exit: %d\n", (int)(return_code));
+        gm_log( GM_LOG_DEBUG, "stdout: %s\n", plugin_output);
+        set_job_string(exec_job, &exec_job->output, "CRITICAL: Return code of %d is out of bounds. (worker: %s)\\n%s", (int)(return_code), identifier, plugin_output);
+        free(plugin_output);
+        if(return_code != 25 && mod_gm_opt->workaround_rc_25 == GM_DISABLED) {
+            return_code = STATE_CRITICAL;
+        }
+    }
+    else {
+        set_job_buffer(exec_job, &exec_job->output, plugin_output);
+    }
+
+    set_job_buffer(exec_job, &exec_job->error, plugin_error);
+    exec_job->return_code = return_code;
+
+    return;
+}
+
+
 /* called when check runs into timeout */
 void check_alarm_handler(int sig) {
     pid_t pid;
@@ -509,8 +618,7 @@ void send_timeout_result(gm_job_t * exec_job) {
         snprintf( buffer, sizeof( buffer ) -1, "(Service Check Timed Out On Worker: %s)\n", mod_gm_opt->identifier);
     if ( !strcmp( exec_job->type, "host" ) )
         snprintf( buffer, sizeof( buffer ) -1, "(Host Check Timed Out On Worker: %s)\n", mod_gm_opt->identifier);
-    free(exec_job->output);
-    exec_job->output = gm_strdup( buffer );
+    set_job_string(exec_job, &exec_job->output, "%s", buffer);
 
     send_result_back(exec_job);
 
@@ -533,8 +641,7 @@ void send_failed_result(gm_job_t * exec_job, int sig) {
 
     signame = nr2signal(sig);
     snprintf( buffer, sizeof( buffer )-1, "(Return code of %d is out of bounds. Worker exited by signal %s on worker: %s)", sig, signame, mod_gm_opt->identifier);
-    free(exec_job->output);
-    exec_job->output = gm_strdup( buffer );
+    set_job_string(exec_job, &exec_job->output, "%s", buffer);
     free(signame);
 
     send_result_back(exec_job);
@@ -280,6 +280,10 @@ int init_embedded_perl(char **env){
     argc=argc;
     struct stat stat_buf;
 
+    /* already running, ex.: worker forked from the zygote */
+    if(my_perl != NULL)
+        return GM_OK;
+
     /* make sure the P1 file exists... */
     if(p1_file==NULL || stat(p1_file,&stat_buf)!=0){
         use_embedded_perl=FALSE;
@@ -24,6 +24,7 @@
 #include "common.h"
 #include "utils.h"
 #include "gearman_utils.h"
+#include "gm_payload.h"
 
 int mod_gm_con_errors = 0;
 struct timeval mod_gm_error_time;
@@ -57,8 +58,14 @@ int create_worker( gm_server_t * server_list[GM_LISTSIZE], gearman_worker_st *wo
 
 /* register function on worker */
 int worker_add_function( gearman_worker_st * worker, char * queue, gearman_worker_fn *function) {
+    return worker_add_function_context( worker, queue, function, NULL );
+}
+
+
+/* add function with context passed to each job */
+int worker_add_function_context( gearman_worker_st * worker, char * queue, gearman_worker_fn *function, void * context) {
     gearman_return_t ret;
-    ret = gearman_worker_add_function( worker, queue, 0, function, NULL );
+    ret = gearman_worker_add_function( worker, queue, 0, function, context );
     if ( ret != GEARMAN_SUCCESS ) {
         gm_log( GM_LOG_ERROR, "worker error: %s\n", gearman_worker_error( worker ) );
         return GM_ERROR;
@@ -124,9 +131,10 @@ int add_job_to_queue( gearman_client_st *client, gm_server_t * server_list[GM_LI
     signal(SIGPIPE, SIG_IGN);
 
     gm_log( GM_LOG_TRACE, "add_job_to_queue(%s, %s, %d, %d, %d, %d)\n", queue, uniq, priority, retries, transport_mode, send_now );
-    gm_log( GM_LOG_TRACE, "%d --->%s<---\n", strlen(data), data );
+    size = mod_gm_payload_size(data, (size_t)-1);
+    gm_log( GM_LOG_TRACE, "%d --->%s<---\n", size, data );
 
-    size = mod_gm_encrypt(&crypted_data, data, transport_mode);
+    size = mod_gm_encrypt_len(&crypted_data, data, size, transport_mode);
     gm_log( GM_LOG_TRACE, "%d +++>\n%s\n<+++\n", size, crypted_data );
 
     if( priority == GM_JOB_PRIO_LOW ) {
@@ -145,8 +153,11 @@ int add_job_to_queue( gearman_client_st *client, gm_server_t * server_list[GM_LI
         gm_log( GM_LOG_ERROR, "add_job_to_queue() wrong priority: %d\n", priority );
     }
 
-    if(send_now != TRUE)
+    if(send_now != TRUE) {
+        if(free_uniq)
+            free(uniq);
         return GM_OK;
+    }
 
     ret2 = gearman_client_run_tasks( client );
     gearman_client_task_free_all( client );
@@ -232,7 +243,7 @@ void free_worker(gearman_worker_st *worker) {
 }
 
 /* get worker/jobs data from gearman server */
-int get_gearman_server_data(mod_gm_server_status_t *stats, char ** message, char ** version, char * hostnam, int port) {
+int get_gearman_server_data(mod_gm_server_status_t *stats, char ** message, char ** version, char * hostnam, int port, int timeout) {
     int rc;
     char *total, *running, *worker, *output, *output_c, *line, *name;
     mod_gm_status_function_t *func;
@@ -240,7 +251,7 @@ int get_gearman_server_data(mod_gm_server_status_t *stats, char ** message, char
     *version  = gm_malloc(GM_BUFFERSIZE);
     snprintf(*version,  GM_BUFFERSIZE, "%s", "" );
 
-    rc = send2gearmandadmin("status\nversion\n", hostnam, port, &output, message);
+    rc = send2gearmandadmin("status\nversion\n", hostnam, port, &output, message, timeout);
     if(rc != STATE_OK) {
         if(output != NULL)
             free(output);
@@ -304,7 +315,7 @@ int get_gearman_server_data(mod_gm_server_status_t *stats, char ** message, char
 
 
 /* send gearman admin */
-int send2gearmandadmin(char * cmd, char * hostnam, int port, char ** output, char ** error) {
+int send2gearmandadmin(char * cmd, char * hostnam, int port, char ** output, char ** error, int timeout) {
     int sockfd, n;
     char buf[GM_BUFFERSIZE];
 
@@ -313,7 +324,7 @@ int send2gearmandadmin(char * cmd, char * hostnam, int port, char ** output, cha
     *output = gm_malloc(GM_BUFFERSIZE);
     snprintf(*output,  GM_BUFFERSIZE, "%s", "" );
 
-    if(gm_net_connect(hostnam, port, &sockfd, error) != GM_OK) {
+    if(gm_net_connect(hostnam, port, &sockfd, error, timeout) != GM_OK) {
         return(STATE_CRITICAL);
     }
 
@@ -327,6 +338,8 @@ int send2gearmandadmin(char * cmd, char * hostnam, int port, char ** output, cha
 
     n = read( sockfd, buf, GM_BUFFERSIZE-1 );
     if (n < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK)
+            errno = ETIMEDOUT;
         snprintf(*error, GM_BUFFERSIZE, "error reading from %s:%i - %s\n", hostnam, (int)port, strerror(errno));
         close(sockfd);
         return( STATE_CRITICAL );
@@ -341,12 +354,15 @@ int send2gearmandadmin(char * cmd, char * hostnam, int port, char ** output, cha
 }
 
 /* opens a tcp connection to a remote host */
-int gm_net_connect (const char *host_name, int port, int *sd, char ** error) {
+int gm_net_connect (const char *host_name, int port, int *sd, char ** error, int timeout) {
     struct addrinfo hints;
     struct addrinfo *r, *res;
+    struct pollfd pfd;
+    struct timeval tv;
     char port_str[6], host[GM_MAX_HOST_ADDRESS_LENGTH];
     size_t len;
-    int result;
+    socklen_t errlen;
+    int result, flags, err;
     int was_refused = FALSE;
 
     memset (&hints, 0, sizeof (hints));
@@ -383,10 +399,35 @@ int gm_net_connect (const char *host_name, int port, int *sd, char ** error) {
             return GM_ERROR;
         }
 
-        /* attempt to open a connection */
+        /* attempt to open a connection, but do not wait longer than the timeout */
+        flags = fcntl(*sd, F_GETFL, 0);
+        fcntl(*sd, F_SETFL, flags | O_NONBLOCK);
         result = connect (*sd, r->ai_addr, r->ai_addrlen);
+        if (result < 0 && errno == EINPROGRESS) {
+            pfd.fd     = *sd;
+            pfd.events = POLLOUT;
+            result = poll(&pfd, 1, timeout);
+            if (result == 0) {
+                errno  = ETIMEDOUT;
+                result = -1;
+            }
+            else if (result > 0) {
+                err    = 0;
+                errlen = sizeof(err);
+                if (getsockopt(*sd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0)
+                    err = errno;
+                errno  = err;
+                result = err == 0 ? 0 : -1;
+            }
+        }
+        fcntl(*sd, F_SETFL, flags);
 
         if (result == 0) {
+            /* reads and writes must not hang either */
+            tv.tv_sec  = timeout / 1000;
+            tv.tv_usec = (timeout % 1000) * 1000;
+            setsockopt(*sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(*sd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
             was_refused = FALSE;
             break;
         }
@@ -0,0 +1,376 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <string.h>
+#include "gm_aesni.h"
+
+#ifdef GM_AESNI
+#include <cpuid.h>
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+
+#define AESNI_MAXROUNDS 14
+
+#define AESNI_TARGET __attribute__((target("aes,sse2")))
+
+#define GCM_TARGET __attribute__((target("aes,pclmul,sse2,ssse3")))
+
+static unsigned char enc_keys[AESNI_MAXROUNDS+1][16];
+static unsigned char dec_keys[AESNI_MAXROUNDS+1][16];
+static int rounds = 0;
+
+/* gcm uses its own key */
+static unsigned char gcm_keys[AESNI_MAXROUNDS+1][16];
+static unsigned char gcm_h[4][16];
+static int gcm_rounds = 0;
+
+static void aesni_invert_keys(void) AESNI_TARGET;
+static void aesni_gcm_powers(const unsigned char *h) GCM_TARGET;
+
+
+/* check cpuid for aes support */
+int mod_gm_aesni_available(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return (ecx & bit_AES) ? 1 : 0;
+}
+
+
+/* check cpuid for carry-less multiplication used by gcm */
+int mod_gm_aesni_gcm_available(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return ((ecx & bit_AES) && (ecx & bit_PCLMUL) && (ecx & bit_SSSE3)) ? 1 : 0;
+}
+
+
+/* convert big endian rijndael round keys */
+static void aesni_convert_keys(unsigned char keys[][16], const unsigned long *rk, int nrounds) {
+    int i, j;
+    for(i = 0; i <= nrounds; i++) {
+        for(j = 0; j < 4; j++) {
+            unsigned long w = rk[i*4+j];
+            keys[i][j*4]   = (unsigned char)(w >> 24);
+            keys[i][j*4+1] = (unsigned char)(w >> 16);
+            keys[i][j*4+2] = (unsigned char)(w >>  8);
+            keys[i][j*4+3] = (unsigned char)(w);
+        }
+    }
+}
+
+
+/* build decryption keys for the equivalent inverse cipher */
+static void aesni_invert_keys(void) {
+    int i;
+    memcpy(dec_keys[0], enc_keys[rounds], 16);
+    for(i = 1; i < rounds; i++)
+        _mm_storeu_si128((__m128i *)dec_keys[i], _mm_aesimc_si128(_mm_loadu_si128((const __m128i *)enc_keys[rounds-i])));
+    memcpy(dec_keys[rounds], enc_keys[0], 16);
+}
+
+
+/* round keys from rijndael are 32bit big endian words */
+void mod_gm_aesni_init(const unsigned long *rk, int nrounds) {
+    rounds = nrounds;
+    aesni_convert_keys(enc_keys, rk, nrounds);
+    aesni_invert_keys();
+}
+
+
+/* set gcm key and hash subkey */
+void mod_gm_aesni_gcm_init(const unsigned long *rk, int nrounds, const unsigned char *h) {
+    gcm_rounds = nrounds;
+    aesni_convert_keys(gcm_keys, rk, nrounds);
+    if(mod_gm_aesni_gcm_available())
+        aesni_gcm_powers(h);
+}
+
+
+/* encrypt blocks, four at a time to keep the pipeline busy */
+AESNI_TARGET
+void mod_gm_aesni_encrypt(unsigned char *out, const unsigned char *in, int size) {
+    __m128i k[AESNI_MAXROUNDS+1];
+    int i, r;
+
+    for(r = 0; r <= rounds; r++)
+        k[r] = _mm_loadu_si128((const __m128i *)enc_keys[r]);
+
+    for(i = 0; i + 64 <= size; i += 64) {
+        __m128i b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in+i)),    k[0]);
+        __m128i b1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in+i+16)), k[0]);
+        __m128i b2 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in+i+32)), k[0]);
+        __m128i b3 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in+i+48)), k[0]);
+        for(r = 1; r < rounds; r++) {
+            b0 = _mm_aesenc_si128(b0, k[r]);
+            b1 = _mm_aesenc_si128(b1, k[r]);
+            b2 = _mm_aesenc_si128(b2, k[r]);
+            b3 = _mm_aesenc_si128(b3, k[r]);
+        }
+        _mm_storeu_si128((__m128i *)(out+i),    _mm_aesenclast_si128(b0, k[rounds]));
+        _mm_storeu_si128((__m128i *)(out+i+16), _mm_aesenclast_si128(b1, k[rounds]));
+        _mm_storeu_si128((__m128i *)(out+i+32), _mm_aesenclast_si128(b2, k[rounds]));
+        _mm_storeu_si128((__m128i *)(out+i+48), _mm_aesenclast_si128(b3, k[rounds]));
+    }
+    for(; i + 16 <= size; i += 16) {
+        __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in+i)), k[0]);
+        for(r = 1; r < rounds; r++)
+            b = _mm_aesenc_si128(b, k[r]);
+        _mm_storeu_si128((__m128i *)(out+i), _mm_aesenclast_si128(b, k[rounds]));
+    }
+}
+
+
+/* decrypt blocks, four at a time to keep the pipeline busy */
+AESNI_TARGET
+void mod_gm_aesni_decrypt(unsigned char *out, const unsigned char *in, int size) {
+    __m128i k[AESNI_MAXROUNDS+1];
+    int i, r;
+
+    for(r = 0; r <= rounds; r++)
+        k[r] = _mm_loadu_si128((const __m128i *)dec_keys[r]);
+
+    for(i = 0; i + 64 <= size; i += 64) {
+        __m128i b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in+i)),    k[0]);
+        __m128i b1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in+i+16)), k[0]);
+        __m128i b2 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in+i+32)), k[0]);
+        __m128i b3 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in+i+48)), k[0]);
+        for(r = 1; r < rounds; r++) {
+            b0 = _mm_aesdec_si128(b0, k[r]);
+            b1 = _mm_aesdec_si128(b1, k[r]);
+            b2 = _mm_aesdec_si128(b2, k[r]);
+            b3 = _mm_aesdec_si128(b3, k[r]);
+        }
+        _mm_storeu_si128((__m128i *)(out+i),    _mm_aesdeclast_si128(b0, k[rounds]));
+        _mm_storeu_si128((__m128i *)(out+i+16), _mm_aesdeclast_si128(b1, k[rounds]));
+        _mm_storeu_si128((__m128i *)(out+i+32), _mm_aesdeclast_si128(b2, k[rounds]));
+        _mm_storeu_si128((__m128i *)(out+i+48), _mm_aesdeclast_si128(b3, k[rounds]));
+    }
+    for(; i + 16 <= size; i += 16) {
+        __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in+i)), k[0]);
+        for(r = 1; r < rounds; r++)
+            b = _mm_aesdec_si128(b, k[r]);
+        _mm_storeu_si128((__m128i *)(out+i), _mm_aesdeclast_si128(b, k[rounds]));
+    }
+}
+
+/* counter mode, four blocks at a time, counter is incremented per block */
+GCM_TARGET
+void mod_gm_aesni_ctr(unsigned char *out, const unsigned char *in, int size, unsigned char *counter) {
+    const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i one   = _mm_set_epi32(0, 0, 0, 1);
+    __m128i k[AESNI_MAXROUNDS+1];
+    __m128i ctr, b0, b1, b2, b3;
+    unsigned char last[16];
+    int i, r;
+
+    for(r = 0; r <= gcm_rounds; r++)
+        k[r] = _mm_loadu_si128((const __m128i *)gcm_keys[r]);
+
+    /* keep the counter byte swapped, so it can be incremented with an add */
+    ctr = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)counter), bswap);
+
+    for(i = 0; i + 64 <= size; i += 64) {
+        b0  = _mm_xor_si128(_mm_shuffle_epi8(ctr, bswap), k[0]); ctr = _mm_add_epi32(ctr, one);
+        b1  = _mm_xor_si128(_mm_shuffle_epi8(ctr, bswap), k[0]); ctr = _mm_add_epi32(ctr, one);
+        b2  = _mm_xor_si128(_mm_shuffle_epi8(ctr, bswap), k[0]); ctr = _mm_add_epi32(ctr, one);
+        b3  = _mm_xor_si128(_mm_shuffle_epi8(ctr, bswap), k[0]); ctr = _mm_add_epi32(ctr, one);
+        for(r = 1; r < gcm_rounds; r++) {
+            b0 = _mm_aesenc_si128(b0, k[r]);
+            b1 = _mm_aesenc_si128(b1, k[r]);
+            b2 = _mm_aesenc_si128(b2, k[r]);
+            b3 = _mm_aesenc_si128(b3, k[r]);
+        }
+        b0 = _mm_xor_si128(_mm_aesenclast_si128(b0, k[gcm_rounds]), _mm_loadu_si128((const __m128i *)(in+i)));
+        b1 = _mm_xor_si128(_mm_aesenclast_si128(b1, k[gcm_rounds]), _mm_loadu_si128((const __m128i *)(in+i+16)));
+        b2 = _mm_xor_si128(_mm_aesenclast_si128(b2, k[gcm_rounds]), _mm_loadu_si128((const __m128i *)(in+i+32)));
+        b3 = _mm_xor_si128(_mm_aesenclast_si128(b3, k[gcm_rounds]), _mm_loadu_si128((const __m128i *)(in+i+48)));
+        _mm_storeu_si128((__m128i *)(out+i),    b0);
+        _mm_storeu_si128((__m128i *)(out+i+16), b1);
+        _mm_storeu_si128((__m128i *)(out+i+32), b2);
+        _mm_storeu_si128((__m128i *)(out+i+48), b3);
+    }
+    for(; i < size; i += 16) {
+        b0 = _mm_xor_si128(_mm_shuffle_epi8(ctr, bswap), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        for(r = 1; r < gcm_rounds; r++)
+            b0 = _mm_aesenc_si128(b0, k[r]);
+        b0 = _mm_aesenclast_si128(b0, k[gcm_rounds]);
+        if(i + 16 <= size) {
+            _mm_storeu_si128((__m128i *)(out+i), _mm_xor_si128(b0, _mm_loadu_si128((const __m128i *)(in+i))));
+        } else {
+            /* partial last block */
+            int j;
+            _mm_storeu_si128((__m128i *)last, b0);
+            for(j = 0; j < size - i; j++)
+                out[i+j] = in[i+j] ^ last[j];
+        }
+    }
+
+    _mm_storeu_si128((__m128i *)counter, _mm_shuffle_epi8(ctr, bswap));
+}
+
+
+/* carry-less multiply, operands are byte reflected, product is not reduced */
+GCM_TARGET
+static void aesni_clmul(__m128i a, __m128i b, __m128i *lo, __m128i *hi) {
+    __m128i t3, t4, t5, t6;
+    t3 = _mm_clmulepi64_si128(a, b, 0x00);
+    t4 = _mm_clmulepi64_si128(a, b, 0x10);
+    t5 = _mm_clmulepi64_si128(a, b, 0x01);
+    t6 = _mm_clmulepi64_si128(a, b, 0x11);
+    t4 = _mm_xor_si128(t4, t5);
+    *lo = _mm_xor_si128(*lo, _mm_xor_si128(t3, _mm_slli_si128(t4, 8)));
+    *hi = _mm_xor_si128(*hi, _mm_xor_si128(t6, _mm_srli_si128(t4, 8)));
+}
+
+
+/* reduce a 256bit product modulo x^128 + x^7 + x^2 + x + 1 */
+GCM_TARGET
+static __m128i aesni_reduce(__m128i t3, __m128i t6) {
+    __m128i t2, t4, t5, t7, t8, t9;
+
+    /* shift result left by one bit */
+    t7 = _mm_srli_epi32(t3, 31);
+    t8 = _mm_srli_epi32(t6, 31);
+    t3 = _mm_slli_epi32(t3, 1);
+    t6 = _mm_slli_epi32(t6, 1);
+    t9 = _mm_srli_si128(t7, 12);
+    t8 = _mm_slli_si128(t8, 4);
+    t7 = _mm_slli_si128(t7, 4);
+    t3 = _mm_or_si128(t3, t7);
+    t6 = _mm_or_si128(t6, t8);
+    t6 = _mm_or_si128(t6, t9);
+
+    t7 = _mm_slli_epi32(t3, 31);
+    t8 = _mm_slli_epi32(t3, 30);
+    t9 = _mm_slli_epi32(t3, 25);
+    t7 = _mm_xor_si128(t7, t8);
+    t7 = _mm_xor_si128(t7, t9);
+    t8 = _mm_srli_si128(t7, 4);
+    t7 = _mm_slli_si128(t7, 12);
+    t3 = _mm_xor_si128(t3, t7);
+    t2 = _mm_srli_epi32(t3, 1);
+    t4 = _mm_srli_epi32(t3, 2);
+    t5 = _mm_srli_epi32(t3, 7);
+    t2 = _mm_xor_si128(t2, t4);
+    t2 = _mm_xor_si128(t2, t5);
+    t2 = _mm_xor_si128(t2, t8);
+    t3 = _mm_xor_si128(t3, t2);
+    return _mm_xor_si128(t6, t3);
+}
+
+
+/* multiply in GF(2^128) */
+GCM_TARGET
+static __m128i aesni_gfmul(__m128i a, __m128i b) {
+    __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+    aesni_clmul(a, b, &lo, &hi);
+    return aesni_reduce(lo, hi);
+}
+
+
+/* precompute powers of the hash subkey for the aggregated ghash */
+GCM_TARGET
+static void aesni_gcm_powers(const unsigned char *h) {
+    const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i p[4];
+    int i;
+    p[0] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)h), bswap);
+    for(i = 1; i < 4; i++)
+        p[i] = aesni_gfmul(p[i-1], p[0]);
+    for(i = 0; i < 4; i++)
+        _mm_storeu_si128((__m128i *)gcm_h[i], p[i]);
+}
+
+
+/* ghash data into hash, four blocks with a single reduction, a partial last block is zero padded */
+GCM_TARGET
+void mod_gm_aesni_ghash(unsigned char *hash, const unsigned char *data, int size) {
+    const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i h1 = _mm_loadu_si128((const __m128i *)gcm_h[0]);
+    __m128i h2 = _mm_loadu_si128((const __m128i *)gcm_h[1]);
+    __m128i h3 = _mm_loadu_si128((const __m128i *)gcm_h[2]);
+    __m128i h4 = _mm_loadu_si128((const __m128i *)gcm_h[3]);
+    __m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)hash), bswap);
+    __m128i lo, hi;
+    unsigned char last[16];
+    int i;
+
+    for(i = 0; i + 64 <= size; i += 64) {
+        lo = _mm_setzero_si128();
+        hi = _mm_setzero_si128();
+        aesni_clmul(_mm_xor_si128(x, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data+i)), bswap)), h4, &lo, &hi);
+        aesni_clmul(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data+i+16)), bswap), h3, &lo, &hi);
+        aesni_clmul(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data+i+32)), bswap), h2, &lo, &hi);
+        aesni_clmul(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data+i+48)), bswap), h1, &lo, &hi);
+        x = aesni_reduce(lo, hi);
+    }
+    for(; i + 16 <= size; i += 16)
+        x = aesni_gfmul(_mm_xor_si128(x, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data+i)), bswap)), h1);
+    if(i < size) {
+        memset(last, 0, 16);
+        memcpy(last, data+i, size-i);
+        x = aesni_gfmul(_mm_xor_si128(x, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)last), bswap)), h1);
+    }
+
+    _mm_storeu_si128((__m128i *)hash, _mm_shuffle_epi8(x, bswap));
+}
+
+#else
+
+/* no aes-ni support compiled in */
+int mod_gm_aesni_available(void) {
+    return 0;
+}
+
+void mod_gm_aesni_init(__attribute__((__unused__)) const unsigned long *rk, __attribute__((__unused__)) int nrounds) {
+    return;
+}
+
+void mod_gm_aesni_encrypt(__attribute__((__unused__)) unsigned char *out, __attribute__((__unused__)) const unsigned char *in, __attribute__((__unused__)) int size) {
+    return;
+}
+
+void mod_gm_aesni_decrypt(__attribute__((__unused__)) unsigned char *out, __attribute__((__unused__)) const unsigned char *in, __attribute__((__unused__)) int size) {
+    return;
+}
+
+int mod_gm_aesni_gcm_available(void) {
+    return 0;
+}
+
+void mod_gm_aesni_gcm_init(__attribute__((__unused__)) const unsigned long *rk, __attribute__((__unused__)) int nrounds, __attribute__((__unused__)) const unsigned char *h) {
+    return;
+}
+
+void mod_gm_aesni_ctr(__attribute__((__unused__)) unsigned char *out, __attribute__((__unused__)) const unsigned char *in, __attribute__((__unused__)) int size, __attribute__((__unused__)) unsigned char *counter) {
+    return;
+}
+
+void mod_gm_aesni_ghash(__attribute__((__unused__)) unsigned char *hash, __attribute__((__unused__)) const unsigned char *data, __attribute__((__unused__)) int size) {
+    return;
+}
+
+#endif
@@ -47,9 +47,147 @@ void *gm_strndup(const char *s, size_t size) {
 void gm_asprintf(char **strp, const char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
+    gm_asprintf_va(strp, fmt, ap);
+    va_end(ap);
+}
+
+void gm_asprintf_va(char **strp, const char *fmt, va_list ap) {
     if (vasprintf(strp, fmt, ap) < 0) {
         log_vasprintf_error();
         exit(2);
     }
+}
+
+#define ARENA_ALIGN_UP(_size)  (((_size) + GM_ARENA_ALIGN - 1) & ~((size_t)GM_ARENA_ALIGN - 1))
+#define ARENA_HEADER           ARENA_ALIGN_UP(sizeof(gm_arena_block_t))
+#define ARENA_DATA(_block)     ((char *)(_block) + ARENA_HEADER)
+
+static gm_arena_block_t *gm_arena_new_block(size_t size) {
+    gm_arena_block_t *block = gm_malloc(ARENA_HEADER + size);
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+gm_arena_t *gm_arena_create(size_t block_size) {
+    gm_arena_t *arena = gm_malloc(sizeof(gm_arena_t));
+    arena->block_size = ARENA_ALIGN_UP(block_size);
+    arena->first      = gm_arena_new_block(arena->block_size);
+    arena->current    = arena->first;
+    arena->last       = NULL;
+    return arena;
+}
+
+void *gm_arena_alloc(gm_arena_t *arena, size_t size) {
+    gm_arena_block_t *block = arena->current;
+    gm_arena_block_t *next;
+    void *ptr;
+
+    size = ARENA_ALIGN_UP(size > 0 ? size : 1);
+    if(block->used + size > block->size) {
+        /* blocks behind the current one are empty, reuse the next one if it fits */
+        next = block->next;
+        if(next == NULL || next->size < size) {
+            next = gm_arena_new_block(size > arena->block_size ? size : arena->block_size);
+            next->next  = block->next;
+            block->next = next;
+        }
+        block = next;
+        arena->current = block;
+    }
+
+    ptr = ARENA_DATA(block) + block->used;
+    block->used += size;
+    arena->last  = ptr;
+    return ptr;
+}
+
+void *gm_arena_realloc(gm_arena_t *arena, void *ptr, size_t old_size, size_t size) {
+    gm_arena_block_t *block = arena->current;
+    size_t offset;
+    void *new_ptr;
+
+    if(ptr == NULL)
+        return gm_arena_alloc(arena, size);
+
+    /* the last allocation can grow in place */
+    if(ptr == arena->last) {
+        offset = (char *)ptr - ARENA_DATA(block);
+        if(offset + ARENA_ALIGN_UP(size > 0 ? size : 1) <= block->size) {
+            block->used = offset + ARENA_ALIGN_UP(size > 0 ? size : 1);
+            return ptr;
+        }
+    }
+
+    new_ptr = gm_arena_alloc(arena, size);
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    return new_ptr;
+}
+
+void *gm_arena_strdup(gm_arena_t *arena, const char *s) {
+    size_t len = strlen(s) + 1;
+    return memcpy(gm_arena_alloc(arena, len), s, len);
+}
+
+void *gm_arena_strndup(gm_arena_t *arena, const char *s, size_t size) {
+    char *copy;
+    size = strnlen(s, size);
+    copy = gm_arena_alloc(arena, size + 1);
+    memcpy(copy, s, size);
+    copy[size] = '\0';
+    return copy;
+}
+
+void gm_arena_asprintf_va(gm_arena_t *arena, char **strp, const char *fmt, va_list ap) {
+    va_list copy;
+    int len;
+
+    va_copy(copy, ap);
+    len = vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+    if(len < 0) {
+        log_vasprintf_error();
+        exit(2);
+    }
+    *strp = gm_arena_alloc(arena, len + 1);
+    vsnprintf(*strp, len + 1, fmt, ap);
+}
+
+void gm_arena_asprintf(gm_arena_t *arena, char **strp, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    gm_arena_asprintf_va(arena, strp, fmt, ap);
     va_end(ap);
 }
+
+void gm_arena_reset(gm_arena_t *arena) {
+    gm_arena_block_t *block = arena->first;
+    gm_arena_block_t *next;
+
+    /* keep blocks of the default size for the next round, oversized ones go back to the system */
+    block->used = 0;
+    while((next = block->next) != NULL) {
+        if(next->size > arena->block_size) {
+            block->next = next->next;
+            free(next);
+            continue;
+        }
+        next->used = 0;
+        block = next;
+    }
+    arena->current = arena->first;
+    arena->last    = NULL;
+}
+
+void gm_arena_free(gm_arena_t *arena) {
+    gm_arena_block_t *block, *next;
+
+    if(arena == NULL)
+        return;
+    for(block = arena->first; block != NULL; block = next) {
+        next = block->next;
+        free(block);
+    }
+    free(arena);
+}
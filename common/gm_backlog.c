@@ -0,0 +1,139 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+#include "utils.h"
+#include "gm_backlog.h"
+
+
+/* reset counters */
+void mod_gm_backlog_init(gm_backlog_t * backlog) {
+    memset(backlog, 0, sizeof(gm_backlog_t));
+    pthread_mutex_init(&backlog->mutex, NULL);
+    pthread_cond_init(&backlog->resumed, NULL);
+}
+
+
+/* end the pause and wake up waiting threads, mutex must be locked */
+static void backlog_resume(gm_backlog_t * backlog, int pending) {
+    struct timeval now;
+    long ms;
+
+    gettimeofday(&now, NULL);
+    ms = (now.tv_sec - backlog->throttled_since.tv_sec) * 1000 + (now.tv_usec - backlog->throttled_since.tv_usec) / 1000;
+    __atomic_add_fetch(&backlog->throttled_ms, ms, __ATOMIC_RELAXED);
+    __atomic_store_n(&backlog->throttled, FALSE, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&backlog->resumed);
+    /* pauses are summarized by the periodic statistics */
+    gm_log( GM_LOG_DEBUG, "resuming result threads after %ldms, %d results waiting for the core\n", ms, pending );
+}
+
+
+/* count added or taken results */
+void mod_gm_backlog_add(gm_backlog_t * backlog, int num) {
+    __atomic_add_fetch(&backlog->pending, num, __ATOMIC_RELAXED);
+}
+
+
+/* pause at the limit, resume at the resume mark */
+int mod_gm_backlog_full(gm_backlog_t * backlog, int limit, int resume) {
+    int pending, throttled;
+
+    if(limit <= 0)
+        return FALSE;
+
+    /* nothing changes, which does not need the lock */
+    pending   = __atomic_load_n(&backlog->pending, __ATOMIC_RELAXED);
+    throttled = __atomic_load_n(&backlog->throttled, __ATOMIC_ACQUIRE);
+    if(throttled && pending > resume)
+        return TRUE;
+    if(!throttled && pending < limit)
+        return FALSE;
+
+    /* only one thread pauses or resumes, the core takes results under the lock */
+    pthread_mutex_lock(&backlog->mutex);
+    pending = __atomic_load_n(&backlog->pending, __ATOMIC_RELAXED);
+    if(backlog->throttled && pending <= resume) {
+        backlog_resume(backlog, pending);
+    }
+    else if(!backlog->throttled && pending >= limit) {
+        gettimeofday(&backlog->throttled_since, NULL);
+        __atomic_add_fetch(&backlog->throttled_num, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&backlog->throttled, TRUE, __ATOMIC_RELEASE);
+        gm_log( GM_LOG_DEBUG, "%d results waiting for the core, pausing result threads\n", pending );
+    }
+    throttled = backlog->throttled;
+    pthread_mutex_unlock(&backlog->mutex);
+
+    return throttled;
+}
+
+
+/* release the mutex when a waiting thread gets cancelled */
+static void backlog_unlock(void * data) {
+    pthread_mutex_unlock(&((gm_backlog_t *)data)->mutex);
+}
+
+
+/* sleep till the core drained the backlog */
+int mod_gm_backlog_wait(gm_backlog_t * backlog, int limit, int resume) {
+    int state, type, full;
+
+    if(limit <= 0)
+        return FALSE;
+
+    /* result threads are cancelled asynchronously, they must never be
+     * cancelled while they hold the mutex. Only the wait itself is a
+     * cancellation point, the cleanup handler releases the mutex then. */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+    full = mod_gm_backlog_full(backlog, limit, resume);
+    if(full) {
+        pthread_mutex_lock(&backlog->mutex);
+        pthread_cleanup_push(backlog_unlock, backlog);
+        pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, &type);
+        pthread_setcancelstate(state, NULL);
+        while(backlog->throttled)
+            pthread_cond_wait(&backlog->resumed, &backlog->mutex);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        pthread_setcanceltype(type, NULL);
+        pthread_cleanup_pop(1);
+    }
+    pthread_setcancelstate(state, NULL);
+
+    return full;
+}
+
+
+/* count taken results, the core ends the pause at the resume mark */
+void mod_gm_backlog_take(gm_backlog_t * backlog, int num, int resume) {
+    int pending;
+
+    /* a pause cannot start between taking and checking */
+    pthread_mutex_lock(&backlog->mutex);
+    pending = __atomic_sub_fetch(&backlog->pending, num, __ATOMIC_RELAXED);
+    if(backlog->throttled && pending <= resume)
+        backlog_resume(backlog, pending);
+    pthread_mutex_unlock(&backlog->mutex);
+}
@@ -24,13 +24,38 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <config.h>
+#if defined(HAVE_SYS_RANDOM_H) && defined(HAVE_GETRANDOM)
+#include <sys/random.h>
+#endif
 #include <gm_crypt.h>
+#include <gm_aesni.h>
+#include <gm_payload.h>
 #include "common.h"
+#include "polarssl/md5.h"
 
 int encryption_initialized = 0;
 unsigned char key[KEYLENGTH(KEYBITS)];
 
+/* expanded key schedules, only written in mod_gm_aes_init() and
+ * shared read-only by all threads afterwards */
+static unsigned long rk_encrypt[RKLENGTH(KEYBITS)];
+static unsigned long rk_decrypt[RKLENGTH(KEYBITS)];
+static int nrounds_encrypt;
+static int nrounds_decrypt;
+static int aes_backend = GM_AES_BACKEND_RIJNDAEL;
+
+/* gcm key schedule and ghash tables for the hash subkey */
+static unsigned long rk_gcm[RKLENGTH(KEYBITS)];
+static int nrounds_gcm;
+static uint64_t gcm_hl[16];
+static uint64_t gcm_hh[16];
+static int gcm_aesni = 0;
+
 
 /* initialize encryption */
 void mod_gm_aes_init(char * password) {
@@ -40,49 +65,81 @@ void mod_gm_aes_init(char * password) {
     for (i = 0; i < 32; i++)
         key[i] = *password != 0 ? *password++ : 0;
 
+    /* key does not change, so expand it only once */
+    nrounds_encrypt = rijndaelSetupEncrypt(rk_encrypt, key, KEYBITS);
+    nrounds_decrypt = rijndaelSetupDecrypt(rk_decrypt, key, KEYBITS);
+    mod_gm_aesni_init(rk_encrypt, nrounds_encrypt);
+
+    /* gcm uses a key derived from the shared password, so ecb
+     * messages never reveal its hash subkey */
+    {
+        unsigned char gcm_key[KEYLENGTH(KEYBITS)];
+        unsigned char input[KEYLENGTH(KEYBITS)+4];
+        memcpy(input, "gcm1", 4);
+        memcpy(input+4, key, KEYLENGTH(KEYBITS));
+        md5(input, sizeof(input), gcm_key);
+        memcpy(input, "gcm2", 4);
+        md5(input, sizeof(input), gcm_key+16);
+        mod_gm_aes_gcm_init(gcm_key);
+    }
+
+    /* use hardware aes if available */
+    mod_gm_aes_set_backend(GM_AES_BACKEND_AESNI);
+
     encryption_initialized = 1;
     return;
 }
 
 
+/* select aes implementation */
+int mod_gm_aes_set_backend(int backend) {
+    if(backend == GM_AES_BACKEND_AESNI && mod_gm_aesni_available())
+        aes_backend = GM_AES_BACKEND_AESNI;
+    else
+        aes_backend = GM_AES_BACKEND_RIJNDAEL;
+    gcm_aesni = aes_backend == GM_AES_BACKEND_AESNI && mod_gm_aesni_gcm_available();
+    return aes_backend;
+}
+
+
+/* encrypt full blocks */
+static void aes_encrypt_blocks(unsigned char * out, const unsigned char * in, int size) {
+    int i;
+    if(aes_backend == GM_AES_BACKEND_AESNI) {
+        mod_gm_aesni_encrypt(out, in, size);
+        return;
+    }
+    for (i = 0; i < size; i += BLOCKSIZE)
+        rijndaelEncrypt(rk_encrypt, nrounds_encrypt, in+i, out+i);
+}
+
+
+/* decrypt full blocks */
+static void aes_decrypt_blocks(unsigned char * out, const unsigned char * in, int size) {
+    int i;
+    if(aes_backend == GM_AES_BACKEND_AESNI) {
+        mod_gm_aesni_decrypt(out, in, size);
+        return;
+    }
+    for (i = 0; i < size; i += BLOCKSIZE)
+        rijndaelDecrypt(rk_decrypt, nrounds_decrypt, in+i, out+i);
+}
+
+
 /* encrypt text with given key */
-int mod_gm_aes_encrypt(unsigned char ** encrypted, char * text) {
-    unsigned long rk[RKLENGTH(KEYBITS)];
-    int nrounds;
-    int i = 0;
-    int k = 0;
+int mod_gm_aes_encrypt(unsigned char ** encrypted, char * text, int size) {
     unsigned char *enc;
-    int size;
     int totalsize;
 
     assert(encryption_initialized == 1);
 
-    nrounds   = rijndaelSetupEncrypt(rk, key, KEYBITS);
-    size      = strlen(text);
+    /* text is null padded to the next full block, at least one byte */
     totalsize = size + BLOCKSIZE-size%BLOCKSIZE;
-    if(size%BLOCKSIZE == 0) {
-        size += BLOCKSIZE;
-    }
     enc       = (unsigned char *) gm_malloc(sizeof(unsigned char)*totalsize);
-    while(size > 0) {
-        unsigned char plaintext[BLOCKSIZE];
-        unsigned char ciphertext[BLOCKSIZE];
-        int j;
-        for (j = 0; j < BLOCKSIZE; j++) {
-            int c = text[i];
-            if(c == 0)
-                break;
-            plaintext[j] = c;
-            i++;
-        }
+    memcpy(enc, text, size);
+    memset(enc+size, 0, totalsize-size);
 
-        for (; j < BLOCKSIZE; j++)
-            plaintext[j] = '\x0';
-        rijndaelEncrypt(rk, nrounds, plaintext, ciphertext);
-        for (j = 0; j < BLOCKSIZE; j++)
-            enc[k++] = ciphertext[j];
-        size -=BLOCKSIZE;
-    }
+    aes_encrypt_blocks(enc, enc, totalsize);
 
     *encrypted = enc;
     return totalsize;
@@ -90,35 +147,255 @@ int mod_gm_aes_encrypt(unsigned char ** encrypted, char * text) {
 
 
 /* decrypt text with given key */
-void mod_gm_aes_decrypt(char ** text, unsigned char * encrypted, int size) {
-    char *decr;
-    unsigned long rk[RKLENGTH(KEYBITS)];
-    int nrounds;
-    int i = 0;
-
-    decr = gm_malloc(sizeof(char*)*size+GM_BUFFERSIZE);
+int mod_gm_aes_decrypt(char ** text, unsigned char * encrypted, int size) {
+    char *decr = *text;
+    char *block;
+    int i;
+    int len = 0;
 
     assert(encryption_initialized == 1);
-    nrounds = rijndaelSetupDecrypt(rk, key, KEYBITS);
-    decr[0] = '\0';
 
-    while(1) {
-        unsigned char plaintext[BLOCKSIZE];
-        unsigned char ciphertext[BLOCKSIZE];
+    size -= size%BLOCKSIZE;
+    aes_decrypt_blocks((unsigned char *)decr, encrypted, size);
+
+    /* binary payloads contain null bytes and know their length */
+    if(mod_gm_payload_is_binary(decr, size)) {
+        len = mod_gm_payload_size(decr, size);
+        decr[len] = '\0';
+        return len;
+    }
+
+    /* join blocks up to their first null byte */
+    for (i = 0; i < size; i += BLOCKSIZE) {
         int j;
-        for (j = 0; j < BLOCKSIZE; j++) {
-            int c = encrypted[i];
-            ciphertext[j] = c;
-            i++;
+        block = decr+i;
+        for (j = 0; j < BLOCKSIZE && block[j] != '\0'; j++)
+            ;
+        if(len != i)
+            memmove(decr+len, block, j);
+        len += j;
+    }
+    decr[len] = '\0';
+
+    return len;
+}
+
+
+/* 4bit tables for ghash, see the gcm specification */
+static void gcm_gen_table(const unsigned char *h) {
+    uint64_t vh, vl;
+    int i, j;
+
+    vh = (uint64_t)h[0] << 56 | (uint64_t)h[1] << 48 | (uint64_t)h[2] << 40 | (uint64_t)h[3] << 32
+       | (uint64_t)h[4] << 24 | (uint64_t)h[5] << 16 | (uint64_t)h[6] << 8  | (uint64_t)h[7];
+    vl = (uint64_t)h[8] << 56 | (uint64_t)h[9] << 48 | (uint64_t)h[10] << 40 | (uint64_t)h[11] << 32
+       | (uint64_t)h[12] << 24 | (uint64_t)h[13] << 16 | (uint64_t)h[14] << 8 | (uint64_t)h[15];
+
+    gcm_hl[8] = vl;
+    gcm_hh[8] = vh;
+    gcm_hh[0] = 0;
+    gcm_hl[0] = 0;
+    for(i = 4; i > 0; i >>= 1) {
+        uint32_t t = (uint32_t)(vl & 1) * 0xe1000000U;
+        vl = (vh << 63) | (vl >> 1);
+        vh = (vh >> 1) ^ ((uint64_t)t << 32);
+        gcm_hl[i] = vl;
+        gcm_hh[i] = vh;
+    }
+    for(i = 2; i <= 8; i *= 2) {
+        vh = gcm_hh[i];
+        vl = gcm_hl[i];
+        for(j = 1; j < i; j++) {
+            gcm_hh[i+j] = vh ^ gcm_hh[j];
+            gcm_hl[i+j] = vl ^ gcm_hl[j];
         }
-        rijndaelDecrypt(rk, nrounds, ciphertext, plaintext);
-        strncat(decr, (char*)plaintext, BLOCKSIZE);
-        size -= BLOCKSIZE;
-        if(size < BLOCKSIZE)
-            break;
     }
+}
 
-    strcpy(*text, decr);
-    free(decr);
-    return;
+
+/* multiply x by the hash subkey */
+static void gcm_mult(unsigned char *x) {
+    static const uint64_t last4[16] = {
+        0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+        0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+    };
+    uint64_t zh, zl;
+    unsigned char lo, hi, rem;
+    int i;
+
+    lo = x[15] & 0xf;
+    zh = gcm_hh[lo];
+    zl = gcm_hl[lo];
+
+    for(i = 15; i >= 0; i--) {
+        lo = x[i] & 0xf;
+        hi = (x[i] >> 4) & 0xf;
+        if(i != 15) {
+            rem = (unsigned char)zl & 0xf;
+            zl  = (zh << 60) | (zl >> 4);
+            zh  = (zh >> 4) ^ (last4[rem] << 48);
+            zh ^= gcm_hh[lo];
+            zl ^= gcm_hl[lo];
+        }
+        rem = (unsigned char)zl & 0xf;
+        zl  = (zh << 60) | (zl >> 4);
+        zh  = (zh >> 4) ^ (last4[rem] << 48);
+        zh ^= gcm_hh[hi];
+        zl ^= gcm_hl[hi];
+    }
+
+    for(i = 0; i < 8; i++) {
+        x[i]   = (unsigned char)(zh >> (56 - 8*i));
+        x[i+8] = (unsigned char)(zl >> (56 - 8*i));
+    }
+}
+
+
+/* update ghash with data, a partial last block is zero padded */
+static void gcm_ghash(unsigned char *hash, const unsigned char *data, int size) {
+    int i, j;
+    if(gcm_aesni) {
+        mod_gm_aesni_ghash(hash, data, size);
+        return;
+    }
+    for(i = 0; i < size; i += BLOCKSIZE) {
+        for(j = 0; j < BLOCKSIZE && i+j < size; j++)
+            hash[j] ^= data[i+j];
+        gcm_mult(hash);
+    }
+}
+
+
+/* counter mode with increment of the last 32bit */
+static void gcm_ctr(unsigned char *out, const unsigned char *in, int size, unsigned char *counter) {
+    unsigned char stream[BLOCKSIZE];
+    int i, j;
+    if(gcm_aesni) {
+        mod_gm_aesni_ctr(out, in, size, counter);
+        return;
+    }
+    for(i = 0; i < size; i += BLOCKSIZE) {
+        rijndaelEncrypt(rk_gcm, nrounds_gcm, counter, stream);
+        for(j = 15; j >= 12 && ++counter[j] == 0; j--)
+            ;
+        for(j = 0; j < BLOCKSIZE && i+j < size; j++)
+            out[i+j] = in[i+j] ^ stream[j];
+    }
+}
+
+
+/* set gcm key */
+void mod_gm_aes_gcm_init(const unsigned char * gcm_key) {
+    unsigned char h[BLOCKSIZE];
+    memset(h, 0, BLOCKSIZE);
+    nrounds_gcm = rijndaelSetupEncrypt(rk_gcm, gcm_key, KEYBITS);
+    rijndaelEncrypt(rk_gcm, nrounds_gcm, h, h);
+    gcm_gen_table(h);
+    mod_gm_aesni_gcm_init(rk_gcm, nrounds_gcm, h);
+    gcm_aesni = aes_backend == GM_AES_BACKEND_AESNI && mod_gm_aesni_gcm_available();
+}
+
+
+/* aes-256-gcm without additional data */
+void mod_gm_aes_gcm(unsigned char * out, const unsigned char * in, int size, const unsigned char * nonce, unsigned char * tag, int decrypt) {
+    unsigned char counter[BLOCKSIZE];
+    unsigned char lengths[BLOCKSIZE];
+    unsigned char ek0[BLOCKSIZE];
+    uint64_t bits = (uint64_t)size * 8;
+    int i;
+
+    /* first counter block encrypts the tag, data starts with the second */
+    memcpy(counter, nonce, GM_GCM_NONCE_LEN);
+    counter[12] = 0;
+    counter[13] = 0;
+    counter[14] = 0;
+    counter[15] = 1;
+    memset(ek0, 0, BLOCKSIZE);
+    gcm_ctr(ek0, ek0, BLOCKSIZE, counter);
+
+    /* hash the ciphertext, before it gets overwritten when decrypting */
+    memset(tag, 0, GM_GCM_TAG_LEN);
+    if(decrypt) {
+        gcm_ghash(tag, in, size);
+        gcm_ctr(out, in, size, counter);
+    } else {
+        gcm_ctr(out, in, size, counter);
+        gcm_ghash(tag, out, size);
+    }
+
+    memset(lengths, 0, BLOCKSIZE);
+    for(i = 0; i < 8; i++)
+        lengths[15-i] = (unsigned char)(bits >> (8*i));
+    gcm_ghash(tag, lengths, BLOCKSIZE);
+
+    for(i = 0; i < GM_GCM_TAG_LEN; i++)
+        tag[i] ^= ek0[i];
+}
+
+
+/* fill nonce with random bytes */
+static void gcm_nonce(unsigned char * nonce) {
+#if defined(HAVE_SYS_RANDOM_H) && defined(HAVE_GETRANDOM)
+    if(getrandom(nonce, GM_GCM_NONCE_LEN, 0) == GM_GCM_NONCE_LEN)
+        return;
+#endif
+    {
+        int fd = open("/dev/urandom", O_RDONLY);
+        ssize_t got = -1;
+        if(fd >= 0) {
+            got = read(fd, nonce, GM_GCM_NONCE_LEN);
+            close(fd);
+        }
+        /* never send a message with a predictable nonce */
+        if(got != GM_GCM_NONCE_LEN) {
+            perror("/dev/urandom");
+            abort();
+        }
+    }
+}
+
+
+/* encrypt text, result is nonce, ciphertext and tag */
+int mod_gm_aes_gcm_encrypt(unsigned char ** encrypted, char * text, int size) {
+    unsigned char *enc;
+
+    assert(encryption_initialized == 1);
+
+    enc = (unsigned char *) gm_malloc(GM_GCM_NONCE_LEN + size + GM_GCM_TAG_LEN);
+    gcm_nonce(enc);
+    mod_gm_aes_gcm(enc+GM_GCM_NONCE_LEN, (unsigned char *)text, size, enc, enc+GM_GCM_NONCE_LEN+size, 0);
+
+    *encrypted = enc;
+    return GM_GCM_NONCE_LEN + size + GM_GCM_TAG_LEN;
+}
+
+
+/* verify and decrypt in place, plain text starts at the beginning of the buffer */
+int mod_gm_aes_gcm_decrypt(char ** text, unsigned char * encrypted, int size) {
+    unsigned char nonce[GM_GCM_NONCE_LEN];
+    unsigned char tag[GM_GCM_TAG_LEN];
+    unsigned char diff = 0;
+    int len, i;
+
+    assert(encryption_initialized == 1);
+
+    len = size - GM_GCM_NONCE_LEN - GM_GCM_TAG_LEN;
+    if(len < 0) {
+        (*text)[0] = '\0';
+        return 0;
+    }
+
+    /* ciphertext is shifted to the start of the buffer while decrypting */
+    memcpy(nonce, encrypted, GM_GCM_NONCE_LEN);
+    mod_gm_aes_gcm((unsigned char *)*text, encrypted+GM_GCM_NONCE_LEN, len, nonce, tag, 1);
+
+    for(i = 0; i < GM_GCM_TAG_LEN; i++)
+        diff |= tag[i] ^ encrypted[GM_GCM_NONCE_LEN+len+i];
+    if(diff != 0) {
+        (*text)[0] = '\0';
+        return 0;
+    }
+
+    (*text)[len] = '\0';
+    return len;
 }
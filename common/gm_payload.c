@@ -0,0 +1,452 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "gm_payload.h"
+#include "utils.h"
+
+/* compare key against a literal of the same length */
+#define KEY_IS(key, name) (!memcmp((key), (name), sizeof(name)-1))
+
+/* map key to enum, dispatched by length and first character */
+int mod_gm_payload_key(const char *key, size_t len) {
+    switch(len) {
+        case 4:
+            if(KEY_IS(key, "type"))                 return GM_KEY_TYPE;
+            break;
+        case 6:
+            if(key[0] == 'o' && KEY_IS(key, "output")) return GM_KEY_OUTPUT;
+            if(key[0] == 's' && KEY_IS(key, "source")) return GM_KEY_SOURCE;
+            if(key[0] == 'r' && KEY_IS(key, "result")) return GM_KEY_RESULT;
+            break;
+        case 7:
+            if(key[0] == 'l' && KEY_IS(key, "latency")) return GM_KEY_LATENCY;
+            if(key[0] == 't' && KEY_IS(key, "timeout")) return GM_KEY_TIMEOUT;
+            break;
+        case 9:
+            switch(key[0]) {
+                case 'h': if(KEY_IS(key, "host_name")) return GM_KEY_HOST_NAME; break;
+                case 'c': if(KEY_IS(key, "core_time")) return GM_KEY_CORE_TIME; break;
+                case 'e': if(KEY_IS(key, "exited_ok")) return GM_KEY_EXITED_OK; break;
+            }
+            break;
+        case 10:
+            if(key[0] == 's' && KEY_IS(key, "start_time")) return GM_KEY_START_TIME;
+            if(key[0] == 'n' && KEY_IS(key, "next_check")) return GM_KEY_NEXT_CHECK;
+            break;
+        case 11:
+            if(key[0] == 'r' && KEY_IS(key, "return_code")) return GM_KEY_RETURN_CODE;
+            if(key[0] == 'f' && KEY_IS(key, "finish_time")) return GM_KEY_FINISH_TIME;
+            break;
+        case 12:
+            if(key[0] == 'r' && KEY_IS(key, "result_queue")) return GM_KEY_RESULT_QUEUE;
+            if(key[0] == 'c' && KEY_IS(key, "command_line")) return GM_KEY_COMMAND_LINE;
+            break;
+        case 13:
+            switch(key[0]) {
+                case 'c': if(KEY_IS(key, "check_options")) return GM_KEY_CHECK_OPTIONS; break;
+                case 'e': if(KEY_IS(key, "early_timeout")) return GM_KEY_EARLY_TIMEOUT; break;
+                case 'p': if(KEY_IS(key, "plugin_output")) return GM_KEY_PLUGIN_OUTPUT; break;
+            }
+            break;
+        case 15:
+            if(key[0] == 's' && KEY_IS(key, "scheduled_check")) return GM_KEY_SCHEDULED_CHECK;
+            if(key[0] == 'c' && KEY_IS(key, "core_start_time")) return GM_KEY_CORE_START_TIME;
+            break;
+        case 16:
+            if(KEY_IS(key, "reschedule_check"))     return GM_KEY_RESCHEDULE_CHECK;
+            break;
+        case 18:
+            if(KEY_IS(key, "long_plugin_output"))   return GM_KEY_LONG_PLUGIN_OUTPUT;
+            break;
+        case 19:
+            if(KEY_IS(key, "service_description"))  return GM_KEY_SERVICE_DESCRIPTION;
+            break;
+    }
+    return GM_KEY_UNKNOWN;
+}
+
+
+/* string keys come first in the key enum, all others are numbers */
+#define KEY_IS_STRING(key) ((key) <= GM_KEY_SOURCE)
+
+/* mutable pointer into data for a position of the read only cursor */
+#define DATA_AT(data, p) ((data) + ((p) - (const unsigned char *)(data)))
+
+/* nested payloads are neither strings nor numbers */
+#define KEY_IS_PAYLOAD(key) ((key) == GM_KEY_RESULT)
+
+
+/* check for binary marker */
+int mod_gm_payload_is_binary(const char *data, size_t size) {
+    return size >= GM_PAYLOAD_HEADER_LEN && !strncmp(data, GM_PAYLOAD_MAGIC, GM_PAYLOAD_MAGIC_LEN);
+}
+
+
+/* check for a binary payload of the current version which fills exactly size bytes */
+int mod_gm_payload_is_complete(const char *data, size_t size) {
+    const unsigned char *hdr = (const unsigned char *)data;
+    if(!mod_gm_payload_is_binary(data, size) || hdr[GM_PAYLOAD_MAGIC_LEN] != GM_PAYLOAD_VERSION)
+        return 0;
+    return GM_PAYLOAD_HEADER_LEN + ((size_t)hdr[4] << 24 | (size_t)hdr[5] << 16 | (size_t)hdr[6] << 8 | (size_t)hdr[7]) == size;
+}
+
+
+/* length of text or binary payload */
+size_t mod_gm_payload_size(const char *data, size_t max) {
+    const unsigned char *hdr = (const unsigned char *)data;
+    size_t len;
+    if(!mod_gm_payload_is_binary(data, max))
+        return strnlen(data, max);
+    len = GM_PAYLOAD_HEADER_LEN + ((size_t)hdr[4] << 24 | (size_t)hdr[5] << 16 | (size_t)hdr[6] << 8 | (size_t)hdr[7]);
+    return len < max ? len : max;
+}
+
+
+/* read unsigned varint, returns number of bytes used or 0 on error */
+static size_t read_varint(const unsigned char *p, const unsigned char *end, unsigned long long *value) {
+    const unsigned char *start = p;
+    int shift = 0;
+    *value = 0;
+    while(p < end && shift < 64) {
+        *value |= (unsigned long long)(*p & 0x7f) << shift;
+        if(!(*p++ & 0x80))
+            return p - start;
+        shift += 7;
+    }
+    return 0;
+}
+
+
+/* write unsigned varint, returns number of bytes written */
+static size_t write_varint(unsigned char *p, unsigned long long value) {
+    size_t n = 0;
+    while(value >= 0x80) {
+        p[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    p[n++] = (unsigned char)value;
+    return n;
+}
+
+
+/* parse binary payload, values stay in place */
+static int parse_binary_payload(gm_payload_t *payload, char *data, size_t size) {
+    const unsigned char *p   = (const unsigned char *)data + GM_PAYLOAD_HEADER_LEN;
+    const unsigned char *end = (const unsigned char *)data + mod_gm_payload_size(data, size);
+    unsigned long long len, num;
+    size_t n;
+    int key;
+
+    payload->binary = 1;
+    if(((const unsigned char *)data)[GM_PAYLOAD_MAGIC_LEN] != GM_PAYLOAD_VERSION)
+        return 0;
+
+    while(p < end) {
+        key = *p++;
+        n   = read_varint(p, end, &len);
+        if(n == 0 || len > (unsigned long long)(end - p - n))
+            break;
+        p += n;
+
+        if(key < GM_PAYLOAD_KEYS) {
+            if(KEY_IS_PAYLOAD(key)) {
+                payload->field[key].ptr = DATA_AT(data, p);
+                payload->field[key].len = len;
+                payload->lines++;
+            }
+            else if(KEY_IS_STRING(key)) {
+                /* strings include their null byte */
+                if(len > 0 && p[len-1] == '\x0') {
+                    payload->field[key].ptr = DATA_AT(data, p);
+                    payload->field[key].len = len - 1;
+                    payload->lines++;
+                }
+            }
+            else if(read_varint(p, p+len, &num) > 0) {
+                payload->field[key].ptr = DATA_AT(data, p);
+                payload->field[key].len = 0;
+                payload->num[key]       = (long long)(num >> 1) ^ -(long long)(num & 1);
+                payload->lines++;
+            }
+        }
+        /* unknown keys from newer versions are skipped */
+        p += len;
+    }
+
+    return payload->lines;
+}
+
+
+/* find next field with the given key */
+int mod_gm_payload_next(char *data, size_t size, int key, size_t *pos, gm_strview_t *value) {
+    const unsigned char *p, *end;
+    unsigned long long len;
+    size_t n;
+    int k;
+
+    if(!mod_gm_payload_is_binary(data, size) || ((const unsigned char *)data)[GM_PAYLOAD_MAGIC_LEN] != GM_PAYLOAD_VERSION)
+        return 0;
+
+    end = (const unsigned char *)data + mod_gm_payload_size(data, size);
+    p   = (const unsigned char *)data + (*pos > GM_PAYLOAD_HEADER_LEN ? *pos : GM_PAYLOAD_HEADER_LEN);
+    while(p < end) {
+        k = *p++;
+        n = read_varint(p, end, &len);
+        if(n == 0 || len > (unsigned long long)(end - p - n))
+            break;
+        p += n;
+        if(k == key) {
+            value->ptr = DATA_AT(data, p);
+            value->len = len;
+            *pos = value->ptr + len - data;
+            return 1;
+        }
+        p += len;
+    }
+    *pos = size;
+    return 0;
+}
+
+
+/* tokenize payload in place */
+int mod_gm_parse_payload(gm_payload_t *payload, char *data, size_t size) {
+    char *end = data + size;
+    char *line, *eol, *eq, *value;
+    int key;
+
+    memset(payload, 0, sizeof(*payload));
+    payload->stop_key = GM_KEY_UNKNOWN;
+
+    if(mod_gm_payload_is_binary(data, size))
+        return parse_binary_payload(payload, data, size);
+
+    /* data[size] is never written, the last line is terminated by the caller */
+    line = data;
+    while(line < end) {
+        eol = memchr(line, '\n', end - line);
+        if(eol == NULL)
+            eol = end;
+        else
+            *eol = '\x0';
+
+        eq = memchr(line, '=', eol - line);
+        key = mod_gm_payload_key(line, eq != NULL ? (size_t)(eq - line) : (size_t)(eol - line));
+
+        /* a line without value ends the payload */
+        if(eq == NULL || eq+1 == eol) {
+            payload->stop_key = key;
+            if(eq != NULL) {
+                *eq = '\x0';
+                payload->stop_value = eol;
+            }
+            break;
+        }
+
+        *eq   = '\x0';
+        value = eq + 1;
+        if(key != GM_KEY_UNKNOWN) {
+            payload->field[key].ptr = value;
+            payload->field[key].len = eol - value;
+            payload->lines++;
+        }
+
+        line = eol + 1;
+    }
+
+    return payload->lines;
+}
+
+
+/* unescape \n and \\ in place, in the same order as the former replace_str calls */
+size_t mod_gm_payload_unescape(char *value, size_t len) {
+    char *src, *dst, *end;
+
+    /* newlines first */
+    end = value + len;
+    for(src = dst = value; src < end; src++, dst++) {
+        if(*src == '\\' && src+1 < end && src[1] == 'n') {
+            *dst = '\n';
+            src++;
+        } else {
+            *dst = *src;
+        }
+    }
+
+    /* then backslashes */
+    end = dst;
+    for(src = dst = value; src < end; src++, dst++) {
+        if(*src == '\\' && src+1 < end && src[1] == '\\') {
+            *dst = '\\';
+            src++;
+        } else {
+            *dst = *src;
+        }
+    }
+    *dst = '\x0';
+
+    return dst - value;
+}
+
+
+/* is key set */
+int mod_gm_payload_has(gm_payload_t *payload, int key) {
+    return payload->field[key].ptr != NULL;
+}
+
+
+/* get integer value */
+int mod_gm_payload_int(gm_payload_t *payload, int key, int def) {
+    if(payload->field[key].ptr == NULL)
+        return def;
+    if(payload->binary)
+        return (int)payload->num[key];
+    return atoi(payload->field[key].ptr);
+}
+
+
+/* get double value */
+double mod_gm_payload_double(gm_payload_t *payload, int key, double def) {
+    if(payload->field[key].ptr == NULL)
+        return def;
+    if(payload->binary)
+        return (double)payload->num[key] / 1000000;
+    return atof(payload->field[key].ptr);
+}
+
+
+/* get time value */
+int mod_gm_payload_timeval(gm_payload_t *payload, int key, struct timeval *tv) {
+    if(payload->field[key].ptr == NULL)
+        return 0;
+    if(payload->binary) {
+        tv->tv_sec  = payload->num[key] / 1000000;
+        tv->tv_usec = payload->num[key] % 1000000;
+    } else {
+        string2timeval(payload->field[key].ptr, tv);
+    }
+    return 1;
+}
+
+
+/* start binary payload */
+void mod_gm_payload_begin(gm_payload_writer_t *writer, char *buf, size_t size) {
+    writer->buf  = buf;
+    writer->size = size;
+    writer->len  = GM_PAYLOAD_HEADER_LEN;
+    memcpy(buf, GM_PAYLOAD_MAGIC, GM_PAYLOAD_MAGIC_LEN);
+    buf[GM_PAYLOAD_MAGIC_LEN] = GM_PAYLOAD_VERSION;
+}
+
+
+/* add string field */
+void mod_gm_payload_add_strn(gm_payload_writer_t *writer, int key, const char *value, size_t len) {
+    unsigned char *p;
+    size_t room;
+
+    /* key, up to 10 bytes length and the null byte */
+    if(writer->len + 12 > writer->size)
+        return;
+    room = writer->size - writer->len - 12;
+    if(len > room)
+        len = room;
+
+    p  = (unsigned char *)writer->buf + writer->len;
+    *p = (unsigned char)key;
+    p += 1 + write_varint(p+1, len+1);
+    memcpy(p, value, len);
+    p[len] = '\x0';
+    writer->len = (char *)p + len + 1 - writer->buf;
+}
+
+
+/* add null terminated string field */
+void mod_gm_payload_add_str(gm_payload_writer_t *writer, int key, const char *value) {
+    if(value == NULL)
+        return;
+    mod_gm_payload_add_strn(writer, key, value, strlen(value));
+}
+
+
+/* add number field */
+void mod_gm_payload_add_int(gm_payload_writer_t *writer, int key, long long value) {
+    unsigned char *p;
+    size_t n;
+
+    /* key, length and up to 10 bytes value */
+    if(writer->len + 12 > writer->size)
+        return;
+
+    p    = (unsigned char *)writer->buf + writer->len;
+    n    = write_varint(p+2, ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63));
+    p[0] = (unsigned char)key;
+    p[1] = (unsigned char)n;
+    writer->len += n + 2;
+}
+
+
+/* add nested payload */
+int mod_gm_payload_add_payload(gm_payload_writer_t *writer, int key, const char *data, size_t len) {
+    unsigned char *p;
+
+    /* key and up to 10 bytes length */
+    if(writer->len + len + 11 > writer->size)
+        return 0;
+
+    p  = (unsigned char *)writer->buf + writer->len;
+    *p = (unsigned char)key;
+    p += 1 + write_varint(p+1, len);
+    memcpy(p, data, len);
+    writer->len = (char *)p + len - writer->buf;
+    return 1;
+}
+
+
+/* add already encoded fields */
+void mod_gm_payload_add_raw(gm_payload_writer_t *writer, const char *data, size_t len) {
+    if(writer->len + len > writer->size)
+        return;
+    memcpy(writer->buf + writer->len, data, len);
+    writer->len += len;
+}
+
+
+/* add time field */
+void mod_gm_payload_add_timeval(gm_payload_writer_t *writer, int key, struct timeval *tv) {
+    mod_gm_payload_add_int(writer, key, (long long)tv->tv_sec * 1000000 + tv->tv_usec);
+}
+
+
+/* finish binary payload */
+size_t mod_gm_payload_end(gm_payload_writer_t *writer) {
+    unsigned char *hdr = (unsigned char *)writer->buf;
+    size_t body = writer->len - GM_PAYLOAD_HEADER_LEN;
+    hdr[4] = (unsigned char)(body >> 24);
+    hdr[5] = (unsigned char)(body >> 16);
+    hdr[6] = (unsigned char)(body >> 8);
+    hdr[7] = (unsigned char)body;
+    if(writer->len < writer->size)
+        writer->buf[writer->len] = '\x0';
+    return writer->len;
+}
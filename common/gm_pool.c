@@ -0,0 +1,187 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "common.h"
+#include "utils.h"
+#include "gm_pool.h"
+
+#define POOL_ALIGN          16
+#define POOL_ALIGN_UP(x)    (((x) + POOL_ALIGN - 1) & ~((size_t)POOL_ALIGN - 1))
+#define POOL_HEADER         POOL_ALIGN_UP(sizeof(gm_pool_item_t))
+#define POOL_CHUNK_HEADER   POOL_ALIGN_UP(sizeof(void *))
+
+#define ITEM_TO_OBJ(item)   ((void *)((char *)(item) + POOL_HEADER))
+#define OBJ_TO_ITEM(obj)    ((gm_pool_item_t *)((char *)(obj) - POOL_HEADER))
+
+static void pool_grow(gm_pool_t * pool);
+static gm_pool_item_t * pool_take(gm_pool_t * pool, int want, int * num);
+static void pool_give(gm_pool_t * pool, gm_pool_cache_t * cache, int num);
+
+
+/* initialize pool */
+void mod_gm_pool_init(gm_pool_t * pool, size_t size, void (*destroy)(void *)) {
+    pool->size     = POOL_HEADER + POOL_ALIGN_UP(size);
+    pool->free     = NULL;
+    pool->free_num = 0;
+    pool->chunks   = NULL;
+    pool->allocs   = 0;
+    pool->objects  = 0;
+    pool->destroy  = destroy;
+    pthread_mutex_init(&pool->lock, NULL);
+}
+
+
+/* free all chunks */
+void mod_gm_pool_destroy(gm_pool_t * pool) {
+    char * chunk;
+    char * next;
+    int x;
+
+    for(chunk = pool->chunks; chunk != NULL; chunk = next) {
+        next = *(char **)chunk;
+        if(pool->destroy != NULL) {
+            for(x = 0; x < GM_POOL_CHUNK_SIZE; x++)
+                pool->destroy(ITEM_TO_OBJ(chunk + POOL_CHUNK_HEADER + x * pool->size));
+        }
+        free(chunk);
+    }
+    pool->chunks   = NULL;
+    pool->free     = NULL;
+    pool->free_num = 0;
+    pthread_mutex_destroy(&pool->lock);
+}
+
+
+/* take object, the thread cache is refilled with a whole batch */
+void * mod_gm_pool_get(gm_pool_t * pool, gm_pool_cache_t * cache) {
+    gm_pool_item_t * item;
+    int num;
+
+    if(cache != NULL && cache->head != NULL) {
+        item        = cache->head;
+        cache->head = item->next;
+        cache->num--;
+        return ITEM_TO_OBJ(item);
+    }
+
+    item = pool_take(pool, cache != NULL ? GM_POOL_BATCH_SIZE : 1, &num);
+    if(cache != NULL) {
+        cache->head = item->next;
+        cache->num  = num - 1;
+    }
+    return ITEM_TO_OBJ(item);
+}
+
+
+/* put object back, full thread caches return a batch to the pool */
+void mod_gm_pool_put(gm_pool_t * pool, gm_pool_cache_t * cache, void * obj) {
+    gm_pool_item_t * item = OBJ_TO_ITEM(obj);
+
+    if(cache == NULL) {
+        pthread_mutex_lock(&pool->lock);
+        item->next = pool->free;
+        pool->free = item;
+        pool->free_num++;
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+
+    item->next  = cache->head;
+    cache->head = item;
+    cache->num++;
+    if(cache->num >= 2 * GM_POOL_BATCH_SIZE)
+        pool_give(pool, cache, GM_POOL_BATCH_SIZE);
+}
+
+
+/* empty thread cache */
+void mod_gm_pool_flush(gm_pool_t * pool, gm_pool_cache_t * cache) {
+    if(cache->num > 0)
+        pool_give(pool, cache, cache->num);
+}
+
+
+/* allocate a new chunk and put its objects on the shared list, pool must be locked */
+static void pool_grow(gm_pool_t * pool) {
+    char * chunk = gm_calloc(1, POOL_CHUNK_HEADER + GM_POOL_CHUNK_SIZE * pool->size);
+    gm_pool_item_t * item;
+    int x;
+
+    *(void **)chunk = pool->chunks;
+    pool->chunks    = chunk;
+    for(x = GM_POOL_CHUNK_SIZE - 1; x >= 0; x--) {
+        item       = (gm_pool_item_t *)(chunk + POOL_CHUNK_HEADER + x * pool->size);
+        item->next = pool->free;
+        pool->free = item;
+    }
+    pool->free_num += GM_POOL_CHUNK_SIZE;
+    pool->objects  += GM_POOL_CHUNK_SIZE;
+    pool->allocs++;
+}
+
+
+/* detach up to want objects from the shared list */
+static gm_pool_item_t * pool_take(gm_pool_t * pool, int want, int * num) {
+    gm_pool_item_t * head;
+    gm_pool_item_t * tail;
+    int n = 1;
+
+    pthread_mutex_lock(&pool->lock);
+    if(pool->free == NULL)
+        pool_grow(pool);
+    head = pool->free;
+    tail = head;
+    while(n < want && tail->next != NULL) {
+        tail = tail->next;
+        n++;
+    }
+    pool->free      = tail->next;
+    pool->free_num -= n;
+    pthread_mutex_unlock(&pool->lock);
+
+    tail->next = NULL;
+    *num       = n;
+    return head;
+}
+
+
+/* move num objects from the thread cache to the shared list */
+static void pool_give(gm_pool_t * pool, gm_pool_cache_t * cache, int num) {
+    gm_pool_item_t * head = cache->head;
+    gm_pool_item_t * tail = head;
+    int n;
+
+    for(n = 1; n < num; n++)
+        tail = tail->next;
+    cache->head = tail->next;
+    cache->num -= num;
+
+    pthread_mutex_lock(&pool->lock);
+    tail->next      = pool->free;
+    pool->free      = head;
+    pool->free_num += num;
+    pthread_mutex_unlock(&pool->lock);
+}
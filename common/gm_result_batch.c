@@ -0,0 +1,261 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "common.h"
+#include "utils.h"
+#include "gearman_utils.h"
+#include "gm_payload.h"
+#include "gm_result_batch.h"
+
+static gm_result_batch_t * batches = NULL;
+static mod_gm_opt_t      * batch_opt;
+static gearman_client_st   batch_client;
+static pthread_t           batch_thr;
+static pthread_mutex_t     batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t      batch_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t      batch_sent   = PTHREAD_COND_INITIALIZER;
+static int                 batch_running = 0;
+static int                 batch_stopping = 0;
+static pid_t               batch_pid = 0;
+
+static void * batch_sender(void * data);
+
+
+/* start sender thread */
+int mod_gm_result_batch_start(mod_gm_opt_t * opt) {
+    sigset_t mask, old;
+    int rc;
+
+    if(batch_running)
+        return GM_OK;
+
+    if(create_client(opt->server_list, &batch_client) != GM_OK) {
+        gm_log( GM_LOG_ERROR, "cannot start client for result batches\n" );
+        return GM_ERROR;
+    }
+
+    batch_opt      = opt;
+    batch_stopping = 0;
+    batch_pid      = getpid();
+
+    /* signals are handled by the other threads */
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, &old);
+    rc = pthread_create(&batch_thr, NULL, batch_sender, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if(rc != 0) {
+        gm_log( GM_LOG_ERROR, "cannot start result batch thread: %s\n", strerror(rc) );
+        free_client(&batch_client);
+        return GM_ERROR;
+    }
+    batch_running = 1;
+
+    gm_log( GM_LOG_DEBUG, "started result batches, batch size %d, interval %dms\n", opt->result_batch_size, opt->result_batch_interval );
+    return GM_OK;
+}
+
+
+/* get batch of a result queue, batch_mutex must be locked */
+static gm_result_batch_t * get_batch(const char * queue) {
+    gm_result_batch_t * batch;
+
+    for(batch = batches; batch != NULL; batch = batch->next) {
+        if(!strcmp(batch->queue, queue))
+            return batch;
+    }
+
+    batch             = gm_calloc(1, sizeof(gm_result_batch_t));
+    batch->queue      = gm_strdup(queue);
+    batch->spare      = gm_malloc(GM_BUFFERSIZE);
+    batch->spare_size = GM_BUFFERSIZE;
+    mod_gm_payload_begin(&batch->writer, gm_malloc(GM_BUFFERSIZE), GM_BUFFERSIZE);
+    batch->next       = batches;
+    batches           = batch;
+    return batch;
+}
+
+
+/* add result, called from the job threads */
+int mod_gm_result_batch_add(const char * queue, const char * data, size_t len) {
+    gm_result_batch_t * batch;
+    size_t size;
+
+    /* forked plugin processes have no sender thread */
+    if(!batch_running || getpid() != batch_pid)
+        return GM_ERROR;
+
+    pthread_mutex_lock(&batch_mutex);
+    batch = get_batch(queue);
+
+    /* full batches are sent by the sender thread */
+    while(!batch_stopping && batch->num >= batch_opt->result_batch_size)
+        pthread_cond_wait(&batch_sent, &batch_mutex);
+    if(batch_stopping) {
+        pthread_mutex_unlock(&batch_mutex);
+        return GM_ERROR;
+    }
+
+    /* key, length and the trailing null byte of the payload */
+    size = batch->writer.len + len + 12;
+    if(size > batch->writer.size) {
+        if(size < 2 * batch->writer.size)
+            size = 2 * batch->writer.size;
+        batch->writer.buf  = gm_realloc(batch->writer.buf, size);
+        batch->writer.size = size;
+    }
+    mod_gm_payload_add_payload(&batch->writer, GM_KEY_RESULT, data, len);
+
+    /* the first result sets the deadline of the batch */
+    batch->num++;
+    if(batch->num == 1)
+        gettimeofday(&batch->first, NULL);
+    if(batch->num == 1 || batch->num >= batch_opt->result_batch_size)
+        pthread_cond_signal(&batch_wakeup);
+    pthread_mutex_unlock(&batch_mutex);
+
+    return GM_OK;
+}
+
+
+/* send one batch, batch_mutex must be locked and is released while sending */
+static void send_batch(gm_result_batch_t * batch) {
+    char * buf;
+    size_t size;
+    int num;
+
+    /* results are collected in the spare buffer meanwhile */
+    mod_gm_payload_end(&batch->writer);
+    buf  = batch->writer.buf;
+    size = batch->writer.size;
+    num  = batch->num;
+    mod_gm_payload_begin(&batch->writer, batch->spare, batch->spare_size);
+    batch->spare = NULL;
+    batch->num   = 0;
+    pthread_cond_broadcast(&batch_sent);
+    pthread_mutex_unlock(&batch_mutex);
+
+    gm_log( GM_LOG_TRACE, "send_batch() sending %d results to %s\n", num, batch->queue );
+    if(add_job_to_queue( &batch_client,
+                         batch_opt->server_list,
+                         batch->queue,
+                         NULL,
+                         buf,
+                         GM_JOB_PRIO_NORMAL,
+                         GM_DEFAULT_JOB_RETRIES,
+                         batch_opt->transportmode,
+                         TRUE
+                        ) != GM_OK) {
+        gm_log( GM_LOG_TRACE, "send_batch() finished unsuccessfully\n" );
+    }
+
+    pthread_mutex_lock(&batch_mutex);
+    batch->spare      = buf;
+    batch->spare_size = size;
+}
+
+
+/* milliseconds since the first result of a batch */
+static long batch_age(gm_result_batch_t * batch, struct timeval * now) {
+    return (now->tv_sec - batch->first.tv_sec) * 1000 + (now->tv_usec - batch->first.tv_usec) / 1000;
+}
+
+
+/* sender thread main loop */
+static void * batch_sender(__attribute__((__unused__)) void * data) {
+    gm_result_batch_t * batch;
+    struct timeval now;
+    struct timespec deadline;
+    long age, wait;
+    int sent;
+
+    pthread_mutex_lock(&batch_mutex);
+    while(1) {
+        /* send full and expired batches, everything when stopping */
+        gettimeofday(&now, NULL);
+        wait = -1;
+        sent = 0;
+        for(batch = batches; batch != NULL; batch = batch->next) {
+            if(batch->num == 0)
+                continue;
+            age = batch_age(batch, &now);
+            if(batch_stopping || batch->num >= batch_opt->result_batch_size || age >= batch_opt->result_batch_interval) {
+                send_batch(batch);
+                sent = 1;
+                break;
+            }
+            if(wait < 0 || batch_opt->result_batch_interval - age < wait)
+                wait = batch_opt->result_batch_interval - age;
+        }
+        if(sent)
+            continue;
+
+        if(batch_stopping)
+            break;
+
+        /* sleep till the next batch expires or new results arrive */
+        if(wait < 0) {
+            pthread_cond_wait(&batch_wakeup, &batch_mutex);
+        } else {
+            deadline.tv_sec  = now.tv_sec + (now.tv_usec / 1000 + wait) / 1000;
+            deadline.tv_nsec = ((now.tv_usec / 1000 + wait) % 1000) * 1000000;
+            pthread_cond_timedwait(&batch_wakeup, &batch_mutex, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&batch_mutex);
+
+    return NULL;
+}
+
+
+/* flush and stop sender thread */
+void mod_gm_result_batch_stop(void) {
+    gm_result_batch_t * batch;
+
+    if(!batch_running || getpid() != batch_pid)
+        return;
+
+    pthread_mutex_lock(&batch_mutex);
+    batch_stopping = 1;
+    pthread_cond_signal(&batch_wakeup);
+    pthread_cond_broadcast(&batch_sent);
+    pthread_mutex_unlock(&batch_mutex);
+    pthread_join(batch_thr, NULL);
+    batch_running = 0;
+
+    while(batches != NULL) {
+        batch   = batches;
+        batches = batch->next;
+        free(batch->queue);
+        free(batch->writer.buf);
+        free(batch->spare);
+        free(batch);
+    }
+    free_client(&batch_client);
+}
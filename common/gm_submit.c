@@ -0,0 +1,353 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "common.h"
+#include "utils.h"
+#include "gearman_utils.h"
+#include "gm_payload.h"
+#include "gm_submit.h"
+
+static gm_ring_t         * submit_ring = NULL;
+static gm_ring_t         * submit_failed_ring = NULL;
+static mod_gm_opt_t      * submit_opt;
+static gearman_client_st   submit_client;
+static pthread_t           submit_thr;
+static int                 submit_pipe[2] = { -1, -1 };
+static int                 submit_running = 0;
+static int                 submit_stopping = 0;
+static int                 submit_lost = 0;
+static struct timeval      submit_error_time;
+
+static void * submit_worker(void * data);
+
+
+/* create ring */
+gm_ring_t * mod_gm_ring_create(unsigned int size) {
+    gm_ring_t * ring = gm_malloc(sizeof(gm_ring_t));
+    ring->slots = gm_calloc(size, sizeof(void *));
+    ring->size  = size;
+    ring->head  = 0;
+    ring->tail  = 0;
+    return ring;
+}
+
+
+/* free ring */
+void mod_gm_ring_free(gm_ring_t * ring) {
+    if(ring == NULL)
+        return;
+    free(ring->slots);
+    free(ring);
+}
+
+
+/* append element, producer side */
+unsigned int mod_gm_ring_push(gm_ring_t * ring, void * elem) {
+    unsigned int tail = ring->tail;
+    unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if(tail - head >= ring->size)
+        return 0;
+    ring->slots[tail & (ring->size - 1)] = elem;
+    /* publish the slot, then look at the consumer again so a consumer
+     * going to sleep on an empty ring cannot be missed */
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+    head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+    return tail + 1 - head;
+}
+
+
+/* remove oldest element, consumer side */
+void * mod_gm_ring_pop(gm_ring_t * ring) {
+    unsigned int head = ring->head;
+    void * elem;
+    if(head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    elem = ring->slots[head & (ring->size - 1)];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+    return elem;
+}
+
+
+/* number of queued elements */
+unsigned int mod_gm_ring_count(gm_ring_t * ring) {
+    unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+    return tail - __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+}
+
+
+/* start sender thread */
+int mod_gm_submit_start(mod_gm_opt_t * opt) {
+    int x;
+
+    if(submit_running)
+        return GM_OK;
+
+    if(pipe(submit_pipe) != 0) {
+        gm_log( GM_LOG_ERROR, "cannot create pipe for batch submission: %s\n", strerror(errno) );
+        return GM_ERROR;
+    }
+    for(x = 0; x < 2; x++) {
+        fcntl(submit_pipe[x], F_SETFL, fcntl(submit_pipe[x], F_GETFL) | O_NONBLOCK);
+        fcntl(submit_pipe[x], F_SETFD, FD_CLOEXEC);
+    }
+
+    if(create_client(opt->server_list, &submit_client) != GM_OK) {
+        gm_log( GM_LOG_ERROR, "cannot start client for batch submission\n" );
+        close(submit_pipe[0]);
+        close(submit_pipe[1]);
+        return GM_ERROR;
+    }
+
+    submit_opt         = opt;
+    submit_ring        = mod_gm_ring_create(GM_SUBMIT_RING_SIZE);
+    submit_failed_ring = mod_gm_ring_create(GM_SUBMIT_RING_SIZE);
+    submit_stopping    = 0;
+    submit_lost        = 0;
+    if(pthread_create(&submit_thr, NULL, submit_worker, NULL) != 0) {
+        gm_log( GM_LOG_ERROR, "cannot start batch submission thread\n" );
+        mod_gm_ring_free(submit_ring);
+        mod_gm_ring_free(submit_failed_ring);
+        submit_ring        = NULL;
+        submit_failed_ring = NULL;
+        free_client(&submit_client);
+        close(submit_pipe[0]);
+        close(submit_pipe[1]);
+        return GM_ERROR;
+    }
+    submit_running = 1;
+
+    gm_log( GM_LOG_DEBUG, "started batch submission, batch size %d, interval %dms\n", opt->batch_submit_size, opt->batch_submit_interval );
+    return GM_OK;
+}
+
+
+/* wake up the sender thread */
+static void submit_wakeup(void) {
+    char c = 0;
+    /* a full pipe already wakes the sender */
+    if(write(submit_pipe[1], &c, 1) < 0)
+        return;
+}
+
+
+/* remove pending wake ups */
+static void submit_drain(void) {
+    char buf[64];
+    while(read(submit_pipe[0], buf, sizeof(buf)) > 0)
+        ;
+}
+
+
+/* queue job, called from the core thread */
+int mod_gm_submit_job(char * queue, char * uniq, char * data, int priority, int type, void * object) {
+    gm_submit_job_t * job;
+    size_t qlen, ulen, dlen;
+    unsigned int count;
+    char * ptr;
+
+    if(!submit_running)
+        return GM_ERROR;
+
+    /* single allocation for the job and its strings */
+    qlen = strlen(queue) + 1;
+    ulen = uniq != NULL ? strlen(uniq) + 1 : 0;
+    dlen = mod_gm_payload_size(data, (size_t)-1);
+    job  = gm_malloc(sizeof(gm_submit_job_t) + qlen + ulen + dlen + 1);
+    ptr  = (char *)(job + 1);
+
+    job->queue = ptr;
+    memcpy(ptr, queue, qlen);
+    ptr += qlen;
+    job->uniq = NULL;
+    if(uniq != NULL) {
+        job->uniq = ptr;
+        memcpy(ptr, uniq, ulen);
+        ptr += ulen;
+    }
+    job->data = ptr;
+    memcpy(ptr, data, dlen);
+    ptr[dlen] = '\0';
+    job->priority = priority;
+    job->type     = type;
+    job->object   = object;
+
+    count = mod_gm_ring_push(submit_ring, job);
+    if(count == 0) {
+        free(job);
+        return GM_ERROR;
+    }
+
+    /* only wake the sender when the ring was empty or a batch is complete */
+    if(count == 1 || count == (unsigned int)submit_opt->batch_submit_size)
+        submit_wakeup();
+
+    return GM_OK;
+}
+
+
+/* take back a failed job, called from the core thread */
+int mod_gm_submit_failed(int * type, void ** object) {
+    gm_submit_job_t * job;
+
+    if(!submit_running)
+        return FALSE;
+
+    job = mod_gm_ring_pop(submit_failed_ring);
+    if(job == NULL)
+        return FALSE;
+    *type   = job->type;
+    *object = job->object;
+    free(job);
+    return TRUE;
+}
+
+
+/* send up to batch_submit_size jobs with a single round trip */
+static void submit_flush(gm_submit_job_t ** batch) {
+    gearman_return_t ret;
+    struct timeval now;
+    int num = 0, retries, x, failed = FALSE;
+
+    while(num < submit_opt->batch_submit_size && (batch[num] = mod_gm_ring_pop(submit_ring)) != NULL)
+        num++;
+    if(num == 0)
+        return;
+
+    gm_log( GM_LOG_TRACE, "submit_flush() sending %d jobs\n", num );
+
+    for(retries = GM_DEFAULT_JOB_RETRIES; ; retries--) {
+        for(x = 0; x < num; x++) {
+            add_job_to_queue( &submit_client,
+                              submit_opt->server_list,
+                              batch[x]->queue,
+                              batch[x]->uniq,
+                              batch[x]->data,
+                              batch[x]->priority,
+                              0,
+                              submit_opt->transportmode,
+                              FALSE
+                            );
+        }
+        ret = gearman_client_run_tasks( &submit_client );
+        gearman_client_task_free_all( &submit_client );
+        if(ret == GEARMAN_SUCCESS) {
+            submit_lost = 0;
+            break;
+        }
+
+        /* only log the first error and then every minute */
+        gettimeofday(&now, NULL);
+        if(submit_lost == 0 || now.tv_sec >= submit_error_time.tv_sec + 60) {
+            submit_error_time = now;
+            gm_log( GM_LOG_ERROR, "sending batch of %d jobs to gearmand failed: %s (%i lost jobs so far)\n", num, gearman_client_error(&submit_client), submit_lost );
+        }
+
+        /* recreate client, otherwise gearman sigsegvs */
+        gearman_client_free( &submit_client );
+        create_client( submit_opt->server_list, &submit_client );
+
+        if(retries == 0) {
+            failed = TRUE;
+            break;
+        }
+    }
+
+    for(x = 0; x < num; x++) {
+        /* hand checks back to the core, so it can reschedule them */
+        if(failed && batch[x]->object != NULL && mod_gm_ring_push(submit_failed_ring, batch[x]) > 0)
+            continue;
+        if(failed)
+            submit_lost++;
+        free(batch[x]);
+    }
+}
+
+
+/* sender thread main loop */
+static void * submit_worker(__attribute__((__unused__)) void * data) {
+    gm_submit_job_t ** batch;
+    struct pollfd pfd;
+    unsigned int count;
+
+    batch = gm_malloc(submit_opt->batch_submit_size * sizeof(gm_submit_job_t *));
+    pfd.fd     = submit_pipe[0];
+    pfd.events = POLLIN;
+
+    while(1) {
+        count = mod_gm_ring_count(submit_ring);
+        if(count == 0) {
+            if(__atomic_load_n(&submit_stopping, __ATOMIC_ACQUIRE))
+                break;
+            poll(&pfd, 1, -1);
+            submit_drain();
+            continue;
+        }
+
+        /* wait for a full batch or the flush interval */
+        if(count < (unsigned int)submit_opt->batch_submit_size && !__atomic_load_n(&submit_stopping, __ATOMIC_ACQUIRE)) {
+            submit_drain();
+            if(mod_gm_ring_count(submit_ring) < (unsigned int)submit_opt->batch_submit_size)
+                poll(&pfd, 1, submit_opt->batch_submit_interval);
+        }
+
+        submit_flush(batch);
+    }
+
+    free(batch);
+    return NULL;
+}
+
+
+/* flush and stop sender thread */
+void mod_gm_submit_stop(void) {
+    gm_submit_job_t * job;
+
+    if(!submit_running)
+        return;
+
+    __atomic_store_n(&submit_stopping, 1, __ATOMIC_RELEASE);
+    submit_wakeup();
+    pthread_join(submit_thr, NULL);
+    submit_running = 0;
+
+    mod_gm_ring_free(submit_ring);
+    submit_ring = NULL;
+    /* the core is going away, nobody reschedules failed jobs anymore */
+    while((job = mod_gm_ring_pop(submit_failed_ring)) != NULL)
+        free(job);
+    mod_gm_ring_free(submit_failed_ring);
+    submit_failed_ring = NULL;
+    free_client(&submit_client);
+    close(submit_pipe[0]);
+    close(submit_pipe[1]);
+    submit_pipe[0] = -1;
+    submit_pipe[1] = -1;
+}
@@ -0,0 +1,129 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "common.h"
+#include "utils.h"
+#include "gm_wakeup.h"
+
+
+/* create non blocking pipe */
+int mod_gm_wakeup_init(gm_wakeup_t * wakeup) {
+    int x;
+
+    wakeup->pending = 0;
+    wakeup->signals = 0;
+    if(pipe(wakeup->fd) != 0) {
+        gm_log( GM_LOG_ERROR, "cannot create wake up pipe: %s\n", strerror(errno) );
+        wakeup->fd[0] = -1;
+        wakeup->fd[1] = -1;
+        return GM_ERROR;
+    }
+    for(x = 0; x < 2; x++) {
+        fcntl(wakeup->fd[x], F_SETFL, fcntl(wakeup->fd[x], F_GETFL) | O_NONBLOCK);
+        fcntl(wakeup->fd[x], F_SETFD, FD_CLOEXEC);
+    }
+    return GM_OK;
+}
+
+
+/* write into the pipe unless there is a pending wake up */
+void mod_gm_wakeup_signal(gm_wakeup_t * wakeup) {
+    char c = 0;
+
+    if(__atomic_exchange_n(&wakeup->pending, 1, __ATOMIC_ACQ_REL))
+        return;
+    __atomic_add_fetch(&wakeup->signals, 1, __ATOMIC_RELAXED);
+    /* a full pipe already wakes the reader */
+    if(write(wakeup->fd[1], &c, 1) < 0)
+        return;
+}
+
+
+/* remove pending wake ups, following signals write again */
+void mod_gm_wakeup_clear(gm_wakeup_t * wakeup) {
+    char buf[64];
+
+    while(read(wakeup->fd[0], buf, sizeof(buf)) > 0)
+        ;
+    __atomic_store_n(&wakeup->pending, 0, __ATOMIC_SEQ_CST);
+}
+
+
+/* close pipe */
+void mod_gm_wakeup_free(gm_wakeup_t * wakeup) {
+    int x;
+
+    for(x = 0; x < 2; x++) {
+        if(wakeup->fd[x] != -1)
+            close(wakeup->fd[x]);
+        wakeup->fd[x] = -1;
+    }
+}
+
+
+/* add latency in ms to its power of two bucket */
+void mod_gm_histogram_add(gm_histogram_t * hist, struct timeval * start, struct timeval * end) {
+    double ms;
+    double limit = 1;
+    int x = 0;
+
+    ms = (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_usec - start->tv_usec) / 1000.0;
+    if(ms < 0)
+        ms = 0;
+    while(ms >= limit && x < GM_HISTOGRAM_BUCKETS - 1) {
+        limit *= 2;
+        x++;
+    }
+    hist->bucket[x]++;
+    hist->count++;
+    hist->sum += ms;
+    if(ms > hist->max)
+        hist->max = ms;
+}
+
+
+/* log non empty buckets and reset histogram */
+void mod_gm_histogram_log(gm_histogram_t * hist, int level, const char * name) {
+    char buf[GM_BUFFERSIZE];
+    size_t len;
+    int x;
+
+    if(hist->count > 0) {
+        len = snprintf(buf, sizeof(buf), "%s: %lu, avg %.2fms, max %.2fms", name, hist->count, hist->sum / hist->count, hist->max);
+        for(x = 0; x < GM_HISTOGRAM_BUCKETS && len < sizeof(buf); x++) {
+            if(hist->bucket[x] == 0)
+                continue;
+            if(x == GM_HISTOGRAM_BUCKETS - 1)
+                len += snprintf(buf+len, sizeof(buf)-len, ", >=%dms: %lu", 1 << (x-1), hist->bucket[x]);
+            else
+                len += snprintf(buf+len, sizeof(buf)-len, ", <%dms: %lu", 1 << x, hist->bucket[x]);
+        }
+        gm_log( level, "%s\n", buf );
+    }
+    memset(hist, 0, sizeof(gm_histogram_t));
+}
@@ -15,6 +15,7 @@
  */
 
 #include "popenRWE.h"
+#include <fcntl.h>
 
 int popenRWE(int *rwepipe, char *command) {
 	int in[2];
@@ -23,15 +24,16 @@ int popenRWE(int *rwepipe, char *command) {
 	int pid;
 	int rc;
 
-	rc = pipe(in);
+	/* other threads must not pass our pipes to their plugins */
+	rc = pipe2(in, O_CLOEXEC);
 	if (rc<0)
 		goto error_in;
 
-	rc = pipe(out);
+	rc = pipe2(out, O_CLOEXEC);
 	if (rc<0)
 		goto error_out;
 
-	rc = pipe(err);
+	rc = pipe2(err, O_CLOEXEC);
 	if (rc<0)
 		goto error_err;
 
@@ -25,6 +25,9 @@
 #include "utils.h"
 #include "gm_crypt.h"
 #include "base64.h"
+#include "gm_payload.h"
+#include "gm_submit.h"
+#include "gm_result_batch.h"
 #include "gearman_utils.h"
 #include "popenRWE.h"
 #include "polarssl/md5.h"
@@ -113,49 +116,74 @@ void mod_gm_crypt_init(char * key) {
 
 /* encrypt text with given key */
 int mod_gm_encrypt(char ** encrypted, char * text, int mode) {
-    int size;
+    return mod_gm_encrypt_len(encrypted, text, strlen(text), mode);
+}
+
+
+/* encrypt text of given length, which may contain null bytes */
+int mod_gm_encrypt_len(char ** encrypted, char * text, int size, int mode) {
     unsigned char * crypted;
     char * base64;
 
     if(mode == GM_ENCODE_AND_ENCRYPT) {
-        size = mod_gm_aes_encrypt(&crypted, text);
+        size = mod_gm_aes_encrypt(&crypted, text, size);
+    }
+    else if(mode == GM_ENCODE_AND_ENCRYPT_GCM || mode == GM_ENCODE_GCM_ACCEPT_ALL) {
+        size = mod_gm_aes_gcm_encrypt(&crypted, text, size);
     }
     else {
-        crypted = (unsigned char*)gm_strdup(text);
-        size    = strlen(text);
+        crypted = (unsigned char*)text;
     }
 
     /* now encode in base64 */
-    base64 = gm_malloc(size*2);
-    base64[0] = 0;
-    base64_encode(crypted, size, base64, size*2);
-    free(crypted);
+    base64 = gm_malloc(BASE64_LENGTH(size)+1);
+    base64_encode(crypted, size, base64, BASE64_LENGTH(size)+1);
+    if(crypted != (unsigned char*)text)
+        free(crypted);
     *encrypted = base64;
-    return strlen(base64);
+    return BASE64_LENGTH(size);
 }
 
 
 /* decrypt text with given key */
-void mod_gm_decrypt(char ** decrypted, char * text, int mode) {
-    char *test;
-    int input_size = strlen(text);
-    unsigned char * buffer = gm_malloc(sizeof(unsigned char) * input_size * 2);
-
-    /* first decode from base64 */
-    size_t bsize = base64_decode(text, buffer, input_size);
-    test = gm_strndup((char *)buffer, 5);
-    if(mode == GM_ENCODE_AND_ENCRYPT || (mode == GM_ENCODE_ACCEPT_ALL && strcmp(test, "type="))) {
-        /* then decrypt */
-        mod_gm_aes_decrypt(decrypted, buffer, bsize);
-    }
-    else  {
-        *decrypted[0] = '\x0';
-        buffer[bsize] = '\x0';
-        strncat(*decrypted, (char*)buffer, bsize);
-    }
-    free(test);
-    free(buffer);
-    return;
+int mod_gm_decrypt(char ** decrypted, char * text, int mode) {
+    return mod_gm_decrypt_len(decrypted, text, strlen(text), mode);
+}
+
+
+/* decode and decrypt text of given length, text does not need to be nul terminated */
+int mod_gm_decrypt_len(char ** decrypted, const char * text, int input_size, int mode) {
+    unsigned char * buffer = (unsigned char *)*decrypted;
+    int plain;
+
+    /* first decode from base64, decoded data is always smaller than the input */
+    int bsize = (int)base64_decode_len(text, input_size, buffer, input_size+1);
+    if(bsize < 0)
+        bsize = 0;
+    buffer[bsize] = '\x0';
+    /* encrypted data may start with the binary marker, so the header has to match exactly */
+    plain = !strncmp((char *)buffer, "type=", 5) || mod_gm_payload_is_complete((char *)buffer, bsize);
+    if(mode == GM_ENCODE_AND_ENCRYPT || (mode == GM_ENCODE_ACCEPT_ALL && !plain)) {
+        /* then decrypt in place */
+        return mod_gm_aes_decrypt(decrypted, buffer, bsize);
+    }
+    if(mode == GM_ENCODE_GCM_ACCEPT_ALL && plain) {
+        /* authenticated data wins, clear text is only used when authentication fails */
+        char * authenticated = gm_malloc(bsize+1);
+        int len = mod_gm_aes_gcm_decrypt(&authenticated, buffer, bsize);
+        if(len > 0) {
+            memcpy(buffer, authenticated, len+1);
+            bsize = len;
+        }
+        free(authenticated);
+    }
+    else if(mode == GM_ENCODE_AND_ENCRYPT_GCM || mode == GM_ENCODE_GCM_ACCEPT_ALL) {
+        /* verify and decrypt in place */
+        bsize = mod_gm_aes_gcm_decrypt(decrypted, buffer, bsize);
+        if(bsize == 0)
+            return 0;
+    }
+    return mod_gm_payload_size((char *)buffer, bsize);
 }
 
 
@@ -253,7 +281,16 @@ int set_default_options(mod_gm_opt_t *opt) {
     opt->fork_on_exec       = GM_DISABLED;
     opt->idle_timeout       = GM_DEFAULT_IDLE_TIMEOUT;
     opt->max_jobs           = GM_DEFAULT_MAX_JOBS;
+    opt->concurrent_checks  = 1;
+    opt->worker_threads     = 1;
+    opt->spawn_checks       = GM_DISABLED;
+    opt->max_output_size    = GM_MAX_OUTPUT;
+    opt->zygote             = GM_DISABLED;
     opt->spawn_rate         = GM_DEFAULT_SPAWN_RATE;
+    opt->autoscale          = GM_DISABLED;
+    opt->result_batch       = GM_DISABLED;
+    opt->result_batch_size  = GM_DEFAULT_BATCH_SIZE;
+    opt->result_batch_interval = GM_DEFAULT_BATCH_INTERVAL;
     opt->timeout_return     = 2;
     opt->identifier         = NULL;
     opt->queue_cust_var     = NULL;
@@ -263,6 +300,15 @@ int set_default_options(mod_gm_opt_t *opt) {
     opt->orphan_service_checks   = GM_ENABLED;
     opt->orphan_return           = 2;
     opt->accept_clear_results    = GM_DISABLED;
+    opt->binary_payload          = GM_DISABLED;
+    opt->binary_queues_num       = 0;
+    for(i=0;i<=GM_LISTSIZE-1;i++)
+        opt->binary_queues_list[i] = NULL;
+    opt->batch_submit            = GM_DISABLED;
+    opt->batch_submit_size       = GM_DEFAULT_BATCH_SIZE;
+    opt->batch_submit_interval   = GM_DEFAULT_BATCH_INTERVAL;
+    opt->result_backlog          = 0;
+    opt->result_backlog_resume   = 0;
     opt->has_starttime      = FALSE;
     opt->has_finishtime     = FALSE;
     opt->has_latency        = FALSE;
@@ -469,6 +515,36 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
         return(GM_OK);
     }
 
+    /* spawn_checks */
+    else if ( !strcmp( key, "spawn_checks" ) ) {
+        opt->spawn_checks = parse_yes_or_no(value, GM_ENABLED);
+        return(GM_OK);
+    }
+
+    /* max_output_size */
+    else if ( !strcmp( key, "max_output_size" ) ) {
+        opt->max_output_size = atoi( value );
+        if(opt->max_output_size <= 0) { opt->max_output_size = GM_MAX_OUTPUT; }
+    }
+
+    /* autoscale */
+    else if ( !strcmp( key, "autoscale" ) ) {
+        opt->autoscale = parse_yes_or_no(value, GM_ENABLED);
+        return(GM_OK);
+    }
+
+    /* result_batch */
+    else if ( !strcmp( key, "result_batch" ) ) {
+        opt->result_batch = parse_yes_or_no(value, GM_ENABLED);
+        return(GM_OK);
+    }
+
+    /* zygote */
+    else if ( !strcmp( key, "zygote" ) ) {
+        opt->zygote = parse_yes_or_no(value, GM_ENABLED);
+        return(GM_OK);
+    }
+
     /* do_hostchecks */
     else if ( !strcmp( key, "do_hostchecks" ) ) {
         opt->do_hostchecks = parse_yes_or_no(value, GM_ENABLED);
@@ -523,6 +599,34 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
         return(GM_OK);
     }
 
+    /* binary_payload */
+    else if ( !strcmp( key, "binary_payload" ) ) {
+        /* parse_yes_or_no() lowercases its argument, queue names keep their case */
+        char *values, *values_original;
+        values_original = values = gm_strdup(value);
+        opt->binary_payload = parse_yes_or_no(value, -1);
+        if(opt->binary_payload == -1) {
+            /* not a bool, only the listed queues get binary check jobs */
+            char *name;
+            opt->binary_payload = GM_ENABLED;
+            while ((name = strsep(&values, ",")) != NULL) {
+                name = trim(name);
+                if(strcmp(name, "") && opt->binary_queues_num < GM_LISTSIZE) {
+                    opt->binary_queues_list[opt->binary_queues_num] = gm_strdup(name);
+                    opt->binary_queues_num++;
+                }
+            }
+        }
+        free(values_original);
+        return(GM_OK);
+    }
+
+    /* batch_submit */
+    else if ( !strcmp( key, "batch_submit" ) ) {
+        opt->batch_submit = parse_yes_or_no(value, GM_ENABLED);
+        return(GM_OK);
+    }
+
     /* enable_embedded_perl */
     else if ( !strcmp( key, "enable_embedded_perl" ) ) {
 #ifdef EMBEDDEDPERL
@@ -675,6 +779,19 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
         opt->keyfile = gm_strdup( value );
     }
 
+    /* transportmode */
+    else if ( !strcmp( key, "transportmode" ) ) {
+        if ( !strcmp( value, "aes" ) ) {
+            opt->transportmode = GM_ENCODE_AND_ENCRYPT;
+        }
+        else if ( !strcmp( value, "aes-gcm" ) ) {
+            opt->transportmode = GM_ENCODE_AND_ENCRYPT_GCM;
+        }
+        else {
+            gm_log( GM_LOG_ERROR, "unknown transport mode '%s', use one of 'aes' and 'aes-gcm'\n", value );
+        }
+    }
+
     /* pidfile */
     else if ( !strcmp( key, "pidfile" ) ) {
         opt->pidfile = gm_strdup( value );
@@ -733,6 +850,30 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
         if(opt->max_jobs < 0) { opt->max_jobs = GM_DEFAULT_MAX_JOBS; }
     }
 
+    /* concurrent_checks */
+    else if ( !strcmp( key, "concurrent_checks" ) ) {
+        opt->concurrent_checks = atoi( value );
+        if(opt->concurrent_checks < 1) { opt->concurrent_checks = 1; }
+    }
+
+    /* worker_threads */
+    else if ( !strcmp( key, "worker_threads" ) ) {
+        opt->worker_threads = atoi( value );
+        if(opt->worker_threads < 1) { opt->worker_threads = 1; }
+    }
+
+    /* result_batch_size */
+    else if ( !strcmp( key, "result_batch_size" ) ) {
+        opt->result_batch_size = atoi( value );
+        if(opt->result_batch_size < 1) { opt->result_batch_size = 1; }
+    }
+
+    /* result_batch_interval */
+    else if ( !strcmp( key, "result_batch_interval" ) ) {
+        opt->result_batch_interval = atoi( value );
+        if(opt->result_batch_interval < 0) { opt->result_batch_interval = 0; }
+    }
+
     /* spawn-rate */
     else if ( !strcmp( key, "spawn-rate" ) ) {
         opt->spawn_rate = atoi( value );
@@ -929,6 +1070,31 @@ int parse_args_line(mod_gm_opt_t *opt, char * arg, int recursion_level) {
         opt->restrict_command_characters = gm_strdup(value);
     }
 
+    /* batch_submit_size */
+    else if ( !strcmp( key, "batch_submit_size" ) ) {
+        opt->batch_submit_size = atoi( value );
+        if(opt->batch_submit_size < 1) { opt->batch_submit_size = 1; }
+        if(opt->batch_submit_size > GM_SUBMIT_RING_SIZE) { opt->batch_submit_size = GM_SUBMIT_RING_SIZE; }
+    }
+
+    /* batch_submit_interval */
+    else if ( !strcmp( key, "batch_submit_interval" ) ) {
+        opt->batch_submit_interval = atoi( value );
+        if(opt->batch_submit_interval < 0) { opt->batch_submit_interval = 0; }
+    }
+
+    /* result_backlog */
+    else if ( !strcmp( key, "result_backlog" ) ) {
+        opt->result_backlog = atoi( value );
+        if(opt->result_backlog < 0) { opt->result_backlog = 0; }
+    }
+
+    /* result_backlog_resume */
+    else if ( !strcmp( key, "result_backlog_resume" ) ) {
+        opt->result_backlog_resume = atoi( value );
+        if(opt->result_backlog_resume < 0) { opt->result_backlog_resume = 0; }
+    }
+
     /* timeout while connecting to gearmand server*/
     else if ( !strcmp( key, "gearman_connection_timeout" ) ) {
         opt->gearman_connection_timeout = atoi( value );
@@ -1019,7 +1185,18 @@ void dumpconfig(mod_gm_opt_t *opt, int mode) {
         gm_log( GM_LOG_DEBUG, "min worker:                      %d\n", opt->min_worker);
         gm_log( GM_LOG_DEBUG, "max worker:                      %d\n", opt->max_worker);
         gm_log( GM_LOG_DEBUG, "spawn rate:                      %d\n", opt->spawn_rate);
+        gm_log( GM_LOG_DEBUG, "autoscale:                       %s\n", opt->autoscale == GM_ENABLED ? "yes" : "no");
+        gm_log( GM_LOG_DEBUG, "zygote:                          %s\n", opt->zygote == GM_ENABLED ? "yes" : "no");
         gm_log( GM_LOG_DEBUG, "fork on exec:                    %s\n", opt->fork_on_exec == GM_ENABLED ? "yes" : "no");
+        gm_log( GM_LOG_DEBUG, "spawn checks:                    %s\n", opt->spawn_checks == GM_ENABLED ? "yes" : "no");
+        gm_log( GM_LOG_DEBUG, "max output size:                 %d\n", opt->max_output_size);
+        gm_log( GM_LOG_DEBUG, "concurrent checks:               %d\n", opt->concurrent_checks);
+        gm_log( GM_LOG_DEBUG, "worker threads:                  %d\n", opt->worker_threads);
+        gm_log( GM_LOG_DEBUG, "result batch:                    %s\n", opt->result_batch == GM_ENABLED ? "yes" : "no");
+        if(opt->result_batch == GM_ENABLED) {
+            gm_log( GM_LOG_DEBUG, "result batch size:               %d\n", opt->result_batch_size);
+            gm_log( GM_LOG_DEBUG, "result batch interval:           %dms\n", opt->result_batch_interval);
+        }
 #ifndef EMBEDDEDPERL
         gm_log( GM_LOG_DEBUG, "embedded perl:                   not compiled\n");
 #endif
@@ -1097,8 +1274,20 @@ void dumpconfig(mod_gm_opt_t *opt, int mode) {
     }
     if(mode == GM_NEB_MODE) {
         gm_log( GM_LOG_DEBUG, "accept clear result:             %s\n", opt->accept_clear_results == GM_ENABLED ? "yes" : "no");
+        gm_log( GM_LOG_DEBUG, "binary payload:                  %s\n", opt->binary_payload == GM_ENABLED ? "yes" : "no");
+        for(i=0;i<opt->binary_queues_num;i++)
+            gm_log( GM_LOG_DEBUG, "binary payload queue:            %s\n", opt->binary_queues_list[i]);
+        gm_log( GM_LOG_DEBUG, "batch submit:                    %s\n", opt->batch_submit == GM_ENABLED ? "yes" : "no");
+        if(opt->batch_submit == GM_ENABLED) {
+            gm_log( GM_LOG_DEBUG, "batch submit size:               %d\n", opt->batch_submit_size);
+            gm_log( GM_LOG_DEBUG, "batch submit interval:           %dms\n", opt->batch_submit_interval);
+        }
+        if(opt->result_backlog > 0) {
+            gm_log( GM_LOG_DEBUG, "result backlog:                  %d\n", opt->result_backlog);
+            gm_log( GM_LOG_DEBUG, "result backlog resume:           %d\n", opt->result_backlog_resume);
+        }
     }
-    gm_log( GM_LOG_DEBUG, "transport mode:                  %s\n", opt->encryption == GM_ENABLED ? "aes-256+base64" : "base64 only");
+    gm_log( GM_LOG_DEBUG, "transport mode:                  %s\n", opt->encryption == GM_ENABLED ? (opt->transportmode == GM_ENCODE_AND_ENCRYPT_GCM ? "aes-256-gcm+base64" : "aes-256+base64") : "base64 only");
     gm_log( GM_LOG_DEBUG, "use uniq jobs:                   %s\n", opt->use_uniq_jobs == GM_ENABLED ? "yes" : "no");
 
     gm_log( GM_LOG_DEBUG, "--------------------------------\n" );
@@ -1127,6 +1316,8 @@ void mod_gm_free_opt(mod_gm_opt_t *opt) {
         free(opt->local_hostgroups_list[i]);
     for(i=0;i<opt->local_servicegroups_num;i++)
         free(opt->local_servicegroups_list[i]);
+    for(i=0;i<opt->binary_queues_num;i++)
+        free(opt->binary_queues_list[i]);
     for(i=0;i<GM_NEBTYPESSIZE;i++) {
         for(j=0;j<opt->exports[i]->elem_number;j++) {
           free(opt->exports[i]->name[j]);
@@ -1240,6 +1431,10 @@ int set_default_job(gm_job_t *job, mod_gm_opt_t *opt) {
     job->start_time.tv_sec   = 0L;
     job->start_time.tv_usec  = 0L;
     job->has_been_sent       = FALSE;
+    job->payload             = NULL;
+    job->binary_payload      = FALSE;
+    job->arena               = NULL;
+    memset(job->env, 0, sizeof(job->env));
 
     return(GM_OK);
 }
@@ -1247,25 +1442,106 @@ int set_default_job(gm_job_t *job, mod_gm_opt_t *opt) {
 
 /* free the job structure */
 int free_job(gm_job_t *job) {
+    int x;
+
+    /* the job itself is part of its arena */
+    if(job->arena != NULL) {
+        gm_arena_free(job->arena);
+        return(GM_OK);
+    }
 
-    free(job->type);
-    free(job->host_name);
-    free(job->service_description);
-    free(job->result_queue);
-    free(job->command_line);
+    /* string values parsed from the payload are not allocated separately */
+    if(job->payload == NULL) {
+        free(job->type);
+        free(job->host_name);
+        free(job->service_description);
+        free(job->result_queue);
+        free(job->command_line);
+        if(job->long_output != NULL)
+            free(job->long_output);
+    }
+    free(job->payload);
     if(job->output != NULL)
         free(job->output);
-    if(job->long_output != NULL)
-        free(job->long_output);
     if(job->source != NULL)
         free(job->source);
     if(job->error != NULL)
         free(job->error);
+    for(x = 0; job->env[x] != NULL; x++)
+        free(job->env[x]);
     free(job);
 
     return(GM_OK);
 }
 
+/* create job inside an arena */
+gm_job_t * create_arena_job(gm_arena_t *arena, mod_gm_opt_t *opt) {
+    gm_job_t * job = gm_arena_alloc(arena, sizeof(gm_job_t));
+    set_default_job(job, opt);
+    job->arena = arena;
+    return(job);
+}
+
+
+/* allocate memory for the lifetime of the job */
+void * job_alloc(gm_job_t *job, size_t size) {
+    if(job->arena != NULL)
+        return(gm_arena_alloc(job->arena, size));
+    return(gm_malloc(size));
+}
+
+
+/* release memory from job_alloc */
+void job_release(gm_job_t *job, void *ptr) {
+    if(job->arena == NULL)
+        free(ptr);
+    return;
+}
+
+
+/* replace job string with formatted text */
+void set_job_string(gm_job_t *job, char **field, const char *fmt, ...) {
+    va_list ap;
+
+    job_release(job, *field);
+    va_start(ap, fmt);
+    if(job->arena != NULL)
+        gm_arena_asprintf_va(job->arena, field, fmt, ap);
+    else
+        gm_asprintf_va(field, fmt, ap);
+    va_end(ap);
+    return;
+}
+
+
+/* replace job string with an allocated buffer */
+void set_job_buffer(gm_job_t *job, char **field, char *buffer) {
+    job_release(job, *field);
+    if(job->arena != NULL) {
+        *field = gm_arena_strdup(job->arena, buffer);
+        free(buffer);
+    } else {
+        *field = buffer;
+    }
+    return;
+}
+
+
+/* add an environment variable for the plugin of this job only */
+int set_job_env(gm_job_t *job, const char *name, const char *value) {
+    int x;
+
+    for(x = 0; x < GM_JOB_ENV_SIZE; x++) {
+        if(job->env[x] == NULL) {
+            set_job_string(job, &job->env[x], "%s=%s", name, value);
+            return(GM_OK);
+        }
+    }
+    gm_log( GM_LOG_ERROR, "too many environment variables for job, skipping %s\n", name);
+    return(GM_ERROR);
+}
+
+
 /* verify if a pid is alive */
 int pid_alive(int pid) {
     if(pid < 0) { pid = -pid; }
@@ -1502,11 +1778,66 @@ int check_param_server(gm_server_t * new_server, gm_server_t * server_list[GM_LI
 }
 
 
+/* plugin output with optional hostname prefix and error output */
+static void build_result_output(gm_job_t * exec_job, char * buffer) {
+    buffer[0]='\x0';
+    if(mod_gm_opt->debug_result) {
+        strcat(buffer, "(");
+        strcat(buffer, hostname);
+        strcat(buffer, ") - ");
+    }
+    strcat(buffer, exec_job->output);
+    if(mod_gm_opt->show_error_output && exec_job->error != NULL && strlen(exec_job->error) > 0) {
+        if(strlen(exec_job->output) > 0)
+            strcat(buffer, "\\n");
+        strcat(buffer, "[");
+        strcat(buffer, exec_job->error);
+        strcat(buffer, "] ");
+    }
+}
+
+
+/* build text result, temp_buffer is used for the output */
+static void build_result_text(gm_job_t * exec_job, char * buffer, char * temp_buffer, int size) {
+    buffer[0]='\x0';
+    snprintf( buffer, size-1, "host_name=%s\ncore_start_time=%Lf\nstart_time=%Lf\nfinish_time=%Lf\nreturn_code=%i\nexited_ok=%i\nsource=%s\n",
+              exec_job->host_name,
+              timeval2double(&exec_job->next_check),
+              timeval2double(&exec_job->start_time),
+              timeval2double(&exec_job->finish_time),
+              exec_job->return_code,
+              exec_job->exited_ok,
+              exec_job->source
+            );
+    buffer[size-1]='\x0';
+
+    if(exec_job->service_description != NULL) {
+        strcat(buffer, "service_description=");
+        strcat(buffer, exec_job->service_description);
+        strcat(buffer, "\n");
+    }
+
+    build_result_output(exec_job, temp_buffer);
+    strcat(buffer, "output=");
+    strcat(buffer, temp_buffer);
+    strcat(buffer, "\n\n\n");
+    strcat(buffer, "\n");
+}
+
+
 /* send results back */
 void send_result_back(gm_job_t * exec_job) {
+    send_result_back_client(exec_job, current_client, current_client_dup);
+    return;
+}
+
+
+/* send results back with the given clients */
+void send_result_back_client(gm_job_t * exec_job, gearman_client_st * client, gearman_client_st * client_dup) {
     char * temp_buffer1;
     char * temp_buffer2;
-    int result_size;
+    int result_size, binary;
+    size_t result_len = 0;
     gm_log( GM_LOG_TRACE, "send_result_back()\n" );
 
     /* avoid duplicate returned results */
@@ -1533,58 +1864,52 @@ void send_result_back(gm_job_t * exec_job) {
         return;
     }
 
+    /* variable parts are copied as a whole, everything else fits into the buffersize */
     result_size  = strlen(exec_job->output)+GM_BUFFERSIZE;
-    temp_buffer1 = gm_malloc(sizeof(char*)*result_size);
-    temp_buffer2 = gm_malloc(sizeof(char*)*result_size);
+    if(exec_job->error != NULL)
+        result_size += strlen(exec_job->error);
+    if(exec_job->host_name != NULL)
+        result_size += strlen(exec_job->host_name);
+    if(exec_job->service_description != NULL)
+        result_size += strlen(exec_job->service_description);
+    temp_buffer1 = job_alloc(exec_job, result_size+1);
+    temp_buffer2 = job_alloc(exec_job, result_size+1);
 
     gm_log( GM_LOG_TRACE, "queue: %s\n", exec_job->result_queue );
-    temp_buffer1[0]='\x0';
-    snprintf( temp_buffer1, result_size-1, "host_name=%s\ncore_start_time=%Lf\nstart_time=%Lf\nfinish_time=%Lf\nreturn_code=%i\nexited_ok=%i\nsource=%s\n",
-              exec_job->host_name,
-              timeval2double(&exec_job->next_check),
-              timeval2double(&exec_job->start_time),
-              timeval2double(&exec_job->finish_time),
-              exec_job->return_code,
-              exec_job->exited_ok,
-              exec_job->source
-            );
-    temp_buffer1[result_size-1]='\x0';
-
-    if(exec_job->service_description != NULL) {
-        temp_buffer2[0]='\x0';
-        strcat(temp_buffer2, "service_description=");
-        strcat(temp_buffer2, exec_job->service_description);
-        strcat(temp_buffer2, "\n");
 
-        strcat(temp_buffer1, temp_buffer2);
+    /* answer binary jobs in binary format, the core obviously understands it,
+     * batched results are always binary */
+    binary = exec_job->binary_payload == TRUE || mod_gm_opt->result_batch == GM_ENABLED;
+    if(binary) {
+        gm_payload_writer_t writer;
+        size_t output_len;
+
+        build_result_output(exec_job, temp_buffer2);
+        output_len = mod_gm_payload_unescape(temp_buffer2, strlen(temp_buffer2));
+
+        mod_gm_payload_begin(&writer, temp_buffer1, result_size);
+        mod_gm_payload_add_str(&writer, GM_KEY_HOST_NAME, exec_job->host_name);
+        mod_gm_payload_add_str(&writer, GM_KEY_SERVICE_DESCRIPTION, exec_job->service_description);
+        mod_gm_payload_add_timeval(&writer, GM_KEY_CORE_START_TIME, &exec_job->next_check);
+        mod_gm_payload_add_timeval(&writer, GM_KEY_START_TIME, &exec_job->start_time);
+        mod_gm_payload_add_timeval(&writer, GM_KEY_FINISH_TIME, &exec_job->finish_time);
+        mod_gm_payload_add_int(&writer, GM_KEY_RETURN_CODE, exec_job->return_code);
+        mod_gm_payload_add_int(&writer, GM_KEY_EXITED_OK, exec_job->exited_ok);
+        mod_gm_payload_add_str(&writer, GM_KEY_SOURCE, exec_job->source != NULL ? exec_job->source : "(null)");
+        mod_gm_payload_add_strn(&writer, GM_KEY_OUTPUT, temp_buffer2, output_len);
+        result_len = mod_gm_payload_end(&writer);
     }
-    temp_buffer1[result_size]='\x0';
-
-    if(exec_job->output != NULL) {
-        temp_buffer2[0]='\x0';
-        strcat(temp_buffer2, "output=");
-        if(mod_gm_opt->debug_result) {
-            strcat(temp_buffer2, "(");
-            strcat(temp_buffer2, hostname);
-            strcat(temp_buffer2, ") - ");
-        }
-        strcat(temp_buffer2, exec_job->output);
-        if(mod_gm_opt->show_error_output && exec_job->error != NULL && strlen(exec_job->error) > 0) {
-            if(strlen(exec_job->output) > 0)
-                strcat(temp_buffer2, "\\n");
-            strcat(temp_buffer2, "[");
-            strcat(temp_buffer2, exec_job->error);
-            strcat(temp_buffer2, "] ");
-        }
-        strcat(temp_buffer2, "\n\n\n");
-        strcat(temp_buffer1, temp_buffer2);
+    else {
+        build_result_text(exec_job, temp_buffer1, temp_buffer2, result_size);
     }
-    strcat(temp_buffer1, "\n");
-    temp_buffer1[result_size]='\x0';
 
     gm_log( GM_LOG_TRACE, "data:\n%s\n", temp_buffer1);
 
-    if(add_job_to_queue( current_client,
+    /* collected results are sent by the batch thread */
+    if(mod_gm_opt->result_batch == GM_ENABLED && mod_gm_result_batch_add(exec_job->result_queue, temp_buffer1, result_len) == GM_OK) {
+        gm_log( GM_LOG_TRACE, "send_result_back() added result to batch\n" );
+    }
+    else if(add_job_to_queue( client,
                          mod_gm_opt->server_list,
                          exec_job->result_queue,
                          NULL,
@@ -1601,13 +1926,16 @@ void send_result_back(gm_job_t * exec_job) {
     }
 
     if( mod_gm_opt->dupserver_num ) {
+        /* duplicate servers may run an older core, so they get text */
+        if(binary)
+            build_result_text(exec_job, temp_buffer1, temp_buffer2, result_size);
         temp_buffer2[0]='\x0';
         if(mod_gm_opt->dup_results_are_passive) {
             strcat(temp_buffer2, "type=passive\n");
         }
         strcat(temp_buffer2, temp_buffer1);
         temp_buffer2[result_size]='\x0';
-        if( add_job_to_queue( current_client_dup,
+        if( add_job_to_queue( client_dup,
                               mod_gm_opt->dupserver_list,
                               exec_job->result_queue,
                               NULL,
@@ -1626,8 +1954,8 @@ void send_result_back(gm_job_t * exec_job) {
     else {
         gm_log( GM_LOG_TRACE, "send_result_back() has no duplicate servers to send to.\n" );
     }
-    free(temp_buffer1);
-    free(temp_buffer2);
+    job_release(exec_job, temp_buffer1);
+    job_release(exec_job, temp_buffer2);
     return;
 }
 
@@ -1687,48 +2015,66 @@ int starts_with(const char *pre, const char *str) {
 
 /* read from filepointer as long as it has data and return size of string */
 int read_filepointer(char **target, FILE* input) {
-    char buffer[GM_BUFFERSIZE] = "";
-    int bytes, size, total;
-    strcpy(buffer,"");
-    size  = GM_BUFFERSIZE;
-    total = size;
-    while(fgets(buffer,sizeof(buffer)-1, input)){
-        if(size >= GM_MAX_OUTPUT) {
-            gm_log( GM_LOG_INFO, "plugin output exceeds %d bytes, cutting off\n", GM_MAX_OUTPUT );
-            while(fgets(buffer,sizeof(buffer)-1, input)){}
+    char buffer[GM_BUFFERSIZE];
+    int bytes, len, size;
+    len  = 0;
+    size = GM_BUFFERSIZE;
+    (*target)[0] = '\x0';
+    while((bytes = fread(buffer, 1, sizeof(buffer), input)) > 0) {
+        if(len >= mod_gm_opt->max_output_size)
             continue;
+        if(len + bytes > mod_gm_opt->max_output_size) {
+            gm_log( GM_LOG_INFO, "plugin output exceeds %d bytes, cutting off\n", mod_gm_opt->max_output_size );
+            bytes = mod_gm_opt->max_output_size - len;
         }
-        bytes = strlen(buffer);
-        if(total < bytes + size) {
-            *target = gm_realloc(*target, total+GM_BUFFERSIZE);
-            total += GM_BUFFERSIZE;
+        /* grow geometrically, appending must not be quadratic for large outputs */
+        if(len + bytes + 1 > size) {
+            while(len + bytes + 1 > size)
+                size *= 2;
+            *target = gm_realloc(*target, size);
         }
-        size += bytes;
-        strncat(*target, buffer, bytes);
+        memcpy(*target + len, buffer, bytes);
+        len += bytes;
+        (*target)[len] = '\x0';
     }
-    return(size);
+    return(len);
 }
 
 /* read from pipe as long as it has data and return size of string */
 int read_pipe(char **target, int input) {
-    char buffer[GM_BUFFERSIZE] = "";
-    int bytes, size, total;
-    strcpy(buffer,"");
-    size  = GM_BUFFERSIZE;
-    total = size;
-    while(read(input, buffer, sizeof(buffer)-1)){
-        if(size >= GM_MAX_OUTPUT) {
-            gm_log( GM_LOG_INFO, "plugin output exceeds %d bytes, cutting off\n", GM_MAX_OUTPUT );
-            while(read(input, buffer, sizeof(buffer)-1)){}
-            continue;
-        }
-        bytes = strlen(buffer);
-        if(total < bytes + size) {
-            *target = gm_realloc(*target, total+GM_BUFFERSIZE);
-            total += GM_BUFFERSIZE;
+    char buffer[GM_BUFFERSIZE];
+    int len, size;
+    len  = strlen(*target);
+    size = GM_BUFFERSIZE - 1;
+    while(read_pipe_data(input, target, &len, &size, mod_gm_opt->max_output_size) > 0) {
+        if(len >= mod_gm_opt->max_output_size) {
+            gm_log( GM_LOG_INFO, "plugin output exceeds %d bytes, cutting off\n", mod_gm_opt->max_output_size );
+            while(read(input, buffer, sizeof(buffer)) > 0) {}
+            break;
         }
-        size += bytes;
-        strncat(*target, buffer, bytes);
     }
-    return(size);
+    return(len);
+}
+
+/* read available data into a growing buffer, returns number of bytes, 0 on end of file or -1 on errors */
+int read_pipe_data(int fd, char **buf, int *len, int *size, int limit) {
+    int n, want;
+
+    if(*buf == NULL || *size - *len < GM_BUFFERSIZE) {
+        *size = *size < GM_BUFFERSIZE ? GM_BUFFERSIZE : *size * 2;
+        *buf  = gm_realloc(*buf, *size + 1);
+    }
+
+    want = *size - *len;
+    if(limit > 0 && want > limit - *len)
+        want = limit - *len;
+
+    do {
+        n = read(fd, *buf + *len, want);
+    } while(n < 0 && errno == EINTR);
+
+    if(n > 0)
+        *len += n;
+    (*buf)[*len] = '\x0';
+    return(n);
 }
@@ -13,6 +13,22 @@
  */
 
 
+#define GM_BASE64_SCALAR 0   /**< byte by byte implementation */
+#define GM_BASE64_SSSE3  1   /**< ssse3 vectorized implementation */
+#define GM_BASE64_AVX2   2   /**< avx2 vectorized implementation */
+
+/** length of the base64 encoded text for n bytes without the terminating null byte */
+#define BASE64_LENGTH(n) ((((n)+2)/3)*4)
+
+/**
+ * select the base64 implementation, falls back to the best one
+ * supported by this cpu
+ *
+ * @param backend the preferred implementation
+ * @return the implementation in use
+ */
+int base64_set_backend(int backend);
+
 /**
  * encode three bytes using base64 (RFC 3548)
  *
@@ -59,6 +75,17 @@ int _base64_decode_triple(char quadruple[4], unsigned char *result);
  */
 size_t base64_decode(char *source, unsigned char *target, size_t targetlen);
 
+/**
+ * decode base64 encoded data of given length
+ *
+ * @param source the encoded data
+ * @param sourcelen length of the encoded data
+ * @param target pointer to the target buffer
+ * @param targetlen length of the target buffer
+ * @return length of converted data on success, -1 otherwise
+ */
+size_t base64_decode_len(const char *source, size_t sourcelen, unsigned char *target, size_t targetlen);
+
 /**
  * @}
  */
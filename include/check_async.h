@@ -0,0 +1,157 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief run checks concurrently from a single process
+ *
+ * checks are started without waiting for the plugin. Plugin output is
+ * read from non blocking pipes and the exit is noticed by a pidfd, or
+ * by a SIGCHLD signalfd on kernels without pidfd support. All of them
+ * are watched by one epoll instance. Finished checks are handed to the
+ * done callback, which owns the job from then on.
+ *
+ * Without pidfd support SIGCHLD has to be blocked in all threads.
+ *
+ * @{
+ */
+
+#ifndef MOD_GM_CHECK_ASYNC_H
+#define MOD_GM_CHECK_ASYNC_H
+
+#include <sys/time.h>
+#include <sys/types.h>
+#include "common.h"
+
+#define GM_MAX_CONCURRENT_CHECKS    256     /**< upper limit for concurrent_checks */
+
+/** callback for finished checks */
+typedef void (*gm_async_done_fn)(gm_job_t * job, void * data);
+
+/** running check */
+typedef struct gm_async_check {
+    gm_job_t     * job;             /**< job, NULL if the slot is free */
+    pid_t          pid;             /**< pid of the plugin */
+    int            pidfd;           /**< pidfd of the plugin or -1 */
+    int            fd[2];           /**< stdout and stderr pipe, -1 when closed */
+    char         * buf[2];          /**< stdout and stderr output */
+    int            len[2];          /**< length of output */
+    int            size[2];         /**< size of output buffers */
+    int            exited;          /**< plugin has been reaped */
+    int            status;          /**< exit status as returned by waitpid */
+    int            killed;          /**< number of kill attempts after the timeout */
+    struct timeval deadline;        /**< next timeout action */
+} gm_async_check_t;
+
+/** check runner */
+typedef struct gm_async {
+    int                 epfd;       /**< epoll instance */
+    int                 sigfd;      /**< SIGCHLD signalfd, only used without pidfd */
+    int                 max;        /**< number of slots */
+    int                 running;    /**< number of used slots */
+    gm_async_check_t  * checks;     /**< slots */
+    gm_async_done_fn    done;       /**< callback for finished checks */
+    void              * data;       /**< callback data */
+} gm_async_t;
+
+/**
+ * mod_gm_async_create
+ *
+ * create check runner
+ *
+ * @param[in] max  - maximum number of concurrent checks
+ * @param[in] done - called for each finished check
+ * @param[in] data - passed to the callback
+ *
+ * @return check runner or NULL on errors
+ */
+gm_async_t * mod_gm_async_create(int max, gm_async_done_fn done, void * data);
+
+/**
+ * mod_gm_async_free
+ *
+ * kill all running checks and free the runner, the jobs of running
+ * checks are freed without calling the done callback
+ *
+ * @param[in] async - check runner
+ *
+ * @return nothing
+ */
+void mod_gm_async_free(gm_async_t * async);
+
+/**
+ * mod_gm_async_start
+ *
+ * start the command line of the job. If the check cannot be started
+ * the job is finished with an error right away.
+ *
+ * @param[in] async - check runner
+ * @param[in] job   - job to run, owned by the runner until done is called
+ *
+ * @return GM_OK or GM_ERROR if all slots are in use
+ */
+int mod_gm_async_start(gm_async_t * async, gm_job_t * job);
+
+/**
+ * mod_gm_async_watch
+ *
+ * wake up mod_gm_async_wait when this file descriptor becomes readable,
+ * reading from it is up to the caller
+ *
+ * @param[in] async - check runner
+ * @param[in] fd    - file descriptor
+ *
+ * @return GM_OK on success
+ */
+int mod_gm_async_watch(gm_async_t * async, int fd);
+
+/**
+ * mod_gm_async_wait
+ *
+ * wait for plugin output, exits and timeouts and finish checks
+ *
+ * @param[in] async   - check runner
+ * @param[in] timeout - maximum time to wait in milliseconds, -1 waits forever
+ *
+ * @return number of finished checks
+ */
+int mod_gm_async_wait(gm_async_t * async, int timeout);
+
+/**
+ * mod_gm_async_abort
+ *
+ * kill all running checks. Unless the worker got a SIGINT, a failed
+ * result is sent for each of them like the classic worker does. Jobs
+ * are freed without calling the done callback.
+ *
+ * @param[in] async - check runner
+ * @param[in] sig   - signal which caused the abort
+ *
+ * @return nothing
+ */
+void mod_gm_async_abort(gm_async_t * async, int sig);
+
+#endif
+
+/**
+ * @}
+ */
@@ -0,0 +1,63 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief run checks with posix_spawn
+ *
+ * the plugin is started directly from the worker with posix_spawn, which
+ * does not copy the address space of the worker. The plugin becomes the
+ * leader of a new process group, output is read from both pipes at the
+ * same time and the timeout is handled by the caller instead of an alarm
+ * in a forked child.
+ *
+ * @{
+ */
+
+#ifndef MOD_GM_CHECK_SPAWN_H
+#define MOD_GM_CHECK_SPAWN_H
+
+#include "common.h"
+
+#define GM_SPAWN_KILL_WAIT  1000    /**< milliseconds between SIGTERM and SIGKILL */
+
+/**
+ * spawn_check
+ *
+ * run a command and wait till it exits or runs into the timeout
+ *
+ * @param[in] command_line - command line
+ * @param[in] timeout - timeout in seconds
+ * @param[in] env - environment for the plugin, NULL for the worker environment
+ * @param[out] plugin_output - pointer to plugin output
+ * @param[out] plugin_error - pointer to plugin error output
+ * @param[out] timed_out - set to TRUE if the plugin had to be killed
+ *
+ * @return exit status as returned by waitpid or -1 on errors
+ */
+int spawn_check(char * command_line, int timeout, char ** env, char ** plugin_output, char ** plugin_error, int * timed_out);
+
+#endif
+
+/**
+ * @}
+ */
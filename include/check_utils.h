@@ -66,6 +66,18 @@ char *extract_check_result(FILE *fp, int trimmed);
  */
 int parse_command_line(char *cmd, char *argv[GM_LISTSIZE]);
 
+/**
+ * verify_restricted_path
+ *
+ * verify command against the restrict_path option
+ *
+ * @param[in] processed_command - command line
+ * @param[out] ret - error message if the command is not allowed
+ *
+ * @return GM_OK if the command may be executed
+ */
+int verify_restricted_path(char *processed_command, char **ret);
+
 /**
  * run_check
  *
@@ -79,6 +91,18 @@ int parse_command_line(char *cmd, char *argv[GM_LISTSIZE]);
  */
 int run_check(char *processed_command, char **plugin_output, char **plugin_error);
 
+/**
+ *
+ * job_environment
+ *
+ * build the plugin environment from the worker environment and the variables of the job
+ *
+ * @param[in] job - job structure
+ *
+ * @return allocated list of pointers, NULL if the job has no own variables
+ */
+char ** job_environment(gm_job_t * job);
+
 /**
  *
  * execute_safe_command
@@ -93,6 +117,56 @@ int run_check(char *processed_command, char **plugin_output, char **plugin_error
  */
 int execute_safe_command(gm_job_t * exec_job, int fork_exec, char * identifier);
 
+/**
+ *
+ * read_plugin_output
+ *
+ * read stdout and stderr of a plugin at the same time and escape newlines
+ *
+ * @param[in] pid - pid of the plugin, killed when exceeding the limit
+ * @param[in] fd_out - stdout pipe
+ * @param[in] fd_err - stderr pipe
+ * @param[out] plugin_output - pointer to plugin output
+ * @param[out] plugin_error - pointer to plugin error output
+ * @param[in] limit - maximum output size or 0 for no limit
+ *
+ * @return GM_ERROR if the plugin had to be killed
+ */
+int read_plugin_output(pid_t pid, int fd_out, int fd_err, char **plugin_output, char **plugin_error, int limit);
+
+/**
+ *
+ * read_pipes
+ *
+ * read stdout and stderr at the same time until both are closed
+ *
+ * @param[in] pid - pid of the plugin, killed when exceeding the limit
+ * @param[in] fd_out - stdout pipe
+ * @param[in] fd_err - stderr pipe
+ * @param[out] output - pointer to raw output
+ * @param[out] error - pointer to raw error output
+ * @param[in] limit - maximum output size or 0 for no limit
+ *
+ * @return GM_ERROR if the plugin had to be killed
+ */
+int read_pipes(pid_t pid, int fd_out, int fd_err, char **output, char **error, int limit);
+
+/**
+ *
+ * set_plugin_result
+ *
+ * convert the exit status and output of a plugin into the job result
+ *
+ * @param[in] exec_job - job structure
+ * @param[in] return_code - exit status as returned by waitpid
+ * @param[in] plugin_output - stdout of the plugin, will be owned by the job
+ * @param[in] plugin_error - stderr of the plugin, will be owned by the job
+ * @param[in] identifier - current worker identifier
+ *
+ * @return nothing
+ */
+void set_plugin_result(gm_job_t * exec_job, int return_code, char * plugin_output, char * plugin_error, char * identifier);
+
 /**
  *
  * kill_child_checks
@@ -60,6 +60,8 @@
 #define GM_DISABLED                     0
 #define GM_BUFFERSIZE               65536
 #define GM_MAX_OUTPUT            10485760   /* limit plugin output size to 10mb */
+#define GM_JOB_ARENA_SIZE     (4*GM_BUFFERSIZE) /* memory block size of a worker job */
+#define GM_JOB_ENV_SIZE       2                 /* number of environment variables set for a single job */
 #define GM_LISTSIZE                   512
 #define GM_NEBTYPESSIZE                33   /* maximum number of neb types */
 #define GM_MAX_HOST_ADDRESS_LENGTH    256   /* max size of a host address */
@@ -109,11 +111,15 @@
 #define GM_DEFAULT_JOB_MAX_AGE          0      /**< discard jobs older than that         */
 #define GM_DEFAULT_SPAWN_RATE           1      /**< number of spawned worker per seconds */
 #define GM_DEFAULT_WORKER_LOOP_SLEEP    1      /**< sleep in worker main loop */
+#define GM_DEFAULT_BATCH_SIZE         100      /**< jobs per batch submission            */
+#define GM_DEFAULT_BATCH_INTERVAL      10      /**< max delay of batched jobs in ms      */
 
 /* transport modes */
 #define GM_ENCODE_AND_ENCRYPT           1
 #define GM_ENCODE_ONLY                  2
 #define GM_ENCODE_ACCEPT_ALL            3
+#define GM_ENCODE_AND_ENCRYPT_GCM       4
+#define GM_ENCODE_GCM_ACCEPT_ALL        5
 
 /* dump config modes */
 #define GM_WORKER_MODE                  1
@@ -145,7 +151,6 @@
 #define STATE_CRITICAL                  2    /**< core exit code for critical */
 #define STATE_UNKNOWN                   3    /**< core exit code for unknown  */
 
-#define GM_SHM_SIZE                  4096    /**< size of the shared memory segment */
 
 /** options exports structure
  *
@@ -219,6 +224,14 @@ typedef struct mod_gm_opt_struct {
     int            orphan_host_checks;                      /**< generate fake result for orphaned host checks */
     int            orphan_service_checks;                   /**< generate fake result for orphaned service checks */
     int            accept_clear_results;                    /**< accept unencrypted results */
+    int            binary_payload;                          /**< send check jobs in the binary format */
+    char         * binary_queues_list[GM_LISTSIZE];         /**< queues which get binary check jobs, all if empty */
+    int            binary_queues_num;                       /**< number of elements in binary_queues_list */
+    int            batch_submit;                            /**< send jobs from a separate thread in batches */
+    int            batch_submit_size;                       /**< flush when this number of jobs is queued */
+    int            batch_submit_interval;                   /**< flush after this number of milliseconds */
+    int            result_backlog;                          /**< pause result threads when this number of results waits for the core */
+    int            result_backlog_resume;                   /**< resume result threads below this number of waiting results */
 /* worker */
     char         * identifier;                              /**< identifier for this worker */
     char         * pidfile;                                 /**< path to a pidfile */
@@ -230,7 +243,16 @@ typedef struct mod_gm_opt_struct {
     int            fork_on_exec;                            /**< flag to disable additional forks for each job */
     int            idle_timeout;                            /**< number of seconds till a idle worker exits */
     int            max_jobs;                                /**< maximum number of jobs done after a worker exits */
+    int            concurrent_checks;                       /**< number of checks a worker runs at the same time */
+    int            worker_threads;                          /**< number of job threads in each worker */
+    int            spawn_checks;                            /**< start plugins with posix_spawn */
+    int            max_output_size;                         /**< plugins are killed when exceeding this output size */
+    int            zygote;                                  /**< fork workers from a pre-initialized template process */
     int            spawn_rate;                              /**< number of spawned new worker */
+    int            autoscale;                               /**< size worker population by the gearmand queues */
+    int            result_batch;                            /**< send results in multi result jobs */
+    int            result_batch_size;                       /**< send when this number of results is collected */
+    int            result_batch_interval;                   /**< send after this number of milliseconds */
     int            show_error_output;                       /**< optional display the stderr output of plugins */
     int            timeout_return;                          /**< timeout return code */
     int            orphan_return;                           /**< orphan return code */
@@ -290,6 +312,10 @@ typedef struct gm_job_struct {
     struct timeval start_time;          /**< time when the job really started */
     struct timeval finish_time;         /**< time when the job was finished */
     int            has_been_sent;       /**< flag if job has been sent back */
+    char         * payload;             /**< decrypted job data, if set the names, type, queue, command line and long output point into it */
+    int            binary_payload;      /**< job used the binary format, the result is sent back the same way */
+    gm_arena_t   * arena;               /**< if set, the job and all its strings are allocated from this arena */
+    char         * env[GM_JOB_ENV_SIZE+1]; /**< NAME=value pairs added to the plugin environment, NULL terminated */
 } gm_job_t;
 
 
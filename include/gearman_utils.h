@@ -37,6 +37,8 @@
 #include <unistd.h>
 #include <assert.h>
 #include <netinet/in.h>
+#include <fcntl.h>
+#include <poll.h>
 #ifdef LIBGEARMAN_1_0
 #include "libgearman-1.0/gearman.h"
 #else
@@ -53,6 +55,8 @@ int create_client( gm_server_t * server_list[GM_LISTSIZE], gearman_client_st * c
 int create_worker( gm_server_t * server_list[GM_LISTSIZE], gearman_worker_st * worker);
 int add_job_to_queue( gearman_client_st *client, gm_server_t * server_list[GM_LISTSIZE], char * queue, char * uniq, char * data, int priority, int retries, int transport_mode, int send_now );
 int worker_add_function( gearman_worker_st * worker, char * queue, gearman_worker_fn *function);
+int worker_add_function_context( gearman_worker_st * worker, char * queue, gearman_worker_fn *function, void * context);
+void send_result_back_client(gm_job_t * exec_job, gearman_client_st * client, gearman_client_st * client_dup);
 void *dummy( gearman_job_st *, void *, size_t *, gearman_return_t * );
 void free_client(gearman_client_st *client);
 void free_worker(gearman_worker_st *worker);
@@ -96,10 +100,11 @@ typedef struct mod_gm_status_server {
  * @param[out] version - version string from server
  * @param[in] hostname - hostname to connect to
  * @param[in] port - port to connect
+ * @param[in] timeout - max milliseconds for connecting and each read/write
  *
  * @return true on success
  */
-int get_gearman_server_data(mod_gm_server_status_t *stats, char ** message, char **version, char * hostname, int port);
+int get_gearman_server_data(mod_gm_server_status_t *stats, char ** message, char **version, char * hostname, int port, int timeout);
 
 /**
  * send2gearmandadmin
@@ -111,11 +116,12 @@ int get_gearman_server_data(mod_gm_server_status_t *stats, char ** message, char
  * @param[in] port - port to connect
  * @param[out] output - result from gearmand
  * @param[out] error - error message
+ * @param[in] timeout - max milliseconds for connecting and each read/write
  *
  * @return true on success
  */
 
-int send2gearmandadmin(char * cmd, char * hostnam, int port, char ** output, char ** error);
+int send2gearmandadmin(char * cmd, char * hostnam, int port, char ** output, char ** error, int timeout);
 
 
 /**
@@ -127,10 +133,11 @@ int send2gearmandadmin(char * cmd, char * hostnam, int port, char ** output, cha
  * @param[in] port - port to connect
  * @param[out] socket - result socket
  * @param[out] error - error message
+ * @param[in] timeout - max milliseconds for connecting and each read/write
  *
  * @return true on success
  */
-int gm_net_connect (const char *host_name, int port, int *sd, char ** error);
+int gm_net_connect (const char *host_name, int port, int *sd, char ** error, int timeout);
 
 /**
  * free_mod_gm_status_server
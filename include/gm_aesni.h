@@ -0,0 +1,129 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief aes-ni backend for the crypt module
+ *
+ * hardware accelerated aes block functions, used by the crypt module
+ * when the cpu supports the aes instructions. Encrypted data is
+ * identical to the software rijndael implementation.
+ *
+ * @{
+ */
+
+#ifndef MOD_GM_AESNI_H
+#define MOD_GM_AESNI_H
+
+#include <config.h>
+
+#if defined(HAVE_CPUID_H) && defined(HAVE_WMMINTRIN_H) && (defined(__x86_64__) || defined(__i386__))
+#define GM_AESNI 1      /**< aes-ni backend is compiled in */
+#endif
+
+/**
+ * check cpu for aes instructions
+ *
+ * @return true if aes-ni can be used
+ */
+int mod_gm_aesni_available(void);
+
+/**
+ * set round keys from an expanded rijndael encryption key
+ *
+ * @param[in] rk      - expanded encryption key from rijndaelSetupEncrypt()
+ * @param[in] nrounds - number of rounds
+ *
+ * @return nothing
+ */
+void mod_gm_aesni_init(const unsigned long *rk, int nrounds);
+
+/**
+ * encrypt blocks
+ *
+ * @param[out] out - encrypted data
+ * @param[in] in   - data to encrypt
+ * @param[in] size - size of data, multiple of the block size
+ *
+ * @return nothing
+ */
+void mod_gm_aesni_encrypt(unsigned char *out, const unsigned char *in, int size);
+
+/**
+ * decrypt blocks
+ *
+ * @param[out] out - decrypted data
+ * @param[in] in   - data to decrypt
+ * @param[in] size - size of data, multiple of the block size
+ *
+ * @return nothing
+ */
+void mod_gm_aesni_decrypt(unsigned char *out, const unsigned char *in, int size);
+
+/**
+ * check cpu for the instructions used by the gcm functions
+ *
+ * @return true if aes-ni and pclmul can be used
+ */
+int mod_gm_aesni_gcm_available(void);
+
+/**
+ * set gcm key from an expanded rijndael encryption key
+ *
+ * @param[in] rk      - expanded encryption key from rijndaelSetupEncrypt()
+ * @param[in] nrounds - number of rounds
+ * @param[in] h       - hash subkey, the encrypted zero block
+ *
+ * @return nothing
+ */
+void mod_gm_aesni_gcm_init(const unsigned long *rk, int nrounds, const unsigned char *h);
+
+/**
+ * encrypt or decrypt in counter mode with the gcm key
+ *
+ * out may point to in or up to one block before it.
+ *
+ * @param[out] out        - result
+ * @param[in] in          - data
+ * @param[in] size        - size of data, any length
+ * @param[in,out] counter - counter block, last 32bit are incremented per block
+ *
+ * @return nothing
+ */
+void mod_gm_aesni_ctr(unsigned char *out, const unsigned char *in, int size, unsigned char *counter);
+
+/**
+ * update ghash with data
+ *
+ * @param[in,out] hash - current hash value
+ * @param[in] data     - data, a partial last block is zero padded
+ * @param[in] size     - size of data
+ *
+ * @return nothing
+ */
+void mod_gm_aesni_ghash(unsigned char *hash, const unsigned char *data, int size);
+
+#endif
+
+/**
+ * @}
+ */
@@ -4,6 +4,23 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stddef.h>
+
+/* arena allocator, everything is released at once by a reset */
+#define GM_ARENA_ALIGN 16
+
+typedef struct gm_arena_block_struct {
+    struct gm_arena_block_struct * next;
+    size_t size;
+    size_t used;
+} gm_arena_block_t;
+
+typedef struct gm_arena_struct {
+    gm_arena_block_t * first;
+    gm_arena_block_t * current;
+    size_t block_size;
+    void * last;
+} gm_arena_t;
+
 #include <include/utils.h>
 
 void *gm_malloc(size_t size);
@@ -12,5 +29,16 @@ void *gm_calloc(size_t count, size_t size);
 void *gm_strdup(const char *s);
 void *gm_strndup(const char *s, size_t size);
 void gm_asprintf(char **strp, const char *fmt, ...);
+void gm_asprintf_va(char **strp, const char *fmt, va_list ap);
 #define gm_free(ptr) do { if(ptr) { free(ptr); ptr = NULL; } } while(0)
+
+gm_arena_t *gm_arena_create(size_t block_size);
+void *gm_arena_alloc(gm_arena_t *arena, size_t size);
+void *gm_arena_realloc(gm_arena_t *arena, void *ptr, size_t old_size, size_t size);
+void *gm_arena_strdup(gm_arena_t *arena, const char *s);
+void *gm_arena_strndup(gm_arena_t *arena, const char *s, size_t size);
+void gm_arena_asprintf(gm_arena_t *arena, char **strp, const char *fmt, ...);
+void gm_arena_asprintf_va(gm_arena_t *arena, char **strp, const char *fmt, va_list ap);
+void gm_arena_reset(gm_arena_t *arena);
+void gm_arena_free(gm_arena_t *arena);
 #endif
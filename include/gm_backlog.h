@@ -0,0 +1,114 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief pause result threads while too many results wait for the core
+ *
+ * result threads count the results they add, the core counts the results
+ * it took. Result threads stop taking new results when the limit is
+ * reached and sleep until the core drained the backlog to the resume
+ * mark. Pausing and resuming happen under a mutex, so the start of a
+ * pause is always set before another thread can end it.
+ *
+ * @{
+ */
+
+#ifndef MOD_GM_BACKLOG_H
+#define MOD_GM_BACKLOG_H
+
+#include <pthread.h>
+#include <sys/time.h>
+
+/** results waiting for the core */
+typedef struct gm_backlog {
+    int             pending;            /**< number of waiting results */
+    int             throttled;          /**< set while result threads are paused */
+    struct timeval  throttled_since;    /**< start of the current pause */
+    unsigned long   throttled_num;      /**< number of pauses */
+    unsigned long   throttled_ms;       /**< total duration of all finished pauses */
+    pthread_mutex_t mutex;              /**< serializes pausing and resuming */
+    pthread_cond_t  resumed;            /**< signalled when a pause ends */
+} gm_backlog_t;
+
+/**
+ * initialize backlog
+ *
+ * @param[in] backlog - backlog to initialize
+ *
+ * @return nothing
+ */
+void mod_gm_backlog_init(gm_backlog_t * backlog);
+
+/**
+ * change number of waiting results, thread safe
+ *
+ * @param[in] backlog - backlog
+ * @param[in] num     - number of added results, negative for taken results
+ *
+ * @return nothing
+ */
+void mod_gm_backlog_add(gm_backlog_t * backlog, int num);
+
+/**
+ * check if result threads should pause, thread safe
+ *
+ * @param[in] backlog - backlog
+ * @param[in] limit   - pause when this number of results is waiting, 0 disables pausing
+ * @param[in] resume  - resume when no more than this number of results is waiting
+ *
+ * @return TRUE while result threads should pause
+ */
+int mod_gm_backlog_full(gm_backlog_t * backlog, int limit, int resume);
+
+/**
+ * wait while the backlog is full, thread safe
+ *
+ * blocks until mod_gm_backlog_take() drained the backlog to the resume
+ * mark. The thread may be cancelled while it waits.
+ *
+ * @param[in] backlog - backlog
+ * @param[in] limit   - pause when this number of results is waiting, 0 disables pausing
+ * @param[in] resume  - resume when no more than this number of results is waiting
+ *
+ * @return TRUE if the caller had to wait
+ */
+int mod_gm_backlog_wait(gm_backlog_t * backlog, int limit, int resume);
+
+/**
+ * count results taken by the core and wake up paused threads, thread safe
+ *
+ * takes the mutex, so the core should count all results of a run at once
+ *
+ * @param[in] backlog - backlog
+ * @param[in] num     - number of taken results
+ * @param[in] resume  - resume when no more than this number of results is waiting
+ *
+ * @return nothing
+ */
+void mod_gm_backlog_take(gm_backlog_t * backlog, int num, int resume);
+
+/**
+ * @}
+ */
+
+#endif
@@ -36,6 +36,12 @@
 #define KEYBITS     256     /**< key size */
 #define BLOCKSIZE    16     /**< block size for encryption */
 
+#define GM_AES_BACKEND_RIJNDAEL 0   /**< software aes implementation */
+#define GM_AES_BACKEND_AESNI    1   /**< aes-ni cpu instructions */
+
+#define GM_GCM_NONCE_LEN 12     /**< size of the gcm nonce */
+#define GM_GCM_TAG_LEN   16     /**< size of the gcm authentication tag */
+
 /**
  * initialize crypto module
  *
@@ -45,26 +51,94 @@
  */
 void mod_gm_aes_init(char * password);
 
+/**
+ * select aes implementation, falls back to rijndael if
+ * aes-ni is not supported by this cpu
+ *
+ * @param[in] backend - GM_AES_BACKEND_RIJNDAEL or GM_AES_BACKEND_AESNI
+ *
+ * @return backend in use
+ */
+int mod_gm_aes_set_backend(int backend);
+
 /**
  * encrypt text
  *
  * @param[out] encrypted - pointer to encrypted text
  * @param[in] text       - text which should be encrypted
+ * @param[in] size       - size of text
  *
  * @return size of encrypted text
  */
-int mod_gm_aes_encrypt(unsigned char ** encrypted, char * text);
+int mod_gm_aes_encrypt(unsigned char ** encrypted, char * text, int size);
 
 /**
  * decrypt text
  *
+ * decrypted must point to a buffer of at least size+1 bytes,
+ * it may point to the encrypted data to decrypt in place
+ *
  * @param[out] decrypted - pointer to decrypted text
  * @param[in] encrypted  - text which should be decrypted
  * @param[in] size       - size of encrypted text
  *
+ * @return length of decrypted text
+ */
+int mod_gm_aes_decrypt(char ** decrypted, unsigned char * encrypted, int size);
+
+/**
+ * set the aes-256-gcm key and precompute the hash subkey
+ *
+ * @param[in] gcm_key - 32 byte key
+ *
  * @return nothing
  */
-void mod_gm_aes_decrypt(char ** decrypted, unsigned char * encrypted, int size);
+void mod_gm_aes_gcm_init(const unsigned char * gcm_key);
+
+/**
+ * aes-256-gcm without additional authenticated data
+ *
+ * out may be the same as in or start before it, so the
+ * ciphertext can be decrypted to the front of its buffer.
+ *
+ * @param[out] out    - resulting text
+ * @param[in] in      - text to en/decrypt
+ * @param[in] size    - size of text
+ * @param[in] nonce   - 12 byte nonce
+ * @param[out] tag    - 16 byte authentication tag of the ciphertext
+ * @param[in] decrypt - true if in is the ciphertext
+ *
+ * @return nothing
+ */
+void mod_gm_aes_gcm(unsigned char * out, const unsigned char * in, int size, const unsigned char * nonce, unsigned char * tag, int decrypt);
+
+/**
+ * encrypt text with a random nonce
+ *
+ * no padding is added, the result is nonce, ciphertext and tag
+ *
+ * @param[out] encrypted - pointer to encrypted text
+ * @param[in] text       - text which should be encrypted
+ * @param[in] size       - size of text
+ *
+ * @return size of encrypted text
+ */
+int mod_gm_aes_gcm_encrypt(unsigned char ** encrypted, char * text, int size);
+
+/**
+ * verify and decrypt text
+ *
+ * text must point to a buffer of at least size bytes, it may
+ * point to the encrypted data to decrypt in place.
+ *
+ * @param[out] text     - pointer to decrypted text
+ * @param[in] encrypted - nonce, ciphertext and tag
+ * @param[in] size      - size of encrypted data
+ *
+ * @return length of decrypted text, 0 and an empty text if
+ *         the message has been tampered with
+ */
+int mod_gm_aes_gcm_decrypt(char ** text, unsigned char * encrypted, int size);
 
 /*
  * @}
@@ -0,0 +1,351 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief key=value payload parser
+ *
+ * tokenizes decrypted job and result payloads in place. Values are
+ * handed out as views into the payload buffer, so the buffer must be
+ * kept until the values are no longer used.
+ *
+ * Besides the newline separated text format, payloads may use a binary
+ * format. It starts with GM_PAYLOAD_MAGIC, the format version and the
+ * big endian 32bit length of the fields. Each field consists of the key
+ * number, the varint encoded value length and the value. Strings are
+ * sent raw and include their trailing null byte, numbers are zigzag
+ * varints and times are microseconds.
+ *
+ * Workers may send several results in one job. Such a multi result
+ * payload is a binary payload which contains one GM_KEY_RESULT field per
+ * result, each holding a complete binary result payload.
+ *
+ * @{
+ */
+
+#ifndef MOD_GM_PAYLOAD_H
+#define MOD_GM_PAYLOAD_H
+
+#include <stddef.h>
+#include <sys/time.h>
+
+#define GM_PAYLOAD_MAGIC        "\x01gm"   /**< marker for binary payloads */
+#define GM_PAYLOAD_MAGIC_LEN    3           /**< length of the marker */
+#define GM_PAYLOAD_VERSION      1           /**< binary format version */
+#define GM_PAYLOAD_HEADER_LEN   8           /**< marker, version and length */
+
+/** keys used in job and result payloads, numbers are used in the binary format, append only */
+enum gm_payload_key {
+    GM_KEY_UNKNOWN = -1,
+    GM_KEY_HOST_NAME,
+    GM_KEY_SERVICE_DESCRIPTION,
+    GM_KEY_TYPE,
+    GM_KEY_RESULT_QUEUE,
+    GM_KEY_COMMAND_LINE,
+    GM_KEY_PLUGIN_OUTPUT,
+    GM_KEY_LONG_PLUGIN_OUTPUT,
+    GM_KEY_OUTPUT,
+    GM_KEY_SOURCE,
+    GM_KEY_CHECK_OPTIONS,
+    GM_KEY_SCHEDULED_CHECK,
+    GM_KEY_RESCHEDULE_CHECK,
+    GM_KEY_EXITED_OK,
+    GM_KEY_EARLY_TIMEOUT,
+    GM_KEY_RETURN_CODE,
+    GM_KEY_LATENCY,
+    GM_KEY_TIMEOUT,
+    GM_KEY_NEXT_CHECK,
+    GM_KEY_CORE_TIME,
+    GM_KEY_CORE_START_TIME,
+    GM_KEY_START_TIME,
+    GM_KEY_FINISH_TIME,
+    GM_KEY_RESULT,
+    GM_PAYLOAD_KEYS          /**< number of known keys */
+};
+
+/** view into the payload buffer */
+typedef struct gm_strview_struct {
+    char         * ptr;                         /**< start of the value, nul terminated in place, NULL if not set */
+    size_t         len;                         /**< length of the value */
+} gm_strview_t;
+
+/** parsed payload */
+typedef struct gm_payload_struct {
+    gm_strview_t   field[GM_PAYLOAD_KEYS];      /**< values by key, use the accessors for numbers */
+    long long      num[GM_PAYLOAD_KEYS];        /**< decoded numbers of binary payloads */
+    int            binary;                      /**< flag whether payload used the binary format */
+    int            lines;                       /**< number of lines with a known key and a value */
+    int            stop_key;                    /**< key of the line without value which ended parsing */
+    char         * stop_value;                  /**< value of that line, NULL if it had no '=' */
+} gm_payload_t;
+
+/** binary payload writer */
+typedef struct gm_payload_writer_struct {
+    char         * buf;                         /**< target buffer */
+    size_t         size;                        /**< size of target buffer */
+    size_t         len;                         /**< bytes written so far */
+} gm_payload_writer_t;
+
+/**
+ * mod_gm_payload_key
+ *
+ * map a key name to its enum value
+ *
+ * @param[in] key - key name, does not need to be nul terminated
+ * @param[in] len - length of key name
+ *
+ * @return key or GM_KEY_UNKNOWN
+ */
+int mod_gm_payload_key(const char *key, size_t len);
+
+/**
+ * mod_gm_parse_payload
+ *
+ * split a payload into key=value lines in place. Parsing stops at the
+ * first line without value, like the strsep loops did before. Later
+ * lines overwrite earlier ones with the same key. Text payloads must be
+ * followed by a null byte at data[size], nothing is written there.
+ *
+ * @param[out] payload - parsed fields
+ * @param[in] data     - payload buffer, will be modified
+ * @param[in] size     - size of payload
+ *
+ * @return number of lines with a known key and a value
+ */
+int mod_gm_parse_payload(gm_payload_t *payload, char *data, size_t size);
+
+/**
+ * mod_gm_payload_next
+ *
+ * iterate over the fields with the given key of a binary payload, used
+ * for keys which occur more than once like GM_KEY_RESULT
+ *
+ * @param[in] data     - binary payload
+ * @param[in] size     - size of payload
+ * @param[in] key      - key to look for
+ * @param[in,out] pos  - position of the next field, start with 0
+ * @param[out] value   - view of the value
+ *
+ * @return true if a field was found
+ */
+int mod_gm_payload_next(char *data, size_t size, int key, size_t *pos, gm_strview_t *value);
+
+/**
+ * mod_gm_payload_unescape
+ *
+ * replace escaped newlines and backslashes in place
+ *
+ * @param[in] value - value to unescape, will be modified
+ * @param[in] len   - length of value
+ *
+ * @return new length of value
+ */
+size_t mod_gm_payload_unescape(char *value, size_t len);
+
+/**
+ * mod_gm_payload_is_binary
+ *
+ * @param[in] data - payload
+ * @param[in] size - size of payload
+ *
+ * @return true if the payload uses the binary format
+ */
+int mod_gm_payload_is_binary(const char *data, size_t size);
+
+/**
+ * mod_gm_payload_is_complete
+ *
+ * stricter than mod_gm_payload_is_binary(), used to tell unencrypted
+ * binary payloads from encrypted data which starts with the marker
+ *
+ * @param[in] data - payload
+ * @param[in] size - size of payload
+ *
+ * @return true if the payload uses the current binary format version and its length is exactly size
+ */
+int mod_gm_payload_is_complete(const char *data, size_t size);
+
+/**
+ * mod_gm_payload_size
+ *
+ * get the length of a text or binary payload
+ *
+ * @param[in] data - payload
+ * @param[in] max  - maximum length
+ *
+ * @return length of payload, at most max
+ */
+size_t mod_gm_payload_size(const char *data, size_t max);
+
+/**
+ * mod_gm_payload_has
+ *
+ * @param[in] payload - parsed payload
+ * @param[in] key     - key to check
+ *
+ * @return true if the key is set
+ */
+int mod_gm_payload_has(gm_payload_t *payload, int key);
+
+/**
+ * mod_gm_payload_int
+ *
+ * @param[in] payload - parsed payload
+ * @param[in] key     - key to get
+ * @param[in] def     - default if key is not set
+ *
+ * @return integer value
+ */
+int mod_gm_payload_int(gm_payload_t *payload, int key, int def);
+
+/**
+ * mod_gm_payload_double
+ *
+ * @param[in] payload - parsed payload
+ * @param[in] key     - key to get, binary payloads store it in microseconds
+ * @param[in] def     - default if key is not set
+ *
+ * @return double value
+ */
+double mod_gm_payload_double(gm_payload_t *payload, int key, double def);
+
+/**
+ * mod_gm_payload_timeval
+ *
+ * @param[in] payload - parsed payload
+ * @param[in] key     - key to get
+ * @param[out] tv     - time value, unchanged if key is not set
+ *
+ * @return true if the key is set
+ */
+int mod_gm_payload_timeval(gm_payload_t *payload, int key, struct timeval *tv);
+
+/**
+ * mod_gm_payload_begin
+ *
+ * start writing a binary payload
+ *
+ * @param[out] writer - writer to initialize
+ * @param[in] buf     - target buffer
+ * @param[in] size    - size of target buffer, at least GM_PAYLOAD_HEADER_LEN
+ *
+ * @return nothing
+ */
+void mod_gm_payload_begin(gm_payload_writer_t *writer, char *buf, size_t size);
+
+/**
+ * mod_gm_payload_add_strn
+ *
+ * add a string field, truncated if the buffer is too small
+ *
+ * @param[in] writer - writer
+ * @param[in] key    - key of field
+ * @param[in] value  - string value
+ * @param[in] len    - length of value
+ *
+ * @return nothing
+ */
+void mod_gm_payload_add_strn(gm_payload_writer_t *writer, int key, const char *value, size_t len);
+
+/**
+ * mod_gm_payload_add_str
+ *
+ * add a null terminated string field, NULL values are skipped
+ *
+ * @param[in] writer - writer
+ * @param[in] key    - key of field
+ * @param[in] value  - string value
+ *
+ * @return nothing
+ */
+void mod_gm_payload_add_str(gm_payload_writer_t *writer, int key, const char *value);
+
+/**
+ * mod_gm_payload_add_raw
+ *
+ * append fields which have been encoded before, e.g. the static
+ * part of a job. Skipped if the buffer is too small.
+ *
+ * @param[in] writer - writer
+ * @param[in] data   - encoded fields without payload header
+ * @param[in] len    - length of data
+ *
+ * @return nothing
+ */
+void mod_gm_payload_add_raw(gm_payload_writer_t *writer, const char *data, size_t len);
+
+/**
+ * mod_gm_payload_add_payload
+ *
+ * add a field which holds another binary payload
+ *
+ * @param[in] writer - writer
+ * @param[in] key    - key of field
+ * @param[in] data   - binary payload
+ * @param[in] len    - length of data
+ *
+ * @return true if the field has been added, false if the buffer is too small
+ */
+int mod_gm_payload_add_payload(gm_payload_writer_t *writer, int key, const char *data, size_t len);
+
+/**
+ * mod_gm_payload_add_int
+ *
+ * add a number field
+ *
+ * @param[in] writer - writer
+ * @param[in] key    - key of field
+ * @param[in] value  - number
+ *
+ * @return nothing
+ */
+void mod_gm_payload_add_int(gm_payload_writer_t *writer, int key, long long value);
+
+/**
+ * mod_gm_payload_add_timeval
+ *
+ * add a time field in microseconds
+ *
+ * @param[in] writer - writer
+ * @param[in] key    - key of field
+ * @param[in] tv     - time value
+ *
+ * @return nothing
+ */
+void mod_gm_payload_add_timeval(gm_payload_writer_t *writer, int key, struct timeval *tv);
+
+/**
+ * mod_gm_payload_end
+ *
+ * finish binary payload, the buffer is null terminated if space is left
+ *
+ * @param[in] writer - writer
+ *
+ * @return length of payload
+ */
+size_t mod_gm_payload_end(gm_payload_writer_t *writer);
+
+#endif
+
+/**
+ * @}
+ */
@@ -0,0 +1,125 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief thread aware pool of fixed size objects
+ *
+ * objects are allocated in chunks and never given back to the system
+ * before the pool is destroyed. Every thread keeps a small cache of free
+ * objects, so the shared free list is only locked once per batch of
+ * objects, no matter if a thread only takes objects from the pool or
+ * only puts them back.
+ *
+ * @{
+ */
+
+#ifndef MOD_GM_POOL_H
+#define MOD_GM_POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define GM_POOL_CHUNK_SIZE  64  /**< objects allocated at once */
+#define GM_POOL_BATCH_SIZE  32  /**< objects moved between a thread cache and the pool at once */
+
+/** free object, the link is stored in front of the object */
+typedef struct gm_pool_item {
+    struct gm_pool_item * next;     /**< next free object */
+} gm_pool_item_t;
+
+/** per thread cache of free objects */
+typedef struct gm_pool_cache {
+    gm_pool_item_t * head;          /**< free objects of this thread */
+    int              num;           /**< number of cached objects */
+} gm_pool_cache_t;
+
+/** object pool */
+typedef struct gm_pool {
+    size_t           size;          /**< slot size including the link */
+    pthread_mutex_t  lock;          /**< protects the fields below */
+    gm_pool_item_t * free;          /**< shared free objects */
+    int              free_num;      /**< number of shared free objects */
+    void           * chunks;        /**< allocated chunks */
+    unsigned long    allocs;        /**< number of heap allocations */
+    unsigned long    objects;       /**< number of allocated objects */
+    void          (* destroy)(void *); /**< called for every object when the pool is destroyed */
+} gm_pool_t;
+
+/**
+ * initialize pool
+ *
+ * @param[in] pool    - pool to initialize
+ * @param[in] size    - object size
+ * @param[in] destroy - called for each object by mod_gm_pool_destroy(), may be NULL
+ *
+ * @return nothing
+ */
+void mod_gm_pool_init(gm_pool_t * pool, size_t size, void (*destroy)(void *));
+
+/**
+ * free all objects of the pool, including the ones still in use
+ *
+ * @param[in] pool - pool to destroy
+ *
+ * @return nothing
+ */
+void mod_gm_pool_destroy(gm_pool_t * pool);
+
+/**
+ * take object from the pool
+ *
+ * new objects are zeroed, recycled objects keep their last content.
+ *
+ * @param[in] pool  - pool
+ * @param[in] cache - cache of the calling thread or NULL
+ *
+ * @return object
+ */
+void * mod_gm_pool_get(gm_pool_t * pool, gm_pool_cache_t * cache);
+
+/**
+ * put object back into the pool
+ *
+ * @param[in] pool  - pool
+ * @param[in] cache - cache of the calling thread or NULL
+ * @param[in] obj   - object from mod_gm_pool_get()
+ *
+ * @return nothing
+ */
+void mod_gm_pool_put(gm_pool_t * pool, gm_pool_cache_t * cache, void * obj);
+
+/**
+ * move all objects of a thread cache back into the pool
+ *
+ * @param[in] pool  - pool
+ * @param[in] cache - cache to empty
+ *
+ * @return nothing
+ */
+void mod_gm_pool_flush(gm_pool_t * pool, gm_pool_cache_t * cache);
+
+/**
+ * @}
+ */
+
+#endif
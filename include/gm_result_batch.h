@@ -0,0 +1,87 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief batched result submission of the worker
+ *
+ * finished checks are collected per result queue and sent by a separate
+ * thread as one multi result job. A batch is sent when result_batch_size
+ * results are collected or the first result waited result_batch_interval
+ * milliseconds. Results are always encoded in the binary format.
+ *
+ * @{
+ */
+
+#ifndef MOD_GM_RESULT_BATCH_H
+#define MOD_GM_RESULT_BATCH_H
+
+#include <sys/time.h>
+#include "common.h"
+#include "gm_payload.h"
+
+/** collected results of one result queue */
+typedef struct gm_result_batch {
+    char                   * queue;         /**< result queue */
+    gm_payload_writer_t      writer;        /**< multi result payload */
+    char                   * spare;         /**< buffer for the next payload while one is sent */
+    size_t                   spare_size;    /**< size of the spare buffer */
+    int                      num;           /**< number of collected results */
+    struct timeval           first;         /**< time of the first collected result */
+    struct gm_result_batch * next;          /**< batch of the next result queue */
+} gm_result_batch_t;
+
+/**
+ * start the sender thread
+ *
+ * @param[in] opt - options with server list and batch settings
+ *
+ * @return GM_OK on success, GM_ERROR otherwise
+ */
+int mod_gm_result_batch_start(mod_gm_opt_t * opt);
+
+/**
+ * add result to the batch of its result queue
+ *
+ * may be called from any thread of the process which started the
+ * sender. Blocks while the batch is full and still being sent.
+ *
+ * @param[in] queue - result queue
+ * @param[in] data  - binary result payload
+ * @param[in] len   - length of the payload
+ *
+ * @return GM_OK if added, GM_ERROR if the result must be sent directly
+ */
+int mod_gm_result_batch_add(const char * queue, const char * data, size_t len);
+
+/**
+ * send all collected results and stop the sender thread
+ *
+ * @return nothing
+ */
+void mod_gm_result_batch_stop(void);
+
+/**
+ * @}
+ */
+
+#endif
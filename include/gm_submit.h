@@ -0,0 +1,160 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief batched job submission
+ *
+ * jobs are put into a single producer, single consumer ring by the
+ * core thread and sent to gearmand by a separate sender thread. The
+ * sender flushes when batch_submit_size jobs are queued or the oldest
+ * queued job waited batch_submit_interval milliseconds. Jobs gearmand
+ * did not accept are handed back to the core thread through a second
+ * ring, see mod_gm_submit_failed().
+ *
+ * @{
+ */
+
+#ifndef MOD_GM_SUBMIT_H
+#define MOD_GM_SUBMIT_H
+
+#include "common.h"
+
+#define GM_SUBMIT_RING_SIZE 8192    /**< number of jobs the ring can hold, must be a power of two */
+
+/** lock free single producer, single consumer ring */
+typedef struct gm_ring {
+    void        ** slots;   /**< queued elements */
+    unsigned int   size;    /**< number of slots, power of two */
+    unsigned int   head;    /**< next slot to read, only written by the consumer */
+    unsigned int   tail;    /**< next slot to write, only written by the producer */
+} gm_ring_t;
+
+/** queued job, strings are stored behind the structure */
+typedef struct gm_submit_job {
+    char         * queue;       /**< target queue */
+    char         * uniq;        /**< uniq key or NULL */
+    char         * data;        /**< unencrypted payload */
+    int            priority;    /**< job priority */
+    int            type;        /**< caller defined type of object */
+    void         * object;      /**< caller defined object, handed back if the job fails */
+} gm_submit_job_t;
+
+/**
+ * create ring
+ *
+ * @param[in] size - number of slots, must be a power of two
+ *
+ * @return new ring
+ */
+gm_ring_t * mod_gm_ring_create(unsigned int size);
+
+/**
+ * free ring, elements still queued are not freed
+ *
+ * @param[in] ring - ring to free
+ *
+ * @return nothing
+ */
+void mod_gm_ring_free(gm_ring_t * ring);
+
+/**
+ * append element, must only be called from the producer thread
+ *
+ * @param[in] ring - ring
+ * @param[in] elem - element to append
+ *
+ * @return number of queued elements including this one, 0 if the ring is full
+ */
+unsigned int mod_gm_ring_push(gm_ring_t * ring, void * elem);
+
+/**
+ * remove oldest element, must only be called from the consumer thread
+ *
+ * @param[in] ring - ring
+ *
+ * @return element or NULL if the ring is empty
+ */
+void * mod_gm_ring_pop(gm_ring_t * ring);
+
+/**
+ * number of queued elements
+ *
+ * @param[in] ring - ring
+ *
+ * @return number of elements
+ */
+unsigned int mod_gm_ring_count(gm_ring_t * ring);
+
+/**
+ * start the sender thread
+ *
+ * @param[in] opt - options with server list and batch settings
+ *
+ * @return GM_OK on success, GM_ERROR otherwise
+ */
+int mod_gm_submit_start(mod_gm_opt_t * opt);
+
+/**
+ * queue job for the sender thread
+ *
+ * must only be called from a single thread. Queue, uniq and data
+ * are copied, so the caller may reuse its buffers. A job counts as
+ * sent only once gearmand accepted it. If it could not be sent, type
+ * and object are handed back by mod_gm_submit_failed(). Jobs without
+ * object are dropped.
+ *
+ * @param[in] queue    - target queue
+ * @param[in] uniq     - uniq key or NULL
+ * @param[in] data     - unencrypted payload
+ * @param[in] priority - job priority
+ * @param[in] type     - caller defined type of object
+ * @param[in] object   - caller defined object or NULL
+ *
+ * @return GM_OK if queued, GM_ERROR if the sender is not running or the ring is full
+ */
+int mod_gm_submit_job(char * queue, char * uniq, char * data, int priority, int type, void * object);
+
+/**
+ * take back a job gearmand did not accept
+ *
+ * must only be called from the thread which queues the jobs
+ *
+ * @param[out] type   - type of object as passed to mod_gm_submit_job()
+ * @param[out] object - object as passed to mod_gm_submit_job()
+ *
+ * @return TRUE if a failed job was returned, FALSE if there is none
+ */
+int mod_gm_submit_failed(int * type, void ** object);
+
+/**
+ * send all queued jobs and stop the sender thread
+ *
+ * @return nothing
+ */
+void mod_gm_submit_stop(void);
+
+/**
+ * @}
+ */
+
+#endif
@@ -0,0 +1,121 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief wake up the core when new results arrive
+ *
+ * result threads signal the core through a pipe which is watched by the
+ * event loop of the core. Only the first result after the core emptied the
+ * result list writes into the pipe, all following results are picked up by
+ * the same wake up. The latency histogram records how long results waited
+ * before the core processed them.
+ *
+ * @{
+ */
+
+#ifndef MOD_GM_WAKEUP_H
+#define MOD_GM_WAKEUP_H
+
+#include <sys/time.h>
+
+#define GM_HISTOGRAM_BUCKETS    16  /**< bucket n counts latencies below 2^n ms, the last one all others */
+
+/** wake up pipe */
+typedef struct gm_wakeup {
+    int     fd[2];                  /**< read and write end of the pipe */
+    int     pending;                /**< set while a wake up is waiting to be handled */
+    unsigned long signals;          /**< number of written wake ups */
+} gm_wakeup_t;
+
+/** latency histogram */
+typedef struct gm_histogram {
+    unsigned long   bucket[GM_HISTOGRAM_BUCKETS];   /**< number of values per bucket */
+    unsigned long   count;                          /**< number of values */
+    double          sum;                            /**< sum of all values in ms */
+    double          max;                            /**< highest value in ms */
+} gm_histogram_t;
+
+/**
+ * create wake up pipe, both ends are non blocking
+ *
+ * @param[in] wakeup - wake up to initialize
+ *
+ * @return GM_OK on success, GM_ERROR otherwise
+ */
+int mod_gm_wakeup_init(gm_wakeup_t * wakeup);
+
+/**
+ * wake up the reader unless a wake up is pending already, thread safe
+ *
+ * @param[in] wakeup - wake up pipe
+ *
+ * @return nothing
+ */
+void mod_gm_wakeup_signal(gm_wakeup_t * wakeup);
+
+/**
+ * empty the pipe and reset the pending flag, must be called
+ * before taking the signaled data
+ *
+ * @param[in] wakeup - wake up pipe
+ *
+ * @return nothing
+ */
+void mod_gm_wakeup_clear(gm_wakeup_t * wakeup);
+
+/**
+ * close wake up pipe
+ *
+ * @param[in] wakeup - wake up pipe
+ *
+ * @return nothing
+ */
+void mod_gm_wakeup_free(gm_wakeup_t * wakeup);
+
+/**
+ * add latency between two timestamps to histogram
+ *
+ * @param[in] hist  - histogram
+ * @param[in] start - start time
+ * @param[in] end   - end time
+ *
+ * @return nothing
+ */
+void mod_gm_histogram_add(gm_histogram_t * hist, struct timeval * start, struct timeval * end);
+
+/**
+ * log histogram and reset it
+ *
+ * @param[in] hist  - histogram
+ * @param[in] level - log level
+ * @param[in] name  - name of the histogram
+ *
+ * @return nothing
+ */
+void mod_gm_histogram_log(gm_histogram_t * hist, int level, const char * name);
+
+/**
+ * @}
+ */
+
+#endif
@@ -106,6 +106,62 @@ int nebmodule_deinit( int flags, int reason );
  */
 void mod_gm_add_result_to_list(check_result * newcheckresult);
 
+/** wait while too many results wait for the core
+ *
+ * pauses when result_backlog results wait for the core and
+ * sleeps till the core drained them to result_backlog_resume results
+ *
+ * @return TRUE if the result thread had to wait
+ */
+int mod_gm_result_backlog_wait(void);
+
+/** get a new check result
+ *
+ * with naemon and nagios 4 results come from a pool and must only be
+ * released by passing them to mod_gm_add_result_to_list() or
+ * mod_gm_free_result(). Strings must be set with mod_gm_result_strdup()
+ * or mod_gm_result_strndup().
+ *
+ * @return uninitialized check result
+ */
+check_result * mod_gm_new_result(void);
+
+/** copy string into the memory of a check result
+ *
+ * @param[in] cr  - check result from mod_gm_new_result()
+ * @param[in] str - string to copy
+ *
+ * @return copy of the string, freed along with the check result
+ */
+char * mod_gm_result_strdup(check_result * cr, const char * str);
+
+/** copy at most len bytes of a string into the memory of a check result
+ *
+ * @param[in] cr  - check result from mod_gm_new_result()
+ * @param[in] str - string to copy
+ * @param[in] len - maximum length
+ *
+ * @return copy of the string, freed along with the check result
+ */
+char * mod_gm_result_strndup(check_result * cr, const char * str, size_t len);
+
+/** free check result which has not been added to the result list
+ *
+ * @param[in] cr - check result from mod_gm_new_result()
+ *
+ * @return nothing
+ */
+void mod_gm_free_result(check_result * cr);
+
+/** move the cached results of the calling thread back into the pool
+ *
+ * must be called by every thread which took or freed results before
+ * it exits
+ *
+ * @return nothing
+ */
+void mod_gm_flush_results(void);
+
 /** wraps the nm_log / write_to_all_logs core logger
  *
  * @param[in] type - type of the log event
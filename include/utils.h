@@ -91,16 +91,48 @@ void mod_gm_crypt_init(char * key);
  */
 int mod_gm_encrypt(char ** encrypted, char * text, int mode);
 
+/**
+ * mod_gm_encrypt_len
+ *
+ * same as mod_gm_encrypt but for text of given length, which may
+ * contain null bytes like binary payloads do
+ *
+ * @param[out] encrypted - pointer to encrypted text
+ * @param[in] text - text to encrypt
+ * @param[in] size - length of text
+ * @param[in] mode - do only base64 encoding or encryption too
+ *
+ * @return length of encrypted text
+ */
+int mod_gm_encrypt_len(char ** encrypted, char * text, int size, int mode);
+
 /**
  * mod_gm_decrypt
  *
+ * decrypted must point to a buffer of at least strlen(text)+1 bytes
+ *
+ * @param[out] decrypted - pointer to decrypted text
+ * @param[in] text - text to decrypt
+ * @param[in] mode - do only base64 decoding or decryption too
+ *
+ * @return length of decrypted text
+ */
+int mod_gm_decrypt(char ** decrypted, char * text, int mode);
+
+/**
+ * mod_gm_decrypt_len
+ *
+ * same as mod_gm_decrypt but for text which is not nul terminated,
+ * decrypted must point to a buffer of at least size+1 bytes
+ *
  * @param[out] decrypted - pointer to decrypted text
  * @param[in] text - text to decrypt
+ * @param[in] size - length of text
  * @param[in] mode - do only base64 decoding or decryption too
  *
- * @return decrypted text
+ * @return length of decrypted text, 0 if the message failed authentication
  */
-void mod_gm_decrypt(char ** decrypted, char * text, int mode);
+int mod_gm_decrypt_len(char ** decrypted, const char * text, int size, int mode);
 
 /**
  * file_exists
@@ -310,6 +342,87 @@ int set_default_job(gm_job_t *job, mod_gm_opt_t *mod_gm_opt);
  */
 int free_job(gm_job_t *job);
 
+/**
+ *
+ * create_arena_job
+ *
+ * allocate a job with defaults from the given arena, the job owns the arena
+ *
+ * @param[in] arena - arena for the job and its strings
+ * @param[in] mod_gm_opt - options structure
+ *
+ * @return new job
+ */
+gm_job_t * create_arena_job(gm_arena_t *arena, mod_gm_opt_t *mod_gm_opt);
+
+/**
+ *
+ * job_alloc
+ *
+ * allocate memory which lives as long as the job
+ *
+ * @param[in] job - job structure
+ * @param[in] size - number of bytes
+ *
+ * @return allocated memory
+ */
+void * job_alloc(gm_job_t *job, size_t size);
+
+/**
+ *
+ * job_release
+ *
+ * release memory from job_alloc, memory from the arena is released with the job
+ *
+ * @param[in] job - job structure
+ * @param[in] ptr - memory to release
+ *
+ * @return nothing
+ */
+void job_release(gm_job_t *job, void *ptr);
+
+/**
+ *
+ * set_job_string
+ *
+ * replace a string of the job with a formatted string
+ *
+ * @param[in] job - job structure
+ * @param[out] field - string field of the job
+ * @param[in] fmt - format string
+ *
+ * @return nothing
+ */
+void set_job_string(gm_job_t *job, char **field, const char *fmt, ...);
+
+/**
+ *
+ * set_job_buffer
+ *
+ * replace a string of the job with an allocated buffer, takes ownership of the buffer
+ *
+ * @param[in] job - job structure
+ * @param[out] field - string field of the job
+ * @param[in] buffer - allocated string
+ *
+ * @return nothing
+ */
+void set_job_buffer(gm_job_t *job, char **field, char *buffer);
+
+/**
+ *
+ * set_job_env
+ *
+ * add an environment variable for the plugin of this job, the worker environment is not changed
+ *
+ * @param[in] job - job structure
+ * @param[in] name - name of the variable
+ * @param[in] value - value of the variable
+ *
+ * @return GM_OK on success
+ */
+int set_job_env(gm_job_t *job, const char *name, const char *value);
+
 
 /**
  * pid_alive
@@ -512,6 +625,23 @@ int read_filepointer(char **, FILE*);
  */
 int read_pipe(char **, int);
 
+/**
+ * read_pipe_data
+ *
+ * reads available data from a file descriptor into a malloced buffer
+ * which grows geometrically. Reads never go beyond the limit, the
+ * caller has to stop once it is reached.
+ *
+ * @param[in] fd - file descriptor to read from
+ * @param[in,out] buf - buffer to read into, may be NULL
+ * @param[in,out] len - length of data in buffer
+ * @param[in,out] size - allocated size of the buffer
+ * @param[in] limit - maximum length or 0 for no limit
+ *
+ * @return number of bytes read, 0 on end of file or -1 on errors
+ */
+int read_pipe_data(int fd, char **buf, int *len, int *size, int limit);
+
 /**
  * @}
  */
@@ -46,13 +46,6 @@
 
 int mod_gm_shm_key;             /**< key for the shared memory segment */
 
-#define SHM_SHIFT             5 /**< nr of global counter              */
-#define SHM_JOBS_DONE         0 /**< shm id for jobs done counter      */
-#define SHM_WORKER_TOTAL      1 /**< shm id for total worker counter   */
-#define SHM_WORKER_RUNNING    2 /**< shm id for running worker counter */
-#define SHM_STATUS_WORKER_PID 3 /**< shm id for status worker pid      */
-#define SHM_WORKER_LAST_CHECK 4 /**< shm time of last check executed   */
-
 /** Mod-Gearman Worker
  *
  * main function of the worker
@@ -123,6 +116,33 @@ void print_version(void);
  */
 int  adjust_number_of_worker(int min, int max, int cur_workers, int cur_jobs);
 
+/**
+ * calculate the number of child worker from the gearmand queues
+ *
+ * @param[in] now         - current time
+ * @param[in] cur_workers - current number of worker
+ * @param[in] cur_jobs    - current number of running jobs
+ *
+ * @return new target number of workers or -1 if there is no estimate
+ */
+int  autoscale_number_of_worker(int now, int cur_workers, int cur_jobs);
+
+/**
+ * stop idle child worker
+ *
+ * @param[in] num - number of worker to stop
+ *
+ * @return nothing
+ */
+void reduce_worker_population(int num);
+
+/**
+ * check the load limits
+ *
+ * @return TRUE if a load limit is reached
+ */
+int  load_limit_reached(void);
+
 /**
  * creates the shared memory segments for the child communication
  *
@@ -187,6 +207,13 @@ void monitor_loop(void);
  */
 void check_worker_population(void);
 
+/**
+ * start new worker right away when all worker are busy
+ *
+ * @return nothing
+ */
+void increase_worker_population(void);
+
 /**
  * returns next number of the shared memory segment for a new child
  *
@@ -0,0 +1,104 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief size the worker population by the gearmand queues
+ *
+ * the main process samples the backlog of the queues it works on and its
+ * own jobs done counter. Arrival rate, completion rate and the time a
+ * worker spends per job are smoothed with an exponentially weighted moving
+ * average. By Little's law the number of busy workers equals the arrival
+ * rate times the time per job, plus what is needed to work off the
+ * current backlog. All numbers are in units of worker processes.
+ *
+ * @{
+ */
+
+#ifndef MOD_GM_WORKER_AUTOSCALE_H
+#define MOD_GM_WORKER_AUTOSCALE_H
+
+#include "common.h"
+
+#define GM_AUTOSCALE_INTERVAL   2       /**< seconds between two samples */
+#define GM_AUTOSCALE_TIMEOUT    1000    /**< max milliseconds to talk to a gearmand */
+#define GM_AUTOSCALE_ALPHA      0.3     /**< weight of the newest sample */
+#define GM_AUTOSCALE_DRAIN      10      /**< work off a backlog within this number of seconds */
+#define GM_AUTOSCALE_HEADROOM   1.2     /**< spare capacity for the arrival rate */
+
+/** autoscaling state */
+typedef struct gm_autoscale {
+    double      arrival_rate;           /**< new jobs per second */
+    double      completion_rate;        /**< finished jobs per second */
+    double      service_time;           /**< seconds a worker spends on a job */
+    double      last_time;              /**< time of the last sample */
+    int         last_backlog;           /**< waiting jobs at the last sample */
+    int         last_done;              /**< jobs done counter at the last sample */
+    int         samples;                /**< number of samples so far */
+} gm_autoscale_t;
+
+/**
+ * autoscale_sample
+ *
+ * add a sample to the moving averages
+ *
+ * @param[in] as - autoscaling state
+ * @param[in] now - current time in seconds
+ * @param[in] backlog - number of waiting jobs
+ * @param[in] jobs_done - total number of jobs done by our workers
+ * @param[in] busy - number of busy workers
+ *
+ * @return nothing
+ */
+void autoscale_sample(gm_autoscale_t * as, double now, int backlog, int jobs_done, int busy);
+
+/**
+ * autoscale_target
+ *
+ * calculate the number of workers for the sampled load. Grows to the
+ * target at once and shrinks by half of the surplus each time.
+ *
+ * @param[in] as - autoscaling state
+ * @param[in] cur_workers - current number of workers
+ * @param[in] min - minimum number of workers
+ * @param[in] max - maximum number of workers
+ *
+ * @return number of workers or -1 if there are not enough samples
+ */
+int autoscale_target(gm_autoscale_t * as, int cur_workers, int min, int max);
+
+/**
+ * autoscale_backlog
+ *
+ * get the number of waiting jobs in our queues from all gearmand servers
+ *
+ * @param[in] opt - options structure
+ *
+ * @return number of waiting jobs or -1 if no server could be queried
+ */
+int autoscale_backlog(mod_gm_opt_t * opt);
+
+/**
+ * @}
+ */
+
+#endif
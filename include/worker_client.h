@@ -30,13 +30,12 @@
 #include <sys/time.h>
 #include <signal.h>
 #include <errno.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
 #include <libgearman/gearman.h>
 
 #define MOD_GM_WORKER
 #include "config.h"
 #include "common.h"
+#include "worker_registry.h"
 
 #define GM_JOB_START            0
 #define GM_JOB_END              1
@@ -45,19 +44,39 @@
 #define GM_WORKER_STANDALONE    1
 #define GM_WORKER_STATUS        2
 
+#define GM_JOB_ARENA_CACHE      16      /* number of job arenas kept for reuse */
+
 #ifdef EMBEDDEDPERL
-void worker_client(int worker_mode, int indx, int shid, char**env);
+void worker_client(int worker_mode, int indx, char**env);
 #else
-void worker_client(int worker_mode, int indx, int shid);
+void worker_client(int worker_mode, int indx);
 #endif
 void worker_loop(void);
 void *get_job( gearman_job_st *, void *, size_t *, gearman_return_t * );
-void do_exec_job(void);
+gm_job_t * alloc_job(void);
+void recycle_job(gm_job_t * job);
+void do_exec_job(gm_job_t * exec_job);
+void send_job_result(gm_job_t * job);
+int prepare_exec_job(gm_job_t * job);
+int start_async_checks(void);
+void stop_async_checks(void);
+void *async_loop(void * data);
+void start_async_check(gm_job_t * job);
+void queue_async_job(gm_job_t * job);
+int wait_for_async_slot(void);
+void async_check_done(gm_job_t * job, void * data);
+void async_job_finished(gm_job_t * job);
+void async_sighandler(int sig);
+void async_exit(int sig);
 int set_worker( gearman_worker_st *worker );
+int set_worker_context( gearman_worker_st *worker, void *context );
 void exit_sighandler(int sig);
 void idle_sighandler(int sig);
+void deferred_exit_sighandler(int sig);
 void set_state(int status);
+void set_slot_queue(const char * queue);
 void clean_worker_exit(int sig);
+void clear_worker_slot(void);
 void *return_status( gearman_job_st *, void *, size_t *, gearman_return_t *);
 #ifdef GM_DEBUG
 void write_debug_file(char ** text);
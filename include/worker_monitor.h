@@ -0,0 +1,90 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief event notifications for the worker main process
+ *
+ * instead of checking the worker population once a second, the main
+ * process waits for workers to exit (pidfds or SIGCHLD) and for workers
+ * to become busy (eventfd). Without epoll support the main process falls
+ * back to polling.
+ *
+ * @{
+ */
+
+#ifndef MOD_GM_WORKER_MONITOR_H
+#define MOD_GM_WORKER_MONITOR_H
+
+#include <sys/types.h>
+
+#define GM_MONITOR_EXIT     1       /**< a worker exited */
+#define GM_MONITOR_BUSY     2       /**< a worker started a job */
+#define GM_MONITOR_EVENTS   64      /**< events per epoll_wait */
+
+/**
+ * monitor_init
+ *
+ * create the epoll set and the eventfd used by workers. Must be called
+ * before the first worker is started.
+ *
+ * @return GM_OK on success, GM_ERROR if events are not supported
+ */
+int monitor_init(void);
+
+/**
+ * monitor_wait
+ *
+ * wait for worker events
+ *
+ * @param[in] timeout - maximum milliseconds to wait
+ *
+ * @return GM_MONITOR_EXIT and GM_MONITOR_BUSY flags or 0 on timeout
+ */
+int monitor_wait(int timeout);
+
+/**
+ * monitor_watch_worker
+ *
+ * get notified when the worker in the given shm slot exits
+ *
+ * @param[in] indx - shm index of the worker
+ * @param[in] pid - pid of the worker
+ *
+ * @return nothing
+ */
+void monitor_watch_worker(int indx, pid_t pid);
+
+/**
+ * monitor_child_init
+ *
+ * release everything a newly forked process does not need
+ *
+ * @return nothing
+ */
+void monitor_child_init(void);
+
+/**
+ * @}
+ */
+
+#endif
@@ -0,0 +1,115 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief pool of worker threads in a single worker process
+ *
+ * each thread has its own gearman worker connection and runs one job at
+ * a time. Results are sent through a small pool of client connections
+ * which is shared by all threads. Gearmand hands out the jobs to idle
+ * threads, so there is no further queueing in the worker.
+ *
+ * @{
+ */
+
+#ifndef MOD_GM_WORKER_POOL_H
+#define MOD_GM_WORKER_POOL_H
+
+#include <pthread.h>
+#include "common.h"
+#include <libgearman/gearman.h>
+
+#define GM_MAX_WORKER_THREADS       256     /**< upper limit for worker_threads */
+#define GM_POOL_THREADS_PER_CLIENT  8       /**< threads sharing one result connection */
+
+/** worker thread */
+typedef struct gm_pool_thread {
+    pthread_t           thread;             /**< thread id */
+    int                 num;                /**< number of this thread */
+    gearman_worker_st   worker;             /**< gearman worker connection */
+} gm_pool_thread_t;
+
+/** result connection */
+typedef struct gm_pool_client {
+    gearman_client_st   client;             /**< client for result queue */
+    gearman_client_st   client_dup;         /**< client for duplicate server */
+    int                 used;               /**< leased by a thread */
+} gm_pool_client_t;
+
+/**
+ * worker_pool_run
+ *
+ * start threads and handle signals, idle timeout and max jobs until the
+ * pool is stopped. Does not return.
+ *
+ * @param[in] size - number of worker threads
+ *
+ * @return nothing
+ */
+void worker_pool_run(int size);
+
+/**
+ * worker_pool_size
+ *
+ * number of running worker threads
+ *
+ * @return number of threads or 0 if there is no pool
+ */
+int worker_pool_size(void);
+
+/**
+ * worker_pool_state
+ *
+ * count started and finished jobs
+ *
+ * @param[in] status - GM_JOB_START or GM_JOB_END
+ *
+ * @return number of idle threads or -1 if there is no pool
+ */
+int worker_pool_state(int status);
+
+/**
+ * worker_pool_stop
+ *
+ * let all threads exit after their current job
+ *
+ * @return nothing
+ */
+void worker_pool_stop(void);
+
+/**
+ * worker_pool_send_result
+ *
+ * send result with one of the shared client connections
+ *
+ * @param[in] job - finished job
+ *
+ * @return nothing
+ */
+void worker_pool_send_result(gm_job_t * job);
+
+#endif
+
+/**
+ * @}
+ */
@@ -0,0 +1,153 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief shared memory registry of all worker processes
+ *
+ * the registry is created by the main process and inherited by all
+ * workers, which keep it mapped for their lifetime. Slot 0 belongs to the
+ * status worker, all other slots are handed out from a lock-free list of
+ * free slots. Only the main process takes slots from the list, slots are
+ * returned by the workers on exit or by the main process for workers
+ * which died.
+ *
+ * @{
+ */
+
+#ifndef MOD_GM_WORKER_REGISTRY_H
+#define MOD_GM_WORKER_REGISTRY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#define GM_REGISTRY_MAGIC       0x4d47574b  /**< "MGWK", marks an initialized registry */
+#define GM_REGISTRY_VERSION     1           /**< increase when the layout changes */
+#define GM_REGISTRY_STATUS_SLOT 0           /**< slot of the status worker */
+#define GM_REGISTRY_NO_SLOT     -1          /**< end of the free list */
+#define GM_SLOT_QUEUE_SIZE      64          /**< max length of the queue name in a slot */
+
+#define GM_SLOT_FREE            0           /**< slot is unused */
+#define GM_SLOT_RESERVED        1           /**< worker is starting */
+#define GM_SLOT_IDLE            2           /**< worker waits for jobs */
+#define GM_SLOT_BUSY            3           /**< worker runs a job */
+
+/** worker slot */
+typedef struct gm_worker_slot {
+    volatile int        pid;                        /**< pid of the worker, 0 if unknown */
+    volatile int        state;                      /**< one of GM_SLOT_* */
+    volatile int        next;                       /**< next free slot */
+    volatile int        jobs_done;                  /**< jobs done by this worker */
+    volatile time_t     job_start;                  /**< start time of the current job */
+    char                queue[GM_SLOT_QUEUE_SIZE];  /**< queue of the current job */
+} gm_worker_slot_t;
+
+/** registry header, followed by the slots */
+typedef struct gm_worker_registry {
+    uint32_t            magic;                      /**< GM_REGISTRY_MAGIC */
+    uint32_t            version;                    /**< GM_REGISTRY_VERSION */
+    uint32_t            slot_size;                  /**< size of a single slot */
+    int                 num_slots;                  /**< number of slots including the status slot */
+    volatile int        jobs_done;                  /**< total jobs done */
+    volatile int        worker_total;               /**< used worker slots */
+    volatile int        worker_running;             /**< busy worker slots */
+    volatile int        last_check;                 /**< time of the last finished job */
+    volatile uint64_t   free_head;                  /**< free list head, tagged against ABA in the upper half */
+    gm_worker_slot_t    slots[];                    /**< worker slots */
+} gm_worker_registry_t;
+
+/**
+ * registry_size
+ *
+ * @param[in] num_slots - number of slots
+ *
+ * @return size of a registry with the given number of slots in bytes
+ */
+size_t registry_size(int num_slots);
+
+/**
+ * registry_init
+ *
+ * initialize registry in the given memory
+ *
+ * @param[in] reg - memory of at least registry_size(num_slots) bytes
+ * @param[in] num_slots - number of slots including the status slot
+ *
+ * @return nothing
+ */
+void registry_init(gm_worker_registry_t * reg, int num_slots);
+
+/**
+ * registry_check
+ *
+ * verify the registry has been initialized with the current layout
+ *
+ * @param[in] reg - registry
+ *
+ * @return GM_OK or GM_ERROR
+ */
+int registry_check(gm_worker_registry_t * reg);
+
+/**
+ * registry_alloc
+ *
+ * take a free worker slot, must only be called from the main process
+ *
+ * @param[in] reg - registry
+ *
+ * @return slot index or GM_REGISTRY_NO_SLOT if all slots are used
+ */
+int registry_alloc(gm_worker_registry_t * reg);
+
+/**
+ * registry_release
+ *
+ * return slot to the free list if it still belongs to the given pid
+ *
+ * @param[in] reg - registry
+ * @param[in] indx - slot index
+ * @param[in] pid - expected pid in this slot
+ *
+ * @return TRUE if the slot has been freed
+ */
+int registry_release(gm_worker_registry_t * reg, int indx, int pid);
+
+/**
+ * registry_set_state
+ *
+ * change state of a slot and update the counters
+ *
+ * @param[in] reg - registry
+ * @param[in] indx - slot index
+ * @param[in] pid - expected pid in this slot
+ * @param[in] state - new state
+ *
+ * @return TRUE on success, FALSE if the slot does not belong to pid anymore
+ */
+int registry_set_state(gm_worker_registry_t * reg, int indx, int pid, int state);
+
+/**
+ * @}
+ */
+
+#endif
@@ -0,0 +1,75 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/** @file
+ *  @brief prefork template for worker processes
+ *
+ * the zygote is forked once from the main process after the config has
+ * been parsed and the crypto functions have been initialized. It starts
+ * the embedded perl interpreter and then only waits for spawn requests
+ * from the main process. New workers are forked from the zygote, so they
+ * start with everything already set up.
+ *
+ * @{
+ */
+
+#ifndef MOD_GM_WORKER_ZYGOTE_H
+#define MOD_GM_WORKER_ZYGOTE_H
+
+#include <sys/types.h>
+
+#define GM_ZYGOTE_TIMEOUT   3000    /**< max milliseconds to wait for a spawned worker */
+
+/** spawn request sent to the zygote */
+typedef struct gm_zygote_request {
+    int     mode;                   /**< worker mode */
+    int     shm_index;              /**< shm slot of the new worker */
+} gm_zygote_request_t;
+
+/**
+ * zygote_spawn
+ *
+ * fork a new worker from the zygote. The zygote will be started if it
+ * is not running yet.
+ *
+ * @param[in] mode - worker mode
+ * @param[in] indx - shm index of the new worker
+ *
+ * @return pid of the new worker or -1 on errors
+ */
+pid_t zygote_spawn(int mode, int indx);
+
+/**
+ * zygote_stop
+ *
+ * stop the zygote, running workers are not affected
+ *
+ * @return nothing
+ */
+void zygote_stop(void);
+
+/**
+ * @}
+ */
+
+#endif
@@ -25,6 +25,11 @@
 #include "result_thread.h"
 #include "mod_gearman.h"
 #include "gearman_utils.h"
+#include "gm_payload.h"
+#include "gm_submit.h"
+#include "gm_pool.h"
+#include "gm_wakeup.h"
+#include "gm_backlog.h"
 
 /* specify event broker API version (required) */
 NEB_API_VERSION( CURRENT_NEB_API_VERSION )
@@ -37,6 +42,7 @@ extern int            event_broker_options;
 extern unsigned long  event_broker_options;
 #ifdef USENAEMON
 #define my_free nm_free
+extern iobroker_set * nagios_iobs;
 #endif
 #endif
 extern int            currently_running_host_checks;
@@ -51,23 +57,85 @@ extern int            process_performance_data;
 #ifdef USENAGIOS3
 extern check_result   check_result_info;
 extern check_result * check_result_list;
+extern int            interval_length;
 #endif
 extern int            log_notifications;
 
 /* global variables */
 #ifdef USENAGIOS3
 static check_result * mod_gm_result_list = 0;
+static check_result * mod_gm_result_list_tail = 0;
 #endif
 #if defined(USENAEMON) || defined(USENAGIOS4)
 static objectlist * mod_gm_result_list = 0;
+
+/* results are freed by us after the core processed them, so they are
+ * recycled in a pool. The list node and all strings live along with the
+ * result, the strings in an arena which is reset on every reuse. */
+#define GM_RESULT_POOL
+#define GM_RESULT_ARENA_SIZE 2048
+typedef struct gm_result_struct {
+    check_result   cr;          /**< must be first */
+    objectlist     node;        /**< node in the result list */
+    gm_arena_t   * arena;       /**< memory for the strings */
+    struct timeval queued;      /**< added to the result list */
+} gm_result_t;
+static gm_pool_t                result_pool;
+static __thread gm_pool_cache_t result_cache;
+static void free_pooled_result(void *);
+
+/* results taken from the result list but not yet processed by the core */
+static objectlist *     core_backlog = 0;
+static gm_histogram_t   result_latency;
 #endif
 static pthread_mutex_t mod_gm_result_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* results waiting for the core, result threads pause when there are too many */
+static gm_backlog_t     result_pending;
+static time_t           result_stats_logged = 0;
+static unsigned long    result_paused_logged = 0;
+#define GM_RESULT_STATS_INTERVAL 60
+
+#ifdef USENAEMON
+/* result threads wake up the event loop of naemon instead of
+ * waiting for the next run of a timed event */
+#define GM_RESULT_WAKEUP
+#define GM_RESULT_WAKEUP_MAX 1000   /* results processed per wake up */
+static gm_wakeup_t      result_wakeup;
+static int              result_wakeup_registered = FALSE;
+#endif
 void *gearman_module_handle=NULL;
 gearman_client_st client;
 
 int send_now, result_threads_running;
 pthread_t result_thr[GM_LISTSIZE];
 char target_queue[GM_BUFFERSIZE];
+
+#if defined(USENAEMON) || defined(USENAGIOS4)
+/* object cache per host and service id. The route is the target queue,
+ * 0 means not resolved yet, 1 means no queue, anything else is an
+ * index+2 into route_names. The job prefix holds the static fields of
+ * check jobs and is built on first use. */
+#define GM_ROUTE_CACHE
+#define GM_ROUTE_UNKNOWN 0
+#define GM_ROUTE_NONE    1
+typedef struct gm_object_cache_struct {
+    int      route;             /**< target queue */
+    char   * prefix;            /**< static part of the check job */
+    size_t   prefix_len;        /**< length of the prefix */
+    int      prefix_binary;     /**< flag whether the prefix uses the binary format */
+    char   * uniq;              /**< uniq key of service checks */
+} gm_object_cache_t;
+static gm_object_cache_t * host_cache = NULL;
+static gm_object_cache_t * service_cache = NULL;
+static unsigned int        host_cache_num = 0;
+static unsigned int        service_cache_num = 0;
+static char        ** route_names = NULL;
+static int            route_names_num = 0;
+static int            route_names_size = 0;
+static int          * route_hash = NULL;
+static int            route_hash_size = 0;
+#endif
 char temp_buffer[GM_BUFFERSIZE];
 char uniq[GM_BUFFERSIZE];
 
@@ -98,13 +166,27 @@ static int   handle_notifications( int,void * );
 static int   handle_perfdata(int e, void *);
 static int   handle_export(int e, void *);
 static void  set_target_queue( host *, service * );
+static void  resolve_target_queue( host *, service * );
+static int   use_binary_payload( const char * );
+static size_t build_job_prefix( host *, service *, int, char *, size_t );
+static char * build_check_job( host *, service *, time_t, struct timeval *, int, char * );
+#ifdef GM_ROUTE_CACHE
+static gm_object_cache_t * object_cache( host *, service * );
+static int   intern_route( const char * );
+static void  build_route_cache(void);
+static void  free_route_cache(void);
+static int   handle_adaptive_data( int, void * );
+#endif
 static int   handle_process_events( int, void * );
 #ifdef USENAGIOS
 static int   handle_timed_events( int, void * );
 #endif
 static void  start_threads(void);
+static int   submit_job( char *, char *, char *, int, int, int, void * );
+static void  reschedule_failed_jobs(void);
 #ifdef USENAGIOS3
 static check_result * merge_result_lists(check_result * lista, check_result * listb);
+static check_result * sort_result_list(check_result * list);
 static void move_results_to_core_3x(void);
 #endif
 #ifdef USENAGIOS4
@@ -113,6 +195,14 @@ static void move_results_to_core(void);
 #ifdef USENAEMON
 static void move_results_to_core(struct nm_event_execution_properties *evprop);
 #endif
+#ifdef GM_RESULT_POOL
+static int   process_results( int );
+#endif
+static void  log_result_stats( time_t );
+#ifdef GM_RESULT_WAKEUP
+static void  register_result_wakeup(void);
+static int   handle_result_wakeup( int, int, void * );
+#endif
 
 int nebmodule_init( int flags, char *args, nebmodule *handle ) {
     int i;
@@ -200,14 +290,21 @@ int nebmodule_init( int flags, char *args, nebmodule *handle ) {
     }
     current_client = &client;
 
+    mod_gm_backlog_init(&result_pending);
+    result_paused_logged = 0;
+#ifdef GM_RESULT_POOL
+    mod_gm_pool_init(&result_pool, sizeof(gm_result_t), free_pooled_result);
+#endif
+#ifdef GM_RESULT_WAKEUP
+    if(mod_gm_wakeup_init(&result_wakeup) != GM_OK)
+        gm_log( GM_LOG_INFO, "Warning: moving results to the core only once per second\n" );
+#endif
+
     /* register callback for process event where everything else starts */
     neb_register_callback( NEBCALLBACK_PROCESS_DATA, gearman_module_handle, 0, handle_process_events );
 #ifdef USENAGIOS
     neb_register_callback( NEBCALLBACK_TIMED_EVENT_DATA, gearman_module_handle, 0, handle_timed_events );
 #endif
-#ifdef USENAEMON
-    schedule_event(1, move_results_to_core, NULL);
-#endif
 
     /* register export callbacks */
     for(i=0;i<GM_NEBTYPESSIZE;i++) {
@@ -253,6 +350,14 @@ static void register_neb_callbacks(void) {
     if ( mod_gm_opt->notifications == GM_ENABLED )
         neb_register_callback( NEBCALLBACK_CONTACT_NOTIFICATION_METHOD_DATA, gearman_module_handle, 0, handle_notifications );
 
+#ifdef GM_ROUTE_CACHE
+    /* cached target queues depend on custom variables */
+    if ( mod_gm_opt->queue_cust_var ) {
+        neb_register_callback( NEBCALLBACK_ADAPTIVE_HOST_DATA, gearman_module_handle, 0, handle_adaptive_data );
+        neb_register_callback( NEBCALLBACK_ADAPTIVE_SERVICE_DATA, gearman_module_handle, 0, handle_adaptive_data );
+    }
+#endif
+
     gm_log( GM_LOG_DEBUG, "registered neb callbacks\n" );
 }
 
@@ -281,6 +386,13 @@ int nebmodule_deinit( int flags, int reason ) {
     if ( mod_gm_opt->notifications == GM_ENABLED )
         neb_deregister_callback( NEBCALLBACK_CONTACT_NOTIFICATION_METHOD_DATA, gearman_module_handle );
 
+#ifdef GM_ROUTE_CACHE
+    if ( mod_gm_opt->queue_cust_var ) {
+        neb_deregister_callback( NEBCALLBACK_ADAPTIVE_HOST_DATA, handle_adaptive_data );
+        neb_deregister_callback( NEBCALLBACK_ADAPTIVE_SERVICE_DATA, handle_adaptive_data );
+    }
+#endif
+
     if ( mod_gm_opt->perfdata != GM_DISABLED ) {
         neb_deregister_callback( NEBCALLBACK_HOST_CHECK_DATA, gearman_module_handle );
         neb_deregister_callback( NEBCALLBACK_SERVICE_CHECK_DATA, gearman_module_handle );
@@ -302,6 +414,30 @@ int nebmodule_deinit( int flags, int reason ) {
         pthread_join(result_thr[x], NULL);
     }
 
+    /* send remaining batched jobs */
+    mod_gm_submit_stop();
+
+#ifdef GM_RESULT_WAKEUP
+    if(result_wakeup_registered)
+        iobroker_unregister(nagios_iobs, result_wakeup.fd[0]);
+    result_wakeup_registered = FALSE;
+    mod_gm_wakeup_free(&result_wakeup);
+#endif
+
+#ifdef GM_RESULT_POOL
+    /* results not yet processed are freed along with the pool, the result
+     * threads flushed their caches when they were cancelled */
+    mod_gm_result_list = 0;
+    core_backlog       = 0;
+    mod_gm_backlog_init(&result_pending);
+    mod_gm_flush_results();
+    mod_gm_pool_destroy(&result_pool);
+#endif
+
+#ifdef GM_ROUTE_CACHE
+    free_route_cache();
+#endif
+
     /* cleanup */
     free_client(&client);
 
@@ -331,6 +467,8 @@ static int handle_timed_events( int event_type, void *data ) {
 
     gm_log( GM_LOG_TRACE, "handle_timed_events(%i, data)\n", event_type, ted->event_type );
 
+    reschedule_failed_jobs();
+
 #ifdef USENAGIOS3
     move_results_to_core_3x();
 #endif
@@ -360,83 +498,269 @@ static check_result * merge_result_lists(check_result * lista, check_result * li
 
     return result;
 }
+
+/* sort results by finish time */
+static check_result * sort_result_list(check_result * list) {
+    check_result * slow;
+    check_result * fast;
+    check_result * half;
+
+    if(list == 0 || list->next == 0)
+        return list;
+
+    /* split list in two halfs */
+    slow = list;
+    fast = list->next;
+    while(fast && fast->next) {
+        slow = slow->next;
+        fast = fast->next->next;
+    }
+    half       = slow->next;
+    slow->next = 0;
+
+    return merge_result_lists(sort_result_list(list), sort_result_list(half));
+}
 #endif
 
 /* insert results list into naemon/nagios4 core */
-#if defined(USENAEMON) || defined(USENAGIOS4)
 #ifdef USENAEMON
 static void move_results_to_core(struct nm_event_execution_properties *evprop) {
+    if(evprop->execution_type == EVENT_EXEC_NORMAL) {
+        reschedule_failed_jobs();
+        process_results(0);
+        schedule_event(1, move_results_to_core, NULL);
+    }
+}
 #endif
 #ifdef USENAGIOS4
 static void move_results_to_core() {
+    process_results(0);
+}
 #endif
-    objectlist *tmp_list = NULL;
-#ifdef USENAEMON
-    if(evprop->execution_type == EVENT_EXEC_NORMAL) {
-#endif
-    /* safely save off currently local list */
-    pthread_mutex_lock(&mod_gm_result_list_mutex);
 
-    for( ; mod_gm_result_list; mod_gm_result_list = mod_gm_result_list->next) {
-        free(tmp_list);
-        process_check_result(mod_gm_result_list->object_ptr);
-        free_check_result(mod_gm_result_list->object_ptr);
-        free(mod_gm_result_list->object_ptr);
-        tmp_list = mod_gm_result_list;
-    }
-    mod_gm_result_list = 0;
-    free(tmp_list);
+/* hand at most max results to the core, all if max is 0.
+ * returns TRUE if results are left over for the next call */
+#ifdef GM_RESULT_POOL
+static int process_results(int max) {
+    check_result *chk_result;
+    struct timeval now;
+    int taken = FALSE;
+    int num   = 0;
+
+    gettimeofday(&now, NULL);
+    while(1) {
+        /* safely save off currently local list, the result threads must not
+         * wait for the core while it processes the results */
+        if(core_backlog == 0) {
+            if(taken)
+                break;
+            pthread_mutex_lock(&mod_gm_result_list_mutex);
+            core_backlog = mod_gm_result_list;
+            mod_gm_result_list = 0;
+            pthread_mutex_unlock(&mod_gm_result_list_mutex);
+            taken = TRUE;
+            continue;
+        }
+        if(max > 0 && num >= max)
+            break;
 
-    pthread_mutex_unlock(&mod_gm_result_list_mutex);
-#ifdef USENAEMON
-        schedule_event(1, move_results_to_core, NULL);
+        /* the list nodes are part of the results, so move on before releasing them */
+        chk_result   = core_backlog->object_ptr;
+        core_backlog = core_backlog->next;
+        mod_gm_histogram_add(&result_latency, &((gm_result_t *)chk_result)->queued, &now);
+        process_check_result(chk_result);
+        mod_gm_free_result(chk_result);
+        num++;
     }
-#endif
+    if(num > 0)
+        mod_gm_backlog_take(&result_pending, num, mod_gm_opt->result_backlog_resume);
+
+    log_result_stats(now.tv_sec);
+
+    return core_backlog != 0;
 }
 #endif
 
+/* log result statistics once per minute, pauses of the result threads are summarized here */
+static void log_result_stats(time_t now) {
+    unsigned long paused;
+
+    if(now < result_stats_logged + GM_RESULT_STATS_INTERVAL)
+        return;
+    result_stats_logged = now;
+
+#ifdef GM_RESULT_POOL
+    mod_gm_histogram_log(&result_latency, GM_LOG_DEBUG, "result latency");
+#endif
+    paused = __atomic_load_n(&result_pending.throttled_num, __ATOMIC_RELAXED);
+    gm_log( paused != result_paused_logged ? GM_LOG_INFO : GM_LOG_DEBUG,
+            "result backlog: %d pending, result threads paused %lu times for %lums\n",
+            __atomic_load_n(&result_pending.pending, __ATOMIC_RELAXED),
+            paused,
+            __atomic_load_n(&result_pending.throttled_ms, __ATOMIC_RELAXED));
+    result_paused_logged = paused;
+}
+
+/* sleeps while too many results wait for the core */
+int mod_gm_result_backlog_wait(void) {
+    return mod_gm_backlog_wait(&result_pending, mod_gm_opt->result_backlog, mod_gm_opt->result_backlog_resume);
+}
+
+/* binary check jobs are only sent to the queues the operator enabled them for */
+static int use_binary_payload(const char * queue) {
+    int i;
+    if(mod_gm_opt->binary_payload != GM_ENABLED)
+        return FALSE;
+    if(mod_gm_opt->binary_queues_num == 0)
+        return TRUE;
+    for(i = 0; i < mod_gm_opt->binary_queues_num; i++) {
+        if(!strcmp(mod_gm_opt->binary_queues_list[i], queue))
+            return TRUE;
+    }
+    return FALSE;
+}
+
 /* insert results list into nagios 3 core */
 #ifdef USENAGIOS3
 static void move_results_to_core_3x() {
    check_result * local;
+   check_result * cr;
+   int num = 0;
 
    /* safely save off currently local list */
    pthread_mutex_lock(&mod_gm_result_list_mutex);
    local = mod_gm_result_list;
    mod_gm_result_list = 0;
+   mod_gm_result_list_tail = 0;
    pthread_mutex_unlock(&mod_gm_result_list_mutex);
 
-   /* merge local into check_result_list, store in check_result_list */
-   check_result_list = merge_result_lists(local, check_result_list);
+   /* results are processed by the reaper from now on */
+   for(cr = local; cr; cr = cr->next)
+       num++;
+   mod_gm_backlog_take(&result_pending, num, mod_gm_opt->result_backlog_resume);
+   log_result_stats(time(NULL));
+
+   /* results are added unsorted, so sort them once per reaper run */
+   local = sort_result_list(local);
+
+   /* merge local into check_result_list, store in check_result_list.
+    * results already in the core list go first on equal finish times */
+   check_result_list = merge_result_lists(check_result_list, local);
 }
 #endif
 
 /* add list to gearman result list */
 #if defined(USENAEMON) || defined(USENAGIOS4)
 void mod_gm_add_result_to_list(check_result * newcr) {
+    objectlist * node = &((gm_result_t *)newcr)->node;
+
+    node->object_ptr = newcr;
+    gettimeofday(&((gm_result_t *)newcr)->queued, NULL);
     pthread_mutex_lock(&mod_gm_result_list_mutex);
-    add_object_to_objectlist(&mod_gm_result_list, newcr);
+    node->next = mod_gm_result_list;
+    mod_gm_result_list = node;
     pthread_mutex_unlock(&mod_gm_result_list_mutex);
+    mod_gm_backlog_add(&result_pending, 1);
+#ifdef GM_RESULT_WAKEUP
+    if(result_wakeup_registered)
+        mod_gm_wakeup_signal(&result_wakeup);
+#endif
+}
+
+/* take check result from the pool */
+check_result * mod_gm_new_result(void) {
+    gm_result_t * res;
+    int state;
+
+    /* result threads are cancelled asynchronously, never leave the cache half updated */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+    res = mod_gm_pool_get(&result_pool, &result_cache);
+    pthread_setcancelstate(state, NULL);
+    if(res->arena == NULL)
+        res->arena = gm_arena_create(GM_RESULT_ARENA_SIZE);
+    return &res->cr;
+}
+
+/* copy string into the arena of the result */
+char * mod_gm_result_strdup(check_result * cr, const char * str) {
+    return gm_arena_strdup(((gm_result_t *)cr)->arena, str);
+}
+
+/* copy string into the arena of the result */
+char * mod_gm_result_strndup(check_result * cr, const char * str, size_t len) {
+    return gm_arena_strndup(((gm_result_t *)cr)->arena, str, len);
+}
+
+/* put check result back into the pool */
+void mod_gm_free_result(check_result * cr) {
+    gm_result_t * res = (gm_result_t *)cr;
+    int state;
+
+    gm_arena_reset(res->arena);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+    mod_gm_pool_put(&result_pool, &result_cache, res);
+    pthread_setcancelstate(state, NULL);
+}
+
+/* move the cached results of the calling thread back into the pool */
+void mod_gm_flush_results(void) {
+    mod_gm_pool_flush(&result_pool, &result_cache);
+}
+
+/* free strings of a pooled result, called when the pool is destroyed */
+static void free_pooled_result(void * obj) {
+    gm_arena_free(((gm_result_t *)obj)->arena);
 }
 #endif
 
 /* add list to gearman result list */
 #ifdef USENAGIOS3
 void mod_gm_add_result_to_list(check_result * newcr) {
-   check_result ** curp;
-
    assert(newcr);
 
-   pthread_mutex_lock(&mod_gm_result_list_mutex);
+   /* append only, sorting is done in move_results_to_core_3x() */
+   newcr->next = 0;
 
-   for (curp = &mod_gm_result_list; *curp; curp = &(*curp)->next)
-      if (mod_gm_time_compare(&(*curp)->finish_time, &newcr->finish_time) >= 0)
-         break;
+   pthread_mutex_lock(&mod_gm_result_list_mutex);
 
-   newcr->next = *curp;
-   *curp = newcr;
+   if (mod_gm_result_list_tail)
+      mod_gm_result_list_tail->next = newcr;
+   else
+      mod_gm_result_list = newcr;
+   mod_gm_result_list_tail = newcr;
 
    pthread_mutex_unlock(&mod_gm_result_list_mutex);
+   mod_gm_backlog_add(&result_pending, 1);
+}
+
+/* results are freed by the core */
+check_result * mod_gm_new_result(void) {
+    return gm_malloc(sizeof(check_result));
+}
+
+/* copy string */
+char * mod_gm_result_strdup(check_result * cr, const char * str) {
+    /* result is unused */
+    cr = cr;
+    return gm_strdup(str);
+}
+
+/* copy string */
+char * mod_gm_result_strndup(check_result * cr, const char * str, size_t len) {
+    /* result is unused */
+    cr = cr;
+    return gm_strndup(str, len);
+}
+
+/* free check result */
+void mod_gm_free_result(check_result * cr) {
+    free_check_result(cr);
+    free(cr);
+}
+
+/* results are not cached */
+void mod_gm_flush_results(void) {
+    return;
 }
 #endif
 
@@ -451,6 +775,12 @@ static int handle_process_events( int event_type, void *data ) {
     if ( ps->type == NEBTYPE_PROCESS_EVENTLOOPSTART ) {
 
         register_neb_callbacks();
+#ifdef GM_ROUTE_CACHE
+        build_route_cache();
+#endif
+#ifdef GM_RESULT_WAKEUP
+        register_result_wakeup();
+#endif
         start_threads();
         send_now = TRUE;
 
@@ -568,16 +898,14 @@ static int handle_eventhandler( int event_type, void *data ) {
                 ds->command_line
     );
 
-    if(add_job_to_queue( &client,
-                         mod_gm_opt->server_list,
-                         target_queue,
-                         NULL,
-                         temp_buffer,
-                         GM_JOB_PRIO_NORMAL,
-                         GM_DEFAULT_JOB_RETRIES,
-                         mod_gm_opt->transportmode,
-                         FALSE
-                        ) == GM_OK) {
+    if(submit_job( target_queue,
+                   NULL,
+                   temp_buffer,
+                   GM_JOB_PRIO_NORMAL,
+                   FALSE,
+                   0,
+                   NULL
+                  ) == GM_OK) {
         gm_log( GM_LOG_TRACE, "handle_eventhandler() finished successfully\n" );
     }
     else {
@@ -791,16 +1119,14 @@ static int handle_notifications( int event_type, void *data ) {
                 svc != NULL ? svc->long_plugin_output : hst->long_plugin_output
     );
 
-    if(add_job_to_queue( &client,
-                         mod_gm_opt->server_list,
-                         target_queue,
-                         NULL,
-                         temp_buffer,
-                         GM_JOB_PRIO_HIGH,
-                         GM_DEFAULT_JOB_RETRIES,
-                         mod_gm_opt->transportmode,
-                         FALSE
-                        ) == GM_OK) {
+    if(submit_job( target_queue,
+                   NULL,
+                   temp_buffer,
+                   GM_JOB_PRIO_HIGH,
+                   FALSE,
+                   0,
+                   NULL
+                  ) == GM_OK) {
         gm_log( GM_LOG_TRACE, "handle_notifications() finished successfully\n" );
     }
     else {
@@ -1037,27 +1363,16 @@ static int handle_host_check( int event_type, void *data ) {
 
     gm_log( GM_LOG_TRACE, "cmd_line: %s\n", processed_command );
 
-    temp_buffer[0]='\x0';
-    snprintf( temp_buffer,GM_BUFFERSIZE-1,"type=host\nresult_queue=%s\nhost_name=%s\nstart_time=%ld.0\nnext_check=%ld.0\ntimeout=%d\ncore_time=%Lf\ncommand_line=%s\n\n\n",
-              mod_gm_opt->result_queue,
-              hst->name,
-              hst->next_check,
-              hst->next_check,
-              host_check_timeout,
-              timeval2double(&core_time),
-              processed_command
-            );
-
-    if(add_job_to_queue( &client,
-                         mod_gm_opt->server_list,
-                         target_queue,
-                        (mod_gm_opt->use_uniq_jobs == GM_ENABLED ? hst->name : NULL),
-                         temp_buffer,
-                         GM_JOB_PRIO_NORMAL,
-                         GM_DEFAULT_JOB_RETRIES,
-                         mod_gm_opt->transportmode,
-                         TRUE
-                        ) == GM_OK) {
+    build_check_job( hst, NULL, hst->next_check, &core_time, host_check_timeout, processed_command );
+
+    if(submit_job( target_queue,
+                   (mod_gm_opt->use_uniq_jobs == GM_ENABLED ? hst->name : NULL),
+                   temp_buffer,
+                   GM_JOB_PRIO_NORMAL,
+                   TRUE,
+                   HOST_CHECK,
+                   hst
+                  ) == GM_OK) {
     }
     else {
         my_free(raw_command);
@@ -1082,11 +1397,10 @@ static int handle_host_check( int event_type, void *data ) {
 #ifdef CHECK_OPTION_ORPHAN_CHECK
     if(mod_gm_opt->orphan_host_checks == GM_ENABLED && check_options & CHECK_OPTION_ORPHAN_CHECK) {
         gm_log( GM_LOG_DEBUG, "host check for %s orphaned\n", hst->name );
-        if ( ( chk_result = ( check_result * )gm_malloc( sizeof *chk_result ) ) == 0 )
-            return NEBERROR_CALLBACKCANCEL;
+        chk_result = mod_gm_new_result();
         snprintf( temp_buffer,GM_BUFFERSIZE-1,"(host check orphaned, is the mod-gearman worker on queue '%s' running?)\n", target_queue);
         init_check_result(chk_result);
-        chk_result->host_name           = gm_strdup( hst->name );
+        chk_result->host_name           = mod_gm_result_strdup( chk_result, hst->name );
         chk_result->scheduled_check     = TRUE;
 #ifdef NAGIOS
         chk_result->reschedule_check    = TRUE;
@@ -1096,7 +1410,7 @@ static int handle_host_check( int event_type, void *data ) {
 #endif
         chk_result->output_file         = 0;
         chk_result->output_file_fp      = NULL;
-        chk_result->output              = gm_strdup(temp_buffer);
+        chk_result->output              = mod_gm_result_strdup( chk_result, temp_buffer );
         chk_result->return_code         = mod_gm_opt->orphan_return;
         chk_result->check_options       = CHECK_OPTION_NONE;
         chk_result->object_check_type   = HOST_CHECK;
@@ -1122,6 +1436,7 @@ static int handle_svc_check( int event_type, void *data ) {
     char *raw_command=NULL;
     char *processed_command=NULL;
     nebstruct_service_check_data * svcdata;
+    char * job_uniq;
     int prio = GM_JOB_PRIO_LOW;
 #ifdef CHECK_OPTION_ORPHAN_CHECK
     check_result * chk_result;
@@ -1220,20 +1535,7 @@ static int handle_svc_check( int event_type, void *data ) {
 
     gm_log( GM_LOG_TRACE, "cmd_line: %s\n", processed_command );
 
-    temp_buffer[0]='\x0';
-    snprintf( temp_buffer,GM_BUFFERSIZE-1,"type=service\nresult_queue=%s\nhost_name=%s\nservice_description=%s\nstart_time=%ld.0\nnext_check=%ld.0\ncore_time=%Lf\ntimeout=%d\ncommand_line=%s\n\n\n",
-              mod_gm_opt->result_queue,
-              svcdata->host_name,
-              svcdata->service_description,
-              svc->next_check,
-              svc->next_check,
-              timeval2double(&core_time),
-              service_check_timeout,
-              processed_command
-            );
-
-    uniq[0]='\x0';
-    snprintf( uniq,GM_BUFFERSIZE-1,"%s-%s", svcdata->host_name, svcdata->service_description);
+    job_uniq = build_check_job( hst, svc, svc->next_check, &core_time, service_check_timeout, processed_command );
 
     /* execute forced checks with high prio as they are propably user requested */
 #ifdef USENAGIOS3
@@ -1244,16 +1546,14 @@ static int handle_svc_check( int event_type, void *data ) {
 #endif
         prio = GM_JOB_PRIO_HIGH;
 
-    if(add_job_to_queue( &client,
-                         mod_gm_opt->server_list,
-                         target_queue,
-                        (mod_gm_opt->use_uniq_jobs == GM_ENABLED ? uniq : NULL),
-                         temp_buffer,
-                         prio,
-                         GM_DEFAULT_JOB_RETRIES,
-                         mod_gm_opt->transportmode,
-                         TRUE
-                        ) == GM_OK) {
+    if(submit_job( target_queue,
+                   (mod_gm_opt->use_uniq_jobs == GM_ENABLED ? job_uniq : NULL),
+                   temp_buffer,
+                   prio,
+                   TRUE,
+                   SERVICE_CHECK,
+                   svc
+                  ) == GM_OK) {
         gm_log( GM_LOG_TRACE, "handle_svc_check() finished successfully\n" );
     }
     else {
@@ -1279,12 +1579,11 @@ static int handle_svc_check( int event_type, void *data ) {
 #ifdef CHECK_OPTION_ORPHAN_CHECK
     if(mod_gm_opt->orphan_service_checks == GM_ENABLED && check_options & CHECK_OPTION_ORPHAN_CHECK) {
         gm_log( GM_LOG_DEBUG, "service check for %s - %s orphaned\n", svc->host_name, svc->description );
-        if ( ( chk_result = ( check_result * )gm_malloc( sizeof *chk_result ) ) == 0 )
-            return NEBERROR_CALLBACKCANCEL;
+        chk_result = mod_gm_new_result();
         snprintf( temp_buffer,GM_BUFFERSIZE-1,"(service check orphaned, is the mod-gearman worker on queue '%s' running?)\n", target_queue);
         init_check_result(chk_result);
-        chk_result->host_name           = gm_strdup( svc->host_name );
-        chk_result->service_description = gm_strdup( svc->description );
+        chk_result->host_name           = mod_gm_result_strdup( chk_result, svc->host_name );
+        chk_result->service_description = mod_gm_result_strdup( chk_result, svc->description );
         chk_result->scheduled_check     = TRUE;
 #ifdef NAGIOS
         chk_result->reschedule_check    = TRUE;
@@ -1294,7 +1593,7 @@ static int handle_svc_check( int event_type, void *data ) {
 #endif
         chk_result->output_file         = 0;
         chk_result->output_file_fp      = NULL;
-        chk_result->output              = gm_strdup(temp_buffer);
+        chk_result->output              = mod_gm_result_strdup( chk_result, temp_buffer );
         chk_result->return_code         = mod_gm_opt->orphan_return;
         chk_result->check_options       = CHECK_OPTION_NONE;
         chk_result->object_check_type   = SERVICE_CHECK;
@@ -1384,6 +1683,10 @@ static int verify_options(mod_gm_opt_t *opt) {
     if ( opt->result_queue == NULL )
         opt->result_queue = GM_DEFAULT_RESULT_QUEUE;
 
+    /* resume result threads at 3/4 of the backlog by default */
+    if ( opt->result_backlog > 0 && ( opt->result_backlog_resume == 0 || opt->result_backlog_resume >= opt->result_backlog ))
+        opt->result_backlog_resume = opt->result_backlog * 3 / 4;
+
     /* nothing set by hand -> defaults */
     if( opt->set_queues_by_hand == 0 ) {
         gm_log( GM_LOG_DEBUG, "starting client with default queues\n" );
@@ -1396,8 +1699,272 @@ static int verify_options(mod_gm_opt_t *opt) {
 }
 
 
-/* return the prefered target function for our worker */
+/* return the prefered target function for our worker, cached per object */
 static void set_target_queue( host *hst, service *svc ) {
+#ifdef GM_ROUTE_CACHE
+    gm_object_cache_t * entry = object_cache( hst, svc );
+    int len;
+
+    if( entry != NULL && entry->route != GM_ROUTE_UNKNOWN ) {
+        if( entry->route == GM_ROUTE_NONE ) {
+            target_queue[0] = '\x0';
+        } else {
+            len = strlen(route_names[entry->route - 2]);
+            memcpy(target_queue, route_names[entry->route - 2], len+1);
+        }
+        return;
+    }
+#endif
+
+    resolve_target_queue( hst, svc );
+
+#ifdef GM_ROUTE_CACHE
+    if( entry != NULL )
+        entry->route = intern_route( target_queue );
+#endif
+    return;
+}
+
+
+/* write the static fields of a check job, returns its length */
+static size_t build_job_prefix( host *hst, service *svc, int binary, char *buf, size_t size ) {
+    gm_payload_writer_t writer;
+    size_t len;
+
+    if(binary) {
+        /* fields only, the header is written per job */
+        mod_gm_payload_begin(&writer, buf, size);
+        mod_gm_payload_add_str(&writer, GM_KEY_TYPE, svc ? "service" : "host");
+        mod_gm_payload_add_str(&writer, GM_KEY_RESULT_QUEUE, mod_gm_opt->result_queue);
+        mod_gm_payload_add_str(&writer, GM_KEY_HOST_NAME, hst->name);
+        if( svc )
+            mod_gm_payload_add_str(&writer, GM_KEY_SERVICE_DESCRIPTION, svc->description);
+        len = writer.len - GM_PAYLOAD_HEADER_LEN;
+        memmove(buf, buf + GM_PAYLOAD_HEADER_LEN, len);
+        return len;
+    }
+
+    if( svc )
+        len = snprintf( buf, size, "type=service\nresult_queue=%s\nhost_name=%s\nservice_description=%s\n", mod_gm_opt->result_queue, hst->name, svc->description );
+    else
+        len = snprintf( buf, size, "type=host\nresult_queue=%s\nhost_name=%s\n", mod_gm_opt->result_queue, hst->name );
+    if( len >= size )
+        len = size - 1;
+    return len;
+}
+
+
+/* write check job into temp_buffer, only the dynamic fields are formated per check. Returns the uniq key */
+static char * build_check_job( host *hst, service *svc, time_t next_check, struct timeval *core_time, int timeout, char *command_line ) {
+    char prefix[GM_BUFFERSIZE];
+    char * job_prefix = prefix;
+    char * job_uniq   = uniq;
+    size_t len = 0;
+    int binary = use_binary_payload( target_queue );
+#ifdef GM_ROUTE_CACHE
+    gm_object_cache_t * entry = object_cache( hst, svc );
+
+    if( entry != NULL ) {
+        /* rebuild the prefix when the target queue moved to another format */
+        if( entry->prefix != NULL && entry->prefix_binary != binary ) {
+            free( entry->prefix );
+            entry->prefix = NULL;
+        }
+        if( entry->prefix == NULL ) {
+            entry->prefix_len    = build_job_prefix( hst, svc, binary, prefix, sizeof(prefix) );
+            entry->prefix        = gm_malloc( entry->prefix_len + 1 );
+            entry->prefix_binary = binary;
+            memcpy( entry->prefix, prefix, entry->prefix_len );
+        }
+        if( svc != NULL && entry->uniq == NULL ) {
+            snprintf( uniq, GM_BUFFERSIZE-1, "%s-%s", hst->name, svc->description );
+            entry->uniq = gm_strdup( uniq );
+        }
+        job_prefix = entry->prefix;
+        job_uniq   = entry->uniq;
+        len        = entry->prefix_len;
+    } else
+#endif
+    {
+        len = build_job_prefix( hst, svc, binary, prefix, sizeof(prefix) );
+        if( svc != NULL )
+            snprintf( uniq, GM_BUFFERSIZE-1, "%s-%s", hst->name, svc->description );
+    }
+    if( svc == NULL )
+        job_uniq = hst->name;
+
+    if(binary) {
+        gm_payload_writer_t writer;
+        struct timeval next_check_time = { next_check, 0 };
+        mod_gm_payload_begin(&writer, temp_buffer, GM_BUFFERSIZE);
+        mod_gm_payload_add_raw(&writer, job_prefix, len);
+        mod_gm_payload_add_timeval(&writer, GM_KEY_NEXT_CHECK, &next_check_time);
+        mod_gm_payload_add_timeval(&writer, GM_KEY_CORE_TIME, core_time);
+        mod_gm_payload_add_int(&writer, GM_KEY_TIMEOUT, timeout);
+        mod_gm_payload_add_str(&writer, GM_KEY_COMMAND_LINE, command_line);
+        mod_gm_payload_end(&writer);
+    } else {
+        memcpy( temp_buffer, job_prefix, len );
+        snprintf( temp_buffer+len, GM_BUFFERSIZE-1-len, "start_time=%ld.0\nnext_check=%ld.0\ncore_time=%ld.%06ld\ntimeout=%d\ncommand_line=%s\n\n\n",
+                  (long)next_check,
+                  (long)next_check,
+                  (long)core_time->tv_sec,
+                  (long)core_time->tv_usec,
+                  timeout,
+                  command_line
+                );
+    }
+
+    return job_uniq;
+}
+
+
+#ifdef GM_ROUTE_CACHE
+/* return cache entry for host or service, NULL if the object is unknown */
+static gm_object_cache_t * object_cache( host *hst, service *svc ) {
+    if( svc != NULL )
+        return( svc->id < service_cache_num ? &service_cache[svc->id] : NULL );
+    return( hst->id < host_cache_num ? &host_cache[hst->id] : NULL );
+}
+
+
+/* string hash for the route names */
+static unsigned int route_hash_key( const char * name ) {
+    unsigned int h = 5381;
+    while( *name )
+        h = h * 33 + (unsigned char)*name++;
+    return h;
+}
+
+
+/* return route index for the queue name, adds it if unknown */
+static int intern_route( const char * name ) {
+    unsigned int h;
+    int x;
+
+    if( name[0] == '\x0' )
+        return GM_ROUTE_NONE;
+
+    /* keep the hash table at most half full */
+    if( route_names_num * 2 >= route_hash_size ) {
+        free(route_hash);
+        route_hash_size = route_hash_size == 0 ? 64 : route_hash_size * 2;
+        route_hash = gm_malloc( route_hash_size * sizeof(int) );
+        for( x = 0; x < route_hash_size; x++ )
+            route_hash[x] = -1;
+        for( x = 0; x < route_names_num; x++ ) {
+            h = route_hash_key( route_names[x] ) & (route_hash_size - 1);
+            while( route_hash[h] != -1 )
+                h = (h + 1) & (route_hash_size - 1);
+            route_hash[h] = x;
+        }
+    }
+
+    h = route_hash_key( name ) & (route_hash_size - 1);
+    while( route_hash[h] != -1 ) {
+        if( !strcmp( route_names[route_hash[h]], name ) )
+            return route_hash[h] + 2;
+        h = (h + 1) & (route_hash_size - 1);
+    }
+
+    if( route_names_num == route_names_size ) {
+        route_names_size = route_names_size == 0 ? 32 : route_names_size * 2;
+        route_names = gm_realloc( route_names, route_names_size * sizeof(char *) );
+    }
+    route_names[route_names_num] = gm_strdup( name );
+    route_hash[h] = route_names_num;
+    route_names_num++;
+    return route_names_num + 1;
+}
+
+
+/* resolve target queues for all hosts and services */
+static void build_route_cache(void) {
+    unsigned int x;
+
+    free_route_cache();
+    host_cache_num    = num_objects.hosts;
+    service_cache_num = num_objects.services;
+    host_cache        = gm_calloc( host_cache_num + 1, sizeof(gm_object_cache_t) );
+    service_cache     = gm_calloc( service_cache_num + 1, sizeof(gm_object_cache_t) );
+
+    for( x = 0; x < host_cache_num; x++ )
+        set_target_queue( host_ary[x], NULL );
+    for( x = 0; x < service_cache_num; x++ )
+        set_target_queue( service_ary[x]->host_ptr, service_ary[x] );
+
+    gm_log( GM_LOG_DEBUG, "resolved target queues for %u hosts and %u services into %d queues\n", host_cache_num, service_cache_num, route_names_num );
+}
+
+
+/* free cache entries */
+static void free_cache_entries( gm_object_cache_t * cache, unsigned int num ) {
+    unsigned int x;
+    for( x = 0; x < num; x++ ) {
+        free( cache[x].prefix );
+        free( cache[x].uniq );
+    }
+    free( cache );
+}
+
+
+/* free routing cache */
+static void free_route_cache(void) {
+    int x;
+    for( x = 0; x < route_names_num; x++ )
+        free( route_names[x] );
+    free( route_names );
+    free( route_hash );
+    free_cache_entries( host_cache, host_cache_num );
+    free_cache_entries( service_cache, service_cache_num );
+    route_names       = NULL;
+    route_hash        = NULL;
+    host_cache        = NULL;
+    service_cache     = NULL;
+    route_names_num   = 0;
+    route_names_size  = 0;
+    route_hash_size   = 0;
+    host_cache_num    = 0;
+    service_cache_num = 0;
+}
+
+
+/* forget cached routes when custom variables change */
+static int handle_adaptive_data( int event_type, void *data ) {
+    nebstruct_adaptive_host_data * ahd;
+    nebstruct_adaptive_service_data * asd;
+    servicesmember * sm;
+    host * hst;
+    service * svc;
+
+    if( event_type == NEBCALLBACK_ADAPTIVE_HOST_DATA ) {
+        ahd = (nebstruct_adaptive_host_data *)data;
+        hst = (host *)ahd->object_ptr;
+        if( hst == NULL || !(ahd->modified_attribute & MODATTR_CUSTOM_VARIABLE) )
+            return NEB_OK;
+        if( hst->id < host_cache_num )
+            host_cache[hst->id].route = GM_ROUTE_UNKNOWN;
+        /* services inherit the queue from host custom variables */
+        for( sm = hst->services; sm != NULL; sm = sm->next ) {
+            if( sm->service_ptr != NULL && sm->service_ptr->id < service_cache_num )
+                service_cache[sm->service_ptr->id].route = GM_ROUTE_UNKNOWN;
+        }
+    }
+    else if( event_type == NEBCALLBACK_ADAPTIVE_SERVICE_DATA ) {
+        asd = (nebstruct_adaptive_service_data *)data;
+        svc = (service *)asd->object_ptr;
+        if( svc == NULL || !(asd->modified_attribute & MODATTR_CUSTOM_VARIABLE) )
+            return NEB_OK;
+        if( svc->id < service_cache_num )
+            service_cache[svc->id].route = GM_ROUTE_UNKNOWN;
+    }
+    return NEB_OK;
+}
+#endif
+
+
+/* resolve the prefered target function from groups and custom variables */
+static void resolve_target_queue( host *hst, service *svc ) {
     int x=0;
     customvariablesmember *temp_customvariablesmember = NULL;
 
@@ -1514,6 +2081,98 @@ static void start_threads(void) {
             pthread_create ( &result_thr[x], NULL, result_worker, (void *)&result_threads_running);
         }
     }
+
+    /* create batch sender */
+    if ( mod_gm_opt->batch_submit == GM_ENABLED ) {
+        if ( mod_gm_submit_start( mod_gm_opt ) != GM_OK ) {
+            gm_log( GM_LOG_ERROR, "cannot start batch submission, sending jobs directly\n" );
+        }
+    }
+}
+
+
+#ifdef GM_RESULT_WAKEUP
+/* watch the wake up pipe in the event loop, fall back to a timed event */
+static void register_result_wakeup(void) {
+    int rc;
+
+    if(result_wakeup.fd[0] != -1) {
+        rc = iobroker_register(nagios_iobs, result_wakeup.fd[0], NULL, handle_result_wakeup);
+        if(rc == 0) {
+            result_wakeup_registered = TRUE;
+            gm_log( GM_LOG_DEBUG, "results are moved to the core as soon as they arrive\n" );
+            return;
+        }
+        gm_log( GM_LOG_ERROR, "cannot register result wake up: %s\n", iobroker_strerror(rc) );
+    }
+    schedule_event(1, move_results_to_core, NULL);
+}
+
+
+/* result threads added new results */
+static int handle_result_wakeup(int fd, int events, void * arg) {
+    /* not used */
+    fd     = fd;
+    events = events;
+    arg    = arg;
+
+    mod_gm_wakeup_clear(&result_wakeup);
+    /* give the core a chance to run its events before processing the remaining results */
+    if(process_results(GM_RESULT_WAKEUP_MAX))
+        mod_gm_wakeup_signal(&result_wakeup);
+    return 0;
+}
+#endif
+
+
+/* hand job to the batch sender, send it directly if that is not possible */
+static int submit_job( char * queue, char * job_uniq, char * data, int priority, int send, int type, void * object ) {
+    if ( mod_gm_submit_job( queue, job_uniq, data, priority, type, object ) == GM_OK )
+        return GM_OK;
+    return add_job_to_queue( &client,
+                             mod_gm_opt->server_list,
+                             queue,
+                             job_uniq,
+                             data,
+                             priority,
+                             GM_DEFAULT_JOB_RETRIES,
+                             mod_gm_opt->transportmode,
+                             send
+                           );
+}
+
+
+/* checks gearmand did not accept are still marked executing,
+ * clear the flag and reschedule them like the core does when
+ * a check gets cancelled */
+static void reschedule_failed_jobs(void) {
+    host * hst;
+    service * svc;
+    void * object;
+    time_t now;
+    int type, num = 0;
+
+    now = time(NULL);
+    while(mod_gm_submit_failed(&type, &object)) {
+        num++;
+        if(type == HOST_CHECK) {
+            hst = (host *)object;
+            hst->is_executing = FALSE;
+#ifndef USENAEMON
+            /* naemon already scheduled the next check before running this one */
+            schedule_host_check(hst, now + (hst->check_interval > 0 ? (time_t)(hst->check_interval * interval_length) : 300), CHECK_OPTION_NONE);
+#endif
+        } else {
+            svc = (service *)object;
+            svc->is_executing = FALSE;
+#ifndef USENAEMON
+            schedule_service_check(svc, now + (svc->check_interval > 0 ? (time_t)(svc->check_interval * interval_length) : 300), CHECK_OPTION_NONE);
+#endif
+        }
+    }
+
+    if(num > 0)
+        gm_log( GM_LOG_ERROR, "gearmand did not accept %d checks, rescheduled them\n", num );
 }
 
 
@@ -1649,16 +2308,14 @@ int handle_perfdata(int event_type, void *data) {
         for (i = 0; i < mod_gm_opt->perfdata_queues_num; i++) {
             char *perfdata_queue = mod_gm_opt->perfdata_queues_list[i];
             /* add our job onto the queue */
-            if(add_job_to_queue( &client,
-                                 mod_gm_opt->server_list,
-                                 perfdata_queue,
-                                 (mod_gm_opt->perfdata_mode == GM_PERFDATA_OVERWRITE ? uniq : NULL),
-                                 temp_buffer,
-                                 GM_JOB_PRIO_NORMAL,
-                                 GM_DEFAULT_JOB_RETRIES,
-                                 mod_gm_opt->transportmode,
-                                 TRUE
-                                ) == GM_OK) {
+            if(submit_job( perfdata_queue,
+                           (mod_gm_opt->perfdata_mode == GM_PERFDATA_OVERWRITE ? uniq : NULL),
+                           temp_buffer,
+                           GM_JOB_PRIO_NORMAL,
+                           TRUE,
+                           0,
+                           NULL
+                          ) == GM_OK) {
                 gm_log( GM_LOG_TRACE, "handle_perfdata() successfully added data to %s\n", perfdata_queue );
             }
             else {
@@ -1789,16 +2446,14 @@ int handle_export(int callback_type, void *data) {
 
         for(i=0;i<mod_gm_opt->exports[callback_type]->elem_number;i++) {
             return_code = mod_gm_opt->exports[callback_type]->return_code[i];
-            add_job_to_queue( &client,
-                              mod_gm_opt->server_list,
-                              mod_gm_opt->exports[callback_type]->name[i], /* queue name */
-                              NULL,
-                              temp_buffer,
-                              GM_JOB_PRIO_NORMAL,
-                              GM_DEFAULT_JOB_RETRIES,
-                              mod_gm_opt->transportmode,
-                              send_now
-                            );
+            submit_job( mod_gm_opt->exports[callback_type]->name[i], /* queue name */
+                        NULL,
+                        temp_buffer,
+                        GM_JOB_PRIO_NORMAL,
+                        send_now,
+                        0,
+                        NULL
+                       );
         }
     }
 
@@ -27,6 +27,7 @@
 #include "utils.h"
 #include "mod_gearman.h"
 #include "gearman_utils.h"
+#include "gm_payload.h"
 
 #ifdef USENAEMON
 static const char *gearman_worker_source_name(void *source) {
@@ -45,6 +46,8 @@ static struct check_engine mod_gearman_check_engine = {
 };
 #endif
 
+static int process_result( gearman_job_st *job, char *data, size_t size, struct timeval *now, char **debug_data );
+
 /* cleanup and exit this thread */
 static void cancel_worker_thread (void * data) {
 
@@ -59,6 +62,12 @@ static void cancel_worker_thread (void * data) {
     return;
 }
 
+/* hand the cached results of this thread back to the pool */
+static void flush_result_cache (__attribute__((__unused__)) void * data) {
+    mod_gm_flush_results();
+    return;
+}
+
 /* callback for task completed */
 void *result_worker( void * data ) {
     gearman_worker_st worker;
@@ -73,8 +82,12 @@ void *result_worker( void * data ) {
     set_worker(&worker);
 
     pthread_cleanup_push ( cancel_worker_thread, (void*) &worker);
+    pthread_cleanup_push ( flush_result_cache, NULL );
 
     while ( 1 ) {
+        /* leave the results in gearmand while the core is behind */
+        mod_gm_result_backlog_wait();
+
         ret = gearman_worker_work( &worker );
         if ( ret != GEARMAN_SUCCESS && ret != GEARMAN_WORK_FAIL ) {
             if ( ret != GEARMAN_TIMEOUT)
@@ -92,24 +105,20 @@ void *result_worker( void * data ) {
         }
     }
 
+    pthread_cleanup_pop(0);
     pthread_cleanup_pop(0);
     return NULL;
 }
 
 /* put back the result into the core */
 void *get_results( gearman_job_st *job, void *context, size_t *result_size, gearman_return_t *ret_ptr ) {
-    int wsize, transportmode;
-    char *workload;
+    int wsize, dsize, transportmode, failed;
+    const char *workload;
     char *decrypted_data;
-    char *decrypted_data_c;
-#ifdef GM_DEBUG
-    char *decrypted_orig;
-#endif
-    struct timeval now, core_start_time;
-    check_result * chk_result;
-    int active_check = TRUE;
-    char *ptr;
-    double now_f, core_starttime_f, starttime_f, finishtime_f, exec_time, latency;
+    char *decrypted_orig = NULL;
+    struct timeval now;
+    gm_strview_t result;
+    size_t pos;
 
     /* for calculating real latency */
     gettimeofday(&now,NULL);
@@ -123,34 +132,32 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
     /* set result pointer to success */
     *ret_ptr = GEARMAN_SUCCESS;
 
-    /* get the data */
+    /* get the data, decoded directly from the gearman buffer */
     wsize = gearman_job_workload_size(job);
-    workload = gm_malloc(sizeof(char*)*wsize+1);
-    strncpy(workload, (const char*)gearman_job_workload(job), wsize);
-    workload[wsize] = '\x0';
+    workload = (const char*)gearman_job_workload(job);
     gm_log( GM_LOG_TRACE, "got result %s\n", gearman_job_handle( job ));
-    gm_log( GM_LOG_TRACE, "%d +++>\n%s\n<+++\n", strlen(workload), workload );
+    gm_log( GM_LOG_TRACE, "%d +++>\n%.*s\n<+++\n", wsize, wsize, workload );
 
     /* decrypt data */
-    decrypted_data   = gm_malloc(wsize*2);
-    decrypted_data_c = decrypted_data;
+    decrypted_data   = gm_malloc(wsize+1);
 
     if(mod_gm_opt->transportmode == GM_ENCODE_AND_ENCRYPT && mod_gm_opt->accept_clear_results == GM_ENABLED) {
         transportmode = GM_ENCODE_ACCEPT_ALL;
+    } else if(mod_gm_opt->transportmode == GM_ENCODE_AND_ENCRYPT_GCM && mod_gm_opt->accept_clear_results == GM_ENABLED) {
+        transportmode = GM_ENCODE_GCM_ACCEPT_ALL;
     } else {
         transportmode = mod_gm_opt->transportmode;
     }
-    mod_gm_decrypt(&decrypted_data, workload, transportmode);
+    dsize = mod_gm_decrypt_len(&decrypted_data, workload, wsize, transportmode);
 
     if(decrypted_data == NULL) {
         *ret_ptr = GEARMAN_WORK_FAIL;
         return NULL;
     }
-    gm_log( GM_LOG_TRACE, "%d --->\n%s\n<---\n", strlen(decrypted_data), decrypted_data );
+    gm_log( GM_LOG_TRACE, "%d --->\n%s\n<---\n", dsize, decrypted_data );
 #ifdef GM_DEBUG
     decrypted_orig   = gm_strdup(decrypted_data);
 #endif
-    free(workload);
 
     /*
      * save this result to a file, so when nagios crashes,
@@ -167,17 +174,45 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
     }
 #endif
 
-    /* nagios will free it after processing */
-    if ( ( chk_result = ( check_result * )gm_malloc( sizeof *chk_result ) ) == 0 ) {
+    /* multi result jobs contain a complete binary payload for each result */
+    pos = 0;
+    if(mod_gm_payload_next(decrypted_data, dsize, GM_KEY_RESULT, &pos, &result)) {
+        failed = 0;
+        do {
+            /* nested results are parsed in place, only binary ones know their end */
+            if(!mod_gm_payload_is_binary(result.ptr, result.len) || process_result(job, result.ptr, result.len, &now, &decrypted_orig) != GM_OK)
+                failed++;
+        } while(mod_gm_payload_next(decrypted_data, dsize, GM_KEY_RESULT, &pos, &result));
+        if(failed > 0)
+            gm_log( GM_LOG_ERROR, "discarded %d invalid results of job (%s)\n", failed, gearman_job_handle( job ) );
+    }
+    else if(process_result(job, decrypted_data, dsize, &now, &decrypted_orig) != GM_OK) {
         *ret_ptr = GEARMAN_WORK_FAIL;
+    }
+
+    free(decrypted_data);
 #ifdef GM_DEBUG
     free(decrypted_orig);
 #endif
-#ifdef USENAEMON
-        free(decrypted_data);
-#endif
-        return NULL;
-    }
+
+    return NULL;
+}
+
+
+/* add a single result to the result list, returns GM_ERROR for invalid results */
+static int process_result( gearman_job_st *job, char *data, size_t size, struct timeval *now, char **debug_data ) {
+    struct timeval core_start_time;
+    check_result * chk_result;
+    int active_check = TRUE;
+    gm_payload_t payload;
+    gm_strview_t *field;
+    double now_f, core_starttime_f, starttime_f, finishtime_f, exec_time, latency;
+
+    /* only used for debugging */
+    debug_data = debug_data;
+
+    /* released after processing, strings are kept along with the result */
+    chk_result = mod_gm_new_result();
     init_check_result(chk_result);
     chk_result->scheduled_check     = TRUE;
 #ifdef USENAGIOS
@@ -191,79 +226,49 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
     core_start_time.tv_sec          = 0;
     core_start_time.tv_usec         = 0;
 
-    while ( (ptr = strsep(&decrypted_data, "\n" )) != NULL ) {
-        char *key   = strsep( &ptr, "=" );
-        char *value = strsep( &ptr, "\x0" );
-
-        if ( key == NULL )
-            continue;
-
-        if ( !strcmp( key, "output" ) ) {
-            if ( value == NULL ) {
-                chk_result->output = gm_strdup("(null)");
-            }
-            else {
-
-                char *tmp_newline = replace_str(value, "\\n", "\n");
-                if (tmp_newline == NULL)
-                    chk_result->output = gm_strdup("(null)");
-
-                char *tmp_backslash = replace_str(tmp_newline, "\\\\", "\\");
-                if (tmp_backslash == NULL)
-                    chk_result->output = gm_strdup("(null)");
-                else
-                    chk_result->output = gm_strdup( tmp_backslash );
-
-                free(tmp_newline);
-                free(tmp_backslash);
-            }
-        }
-
-        if ( value == NULL || !strcmp( value, "") )
-            break;
+    /* tokenize in place, only strings handed over to the core are copied */
+    mod_gm_parse_payload(&payload, data, size);
+
+    field = &payload.field[GM_KEY_OUTPUT];
+    if ( field->ptr != NULL ) {
+        /* binary payloads contain the raw output */
+        if ( !payload.binary )
+            field->len = mod_gm_payload_unescape(field->ptr, field->len);
+        chk_result->output = mod_gm_result_strndup( chk_result, field->ptr, field->len );
+    } else if ( payload.stop_key == GM_KEY_OUTPUT ) {
+        /* output without value */
+        chk_result->output = mod_gm_result_strdup( chk_result, payload.stop_value == NULL ? "(null)" : "" );
+    }
 
-        if ( !strcmp( key, "host_name" ) ) {
-            chk_result->host_name = gm_strdup( value );
-        } else if ( !strcmp( key, "service_description" ) ) {
-            chk_result->service_description = gm_strdup( value );
-        } else if ( !strcmp( key, "source" ) ) {
+    field = &payload.field[GM_KEY_HOST_NAME];
+    if ( field->ptr != NULL )
+        chk_result->host_name = mod_gm_result_strndup( chk_result, field->ptr, field->len );
+    field = &payload.field[GM_KEY_SERVICE_DESCRIPTION];
+    if ( field->ptr != NULL )
+        chk_result->service_description = mod_gm_result_strndup( chk_result, field->ptr, field->len );
 #ifdef USENAEMON
-            chk_result->source = value;
+    /* only checked for being set, see gearman_worker_source_name() */
+    chk_result->source = payload.field[GM_KEY_SOURCE].ptr;
 #endif
-        } else if ( !strcmp( key, "check_options" ) ) {
-            chk_result->check_options = atoi( value );
-        } else if ( !strcmp( key, "scheduled_check" ) ) {
-            chk_result->scheduled_check = atoi( value );
-        } else if ( !strcmp( key, "type" ) && !strcmp( value, "passive" ) ) {
-            active_check=FALSE;
-        } else if ( !strcmp( key, "reschedule_check" ) ) {
+    chk_result->check_options   = mod_gm_payload_int( &payload, GM_KEY_CHECK_OPTIONS, chk_result->check_options );
+    chk_result->scheduled_check = mod_gm_payload_int( &payload, GM_KEY_SCHEDULED_CHECK, chk_result->scheduled_check );
+    if ( payload.field[GM_KEY_TYPE].ptr != NULL && !strcmp( payload.field[GM_KEY_TYPE].ptr, "passive" ) )
+        active_check = FALSE;
 #ifdef USENAGIOS
-            chk_result->reschedule_check = atoi( value );
+    chk_result->reschedule_check = mod_gm_payload_int( &payload, GM_KEY_RESCHEDULE_CHECK, chk_result->reschedule_check );
 #endif
-        } else if ( !strcmp( key, "exited_ok" ) ) {
-            chk_result->exited_ok = atoi( value );
-        } else if ( !strcmp( key, "early_timeout" ) ) {
-            chk_result->early_timeout = atoi( value );
-        } else if ( !strcmp( key, "return_code" ) ) {
-            chk_result->return_code = atoi( value );
-        } else if ( !strcmp( key, "core_start_time" ) ) {
-            string2timeval(value, &core_start_time);
-        } else if ( !strcmp( key, "start_time" ) ) {
-            string2timeval(value, &chk_result->start_time);
-        } else if ( !strcmp( key, "finish_time" ) ) {
-            string2timeval(value, &chk_result->finish_time);
-        } else if ( !strcmp( key, "latency" ) ) {
-            chk_result->latency = atof( value );
-        }
-    }
+    chk_result->exited_ok       = mod_gm_payload_int( &payload, GM_KEY_EXITED_OK, chk_result->exited_ok );
+    chk_result->early_timeout   = mod_gm_payload_int( &payload, GM_KEY_EARLY_TIMEOUT, chk_result->early_timeout );
+    chk_result->return_code     = mod_gm_payload_int( &payload, GM_KEY_RETURN_CODE, chk_result->return_code );
+    chk_result->latency         = mod_gm_payload_double( &payload, GM_KEY_LATENCY, chk_result->latency );
+    mod_gm_payload_timeval( &payload, GM_KEY_CORE_START_TIME, &core_start_time );
+    mod_gm_payload_timeval( &payload, GM_KEY_START_TIME, &chk_result->start_time );
+    mod_gm_payload_timeval( &payload, GM_KEY_FINISH_TIME, &chk_result->finish_time );
 
     if ( chk_result->host_name == NULL || chk_result->output == NULL ) {
-        *ret_ptr= GEARMAN_WORK_FAIL;
         gm_log( GM_LOG_ERROR, "discarded invalid job (%s), check your encryption settings\n", gearman_job_handle( job ) );
-#ifdef GM_DEBUG
-    free(decrypted_orig);
-#endif
-        return NULL;
+        mod_gm_free_result( chk_result );
+        return GM_ERROR;
     }
 
     if ( chk_result->service_description != NULL ) {
@@ -290,7 +295,7 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
     }
 
     /* calculate real latency */
-    now_f            = timeval2double(&now);
+    now_f            = timeval2double(now);
     core_starttime_f = timeval2double(&core_start_time);
     starttime_f      = timeval2double(&chk_result->start_time);
     finishtime_f     = timeval2double(&chk_result->finish_time);
@@ -306,7 +311,7 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
 
 #ifdef GM_DEBUG
     if(chk_result->latency > 1000)
-        write_debug_file(&decrypted_orig);
+        write_debug_file(debug_data);
 #endif
 
     /* this check is not a freshnes check */
@@ -317,9 +322,10 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
         /* does this services exist */
         service * svc = find_service( chk_result->host_name, chk_result->service_description );
         if(svc == NULL) {
-            write_debug_file(&decrypted_orig);
+            write_debug_file(debug_data);
             gm_log( GM_LOG_ERROR, "service '%s' on host '%s' could not be found\n", chk_result->service_description, chk_result->host_name );
-            return NULL;
+            mod_gm_free_result( chk_result );
+            return GM_OK;
         }
 #endif
         gm_log( GM_LOG_DEBUG, "service job completed: %s %s: exit %d, latency: %0.3f, exec_time: %0.3f\n", chk_result->host_name, chk_result->service_description, chk_result->return_code, chk_result->latency, exec_time );
@@ -329,9 +335,10 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
 /* TODO: this is done by core already! no need to do this twice */
         host * hst = find_host( chk_result->host_name );
         if(hst == NULL) {
-            write_debug_file(&decrypted_orig);
+            write_debug_file(debug_data);
             gm_log( GM_LOG_ERROR, "host '%s' could not be found\n", chk_result->host_name );
-            return NULL;
+            mod_gm_free_result( chk_result );
+            return GM_OK;
         }
 #endif
 #if defined(USENAEMON)
@@ -348,15 +355,7 @@ void *get_results( gearman_job_st *job, void *context, size_t *result_size, gear
     /* add result to result list */
     mod_gm_add_result_to_list( chk_result );
 
-    /* reset pointer */
-    chk_result = NULL;
-
-    free(decrypted_data_c);
-#ifdef GM_DEBUG
-    free(decrypted_orig);
-#endif
-
-    return NULL;
+    return GM_OK;
 }
 
 
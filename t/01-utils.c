@@ -3,14 +3,23 @@
 #include <string.h>
 #include <unistd.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <t/tap.h>
 #include <common.h>
 #include <utils.h>
 #include <check_utils.h>
+#include <gm_crypt.h>
+#include <base64.h>
+#include <gm_payload.h>
+#include <gm_submit.h>
 
 #include <worker_dummy_functions.c>
 
+#define AES_RANDOM_RUNS 100     /* random sized messages per aes backend comparison */
+#define AES_RANDOM_SIZE 4500    /* maximum random message size, leaves room for padding in the 5000 byte buffers */
+
 void printf_hex(char*, int);
 void printf_hex(char* text, int length) {
     int i;
@@ -20,6 +29,34 @@ void printf_hex(char* text, int length) {
     return;
 }
 
+void hex2bin(const char*, unsigned char*);
+void hex2bin(const char* hex, unsigned char* bin) {
+    unsigned int c;
+    for(; hex[0] && hex[1]; hex += 2) {
+        sscanf(hex, "%2x", &c);
+        *bin++ = (unsigned char)c;
+    }
+    return;
+}
+
+/* consumer side of the ring stress test, returns number of out of order elements */
+void *ring_consumer(void *);
+void *ring_consumer(void *data) {
+    gm_ring_t *ring = (gm_ring_t *)data;
+    long expected = 1, errors = 0;
+    void *elem;
+    while(expected <= 100000) {
+        if((elem = mod_gm_ring_pop(ring)) == NULL) {
+            sched_yield();
+            continue;
+        }
+        if((long)elem != expected)
+            errors++;
+        expected++;
+    }
+    return (void *)errors;
+}
+
 mod_gm_opt_t * renew_opts(void);
 mod_gm_opt_t * renew_opts() {
     mod_gm_opt_t *mod_gm_opt;
@@ -30,11 +67,42 @@ mod_gm_opt_t * renew_opts() {
     return mod_gm_opt;
 }
 
+/* batch submit to a port nobody listens on, returns the number of handed back jobs */
+int submit_to_closed_port(void);
+int submit_to_closed_port() {
+    char server[] = "server=127.0.0.1:1";
+    int type = 0, num = 0, i;
+    void *object = NULL;
+
+    /* the gearman client reads the global options */
+    mod_gm_opt = renew_opts();
+    parse_args_line(mod_gm_opt, server, 0);
+    mod_gm_opt->batch_submit_interval = 10;
+    if(mod_gm_submit_start(mod_gm_opt) == GM_OK) {
+        mod_gm_submit_job("service", NULL, "type=service\n", GM_JOB_PRIO_NORMAL, 2, &num);
+        mod_gm_submit_job("perfdata", NULL, "type=perfdata\n", GM_JOB_PRIO_NORMAL, 0, NULL);
+        for(i = 0; i < 1000 && num == 0; i++) {
+            while(mod_gm_submit_failed(&type, &object)) {
+                if(type != 2 || object != &num)
+                    num = -1000;
+                num++;
+            }
+            if(num == 0)
+                usleep(10000);
+        }
+        mod_gm_submit_stop();
+    }
+    mod_gm_free_opt(mod_gm_opt);
+    mod_gm_opt = NULL;
+
+    return num;
+}
+
 int main(void) {
-    plan(73);
+    plan(135);
 
     /* lowercase */
-    char test[100];
+    char test[200];
     ok(lc(NULL) == NULL, "lc(NULL)");
     strcpy(test, "Yes"); like(lc(test), "yes", "lc(yes)");
     strcpy(test, "YES"); like(lc(test), "yes", "lc(YES)");
@@ -116,11 +184,51 @@ int main(void) {
 
     /* decrypt */
     char * decrypted = malloc(GM_BUFFERSIZE);
-    mod_gm_decrypt(&decrypted, encrypted, GM_ENCODE_AND_ENCRYPT);
+    len = mod_gm_decrypt(&decrypted, encrypted, GM_ENCODE_AND_ENCRYPT);
     like(decrypted, text, "decrypted text");
+    ok(len == (int)strlen(text), "length of decrypted text");
     free(decrypted);
     free(encrypted);
 
+    /* compare aes backends with random data, block size edge cases first, then random sizes */
+    int sizes[] = { 0, 1, 15, 16, 17, 63, 64, 65, 300, 4103 };
+    int x, same_enc = 1, same_dec = 1, len2, size;
+    int runs = (int)(sizeof(sizes)/sizeof(sizes[0])) + AES_RANDOM_RUNS;
+    unsigned int seed = time(NULL);
+    unsigned char *enc1, *enc2;
+    char *plain = malloc(5000), *dec = malloc(5000);
+    diag("random seed: %u", seed);
+    skip(mod_gm_aes_set_backend(GM_AES_BACKEND_AESNI) != GM_AES_BACKEND_AESNI, 2, "cpu has no aes-ni support");
+    for(x = 0; x < runs; x++) {
+        int i;
+        size = x < runs - AES_RANDOM_RUNS ? sizes[x] : (int)(rand_r(&seed) % AES_RANDOM_SIZE);
+        /* no null bytes, the plain aes functions work on strings */
+        for(i = 0; i < size; i++)
+            plain[i] = (char)(1 + rand_r(&seed) % 255);
+        plain[size] = '\0';
+        mod_gm_aes_set_backend(GM_AES_BACKEND_RIJNDAEL);
+        len  = mod_gm_aes_encrypt(&enc1, plain, strlen(plain));
+        mod_gm_aes_set_backend(GM_AES_BACKEND_AESNI);
+        len2 = mod_gm_aes_encrypt(&enc2, plain, strlen(plain));
+        if(len != len2 || memcmp(enc1, enc2, len) != 0)
+            same_enc = 0;
+        mod_gm_aes_decrypt(&dec, enc1, len);
+        if(strcmp(dec, plain) != 0)
+            same_dec = 0;
+        mod_gm_aes_set_backend(GM_AES_BACKEND_RIJNDAEL);
+        mod_gm_aes_decrypt(&dec, enc2, len2);
+        if(strcmp(dec, plain) != 0)
+            same_dec = 0;
+        free(enc1);
+        free(enc2);
+    }
+    ok(same_enc == 1, "aes-ni and rijndael encrypt identical");
+    ok(same_dec == 1, "aes-ni and rijndael decrypt each other");
+    endskip;
+    mod_gm_aes_set_backend(GM_AES_BACKEND_AESNI);
+    free(plain);
+    free(dec);
+
     /* base 64 */
     char * base64;
     len = mod_gm_encrypt(&base64, text, GM_ENCODE_ONLY);
@@ -129,11 +237,100 @@ int main(void) {
 
     /* debase 64 */
     char * debase64 = malloc(GM_BUFFERSIZE);
-    mod_gm_decrypt(&debase64, base64, GM_ENCODE_ONLY);
+    len = mod_gm_decrypt(&debase64, base64, GM_ENCODE_ONLY);
     like(debase64, text, "debase64 text");
+    ok(len == (int)strlen(text), "length of debase64 text");
     free(debase64);
     free(base64);
 
+    /* aes-256-gcm test vector from the gcm specification */
+    unsigned char gcm_key[32], gcm_iv[12], gcm_plain[64], gcm_cipher[64], gcm_tag[16], gcm_out[64], gcm_outtag[16];
+    hex2bin("feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308", gcm_key);
+    hex2bin("cafebabefacedbaddecaf888", gcm_iv);
+    hex2bin("d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+            "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255", gcm_plain);
+    hex2bin("522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+            "8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662898015ad", gcm_cipher);
+    hex2bin("b094dac5d93471bdec1a502270e3cc6c", gcm_tag);
+    mod_gm_aes_set_backend(GM_AES_BACKEND_RIJNDAEL);
+    mod_gm_aes_gcm_init(gcm_key);
+    mod_gm_aes_gcm(gcm_out, gcm_plain, 64, gcm_iv, gcm_outtag, 0);
+    ok(memcmp(gcm_out, gcm_cipher, 64) == 0 && memcmp(gcm_outtag, gcm_tag, 16) == 0, "aes-gcm test vector");
+    skip(mod_gm_aes_set_backend(GM_AES_BACKEND_AESNI) != GM_AES_BACKEND_AESNI, 1, "cpu has no aes-ni support");
+    mod_gm_aes_gcm(gcm_out, gcm_cipher, 64, gcm_iv, gcm_outtag, 1);
+    ok(memcmp(gcm_out, gcm_plain, 64) == 0 && memcmp(gcm_outtag, gcm_tag, 16) == 0, "aes-gcm test vector with aes-ni");
+    endskip;
+    mod_gm_crypt_init(key);
+
+    /* aes-256-gcm transport mode */
+    char * encrypted2;
+    decrypted = malloc(GM_BUFFERSIZE);
+    mod_gm_encrypt(&encrypted, text, GM_ENCODE_AND_ENCRYPT_GCM);
+    mod_gm_encrypt(&encrypted2, text, GM_ENCODE_AND_ENCRYPT_GCM);
+    ok(strcmp(encrypted, encrypted2) != 0, "aes-gcm uses a new nonce per message");
+    len = mod_gm_decrypt(&decrypted, encrypted, GM_ENCODE_AND_ENCRYPT_GCM);
+    like(decrypted, text, "aes-gcm decrypted text");
+    ok(len == (int)strlen(text), "length of aes-gcm decrypted text");
+    encrypted2[20] = encrypted2[20] == 'A' ? 'B' : 'A';
+    ok(mod_gm_decrypt(&decrypted, encrypted2, GM_ENCODE_AND_ENCRYPT_GCM) == 0 && decrypted[0] == '\0', "aes-gcm rejects modified message");
+    free(encrypted);
+    free(encrypted2);
+
+    /* compare aes-gcm backends */
+    same_dec = 1;
+    plain = malloc(5000);
+    skip(mod_gm_aes_set_backend(GM_AES_BACKEND_AESNI) != GM_AES_BACKEND_AESNI, 1, "cpu has no aes-ni support");
+    for(x = 0; x < runs; x++) {
+        int i;
+        size = x < runs - AES_RANDOM_RUNS ? sizes[x] : (int)(rand_r(&seed) % AES_RANDOM_SIZE);
+        for(i = 0; i < size; i++)
+            plain[i] = (char)(rand_r(&seed) % 256);
+        mod_gm_aes_set_backend(GM_AES_BACKEND_RIJNDAEL);
+        len  = mod_gm_aes_gcm_encrypt(&enc1, plain, size);
+        mod_gm_aes_set_backend(GM_AES_BACKEND_AESNI);
+        len2 = mod_gm_aes_gcm_encrypt(&enc2, plain, size);
+        dec  = (char *)enc1;
+        if(mod_gm_aes_gcm_decrypt(&dec, enc1, len) != size || memcmp(dec, plain, size) != 0)
+            same_dec = 0;
+        mod_gm_aes_set_backend(GM_AES_BACKEND_RIJNDAEL);
+        dec  = (char *)enc2;
+        if(mod_gm_aes_gcm_decrypt(&dec, enc2, len2) != size || memcmp(dec, plain, size) != 0)
+            same_dec = 0;
+        free(enc1);
+        free(enc2);
+    }
+    ok(same_dec == 1, "aes-ni and rijndael aes-gcm decrypt each other");
+    endskip;
+    mod_gm_aes_set_backend(GM_AES_BACKEND_AESNI);
+    free(plain);
+
+    /* aes-gcm accepting clear text results */
+    mod_gm_encrypt(&base64, "type=passive\n", GM_ENCODE_ONLY);
+    len = mod_gm_decrypt(&decrypted, base64, GM_ENCODE_GCM_ACCEPT_ALL);
+    like(decrypted, "type=passive\n", "aes-gcm accepts clear text");
+    free(base64);
+
+    /* encrypted message which looks like clear text, the nonce reads type=passive */
+    unsigned char gcm_msg[GM_GCM_NONCE_LEN+13+GM_GCM_TAG_LEN];
+    memcpy(gcm_msg, "type=passive", GM_GCM_NONCE_LEN);
+    mod_gm_aes_gcm(gcm_msg+GM_GCM_NONCE_LEN, (const unsigned char *)"type=active\n\n", 13, gcm_msg, gcm_msg+GM_GCM_NONCE_LEN+13, 0);
+    base64 = malloc(BASE64_LENGTH(sizeof(gcm_msg))+1);
+    base64_encode(gcm_msg, sizeof(gcm_msg), base64, BASE64_LENGTH(sizeof(gcm_msg))+1);
+    len = mod_gm_decrypt(&decrypted, base64, GM_ENCODE_GCM_ACCEPT_ALL);
+    ok(len == 13 && !strcmp(decrypted, "type=active\n\n"), "aes-gcm prefers authenticated data over clear text");
+    free(base64);
+    free(decrypted);
+
+    /* only complete binary payloads count as unencrypted */
+    gm_payload_writer_t plain_writer;
+    char plain_bin[64];
+    mod_gm_payload_begin(&plain_writer, plain_bin, sizeof(plain_bin));
+    mod_gm_payload_add_str(&plain_writer, GM_KEY_HOST_NAME, "host");
+    len = mod_gm_payload_end(&plain_writer);
+    x = mod_gm_payload_is_complete(plain_bin, len) && !mod_gm_payload_is_complete(plain_bin, len+1) && !mod_gm_payload_is_complete(plain_bin, len-1);
+    plain_bin[GM_PAYLOAD_MAGIC_LEN]++;
+    ok(x && !mod_gm_payload_is_complete(plain_bin, len), "binary payload header has to match exactly");
+
 
     /* file_exists */
     ok(file_exists("01_utils") == 1, "file_exists('01_utils')");
@@ -174,6 +371,33 @@ int main(void) {
     ok(t.tv_usec == 0, "string2timeval 8");
 
     /* command line parsing */
+    mod_gm_free_opt(mod_gm_opt);
+    mod_gm_opt = renew_opts();
+    strcpy(test, "transportmode=aes-gcm");
+    parse_args_line(mod_gm_opt, test, 0);
+    ok(mod_gm_opt->transportmode == GM_ENCODE_AND_ENCRYPT_GCM, "transportmode=aes-gcm");
+
+    mod_gm_free_opt(mod_gm_opt);
+    mod_gm_opt = renew_opts();
+    ok(mod_gm_opt->result_backlog == 0, "result_backlog disabled by default");
+    strcpy(test, "result_backlog=10000");
+    parse_args_line(mod_gm_opt, test, 0);
+    strcpy(test, "result_backlog_resume=-5");
+    parse_args_line(mod_gm_opt, test, 0);
+    ok(mod_gm_opt->result_backlog == 10000 && mod_gm_opt->result_backlog_resume == 0, "result_backlog=10000");
+
+    mod_gm_free_opt(mod_gm_opt);
+    mod_gm_opt = renew_opts();
+    strcpy(test, "binary_payload=yes");
+    parse_args_line(mod_gm_opt, test, 0);
+    ok(mod_gm_opt->binary_payload == GM_ENABLED && mod_gm_opt->binary_queues_num == 0, "binary_payload=yes");
+    mod_gm_free_opt(mod_gm_opt);
+    mod_gm_opt = renew_opts();
+    strcpy(test, "binary_payload=service, hostgroup_Linux");
+    parse_args_line(mod_gm_opt, test, 0);
+    ok(mod_gm_opt->binary_payload == GM_ENABLED && mod_gm_opt->binary_queues_num == 2
+       && !strcmp(mod_gm_opt->binary_queues_list[0], "service") && !strcmp(mod_gm_opt->binary_queues_list[1], "hostgroup_Linux"), "binary_payload=service,hostgroup_Linux");
+
     mod_gm_free_opt(mod_gm_opt);
     mod_gm_opt = renew_opts();
     strcpy(test, "server=host:4730");
@@ -245,6 +469,162 @@ int main(void) {
     is(starts_with(test2, test), FALSE,  "starts_with(xyz, test123)");
     free(test2);
 
+    /* payload parser */
+    const char * keys[] = { "host_name", "service_description", "type", "result_queue", "command_line",
+                            "plugin_output", "long_plugin_output", "output", "source", "check_options",
+                            "scheduled_check", "reschedule_check", "exited_ok", "early_timeout", "return_code",
+                            "latency", "timeout", "next_check", "core_time", "core_start_time", "start_time",
+                            "finish_time", "result" };
+    int k, keys_ok = 0;
+    for(k = 0; k < GM_PAYLOAD_KEYS; k++) {
+        if(mod_gm_payload_key(keys[k], strlen(keys[k])) == k)
+            keys_ok++;
+    }
+    ok(keys_ok == GM_PAYLOAD_KEYS, "mod_gm_payload_key() knows %d of %d keys", keys_ok, GM_PAYLOAD_KEYS);
+    ok(mod_gm_payload_key("host_nam", 8) == GM_KEY_UNKNOWN
+       && mod_gm_payload_key("host_namex", 10) == GM_KEY_UNKNOWN
+       && mod_gm_payload_key("", 0) == GM_KEY_UNKNOWN, "mod_gm_payload_key() unknown keys");
+
+    gm_payload_t payload;
+    strcpy(test, "host_name=host\nservice_description=svc\ncommand_line=/bin/check a=b\nfoo=bar\noutput=a\\nb\\\\c\n\nreturn_code=2\n");
+    ok(mod_gm_parse_payload(&payload, test, strlen(test)) == 4, "mod_gm_parse_payload() known lines: %d", payload.lines);
+    is(payload.field[GM_KEY_HOST_NAME].ptr, "host", "payload host_name");
+    ok(payload.field[GM_KEY_HOST_NAME].len == 4, "payload host_name length");
+    is(payload.field[GM_KEY_COMMAND_LINE].ptr, "/bin/check a=b", "payload value containing =");
+    ok(payload.field[GM_KEY_RETURN_CODE].ptr == NULL, "payload stops at empty line");
+    ok(payload.stop_key == GM_KEY_UNKNOWN, "payload stop key");
+    payload.field[GM_KEY_OUTPUT].len = mod_gm_payload_unescape(payload.field[GM_KEY_OUTPUT].ptr, payload.field[GM_KEY_OUTPUT].len);
+    is(payload.field[GM_KEY_OUTPUT].ptr, "a\nb\\c", "payload output unescaped");
+    ok(payload.field[GM_KEY_OUTPUT].len == 5, "payload output unescaped length");
+
+    strcpy(test, "host_name=host\noutput=\nreturn_code=2");
+    mod_gm_parse_payload(&payload, test, strlen(test));
+    ok(payload.field[GM_KEY_OUTPUT].ptr == NULL && payload.stop_key == GM_KEY_OUTPUT && payload.stop_value != NULL && *payload.stop_value == '\x0', "payload empty output");
+
+    /* the byte behind the payload may belong to the next nested record */
+    strcpy(test, "host_name=host\nreturn_code=2X");
+    k = strlen(test) - 1;
+    mod_gm_parse_payload(&payload, test, k);
+    ok(test[k] == 'X' && payload.field[GM_KEY_RETURN_CODE].len == 1 && payload.field[GM_KEY_HOST_NAME].len == 4, "payload does not write behind its end");
+
+    /* binary payload */
+    gm_payload_writer_t writer;
+    struct timeval tv1 = { 1550240508, 123456 }, tv2 = { 0, 0 };
+    char * bin = malloc(GM_BUFFERSIZE);
+    int binsize;
+    mod_gm_payload_begin(&writer, bin, GM_BUFFERSIZE);
+    mod_gm_payload_add_str(&writer, GM_KEY_HOST_NAME, "host");
+    mod_gm_payload_add_str(&writer, GM_KEY_OUTPUT, "line1\nline2\\");
+    mod_gm_payload_add_int(&writer, GM_KEY_RETURN_CODE, -2);
+    mod_gm_payload_add_timeval(&writer, GM_KEY_START_TIME, &tv1);
+    mod_gm_payload_add_int(&writer, GM_PAYLOAD_KEYS+5, 1);
+    binsize = mod_gm_payload_end(&writer);
+    ok(mod_gm_payload_size(bin, (size_t)-1) == (size_t)binsize, "binary payload size %d", binsize);
+
+    mod_gm_encrypt_len(&encrypted, bin, binsize, GM_ENCODE_AND_ENCRYPT);
+    decrypted = malloc(strlen(encrypted)+1);
+    ok(mod_gm_decrypt(&decrypted, encrypted, GM_ENCODE_AND_ENCRYPT) == binsize, "binary payload survives encryption");
+    ok(mod_gm_parse_payload(&payload, decrypted, binsize) == 4 && payload.binary, "binary payload parsed");
+    is(payload.field[GM_KEY_HOST_NAME].ptr, "host", "binary payload host_name");
+    is(payload.field[GM_KEY_OUTPUT].ptr, "line1\nline2\\", "binary payload raw output");
+    ok(mod_gm_payload_int(&payload, GM_KEY_RETURN_CODE, 0) == -2, "binary payload negative number");
+    mod_gm_payload_timeval(&payload, GM_KEY_START_TIME, &tv2);
+    ok(tv2.tv_sec == tv1.tv_sec && tv2.tv_usec == tv1.tv_usec, "binary payload microseconds");
+    ok(!mod_gm_payload_has(&payload, GM_KEY_SERVICE_DESCRIPTION), "binary payload missing key");
+    free(encrypted);
+    free(decrypted);
+
+    mod_gm_encrypt_len(&encrypted, bin, binsize, GM_ENCODE_ONLY);
+    decrypted = malloc(strlen(encrypted)+1);
+    ok(mod_gm_decrypt(&decrypted, encrypted, GM_ENCODE_ACCEPT_ALL) == binsize, "unencrypted binary payload accepted");
+    free(encrypted);
+    free(decrypted);
+
+    /* multi result payload */
+    char * multi = malloc(GM_BUFFERSIZE);
+    int multisize, results = 0;
+    size_t pos = 0;
+    gm_strview_t result;
+    mod_gm_payload_begin(&writer, multi, GM_BUFFERSIZE);
+    ok(mod_gm_payload_add_payload(&writer, GM_KEY_RESULT, bin, binsize) && mod_gm_payload_add_payload(&writer, GM_KEY_RESULT, bin, binsize), "multi payload add results");
+    ok(!mod_gm_payload_add_payload(&writer, GM_KEY_RESULT, bin, GM_BUFFERSIZE), "multi payload rejects oversized result");
+    multisize = mod_gm_payload_end(&writer);
+    ok(mod_gm_parse_payload(&payload, multi, multisize) >= 0 && payload.binary && mod_gm_payload_has(&payload, GM_KEY_RESULT), "multi payload parsed");
+    while(mod_gm_payload_next(multi, multisize, GM_KEY_RESULT, &pos, &result)) {
+        if(result.len == (size_t)binsize && memcmp(result.ptr, bin, binsize) == 0
+           && mod_gm_parse_payload(&payload, result.ptr, result.len) == 4)
+            results++;
+    }
+    ok(results == 2, "multi payload contains %d results", results);
+    is(payload.field[GM_KEY_HOST_NAME].ptr, "host", "multi payload nested host_name");
+    pos = 0;
+    ok(!mod_gm_payload_next(bin, binsize, GM_KEY_RESULT, &pos, &result), "single result payload has no nested results");
+    strcpy(test, "host_name=host\noutput=result\n");
+    pos = 0;
+    ok(!mod_gm_payload_next(test, strlen(test), GM_KEY_RESULT, &pos, &result), "text payload has no nested results");
+    free(multi);
+    free(bin);
+
+    /* batch submission ring */
+    gm_ring_t *ring = mod_gm_ring_create(4);
+    long r;
+    for(r = 1; r <= 4; r++)
+        mod_gm_ring_push(ring, (void *)r);
+    ok(mod_gm_ring_push(ring, (void *)5L) == 0, "ring full");
+    ok(mod_gm_ring_count(ring) == 4, "ring count");
+    ok(mod_gm_ring_pop(ring) == (void *)1L && mod_gm_ring_pop(ring) == (void *)2L, "ring is fifo");
+    ok(mod_gm_ring_push(ring, (void *)5L) == 3, "ring push returns number of queued elements");
+    while(mod_gm_ring_pop(ring) != NULL)
+        ;
+    ok(mod_gm_ring_count(ring) == 0, "ring empty");
+    mod_gm_ring_free(ring);
+
+    pthread_t consumer;
+    void *ring_errors;
+    ring = mod_gm_ring_create(64);
+    pthread_create(&consumer, NULL, ring_consumer, ring);
+    for(r = 1; r <= 100000; r++) {
+        while(mod_gm_ring_push(ring, (void *)r) == 0)
+            sched_yield();
+    }
+    pthread_join(consumer, &ring_errors);
+    ok(ring_errors == NULL, "ring keeps order between threads");
+    mod_gm_ring_free(ring);
+
+    /* jobs gearmand did not accept are handed back */
+    ok(submit_to_closed_port() == 1, "failed check is handed back, other jobs are dropped");
+
+    /* arena allocator */
+    gm_arena_t *arena = gm_arena_create(1024);
+    char *a1, *a2, *a3;
+    a1 = gm_arena_alloc(arena, 10);
+    a2 = gm_arena_strdup(arena, "arena test");
+    ok(((size_t)a1 % GM_ARENA_ALIGN) == 0 && ((size_t)a2 % GM_ARENA_ALIGN) == 0 && a2 > a1, "arena allocations are aligned");
+    ok(gm_arena_realloc(arena, a2, 11, 100) == a2 && !strcmp(a2, "arena test"), "last allocation grows in place");
+    a3 = gm_arena_realloc(arena, a1, 10, 20);
+    ok(a3 != a1, "other allocations are moved");
+    gm_arena_asprintf(arena, &a3, "%s %d", "number", 42);
+    ok(!strcmp(a3, "number 42"), "arena asprintf");
+    a3 = gm_arena_alloc(arena, 5000);
+    memset(a3, 'x', 5000);
+    ok(arena->first->next != NULL && arena->first->next->size >= 5000, "large allocation gets its own block");
+    gm_arena_reset(arena);
+    ok(arena->first->next == NULL && gm_arena_alloc(arena, 10) == a1, "reset reuses memory and drops large blocks");
+    gm_arena_free(arena);
+
+    /* job strings from the arena */
+    gm_job_t *job = create_arena_job(gm_arena_create(GM_JOB_ARENA_SIZE), mod_gm_opt);
+    set_job_string(job, &job->output, "(Host Check Timed Out On Worker: %s)", "test");
+    set_job_buffer(job, &job->error, gm_strdup("stderr"));
+    ok(!strcmp(job->output, "(Host Check Timed Out On Worker: test)") && !strcmp(job->error, "stderr"), "job strings in arena");
+    free_job(job);
+    job = gm_malloc(sizeof(gm_job_t));
+    set_default_job(job, mod_gm_opt);
+    set_job_string(job, &job->output, "first");
+    set_job_string(job, &job->output, "%s", "second");
+    ok(job->arena == NULL && !strcmp(job->output, "second"), "job strings without arena");
+    free_job(job);
+
     mod_gm_free_opt(mod_gm_opt);
 
     return exit_status();
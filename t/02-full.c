@@ -16,7 +16,8 @@
 #endif
 #include "gearman_utils.h"
 
-#define GEARMAND_TEST_PORT   54730
+#define GEARMAND_TEST_PORT    54730
+#define GEARMAND_TEST_TIMEOUT 10000
 
 #include <worker_dummy_functions.c>
 
@@ -279,7 +280,7 @@ void diag_queues() {
     stats = malloc(sizeof(mod_gm_server_status_t));
     stats->function_num = 0;
     stats->worker_num   = 0;
-    rc = get_gearman_server_data(stats, &message, &version, "127.0.0.1", GEARMAND_TEST_PORT);
+    rc = get_gearman_server_data(stats, &message, &version, "127.0.0.1", GEARMAND_TEST_PORT, GEARMAND_TEST_TIMEOUT);
     diag("get_gearman_server_data:  rc: %d\n", rc);
     diag("get_gearman_server_data: msg: %s\n", message);
     diag("get_gearman_server_data: ver: %s\n", version);
@@ -310,7 +311,7 @@ void wait_for_empty_queue(char *queue, int timeout) {
         stats = malloc(sizeof(mod_gm_server_status_t));
         stats->function_num = 0;
         stats->worker_num   = 0;
-        rc = get_gearman_server_data(stats, &message, &version, "127.0.0.1", GEARMAND_TEST_PORT);
+        rc = get_gearman_server_data(stats, &message, &version, "127.0.0.1", GEARMAND_TEST_PORT, GEARMAND_TEST_TIMEOUT);
         if( rc == STATE_OK ) {
             for(x=0; x<stats->function_num;x++) {
                 if(stats->function[x]->waiting == 0 &&
@@ -571,7 +572,7 @@ int main (int argc, char **argv, char **env) {
     free_worker(&worker);
 
     /* shutdown gearmand */
-    rc = send2gearmandadmin("shutdown\n", "127.0.0.1", GEARMAND_TEST_PORT, &output, &message);
+    rc = send2gearmandadmin("shutdown\n", "127.0.0.1", GEARMAND_TEST_PORT, &output, &message, GEARMAND_TEST_TIMEOUT);
     ok(rc == 0, "rc of send2gearmandadmin %d", rc);
     like(output, "OK", "output contains OK");
     free(message);
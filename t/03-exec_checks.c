@@ -2,12 +2,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <t/tap.h>
 #include <config.h>
 #include <common.h>
 #include <utils.h>
 #include <check_utils.h>
+#include <check_async.h>
 #ifdef EMBEDDEDPERL
 #include <epn_utils.h>
 #endif
@@ -17,16 +19,58 @@
 
 mod_gm_opt_t *mod_gm_opt;
 
+/* finished concurrent checks */
+gm_job_t * done_jobs[10];
+int done_num = 0;
+void check_done(gm_job_t * job, void * data);
+void check_done(gm_job_t * job, void * data) {
+    data = data;
+    done_jobs[done_num++] = job;
+}
+
+/* create job for concurrent checks */
+gm_job_t * new_job(char * command_line, int timeout);
+gm_job_t * new_job(char * command_line, int timeout) {
+    gm_job_t * job = ( gm_job_t * )malloc( sizeof *job );
+    set_default_job(job, mod_gm_opt);
+    job->command_line = strdup(command_line);
+    job->type         = strdup("service");
+    job->timeout      = timeout;
+    return job;
+}
+
+/* run a job in its own thread like the worker pool does */
+void * run_job_thread(void * data);
+void * run_job_thread(void * data) {
+    execute_safe_command((gm_job_t *)data, GM_ENABLED, "thread");
+    return NULL;
+}
+
+/* run concurrent checks till the given number is finished, returns seconds */
+double wait_for_checks(gm_async_t * async, int num);
+double wait_for_checks(gm_async_t * async, int num) {
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    while(done_num < num) {
+        mod_gm_async_wait(async, 1000);
+        gettimeofday(&end, NULL);
+        if(end.tv_sec - start.tv_sec > 20)
+            break;
+    }
+    gettimeofday(&end, NULL);
+    return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_usec - start.tv_usec)/1000000;
+}
+
 int main (int argc, char **argv, char **env) {
     argc = argc; argv = argv; env  = env;
-    int rc, rrc;
+    int rc, rrc, i;
     char *result, *error;
     char cmd[120];
     char hostname[GM_BUFFERSIZE];
     char cwd[1024];
     struct stat st;
 
-    plan(80);
+    plan(104);
 
     /* set hostname and cwd */
     gethostname(hostname, GM_BUFFERSIZE-1);
@@ -192,6 +236,19 @@ int main (int argc, char **argv, char **env) {
     free(exec_job->output);
     free(exec_job->error);
 
+    /* non existing command with spawn, logs the failed command */
+    free(exec_job->command_line);
+    exec_job->command_line    = strdup("/bin/doesntexist");
+    mod_gm_opt->spawn_checks  = GM_ENABLED;
+    mod_gm_opt->debug_level   = GM_LOG_DEBUG;
+    execute_safe_command(exec_job, fork_on_exec, hostname);
+    mod_gm_opt->spawn_checks  = GM_DISABLED;
+    mod_gm_opt->debug_level   = 0;
+    cmp_ok(exec_job->return_code, "==", 2, "spawned cmd '%s' returns rc 2", exec_job->command_line);
+    like(exec_job->output, "CRITICAL: Return code of 127 is out of bounds. Make sure the plugin you're trying to run actually exists. \\(worker:", "returned result string");
+    free(exec_job->output);
+    free(exec_job->error);
+
 
 
     /*****************************************
@@ -380,6 +437,119 @@ int main (int argc, char **argv, char **env) {
     cmp_ok(exec_job->return_code, "==", 0, "cmd '%s' returns rc 0", exec_job->command_line);
     like(exec_job->output, "test plugin OK", "returned result string");
 
+    /*****************************************
+     * large stderr must not block reading stdout
+     */
+    time_t started;
+    gm_job_t * large_job;
+    for(fork_on_exec = 0; fork_on_exec <= 1; fork_on_exec++) {
+        large_job = new_job("head -c 300000 /dev/zero | tr '\\0' e 1>&2; echo done", 10);
+        started   = time(NULL);
+        execute_safe_command(large_job, fork_on_exec, hostname);
+        ok(large_job->return_code == 0 && time(NULL) - started < 5, "300kb of stderr returned rc %d in %ds with fork_on_exec=%d", large_job->return_code, (int)(time(NULL) - started), fork_on_exec);
+        like(large_job->output, "^done", "returned result string");
+        free_job(large_job);
+    }
+
+    /*****************************************
+     * plugins exceeding the output limit are killed
+     */
+    mod_gm_opt->max_output_size = 100000;
+    large_job = new_job("/usr/bin/yes", 10);
+    started   = time(NULL);
+    execute_safe_command(large_job, 0, hostname);
+    ok(time(NULL) - started < 5 && strlen(large_job->output) < 250000, "endless output stopped after %ds at %d bytes", (int)(time(NULL) - started), (int)strlen(large_job->output));
+    free_job(large_job);
+    mod_gm_opt->max_output_size = GM_MAX_OUTPUT;
+
+    /*****************************************
+     * concurrent checks
+     */
+    gm_async_t * async = mod_gm_async_create(5, check_done, NULL);
+    ok(async != NULL, "created runner for concurrent checks");
+    rc = GM_OK;
+    for(i = 0; i < 5; i++)
+        rc += mod_gm_async_start(async, new_job("./t/sleep 1", 10));
+    cmp_ok(rc, "==", GM_OK, "started 5 checks");
+    gm_job_t * extra_job = new_job("./t/sleep 1", 10);
+    cmp_ok(mod_gm_async_start(async, extra_job), "==", GM_ERROR, "no free slot for 6th check");
+    free_job(extra_job);
+    double duration = wait_for_checks(async, 5);
+    ok(done_num == 5 && duration < 3, "5 checks of 1 second finished concurrently in %.2fs", duration);
+    cmp_ok(done_jobs[0]->return_code, "==", 0, "cmd '%s' returns rc 0", done_jobs[0]->command_line);
+    like(done_jobs[0]->output, "sleeping 1 seconds", "returned result string");
+    for(i = 0; i < done_num; i++)
+        free_job(done_jobs[i]);
+    done_num = 0;
+
+    /* capture stderr */
+    mod_gm_async_start(async, new_job("./t/both", 10));
+    wait_for_checks(async, 1);
+    cmp_ok(done_jobs[0]->return_code, "==", 0, "cmd '%s' returns rc 0", done_jobs[0]->command_line);
+    like(done_jobs[0]->output, "stdout output", "returned result string");
+    like(done_jobs[0]->error,  "stderr output", "returned error string");
+    free_job(done_jobs[0]);
+    done_num = 0;
+
+    /* non existing command */
+    mod_gm_async_start(async, new_job("/bin/doesntexist", 10));
+    wait_for_checks(async, 1);
+    cmp_ok(done_jobs[0]->return_code, "==", 2, "cmd '%s' returns rc 2", done_jobs[0]->command_line);
+    like(done_jobs[0]->output, "CRITICAL: Return code of 127 is out of bounds. Make sure the plugin you're trying to run actually exists. \\(worker:", "returned result string");
+    free_job(done_jobs[0]);
+    done_num = 0;
+
+    /* timeout */
+    mod_gm_async_start(async, new_job("./t/sleep 10", 1));
+    duration = wait_for_checks(async, 1);
+    cmp_ok(done_jobs[0]->return_code, "==", mod_gm_opt->timeout_return, "cmd '%s' returns timeout rc after %.2fs", done_jobs[0]->command_line, duration);
+    like(done_jobs[0]->output, "Service Check Timed Out On Worker", "returned result string");
+    free_job(done_jobs[0]);
+    done_num = 0;
+    mod_gm_async_free(async);
+
+    /*****************************************
+     * job environment in parallel threads
+     */
+    pthread_t env_threads[5];
+    gm_job_t * env_jobs[5];
+    setenv("NAGIOS_SERVICEOUTPUT", "worker", 1);
+    for(i = 0; i < 5; i++) {
+        env_jobs[i] = new_job("/bin/sh -c 'sleep 0.2; echo $NAGIOS_SERVICEOUTPUT'", 10);
+        snprintf(cmd, sizeof(cmd), "output of job %d", i);
+        set_job_env(env_jobs[i], "NAGIOS_SERVICEOUTPUT", cmd);
+        pthread_create(&env_threads[i], NULL, run_job_thread, env_jobs[i]);
+    }
+    rc = 0;
+    for(i = 0; i < 5; i++) {
+        pthread_join(env_threads[i], NULL);
+        snprintf(cmd, sizeof(cmd), "output of job %d\\n", i);
+        if(env_jobs[i]->output == NULL || strcmp(env_jobs[i]->output, cmd)) {
+            diag("job %d got: %s", i, env_jobs[i]->output);
+            rc++;
+        }
+        free_job(env_jobs[i]);
+    }
+    ok(rc == 0, "5 parallel plugins got their own environment");
+
+    /* without fork */
+    env_jobs[0] = new_job("/bin/sh -c 'echo $NAGIOS_SERVICEOUTPUT'", 10);
+    set_job_env(env_jobs[0], "NAGIOS_SERVICEOUTPUT", "not forked");
+    execute_safe_command(env_jobs[0], 0, hostname);
+    like(env_jobs[0]->output, "^not forked\\\\n$", "plugin without fork got the job environment");
+    free_job(env_jobs[0]);
+
+    /* with spawn */
+    env_jobs[0] = new_job("/usr/bin/env", 10);
+    set_job_env(env_jobs[0], "NAGIOS_SERVICEOUTPUT", "spawned");
+    mod_gm_opt->spawn_checks = GM_ENABLED;
+    execute_safe_command(env_jobs[0], 0, hostname);
+    mod_gm_opt->spawn_checks = GM_DISABLED;
+    like(env_jobs[0]->output, "NAGIOS_SERVICEOUTPUT=spawned\\\\n", "spawned plugin got the job environment");
+    free_job(env_jobs[0]);
+    like(getenv("NAGIOS_SERVICEOUTPUT"), "^worker$", "worker environment is unchanged");
+    unsetenv("NAGIOS_SERVICEOUTPUT");
+
     /*****************************************
      * restricted paths
      */
@@ -4,6 +4,8 @@
 #include <unistd.h>
 #include <dlfcn.h>
 #include <ltdl.h>
+#include <pthread.h>
+#include <sys/time.h>
 #include <t/tap.h>
 
 #include <config.h>
@@ -11,6 +13,7 @@
 #ifdef USENAGIOS3
 #include "nagios3/nagios.h"
 #include "nagios3/nebmodules.h"
+#include "nagios3/neberrors.h"
 #include "nagios3/nebstructs.h"
 #include "nagios3/nebcallbacks.h"
 #include "nagios3/broker.h"
@@ -19,6 +22,7 @@
 #ifdef USENAGIOS4
 #include "nagios4/nagios.h"
 #include "nagios4/nebmodules.h"
+#include "nagios4/neberrors.h"
 #include "nagios4/nebstructs.h"
 #include "nagios4/nebcallbacks.h"
 #include "nagios4/broker.h"
@@ -45,9 +49,16 @@ int event_broker_options;
 #if defined(USENAEMON) || defined(USENAGIOS4)
 unsigned long event_broker_options;
 #ifdef USENAEMON
-timed_event *schedule_event(time_t delay, event_callback callback, void *user_data) { delay = delay; callback = callback; user_data = user_data; return(NULL); }
+event_callback reaper_callback = NULL;
+timed_event *schedule_event(time_t delay, event_callback callback, void *user_data) { delay = delay; reaper_callback = callback; user_data = user_data; return(NULL); }
 #endif
 #endif
+#if defined(USENAGIOS3) || defined(USENAGIOS4)
+int (*reaper_callback)(int,void *) = NULL;
+int interval_length;
+void schedule_service_check(service *svc, time_t check_time, int options) { svc = svc; check_time = check_time; options = options; }
+void schedule_host_check(host *hst, time_t check_time, int options) { hst = hst; check_time = check_time; options = options; }
+#endif
 #ifdef USENAGIOS3
 check_result *check_result_list;
 check_result check_result_info;
@@ -55,8 +66,331 @@ check_result check_result_info;
 int process_performance_data;
 int log_notifications;
 
-void check_neb(char * nebargs);
-void check_neb(char * nebargs) {
+#define FLOOD_RESULTS 5000
+int results_processed;
+long max_stall;
+check_result * (*new_result)(void);
+int results_added;
+int flood_active;               /* set while results are flooded */
+int core_processing;            /* set when the core starts processing flooded results */
+int added_while_processing;     /* result thread was not blocked by the processing core */
+
+/* check mode flags */
+#define NEB_FLOOD           1
+#define NEB_BENCH           2
+#define NEB_BENCH_NOCACHE   4
+
+/* registered callbacks by type */
+int (*neb_callbacks[NEBCALLBACK_NUMITEMS])(int,void *);
+
+/* fake object table */
+#define BENCH_HOSTS         100
+#define BENCH_SERVICES      10      /* per host */
+#define BENCH_ROUNDS        8       /* stays below the batch submission ring size */
+#if defined(USENAEMON) || defined(USENAGIOS4)
+struct object_count num_objects;
+host **host_ary;
+service **service_ary;
+#endif
+double bench_rate;
+
+/* fake core result processing, take some time like the real core does */
+#if defined(USENAEMON) || defined(USENAGIOS4)
+int process_check_result(check_result *cr) {
+    int added, x;
+    cr = cr;
+    /* the first flooded result waits till the result thread adds more */
+    if(flood_active && !__atomic_load_n(&core_processing, __ATOMIC_ACQUIRE)) {
+        added = __atomic_load_n(&results_added, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&core_processing, 1, __ATOMIC_RELEASE);
+        for(x = 0; x < 5000 && __atomic_load_n(&results_added, __ATOMIC_ACQUIRE) == added; x++)
+            usleep(1000);
+        added_while_processing = __atomic_load_n(&results_added, __ATOMIC_ACQUIRE) != added;
+    }
+    results_processed++;
+    usleep(20);
+    return 0;
+}
+int free_check_result(check_result *cr) { cr = cr; return 0; }
+int add_object_to_objectlist(objectlist **list, void *object_ptr) {
+    objectlist *item = calloc(1, sizeof(objectlist));
+    item->object_ptr = object_ptr;
+    item->next       = *list;
+    *list            = item;
+    return 0;
+}
+#endif
+
+#if defined(USENAGIOS3) || defined(USENAGIOS4)
+/* send reaper timed event */
+static void ted_reaper(void) {
+    nebstruct_timed_event_data ted;
+    memset(&ted, 0, sizeof(ted));
+    ted.event_type = EVENT_CHECK_REAPER;
+    reaper_callback(NEBCALLBACK_TIMED_EVENT_DATA, &ted);
+}
+#endif
+
+/* run one reaper event, just like the core would do */
+void run_reaper(void);
+void run_reaper(void) {
+#ifdef USENAEMON
+    struct nm_event_execution_properties evprop;
+    memset(&evprop, 0, sizeof(evprop));
+    evprop.execution_type = EVENT_EXEC_NORMAL;
+    reaper_callback(&evprop);
+#endif
+#if defined(USENAGIOS3) || defined(USENAGIOS4)
+    ted_reaper();
+#endif
+#ifdef USENAGIOS3
+    while(check_result_list != NULL) {
+        check_result *tmp = check_result_list;
+        check_result_list = check_result_list->next;
+        results_processed++;
+        free(tmp);
+    }
+#endif
+}
+
+/* simulates a result thread adding results as fast as possible */
+void *flood_results(void *data);
+void *flood_results(void *data) {
+    void (*add_result)(check_result *) = data;
+    struct timeval start, end;
+    long stall;
+    int i;
+#if defined(USENAEMON) || defined(USENAGIOS4)
+    int x;
+#endif
+    for(i = 0; i < FLOOD_RESULTS; i++) {
+#if defined(USENAEMON) || defined(USENAGIOS4)
+        /* keep the second half till the core processes results */
+        if(i == FLOOD_RESULTS / 2) {
+            for(x = 0; x < 5000 && !__atomic_load_n(&core_processing, __ATOMIC_ACQUIRE); x++)
+                usleep(1000);
+        }
+#endif
+        /* naemon and nagios 4 results must come from the result pool */
+        check_result *cr = new_result();
+        memset(cr, 0, sizeof(check_result));
+        gettimeofday(&cr->finish_time, NULL);
+        gettimeofday(&start, NULL);
+        add_result(cr);
+        gettimeofday(&end, NULL);
+        __atomic_add_fetch(&results_added, 1, __ATOMIC_RELEASE);
+        stall = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+        if(stall > max_stall)
+            max_stall = stall;
+    }
+    return NULL;
+}
+
+/* measure how long result threads get blocked while the core processes results */
+void check_result_flood(void* neb_handle);
+void check_result_flood(void* neb_handle) {
+    void *add_result;
+    pthread_t thr;
+    int i;
+
+    add_result = dlsym(neb_handle, "mod_gm_add_result_to_list");
+    new_result = (check_result * (*)(void))dlsym(neb_handle, "mod_gm_new_result");
+    ok(add_result != NULL && new_result != NULL, "located mod_gm_add_result_to_list() and mod_gm_new_result()");
+    ok(reaper_callback != NULL, "got reaper callback");
+    if(add_result == NULL || new_result == NULL || reaper_callback == NULL)
+        BAIL_OUT("cannot flood results\n");
+
+    results_processed      = 0;
+    max_stall              = 0;
+    results_added          = 0;
+    core_processing        = 0;
+    added_while_processing = 0;
+    flood_active           = 1;
+    pthread_create(&thr, NULL, flood_results, add_result);
+    for(i = 0; i < 200 && results_processed < FLOOD_RESULTS; i++) {
+        usleep(10000);
+        run_reaper();
+    }
+    pthread_join(thr, NULL);
+    run_reaper();
+    flood_active = 0;
+
+    ok(results_processed == FLOOD_RESULTS, "processed %d of %d results", results_processed, FLOOD_RESULTS);
+    diag("max result thread stall: %.3fms", (double)max_stall/1000);
+#if defined(USENAEMON) || defined(USENAGIOS4)
+    ok(added_while_processing, "result thread added results while the core processed results");
+#else
+    skippy(1, "nagios3 processes results outside of the module");
+#endif
+}
+
+#define BURST_RESULTS 50000
+#define BURST_TIMESTAMPS 1000
+#define BURST_REFERENCE  5000
+#ifdef USENAGIOS3
+/* sorted insert, like nagios 3 results have been added before */
+static check_result * sorted_insert(check_result * list, check_result * newcr) {
+    check_result ** curp;
+    for (curp = &list; *curp; curp = &(*curp)->next)
+        if ((*curp)->finish_time.tv_sec >= newcr->finish_time.tv_sec)
+            break;
+    newcr->next = *curp;
+    *curp = newcr;
+    return list;
+}
+#endif
+
+/* add a large burst of results and check the core list is sorted and stable */
+void check_result_burst(void* neb_handle);
+void check_result_burst(void* neb_handle) {
+#ifdef USENAGIOS3
+    void (*add_result)(check_result *);
+    check_result *list = NULL, *cr;
+    struct timeval start, end;
+    double sorted_insert_time, append_time;
+    int i, sorted = 1, stable = 1;
+
+    add_result = (void (*)(check_result *))dlsym(neb_handle, "mod_gm_add_result_to_list");
+
+    /* sorted insert is quadratic, so only time a smaller reference burst */
+    srand(1);
+    gettimeofday(&start, NULL);
+    for(i = 0; i < BURST_REFERENCE; i++) {
+        cr = calloc(1, sizeof(check_result));
+        cr->finish_time.tv_sec = rand() % BURST_TIMESTAMPS;
+        list = sorted_insert(list, cr);
+    }
+    gettimeofday(&end, NULL);
+    sorted_insert_time = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_usec - start.tv_usec)/1000000;
+    while(list != NULL) {
+        cr   = list;
+        list = list->next;
+        free(cr);
+    }
+
+    /* few distinct timestamps, so most results share their finish time
+     * with others. The return code keeps the order they have been added in.
+     * The second half is merged into a core list which is not empty. */
+    srand(1);
+    gettimeofday(&start, NULL);
+    for(i = 0; i < BURST_RESULTS; i++) {
+        cr = calloc(1, sizeof(check_result));
+        cr->finish_time.tv_sec = rand() % BURST_TIMESTAMPS;
+        cr->return_code        = i;
+        add_result(cr);
+        if(i == BURST_RESULTS/2)
+            ted_reaper();
+    }
+    ted_reaper();
+    gettimeofday(&end, NULL);
+    append_time = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_usec - start.tv_usec)/1000000;
+
+    i = 0;
+    for(cr = check_result_list; cr != NULL; cr = cr->next) {
+        if(cr->next != NULL && cr->finish_time.tv_sec > cr->next->finish_time.tv_sec)
+            sorted = 0;
+        if(cr->next != NULL && cr->finish_time.tv_sec == cr->next->finish_time.tv_sec && cr->return_code > cr->next->return_code)
+            stable = 0;
+        i++;
+    }
+    ok(i == BURST_RESULTS && sorted == 1, "core result list contains %d sorted results", i);
+    ok(stable == 1, "results with equal finish time keep the order they have been added in");
+    diag("sorted insert of %d results: %.3fs", BURST_REFERENCE, sorted_insert_time);
+    diag("append and sort of %d results: %.3fs", BURST_RESULTS, append_time);
+    run_reaper();
+#else
+    neb_handle = neb_handle;
+    skippy(2, "burst benchmark only for nagios3");
+#endif
+}
+
+#if defined(USENAEMON) || defined(USENAGIOS4)
+/* create fake hosts and services */
+static void create_objects(void) {
+    char name[64];
+    int x, y;
+
+    host_ary    = calloc(BENCH_HOSTS, sizeof(host *));
+    service_ary = calloc(BENCH_HOSTS * BENCH_SERVICES, sizeof(service *));
+    for(x = 0; x < BENCH_HOSTS; x++) {
+        host *hst = calloc(1, sizeof(host));
+        snprintf(name, sizeof(name), "host%03d", x);
+        hst->id         = x;
+        hst->name       = strdup(name);
+        hst->next_check = time(NULL);
+        host_ary[x]     = hst;
+        for(y = 0; y < BENCH_SERVICES; y++) {
+            service *svc = calloc(1, sizeof(service));
+            snprintf(name, sizeof(name), "service %03d", y);
+            svc->id          = x * BENCH_SERVICES + y;
+            svc->host_name   = hst->name;
+            svc->description = strdup(name);
+            svc->host_ptr    = hst;
+            svc->next_check  = hst->next_check;
+            service_ary[svc->id] = svc;
+        }
+    }
+}
+#endif
+
+/* send service checks for the fake objects and measure jobs per second */
+void check_job_benchmark(int cached);
+void check_job_benchmark(int cached) {
+#if defined(USENAEMON) || defined(USENAGIOS4)
+    nebstruct_process_data ps;
+    nebstruct_service_check_data ds;
+    check_result cr;
+    struct timeval start, end;
+    double rate;
+    int x, round, accepted = 0, total = BENCH_HOSTS * BENCH_SERVICES * BENCH_ROUNDS;
+
+    if(host_ary == NULL)
+        create_objects();
+
+    /* object ids beyond num_objects are not cached */
+    num_objects.hosts    = cached ? BENCH_HOSTS : 0;
+    num_objects.services = cached ? BENCH_HOSTS * BENCH_SERVICES : 0;
+    memset(&ps, 0, sizeof(ps));
+    ps.type = NEBTYPE_PROCESS_EVENTLOOPSTART;
+    neb_callbacks[NEBCALLBACK_PROCESS_DATA](NEBCALLBACK_PROCESS_DATA, &ps);
+    if(neb_callbacks[NEBCALLBACK_SERVICE_CHECK_DATA] == NULL)
+        BAIL_OUT("service check callback has not been registered\n");
+
+    memset(&ds, 0, sizeof(ds));
+    memset(&cr, 0, sizeof(cr));
+    ds.type             = NEBTYPE_SERVICECHECK_INITIATE;
+    ds.check_result_ptr = &cr;
+    ds.command_line     = "/usr/lib/nagios/plugins/check_dummy 0 'everything is fine'";
+
+    /* report the best round, the first one also fills the cache */
+    bench_rate = 0;
+    for(round = 0; round < BENCH_ROUNDS; round++) {
+        gettimeofday(&start, NULL);
+        for(x = 0; x < BENCH_HOSTS * BENCH_SERVICES; x++) {
+            service *svc           = service_ary[x];
+            ds.object_ptr          = svc;
+            ds.host_name           = svc->host_name;
+            ds.service_description = svc->description;
+            if(neb_callbacks[NEBCALLBACK_SERVICE_CHECK_DATA](NEBCALLBACK_SERVICE_CHECK_DATA, &ds) == NEBERROR_CALLBACKOVERRIDE)
+                accepted++;
+        }
+        gettimeofday(&end, NULL);
+        rate = BENCH_HOSTS * BENCH_SERVICES / ((double)(end.tv_sec - start.tv_sec) + (double)(end.tv_usec - start.tv_usec)/1000000);
+        if(rate > bench_rate)
+            bench_rate = rate;
+    }
+
+    ok(accepted == total, "%s: sent %d of %d service checks", cached ? "cached" : "uncached", accepted, total);
+    diag("%s service check jobs: %.0f/s", cached ? "cached" : "uncached", bench_rate);
+#else
+    cached = cached;
+    bench_rate = 0;
+    skippy(1, "job benchmark only for naemon and nagios4");
+#endif
+}
+
+void check_neb(char * nebargs, int mode);
+void check_neb(char * nebargs, int mode) {
     int (*initfunc)(int,char *,void *);
     int (*deinitfunc)(int,int);
     int *module_version_ptr=NULL;
@@ -77,6 +411,8 @@ void check_neb(char * nebargs) {
 #endif
     process_performance_data         = 1;
 
+    memset(neb_callbacks, 0, sizeof(neb_callbacks));
+
     /* load neb module */
     neb_handle=(void *)dlopen("./"BROKER_MODULE, RTLD_LAZY|RTLD_GLOBAL);
     ok(neb_handle != NULL, "neb module loaded");
@@ -95,6 +431,13 @@ void check_neb(char * nebargs) {
     int result=(*initfunc)(NEBMODULE_NORMAL_LOAD, nebargs, neb_handle);
     ok(result == 0, "run nebmodule_init() -> %d", result);
 
+    if(mode & NEB_FLOOD) {
+        check_result_flood(neb_handle);
+        check_result_burst(neb_handle);
+    }
+    if(mode & NEB_BENCH)
+        check_job_benchmark(!(mode & NEB_BENCH_NOCACHE));
+
     /* deinit neb module */
     dlerror();
     deinit_func=(void *)dlsym(neb_handle,"nebmodule_deinit");
@@ -123,19 +466,20 @@ void write_core_log(char *data) {
 /* fake some core functions */
 int neb_set_module_info(void *handle, int type, char *data) { handle=handle; type=type; data=data; return 0; }
 #if defined(USENAGIOS3) || defined(USENAGIOS4)
-int neb_register_callback(int callback_type, void *mod_handle, int priority, int (*callback_func)(int,void *)) { callback_type=callback_type; mod_handle=mod_handle; priority=priority; callback_func=callback_func; return 0; }
+int neb_register_callback(int callback_type, void *mod_handle, int priority, int (*callback_func)(int,void *)) { mod_handle=mod_handle; priority=priority; if(callback_type == NEBCALLBACK_TIMED_EVENT_DATA) { reaper_callback = callback_func; } neb_callbacks[callback_type] = callback_func; return 0; }
 int neb_deregister_callback(int callback_type, int (*callback_func)(int,void *)) { callback_type=callback_type; callback_func=callback_func; return 0; }
 #endif
 #ifdef USENAEMON
-int neb_register_callback(enum NEBCallbackType callback_type, void *mod_handle, int priority, int (*callback_func)(int, void *)) { return 0; }
+int neb_register_callback(enum NEBCallbackType callback_type, void *mod_handle, int priority, int (*callback_func)(int, void *)) { neb_callbacks[callback_type] = callback_func; return 0; }
 int neb_deregister_callback(enum NEBCallbackType callback_type, void *callback_func) { return 0; }
 #endif
 
 
 int main(void) {
     int i;
+    double uncached_rate;
 
-    plan(32);
+    plan(56);
 
     char * test_nebargs[] = {
         "encryption=no server=localhost",
@@ -146,8 +490,15 @@ int main(void) {
 
     int num = sizeof(test_nebargs) / sizeof(test_nebargs[0]);
     for(i=0;i<num;i++) {
-        check_neb(test_nebargs[i]);
+        check_neb(test_nebargs[i], i == 0 ? NEB_FLOOD : 0);
     }
 
+    /* job creation with and without the object cache */
+    check_neb("encryption=no server=localhost services=yes result_workers=0 batch_submit=yes", NEB_BENCH|NEB_BENCH_NOCACHE);
+    uncached_rate = bench_rate;
+    check_neb("encryption=no server=localhost services=yes result_workers=0 batch_submit=yes", NEB_BENCH);
+    if(uncached_rate > 0)
+        diag("object cache speedup: %.2fx", bench_rate / uncached_rate);
+
     return exit_status();
 }
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/time.h>
 
 #include <t/tap.h>
 #include <common.h>
@@ -54,15 +55,58 @@ int check_logfile(char *logfile, char *match) {
 }
 
 
+double elapsed(struct timeval *start);
+double elapsed(struct timeval *start) {
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    return (double)(end.tv_sec - start->tv_sec) + (double)(end.tv_usec - start->tv_usec)/1000000;
+}
+
+/* run command with the given launcher */
+gm_job_t * run_job(char * cmd, int fork_exec, int spawn, int timeout);
+gm_job_t * run_job(char * cmd, int fork_exec, int spawn, int timeout) {
+    gm_job_t * job;
+    job = ( gm_job_t * )malloc( sizeof *job );
+    set_default_job(job, mod_gm_opt);
+    job->command_line = strdup(cmd);
+    job->type         = strdup("service");
+    job->timeout      = timeout;
+    mod_gm_opt->spawn_checks = spawn;
+    execute_safe_command(job, fork_exec, hostname);
+    mod_gm_opt->spawn_checks = GM_DISABLED;
+    return job;
+}
+
+/* run checks in a loop and report checks per second */
+void benchmark_launcher(char * name, int fork_exec, int spawn, int iterations);
+void benchmark_launcher(char * name, int fork_exec, int spawn, int iterations) {
+    struct timeval start;
+    gm_job_t * job;
+    int x, failed = 0;
+
+    gettimeofday(&start, NULL);
+    for(x=0; x<iterations; x++) {
+        job = run_job("/bin/true", fork_exec, spawn, 10);
+        if(job->return_code != 0)
+            failed++;
+        free_job(job);
+    }
+    diag("%-22s %8.1f checks/s", name, iterations/elapsed(&start));
+    ok(failed == 0, "%d checks with %s", iterations, name);
+}
+
 int main (int argc, char **argv, char **env) {
     argc = argc; argv = argv; env  = env;
     char *result, *error;
+    char *fork_output;
     char cmd[120];
+    struct timeval start;
+    gm_job_t * job;
     char logf[150];
     char * worker_logfile;
     int x, rc, matches;
 
-    plan(3);
+    plan(10);
 
     /* set hostname */
     gethostname(hostname, GM_BUFFERSIZE-1);
@@ -116,6 +160,36 @@ int main (int argc, char **argv, char **env) {
         free(error);
     }
 
+    /* spawn returns the same as fork */
+    job = run_job("/bin/echo launcher test", GM_ENABLED, GM_DISABLED, 10);
+    fork_output = strdup(job->output);
+    free_job(job);
+    job = run_job("/bin/echo launcher test", GM_ENABLED, GM_ENABLED, 10);
+    is(job->output, fork_output, "spawn output matches fork output");
+    free_job(job);
+    free(fork_output);
+
+    /* spawn with shell */
+    job = run_job("echo piped | cat; echo err 1>&2", GM_ENABLED, GM_ENABLED, 10);
+    ok(job->return_code == 0 && !strncmp(job->output, "piped", 5) && !strcmp(job->error, "err"), "spawn with shell returns output and error");
+    free_job(job);
+
+    /* spawn non existing plugin */
+    job = run_job("/bin/doesntexist", GM_ENABLED, GM_ENABLED, 10);
+    like(job->output, "CRITICAL: Return code of 127 is out of bounds. Make sure the plugin you're trying to run actually exists.", "spawn returns 127 for non existing plugin");
+    free_job(job);
+
+    /* spawn timeout */
+    gettimeofday(&start, NULL);
+    job = run_job("/bin/sleep 5", GM_ENABLED, GM_ENABLED, 1);
+    ok(job->return_code == mod_gm_opt->timeout_return && job->early_timeout == 1 && elapsed(&start) < 3, "spawn kills plugin on timeout: %s", job->output);
+    free_job(job);
+
+    /* compare launchers */
+    benchmark_launcher("fork_on_exec=no", GM_DISABLED, GM_DISABLED, 300);
+    benchmark_launcher("fork_on_exec=yes", GM_ENABLED, GM_DISABLED, 300);
+    benchmark_launcher("spawn_checks=yes", GM_ENABLED, GM_ENABLED, 300);
+
 
     free_job(exec_job);
     mod_gm_free_opt(mod_gm_opt);
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <t/tap.h>
+#include <common.h>
+#include <utils.h>
+#include <base64.h>
+
+#include <worker_dummy_functions.c>
+
+mod_gm_opt_t *mod_gm_opt;
+
+double elapsed(struct timeval *start);
+double elapsed(struct timeval *start) {
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    return (double)(end.tv_sec - start->tv_sec) + (double)(end.tv_usec - start->tv_usec)/1000000;
+}
+
+/* encrypt and decrypt payloads of the given size and report messages per second */
+void benchmark_crypt(int size, int iterations, int mode);
+void benchmark_crypt(int size, int iterations, int mode) {
+    char *text, *encrypted, *decrypted;
+    struct timeval start;
+    double duration;
+    int x;
+
+    text = malloc(size+1);
+    for(x=0; x<size; x++)
+        text[x] = 'a' + x%26;
+    text[size] = '\x0';
+    decrypted = malloc(size*2+GM_BUFFERSIZE);
+
+    /* encrypt */
+    gettimeofday(&start, NULL);
+    for(x=0; x<iterations; x++) {
+        mod_gm_encrypt(&encrypted, text, mode);
+        free(encrypted);
+    }
+    duration = elapsed(&start);
+    diag("%s encrypt %6d bytes: %10.0f msg/s", mode == GM_ENCODE_AND_ENCRYPT ? "aes    " : "aes-gcm", size, iterations/duration);
+
+    /* decrypt */
+    mod_gm_encrypt(&encrypted, text, mode);
+    gettimeofday(&start, NULL);
+    for(x=0; x<iterations; x++) {
+        mod_gm_decrypt(&decrypted, encrypted, mode);
+    }
+    duration = elapsed(&start);
+    diag("%s decrypt %6d bytes: %10.0f msg/s", mode == GM_ENCODE_AND_ENCRYPT ? "aes    " : "aes-gcm", size, iterations/duration);
+
+    ok(strcmp(decrypted, text) == 0, "decrypted %d bytes in mode %d", size, mode);
+
+    free(encrypted);
+    free(decrypted);
+    free(text);
+}
+
+/* base64 encode and decode with given implementation, returns MB/s */
+double benchmark_base64_backend(int backend, unsigned char *data, int size, char *encoded, unsigned char *decoded, int iterations);
+double benchmark_base64_backend(int backend, unsigned char *data, int size, char *encoded, unsigned char *decoded, int iterations) {
+    struct timeval start;
+    int x;
+    base64_set_backend(backend);
+    gettimeofday(&start, NULL);
+    for(x=0; x<iterations; x++) {
+        base64_encode(data, size, encoded, BASE64_LENGTH(size)+1);
+        base64_decode_len(encoded, BASE64_LENGTH(size), decoded, size+32);
+    }
+    return (double)size*iterations/elapsed(&start)/1024/1024;
+}
+
+/* compare scalar and vectorized base64 */
+void benchmark_base64(int size, int iterations);
+void benchmark_base64(int size, int iterations) {
+    unsigned char *data, *decoded;
+    char *encoded, *scalar;
+    double scalar_rate, simd_rate;
+    int x, backend;
+
+    data    = malloc(size);
+    decoded = malloc(size+32);
+    encoded = malloc(BASE64_LENGTH(size)+1);
+    scalar  = malloc(BASE64_LENGTH(size)+1);
+    for(x=0; x<size; x++)
+        data[x] = (unsigned char)(x*31+7);
+
+    scalar_rate = benchmark_base64_backend(GM_BASE64_SCALAR, data, size, scalar, decoded, iterations);
+    backend     = base64_set_backend(GM_BASE64_AVX2);
+    simd_rate   = benchmark_base64_backend(backend, data, size, encoded, decoded, iterations);
+    diag("base64 %7d bytes: scalar %8.1f MB/s, backend %d %8.1f MB/s", size, scalar_rate, backend, simd_rate);
+
+    ok(strcmp(encoded, scalar) == 0 && memcmp(decoded, data, size) == 0, "base64 backend %d matches scalar for %d bytes", backend, size);
+
+    free(data);
+    free(decoded);
+    free(encoded);
+    free(scalar);
+}
+
+int main(void) {
+    plan(7);
+
+    mod_gm_opt = malloc(sizeof(mod_gm_opt_t));
+    set_default_options(mod_gm_opt);
+    mod_gm_crypt_init("test1234");
+
+    /* typical check result size */
+    benchmark_crypt(300, 20000, GM_ENCODE_AND_ENCRYPT);
+    benchmark_crypt(300, 20000, GM_ENCODE_AND_ENCRYPT_GCM);
+
+    /* large plugin output */
+    benchmark_crypt(65536, 200, GM_ENCODE_AND_ENCRYPT);
+    benchmark_crypt(65536, 200, GM_ENCODE_AND_ENCRYPT_GCM);
+
+    /* base64 transport encoding */
+    benchmark_base64(1024, 20000);
+    benchmark_base64(65536, 500);
+    benchmark_base64(1048576, 30);
+
+    mod_gm_free_opt(mod_gm_opt);
+    return exit_status();
+}
+
+/* core log wrapper */
+void write_core_log(char *data) {
+    printf("core logger is not available for tests: %s", data);
+    return;
+}
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#include <t/tap.h>
+#include <common.h>
+#include <utils.h>
+#include <gearman_utils.h>
+#include <worker_autoscale.h>
+
+#include <worker_dummy_functions.c>
+
+mod_gm_opt_t *mod_gm_opt;
+
+#define MIN_WORKER   1
+#define MAX_WORKER  50
+
+/* simulated worker host with a single queue */
+typedef struct sim {
+    double  time;           /* current time */
+    double  backlog;        /* waiting jobs */
+    double  done;           /* jobs done */
+    double  service;        /* seconds per job */
+    int     workers;        /* number of workers */
+    int     max_workers;    /* highest number of workers seen */
+} sim_t;
+
+/* feed the autoscaler with a synthetic queue trace, new jobs per second for each interval */
+void simulate(gm_autoscale_t *as, sim_t *sim, double *trace, int num);
+void simulate(gm_autoscale_t *as, sim_t *sim, double *trace, int num) {
+    double completed, capacity;
+    int x, busy, target;
+
+    for(x=0; x<num; x++) {
+        sim->time    += GM_AUTOSCALE_INTERVAL;
+        sim->backlog += trace[x] * GM_AUTOSCALE_INTERVAL;
+
+        /* workers take jobs from the queue as fast as they can */
+        capacity  = sim->workers * GM_AUTOSCALE_INTERVAL / sim->service;
+        completed = sim->backlog < capacity ? sim->backlog : capacity;
+        sim->backlog -= completed;
+        sim->done    += completed;
+        busy = (int)(completed * sim->service / GM_AUTOSCALE_INTERVAL + 0.5);
+
+        autoscale_sample(as, sim->time, (int)sim->backlog, (int)sim->done, busy);
+        target = autoscale_target(as, sim->workers, MIN_WORKER, MAX_WORKER);
+        if(target >= 0)
+            sim->workers = target;
+        if(sim->workers > sim->max_workers)
+            sim->max_workers = sim->workers;
+    }
+}
+
+/* run a constant rate for the given number of intervals */
+void simulate_rate(gm_autoscale_t *as, sim_t *sim, double rate, int num);
+void simulate_rate(gm_autoscale_t *as, sim_t *sim, double rate, int num) {
+    double trace[100];
+    int x;
+    for(x=0; x<num && x<100; x++)
+        trace[x] = rate;
+    simulate(as, sim, trace, x);
+}
+
+/* open a listening socket which never answers */
+int silent_server(int *port);
+int silent_server(int *port) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int sd;
+
+    sd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(sd < 0 || bind(sd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(sd, 5) != 0)
+        return -1;
+    getsockname(sd, (struct sockaddr *)&addr, &len);
+    *port = ntohs(addr.sin_port);
+    return sd;
+}
+
+int main(void) {
+    gm_autoscale_t as;
+    sim_t sim;
+    mod_gm_server_status_t *stats;
+    struct timeval start_time, end_time;
+    char * message = NULL;
+    char * version = NULL;
+    char server[100];
+    int x, start, sd, port, rc;
+    double ramp[30];
+
+    plan(15);
+
+    mod_gm_opt = malloc(sizeof(mod_gm_opt_t));
+    set_default_options(mod_gm_opt);
+
+    memset(&as, 0, sizeof(as));
+    memset(&sim, 0, sizeof(sim));
+    sim.service = 0.2;
+    sim.workers = MIN_WORKER;
+
+    /* no estimate without rates */
+    autoscale_sample(&as, 0, 0, 0, 0);
+    ok(autoscale_target(&as, 1, MIN_WORKER, MAX_WORKER) == -1, "no target after the first sample");
+
+    /* steady load of 50 jobs/s at 0.2s each keeps 10 workers busy */
+    simulate_rate(&as, &sim, 50, 30);
+    diag("steady: %d workers, backlog %.0f", sim.workers, sim.backlog);
+    ok(sim.workers >= 10 && sim.workers <= 14, "steady load sized by little's law: %d workers", sim.workers);
+    ok(sim.backlog < 50*GM_AUTOSCALE_INTERVAL, "no backlog at steady load: %.0f", sim.backlog);
+
+    /* burst to 200 jobs/s needs 40 workers */
+    start = sim.workers;
+    simulate_rate(&as, &sim, 200, 3);
+    diag("burst: %d -> %d workers after %ds, backlog %.0f", start, sim.workers, 3*GM_AUTOSCALE_INTERVAL, sim.backlog);
+    ok(sim.workers >= 40, "grows to %d workers within %d seconds", sim.workers, 3*GM_AUTOSCALE_INTERVAL);
+    simulate_rate(&as, &sim, 200, 10);
+    ok(sim.backlog < 200*GM_AUTOSCALE_INTERVAL, "backlog worked off: %.0f", sim.backlog);
+    ok(sim.workers <= MAX_WORKER, "stays below max worker: %d", sim.workers);
+
+    /* load drops, shrink before any idle timeout */
+    simulate_rate(&as, &sim, 5, 10);
+    diag("drop: %d workers after %ds", sim.workers, 10*GM_AUTOSCALE_INTERVAL);
+    ok(sim.workers <= 5, "shrinks to %d workers within %d seconds", sim.workers, 10*GM_AUTOSCALE_INTERVAL);
+
+    /* no load at all */
+    simulate_rate(&as, &sim, 0, 10);
+    ok(sim.workers == MIN_WORKER, "shrinks to min worker without load: %d", sim.workers);
+
+    /* overload is capped */
+    simulate_rate(&as, &sim, 10000, 5);
+    ok(sim.workers == MAX_WORKER, "capped at max worker: %d", sim.workers);
+
+    /* slow ramp up and down again follows the load without overshooting */
+    memset(&as, 0, sizeof(as));
+    memset(&sim, 0, sizeof(sim));
+    sim.service = 0.5;
+    sim.workers = MIN_WORKER;
+    for(x=0; x<30; x++)
+        ramp[x] = x < 15 ? x*4 : (30-x)*4;
+    simulate(&as, &sim, ramp, 30);
+    diag("ramp: max %d workers, end %d workers, backlog %.0f", sim.max_workers, sim.workers, sim.backlog);
+    ok(sim.max_workers >= 28 && sim.max_workers <= 45, "ramp up to %d workers", sim.max_workers);
+
+    /* jobs done counter reset by a restart */
+    memset(&as, 0, sizeof(as));
+    autoscale_sample(&as, 0, 0, 1000, 0);
+    autoscale_sample(&as, 2, 0, 10, 1);
+    ok(as.arrival_rate == 5 && as.completion_rate == 5, "counter reset: arrivals %.1f/s, done %.1f/s", as.arrival_rate, as.completion_rate);
+
+    /* jobs are waiting but nothing finished yet */
+    memset(&as, 0, sizeof(as));
+    autoscale_sample(&as, 0, 0, 0, 0);
+    autoscale_sample(&as, 2, 100, 0, 0);
+    ok(autoscale_target(&as, 5, MIN_WORKER, MAX_WORKER) == 6, "grows while jobs are waiting: %d", autoscale_target(&as, 5, MIN_WORKER, MAX_WORKER));
+
+    /* a gearmand which accepts but never answers must not block the sampling */
+    sd = silent_server(&port);
+    ok(sd >= 0, "silent server listens on port %d", port);
+    stats = malloc(sizeof(mod_gm_server_status_t));
+    stats->function_num = 0;
+    stats->worker_num   = 0;
+    gettimeofday(&start_time, NULL);
+    rc = get_gearman_server_data(stats, &message, &version, "127.0.0.1", port, GM_AUTOSCALE_TIMEOUT);
+    gettimeofday(&end_time, NULL);
+    diag("silent server: %.3fs, %s", end_time.tv_sec - start_time.tv_sec + (end_time.tv_usec - start_time.tv_usec) / 1000000.0, message);
+    ok(rc == STATE_CRITICAL, "no data from a silent server: rc %d", rc);
+    free(message);
+    free(version);
+    free_mod_gm_status_server(stats);
+
+    snprintf(server, sizeof(server), "server=127.0.0.1:%d", port);
+    parse_args_line(mod_gm_opt, server, 0);
+    ok(autoscale_backlog(mod_gm_opt) == -1, "no backlog from a silent server");
+    close(sd);
+
+    mod_gm_free_opt(mod_gm_opt);
+    return exit_status();
+}
+
+/* core log wrapper */
+void write_core_log(char *data) {
+    printf("core logger is not available for tests: %s", data);
+    return;
+}
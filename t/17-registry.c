@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <t/tap.h>
+#include <common.h>
+#include <utils.h>
+#include <worker_registry.h>
+
+#include <worker_dummy_functions.c>
+
+mod_gm_opt_t *mod_gm_opt;
+
+#define NUM_SLOTS   2001
+#define NUM_THREADS 8
+
+gm_worker_registry_t *reg;
+int releases[NUM_THREADS];
+
+/* release every slot which has our thread number as pid */
+void *release_slots(void *data);
+void *release_slots(void *data) {
+    int nr = *(int*)data;
+    int x;
+    for(x = 1; x < NUM_SLOTS; x++) {
+        if(registry_release(reg, x, nr+1) == TRUE)
+            releases[nr]++;
+    }
+    return NULL;
+}
+
+int main(void) {
+    pthread_t threads[NUM_THREADS];
+    int nrs[NUM_THREADS];
+    char *seen;
+    int x, indx, unique, total;
+
+    plan(14);
+
+    mod_gm_opt = malloc(sizeof(mod_gm_opt_t));
+    set_default_options(mod_gm_opt);
+
+    reg  = calloc(1, registry_size(NUM_SLOTS));
+    seen = calloc(NUM_SLOTS, 1);
+    ok(registry_check(reg) == GM_ERROR, "uninitialized registry is rejected");
+    registry_init(reg, NUM_SLOTS);
+    ok(registry_check(reg) == GM_OK, "registry layout version %d", reg->version);
+
+    /* all worker slots can be used, the status slot is never handed out */
+    unique = 0;
+    while((indx = registry_alloc(reg)) != GM_REGISTRY_NO_SLOT) {
+        if(indx > GM_REGISTRY_STATUS_SLOT && indx < NUM_SLOTS && seen[indx] == 0)
+            unique++;
+        seen[indx] = 1;
+        reg->slots[indx].pid = 1 + indx % NUM_THREADS;
+    }
+    ok(unique == NUM_SLOTS-1, "allocated %d unique slots", unique);
+    ok(reg->worker_total == NUM_SLOTS-1, "worker total: %d", reg->worker_total);
+    ok(registry_alloc(reg) == GM_REGISTRY_NO_SLOT, "no slot left");
+
+    /* state changes keep the running counter */
+    ok(registry_set_state(reg, 5, 5 % NUM_THREADS + 1, GM_SLOT_BUSY) == TRUE, "set busy");
+    ok(registry_set_state(reg, 6, 4711, GM_SLOT_BUSY) == FALSE, "cannot set state of foreign slot");
+    ok(reg->worker_running == 1, "worker running: %d", reg->worker_running);
+
+    /* slots are only released by their owner and only once */
+    ok(registry_release(reg, 7, 4711) == FALSE, "foreign pid cannot release slot");
+    ok(registry_release(reg, 7, 7 % NUM_THREADS + 1) == TRUE, "owner releases slot");
+    ok(registry_release(reg, 7, 0) == FALSE, "slot cannot be released twice");
+    ok(registry_alloc(reg) == 7, "released slot is reused");
+    reg->slots[7].pid = 7 % NUM_THREADS + 1;
+
+    /* concurrent releases, all threads try every slot and push their own ones onto the free list */
+    for(x = 0; x < NUM_THREADS; x++) {
+        nrs[x] = x;
+        pthread_create(&threads[x], NULL, release_slots, &nrs[x]);
+    }
+    for(x = 0; x < NUM_THREADS; x++)
+        pthread_join(threads[x], NULL);
+    total = 0;
+    for(x = 0; x < NUM_THREADS; x++)
+        total += releases[x];
+    ok(total == NUM_SLOTS-1 && reg->worker_total == 0 && reg->worker_running == 0, "released %d slots concurrently, total %d, running %d", total, reg->worker_total, reg->worker_running);
+
+    /* free list is still intact */
+    memset(seen, 0, NUM_SLOTS);
+    unique = 0;
+    while((indx = registry_alloc(reg)) != GM_REGISTRY_NO_SLOT) {
+        if(indx > GM_REGISTRY_STATUS_SLOT && indx < NUM_SLOTS && seen[indx] == 0)
+            unique++;
+        seen[indx] = 1;
+    }
+    ok(unique == NUM_SLOTS-1, "reallocated %d unique slots", unique);
+
+    free(seen);
+    free(reg);
+    mod_gm_free_opt(mod_gm_opt);
+    return exit_status();
+}
+
+/* core log wrapper */
+void write_core_log(char *data) {
+    printf("core logger is not available for tests: %s", data);
+    return;
+}
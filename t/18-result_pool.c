@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <t/tap.h>
+#include <common.h>
+#include <utils.h>
+#include <gm_pool.h>
+
+#include <worker_dummy_functions.c>
+
+mod_gm_opt_t *mod_gm_opt;
+
+#define NUM_PRODUCERS   4
+#define NUM_RESULTS     50000       /* per producer */
+#define ARENA_SIZE      2048
+#define LARGE_EVERY     100         /* every n-th output does not fit into the arena */
+#define MAX_INFLIGHT    1000        /* results waiting for the core */
+
+/* result as used by the neb module, strings are kept in the arena */
+typedef struct test_result {
+    char                 data[256];     /* stands in for the check_result */
+    struct test_result * next;          /* stands in for the list node */
+    gm_arena_t         * arena;         /* string memory */
+    char               * host_name;
+    char               * output;
+    int                  blocks;        /* arena blocks of the default size */
+} test_result_t;
+
+gm_pool_t pool;
+pthread_mutex_t list_lock = PTHREAD_MUTEX_INITIALIZER;
+test_result_t *list = NULL;
+int producers_running = NUM_PRODUCERS;
+unsigned long consumed = 0;
+int inflight = 0;
+unsigned long arena_allocs = 0;
+int destroyed = 0;
+__thread gm_pool_cache_t cache;
+
+/* count destroyed objects */
+void destroy_result(void *obj);
+void destroy_result(void *obj) {
+    gm_arena_free(((test_result_t *)obj)->arena);
+    destroyed++;
+}
+
+/* result thread, creates results and adds them to the shared list */
+void *produce(void *data);
+void *produce(void *data) {
+    char output[ARENA_SIZE*2];
+    test_result_t *res;
+    int nr = *(int*)data;
+    int x, len;
+
+    memset(output, 'x', sizeof(output));
+    for(x = 0; x < NUM_RESULTS; x++) {
+        /* the core keeps up with the results */
+        while(__atomic_load_n(&inflight, __ATOMIC_RELAXED) >= MAX_INFLIGHT)
+            usleep(50);
+        res = mod_gm_pool_get(&pool, &cache);
+        if(res->arena == NULL) {
+            res->arena = gm_arena_create(ARENA_SIZE);
+            __atomic_add_fetch(&arena_allocs, 1, __ATOMIC_RELAXED);
+        }
+        len = x % LARGE_EVERY == 0 ? ARENA_SIZE + 100 : 20 + x % 200;
+        snprintf(res->data, sizeof(res->data), "host%d", nr);
+        res->host_name = gm_arena_strdup(res->arena, res->data);
+        res->output    = gm_arena_strndup(res->arena, output, len);
+
+        pthread_mutex_lock(&list_lock);
+        res->next = list;
+        list      = res;
+        pthread_mutex_unlock(&list_lock);
+        __atomic_add_fetch(&inflight, 1, __ATOMIC_RELAXED);
+    }
+    mod_gm_pool_flush(&pool, &cache);
+    __atomic_sub_fetch(&producers_running, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* core thread, takes the whole list at once and releases the results */
+void *consume(void *data);
+void *consume(void *data) {
+    test_result_t *local, *res;
+    gm_arena_block_t *block;
+    int running, blocks;
+
+    data = data;
+    do {
+        running = __atomic_load_n(&producers_running, __ATOMIC_ACQUIRE);
+        pthread_mutex_lock(&list_lock);
+        local = list;
+        list  = NULL;
+        pthread_mutex_unlock(&list_lock);
+
+        while(local) {
+            res   = local;
+            local = local->next;
+            /* oversized blocks are freed by the reset, new default blocks are kept */
+            blocks = 0;
+            for(block = res->arena->first; block != NULL; block = block->next) {
+                if(block->size > res->arena->block_size)
+                    __atomic_add_fetch(&arena_allocs, 1, __ATOMIC_RELAXED);
+                else
+                    blocks++;
+            }
+            if(blocks > res->blocks) {
+                __atomic_add_fetch(&arena_allocs, blocks - (res->blocks ? res->blocks : 1), __ATOMIC_RELAXED);
+                res->blocks   = blocks;
+            }
+            gm_arena_reset(res->arena);
+            mod_gm_pool_put(&pool, &cache, res);
+            __atomic_sub_fetch(&inflight, 1, __ATOMIC_RELAXED);
+            consumed++;
+        }
+        usleep(100);
+    } while(running > 0);
+    mod_gm_pool_flush(&pool, &cache);
+    return NULL;
+}
+
+int main(void) {
+    pthread_t producers[NUM_PRODUCERS];
+    pthread_t consumer;
+    int nrs[NUM_PRODUCERS];
+    void *obj, *first;
+    double allocs;
+    int x;
+
+    plan(10);
+
+    mod_gm_opt = malloc(sizeof(mod_gm_opt_t));
+    set_default_options(mod_gm_opt);
+
+    /* basic pool operations */
+    mod_gm_pool_init(&pool, sizeof(test_result_t), NULL);
+    first = mod_gm_pool_get(&pool, NULL);
+    ok(pool.allocs == 1 && pool.objects == GM_POOL_CHUNK_SIZE, "first object allocates one chunk of %d objects", GM_POOL_CHUNK_SIZE);
+    ok(((test_result_t *)first)->arena == NULL && ((test_result_t *)first)->data[0] == 0, "new objects are zeroed");
+    mod_gm_pool_put(&pool, NULL, first);
+    obj = mod_gm_pool_get(&pool, &cache);
+    ok(obj == first, "object is recycled");
+    ok(cache.num == GM_POOL_BATCH_SIZE - 1 && pool.free_num == GM_POOL_CHUNK_SIZE - GM_POOL_BATCH_SIZE, "cache refilled with a batch: %d cached, %d shared", cache.num, pool.free_num);
+    mod_gm_pool_put(&pool, &cache, obj);
+    for(x = 0; x < GM_POOL_BATCH_SIZE; x++)
+        mod_gm_pool_put(&pool, &cache, mod_gm_pool_get(&pool, NULL));
+    ok(cache.num == GM_POOL_BATCH_SIZE && pool.free_num == GM_POOL_CHUNK_SIZE - GM_POOL_BATCH_SIZE, "full cache returns a batch: %d cached, %d shared", cache.num, pool.free_num);
+    mod_gm_pool_flush(&pool, &cache);
+    ok(cache.num == 0 && cache.head == NULL && pool.free_num == GM_POOL_CHUNK_SIZE, "flush empties the cache");
+    mod_gm_pool_destroy(&pool);
+
+    /* result threads and core thread */
+    mod_gm_pool_init(&pool, sizeof(test_result_t), destroy_result);
+    pthread_create(&consumer, NULL, consume, NULL);
+    for(x = 0; x < NUM_PRODUCERS; x++) {
+        nrs[x] = x;
+        pthread_create(&producers[x], NULL, produce, &nrs[x]);
+    }
+    for(x = 0; x < NUM_PRODUCERS; x++)
+        pthread_join(producers[x], NULL);
+    pthread_join(consumer, NULL);
+
+    ok(consumed == NUM_PRODUCERS*NUM_RESULTS, "consumed %lu results", consumed);
+    ok(pool.free_num == (int)pool.objects, "all %lu objects back in the pool", pool.objects);
+
+    allocs = (double)(pool.allocs + arena_allocs) / consumed;
+    diag("%lu results, %lu pooled objects, %lu chunk and %lu arena allocations", consumed, pool.objects, pool.allocs, arena_allocs);
+    diag("%.4f allocations per result, 5 without the pool", allocs);
+    ok(allocs < 2.0/LARGE_EVERY, "%.4f allocations per result", allocs);
+
+    mod_gm_pool_destroy(&pool);
+    ok(destroyed == (int)(pool.allocs * GM_POOL_CHUNK_SIZE), "destroy called for all %d objects", destroyed);
+
+    mod_gm_free_opt(mod_gm_opt);
+    return exit_status();
+}
+
+/* core log wrapper */
+void write_core_log(char *data) {
+    printf("core logger is not available for tests: %s", data);
+    return;
+}
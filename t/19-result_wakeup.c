@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <t/tap.h>
+#include <common.h>
+#include <utils.h>
+#include <gm_wakeup.h>
+
+#include <worker_dummy_functions.c>
+
+mod_gm_opt_t *mod_gm_opt;
+
+#define NUM_PRODUCERS   4
+#define BURST           20          /* results per job */
+#define RUNTIME         2500        /* ms per mode */
+#define TICK            1000        /* ms between timed result events */
+
+/* result as added by the result threads */
+typedef struct test_result {
+    struct timeval       queued;
+    struct test_result * next;
+} test_result_t;
+
+pthread_mutex_t list_lock = PTHREAD_MUTEX_INITIALIZER;
+test_result_t *list = NULL;
+gm_wakeup_t wakeup;
+int use_wakeup = FALSE;
+int stopping = 0;
+unsigned long produced = 0;
+
+/* result thread, adds bursts of results like a multi result job */
+void *produce(void *data);
+void *produce(void *data) {
+    test_result_t *res;
+    unsigned int seed = *(unsigned int*)data;
+    int x;
+
+    while(!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        for(x = 0; x < BURST; x++) {
+            res = malloc(sizeof(test_result_t));
+            gettimeofday(&res->queued, NULL);
+            pthread_mutex_lock(&list_lock);
+            res->next = list;
+            list      = res;
+            pthread_mutex_unlock(&list_lock);
+            if(use_wakeup)
+                mod_gm_wakeup_signal(&wakeup);
+            __atomic_add_fetch(&produced, 1, __ATOMIC_RELAXED);
+        }
+        usleep(2000 + rand_r(&seed) % 8000);
+    }
+    return NULL;
+}
+
+/* core, takes the whole list and records the latency of each result */
+unsigned long process(gm_histogram_t *hist);
+unsigned long process(gm_histogram_t *hist) {
+    test_result_t *local, *res;
+    struct timeval now;
+    unsigned long num = 0;
+
+    pthread_mutex_lock(&list_lock);
+    local = list;
+    list  = NULL;
+    pthread_mutex_unlock(&list_lock);
+
+    gettimeofday(&now, NULL);
+    while(local) {
+        res   = local;
+        local = local->next;
+        mod_gm_histogram_add(hist, &res->queued, &now);
+        free(res);
+        num++;
+    }
+    return num;
+}
+
+/* run result threads and the core event loop for a while */
+unsigned long run(gm_histogram_t *hist, int with_wakeup, int *wakeups);
+unsigned long run(gm_histogram_t *hist, int with_wakeup, int *wakeups) {
+    pthread_t producers[NUM_PRODUCERS];
+    unsigned int seeds[NUM_PRODUCERS];
+    struct pollfd pfd;
+    struct timeval start, now;
+    long elapsed, next_tick = TICK;
+    unsigned long consumed = 0;
+    int x;
+
+    use_wakeup = with_wakeup;
+    stopping   = 0;
+    produced   = 0;
+    *wakeups   = 0;
+    gettimeofday(&start, NULL);
+    for(x = 0; x < NUM_PRODUCERS; x++) {
+        seeds[x] = x+1;
+        pthread_create(&producers[x], NULL, produce, &seeds[x]);
+    }
+
+    pfd.fd     = wakeup.fd[0];
+    pfd.events = POLLIN;
+    while(1) {
+        gettimeofday(&now, NULL);
+        elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000;
+        if(elapsed >= RUNTIME)
+            break;
+
+        /* the event loop sleeps until the next timed event or until the pipe is readable */
+        pfd.revents = 0;
+        if(with_wakeup && poll(&pfd, 1, next_tick - elapsed) > 0) {
+            mod_gm_wakeup_clear(&wakeup);
+            consumed += process(hist);
+            (*wakeups)++;
+            continue;
+        }
+        if(!with_wakeup)
+            usleep((next_tick - elapsed) * 1000);
+        gettimeofday(&now, NULL);
+        elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000;
+        if(elapsed >= next_tick) {
+            next_tick += TICK;
+            if(!with_wakeup) {
+                consumed += process(hist);
+                (*wakeups)++;
+            }
+        }
+    }
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    for(x = 0; x < NUM_PRODUCERS; x++)
+        pthread_join(producers[x], NULL);
+    mod_gm_wakeup_clear(&wakeup);
+    consumed += process(hist);
+    return consumed;
+}
+
+int main(void) {
+    gm_histogram_t hist, timed, woken;
+    struct timeval t1 = { 100, 0 }, t2 = { 100, 500 };
+    struct pollfd pfd;
+    unsigned long consumed, results;
+    double timed_avg;
+    int wakeups;
+    char c;
+
+    plan(10);
+
+    mod_gm_opt = malloc(sizeof(mod_gm_opt_t));
+    set_default_options(mod_gm_opt);
+
+    /* wake up pipe */
+    ok(mod_gm_wakeup_init(&wakeup) == GM_OK, "wake up pipe created");
+    mod_gm_wakeup_signal(&wakeup);
+    mod_gm_wakeup_signal(&wakeup);
+    mod_gm_wakeup_signal(&wakeup);
+    ok(wakeup.signals == 1 && read(wakeup.fd[0], &c, 1) == 1 && read(wakeup.fd[0], &c, 1) == -1, "pending wake up is not written again");
+    mod_gm_wakeup_clear(&wakeup);
+    mod_gm_wakeup_signal(&wakeup);
+    mod_gm_wakeup_clear(&wakeup);
+    pfd.fd     = wakeup.fd[0];
+    pfd.events = POLLIN;
+    ok(wakeup.signals == 2 && wakeup.pending == 0 && poll(&pfd, 1, 0) == 0, "clear empties the pipe");
+
+    /* histogram buckets */
+    memset(&hist, 0, sizeof(hist));
+    mod_gm_histogram_add(&hist, &t1, &t2);
+    t2.tv_usec = 0; t2.tv_sec = 103;
+    mod_gm_histogram_add(&hist, &t1, &t2);
+    t2.tv_sec = 100000;
+    mod_gm_histogram_add(&hist, &t1, &t2);
+    ok(hist.bucket[0] == 1 && hist.bucket[12] == 1 && hist.bucket[GM_HISTOGRAM_BUCKETS-1] == 1 && hist.count == 3, "histogram buckets");
+    mod_gm_histogram_log(&hist, GM_LOG_INFO, "histogram");
+    ok(hist.count == 0 && hist.max == 0, "histogram reset after logging");
+
+    /* results picked up by a timed event once per second */
+    memset(&timed, 0, sizeof(timed));
+    consumed  = run(&timed, FALSE, &wakeups);
+    results   = produced;
+    timed_avg = timed.sum / timed.count;
+    diag("timed event: %lu results in %d runs, avg %.2fms, max %.2fms", consumed, wakeups, timed_avg, timed.max);
+    mod_gm_histogram_log(&timed, GM_LOG_INFO, "latency timed event");
+    ok(consumed == results, "timed event processed all %lu results", consumed);
+
+    /* results wake up the core */
+    memset(&woken, 0, sizeof(woken));
+    consumed = run(&woken, TRUE, &wakeups);
+    results  = produced;
+    diag("wake up: %lu results in %d wake ups, avg %.2fms, max %.2fms", consumed, wakeups, woken.sum / woken.count, woken.max);
+    ok(consumed == results, "wake up processed all %lu results", consumed);
+    ok(woken.sum / woken.count < timed_avg / 10, "average latency %.2fms instead of %.2fms", woken.sum / woken.count, timed_avg);
+    ok((unsigned long)wakeups < consumed / 2, "%d wake ups for %lu results", wakeups, consumed);
+    mod_gm_histogram_log(&woken, GM_LOG_INFO, "latency wake up");
+
+    mod_gm_wakeup_free(&wakeup);
+    ok(wakeup.fd[0] == -1 && wakeup.fd[1] == -1, "wake up pipe closed");
+
+    mod_gm_free_opt(mod_gm_opt);
+    return exit_status();
+}
+
+/* core log wrapper */
+void write_core_log(char *data) {
+    printf("core logger is not available for tests: %s", data);
+    return;
+}
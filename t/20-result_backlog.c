@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <t/tap.h>
+#include <common.h>
+#include <utils.h>
+#include <gm_backlog.h>
+
+#include <worker_dummy_functions.c>
+
+mod_gm_opt_t *mod_gm_opt;
+
+#define LIMIT           100
+#define RESUME          75
+#define NUM_PRODUCERS   4
+#define RUNTIME         1000        /* ms of concurrent results */
+
+gm_backlog_t backlog;
+int stopping = 0;
+int max_pending = 0;
+
+/* result thread, takes a result unless the backlog is full */
+void *produce(void *data);
+void *produce(void *data) {
+    int pending;
+
+    data = data;
+    while(!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        if(mod_gm_backlog_wait(&backlog, LIMIT, RESUME))
+            continue;
+        mod_gm_backlog_add(&backlog, 1);
+        pending = __atomic_load_n(&backlog.pending, __ATOMIC_RELAXED);
+        if(pending > __atomic_load_n(&max_pending, __ATOMIC_RELAXED))
+            __atomic_store_n(&max_pending, pending, __ATOMIC_RELAXED);
+        usleep(10);
+    }
+    return NULL;
+}
+
+/* result thread which waits once, returns when it was woken up */
+void *wait_once(void *data);
+void *wait_once(void *data) {
+    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+    *(int *)data = mod_gm_backlog_wait(&backlog, LIMIT, RESUME);
+    return NULL;
+}
+
+/* set the number of waiting results */
+void set_pending(int num);
+void set_pending(int num) {
+    mod_gm_backlog_add(&backlog, num - backlog.pending);
+}
+
+int main(void) {
+    pthread_t producers[NUM_PRODUCERS];
+    struct timeval start, now;
+    unsigned int seed;
+    long elapsed;
+    int x, rc;
+
+    plan(14);
+
+    mod_gm_opt = malloc(sizeof(mod_gm_opt_t));
+    set_default_options(mod_gm_opt);
+
+    /* no limit */
+    mod_gm_backlog_init(&backlog);
+    set_pending(100000);
+    ok(mod_gm_backlog_full(&backlog, 0, 0) == FALSE && backlog.throttled_num == 0, "never full without limit");
+
+    /* pause at the limit */
+    mod_gm_backlog_init(&backlog);
+    set_pending(LIMIT - 1);
+    ok(mod_gm_backlog_full(&backlog, LIMIT, RESUME) == FALSE, "not full below the limit");
+    set_pending(LIMIT);
+    ok(mod_gm_backlog_full(&backlog, LIMIT, RESUME) == TRUE && backlog.throttled_num == 1, "paused at the limit");
+
+    /* stay paused till the resume mark */
+    rc = 0;
+    for(x = LIMIT - 1; x > RESUME; x--) {
+        set_pending(x);
+        if(mod_gm_backlog_full(&backlog, LIMIT, RESUME) != TRUE)
+            rc++;
+    }
+    ok(rc == 0 && backlog.throttled_num == 1, "still paused above the resume mark");
+    usleep(20000);
+    set_pending(RESUME);
+    ok(mod_gm_backlog_full(&backlog, LIMIT, RESUME) == FALSE, "resumed at the resume mark");
+    diag("paused for %lums", backlog.throttled_ms);
+    ok(backlog.throttled_ms >= 10 && backlog.throttled_ms < 10000, "pause duration counted: %lums", backlog.throttled_ms);
+
+    /* no pause between the marks on the way up */
+    rc = 0;
+    for(x = RESUME; x < LIMIT; x++) {
+        set_pending(x);
+        if(mod_gm_backlog_full(&backlog, LIMIT, RESUME) != FALSE)
+            rc++;
+    }
+    ok(rc == 0 && backlog.throttled_num == 1, "not paused again below the limit");
+    set_pending(LIMIT + 10);
+    ok(mod_gm_backlog_full(&backlog, LIMIT, RESUME) == TRUE && backlog.throttled_num == 2, "second pause counted");
+    set_pending(0);
+    ok(mod_gm_backlog_full(&backlog, LIMIT, RESUME) == FALSE && backlog.throttled == FALSE, "resumed when the core took everything");
+
+    /* paused threads sleep till the core took enough results */
+    pthread_t waiter;
+    int waited = FALSE;
+    set_pending(LIMIT);
+    pthread_create(&waiter, NULL, wait_once, &waited);
+    usleep(20000);
+    mod_gm_backlog_take(&backlog, LIMIT - RESUME - 1, RESUME);
+    usleep(20000);
+    rc = waited;
+    mod_gm_backlog_take(&backlog, 1, RESUME);
+    pthread_join(waiter, NULL);
+    ok(rc == FALSE && waited == TRUE && backlog.throttled == FALSE, "paused thread is woken up at the resume mark");
+
+    /* a waiting thread can be cancelled */
+    set_pending(LIMIT);
+    pthread_create(&waiter, NULL, wait_once, &waited);
+    usleep(20000);
+    pthread_cancel(waiter);
+    pthread_join(waiter, NULL);
+    mod_gm_backlog_take(&backlog, LIMIT, RESUME);
+    ok(backlog.throttled == FALSE && backlog.pending == 0, "cancelled thread released the backlog");
+
+    /* result threads and a core which takes all results at random intervals */
+    mod_gm_backlog_init(&backlog);
+    seed = time(NULL);
+    diag("random seed: %u", seed);
+    gettimeofday(&start, NULL);
+    for(x = 0; x < NUM_PRODUCERS; x++)
+        pthread_create(&producers[x], NULL, produce, NULL);
+    do {
+        usleep(rand_r(&seed) % 5000);
+        mod_gm_backlog_take(&backlog, __atomic_load_n(&backlog.pending, __ATOMIC_RELAXED), RESUME);
+        gettimeofday(&now, NULL);
+        elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000;
+    } while(elapsed < RUNTIME);
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    mod_gm_backlog_take(&backlog, __atomic_load_n(&backlog.pending, __ATOMIC_RELAXED), RESUME);
+    for(x = 0; x < NUM_PRODUCERS; x++)
+        pthread_join(producers[x], NULL);
+    gettimeofday(&now, NULL);
+    elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000;
+    diag("concurrent: %lu pauses for %lums in %ldms, max %d pending", backlog.throttled_num, backlog.throttled_ms, elapsed, max_pending);
+    ok(backlog.throttled_num > 0, "result threads paused %lu times", backlog.throttled_num);
+    ok(backlog.throttled_ms <= (unsigned long)elapsed, "paused %lums within %ldms", backlog.throttled_ms, elapsed);
+    ok(max_pending <= LIMIT + NUM_PRODUCERS, "max %d results pending with a limit of %d", max_pending, LIMIT);
+
+    mod_gm_free_opt(mod_gm_opt);
+    return exit_status();
+}
+
+/* core log wrapper */
+void write_core_log(char *data) {
+    printf("core logger is not available for tests: %s", data);
+    return;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <t/tap.h>
+#include <common.h>
+#include <utils.h>
+#include <check_utils.h>
+#include <worker_client.h>
+#include <worker_pool.h>
+
+#include <worker_dummy_functions.c>
+
+mod_gm_opt_t *mod_gm_opt;
+
+/* the pool is started by worker_pool_run() which needs a gearmand */
+extern int pool_size;
+extern int pool_busy;
+
+#define NUM_THREADS  32
+#define FAST_CHECKS  50
+
+/* worker thread, runs checks like a thread of the worker pool */
+typedef struct pool_test {
+    int    nr;
+    int    errors;
+    int    timeouts;
+    double slowest;
+} pool_test_t;
+
+/* run one check and return its duration in seconds */
+double run_pool_check(char * cmd, int timeout, char ** output, int * rc);
+double run_pool_check(char * cmd, int timeout, char ** output, int * rc) {
+    struct timeval start, end;
+    gm_job_t * job;
+
+    job = gm_malloc(sizeof(gm_job_t));
+    set_default_job(job, mod_gm_opt);
+    job->command_line = gm_strdup(cmd);
+    job->type         = gm_strdup("service");
+    job->timeout      = timeout;
+
+    gettimeofday(&start, NULL);
+    worker_pool_state(GM_JOB_START);
+    execute_safe_command(job, GM_ENABLED, "pool");
+    worker_pool_state(GM_JOB_END);
+    gettimeofday(&end, NULL);
+
+    *output = gm_strdup(job->output != NULL ? job->output : "");
+    *rc     = job->return_code;
+    free_job(job);
+    return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+}
+
+/* odd threads run long and timed out checks, even threads many short ones */
+void *pool_thread(void *data);
+void *pool_thread(void *data) {
+    pool_test_t * t = (pool_test_t *)data;
+    char cmd[100], expect[100], *output;
+    double duration;
+    int x, rc;
+
+    if(t->nr % 2 == 1) {
+        for(x = 0; x < 2; x++) {
+            duration = run_pool_check("/bin/sh -c 'sleep 1; echo slow'", 10, &output, &rc);
+            if(rc != 0 || strcmp(output, "slow\\n") || duration > 5) {
+                diag("thread %d: slow check returned %d after %.2fs: %s", t->nr, rc, duration, output);
+                t->errors++;
+            }
+            free(output);
+        }
+        duration = run_pool_check("/bin/sleep 10", 1, &output, &rc);
+        if(rc == mod_gm_opt->timeout_return && strstr(output, "Timed Out On Worker: pool") != NULL && duration < 5)
+            t->timeouts++;
+        else
+            diag("thread %d: timeout check returned %d after %.2fs: %s", t->nr, rc, duration, output);
+        free(output);
+        return NULL;
+    }
+
+    for(x = 0; x < FAST_CHECKS; x++) {
+        snprintf(cmd, sizeof(cmd), "/bin/echo thread %d check %d", t->nr, x);
+        snprintf(expect, sizeof(expect), "thread %d check %d\\n", t->nr, x);
+        duration = run_pool_check(cmd, 10, &output, &rc);
+        if(rc != 0 || strcmp(output, expect)) {
+            diag("thread %d: check %d returned %d: %s", t->nr, x, rc, output);
+            t->errors++;
+        }
+        if(duration > t->slowest)
+            t->slowest = duration;
+        free(output);
+    }
+    return NULL;
+}
+
+int main(void) {
+    pthread_t threads[NUM_THREADS];
+    pool_test_t tests[NUM_THREADS];
+    double slowest = 0;
+    int x, errors = 0, timeouts = 0;
+
+    plan(6);
+
+    mod_gm_opt = gm_malloc(sizeof(mod_gm_opt_t));
+    set_default_options(mod_gm_opt);
+
+    ok(worker_pool_state(GM_JOB_START) == -1, "no pool, no job accounting");
+
+    pool_size = NUM_THREADS;
+    ok(worker_pool_state(GM_JOB_START) == NUM_THREADS-1 && worker_pool_state(GM_JOB_END) == NUM_THREADS, "idle threads are counted");
+
+    memset(tests, 0, sizeof(tests));
+    for(x = 0; x < NUM_THREADS; x++) {
+        tests[x].nr = x;
+        pthread_create(&threads[x], NULL, pool_thread, &tests[x]);
+    }
+    for(x = 0; x < NUM_THREADS; x++) {
+        pthread_join(threads[x], NULL);
+        errors   += tests[x].errors;
+        timeouts += tests[x].timeouts;
+        if(tests[x].slowest > slowest)
+            slowest = tests[x].slowest;
+    }
+
+    ok(errors == 0, "%d threads with overlapping checks got their own results", NUM_THREADS);
+    ok(timeouts == NUM_THREADS/2, "%d of %d checks timed out", timeouts, NUM_THREADS/2);
+    ok(slowest < 0.9, "short checks do not wait for long running checks of other threads, slowest took %.2fs", slowest);
+    ok(pool_busy == 0 && worker_pool_state(GM_JOB_START) == NUM_THREADS-1, "all threads are idle again");
+
+    pool_size = 0;
+    mod_gm_free_opt(mod_gm_opt);
+    return exit_status();
+}
+
+/* core log wrapper */
+void write_core_log(char *data) {
+    printf("core logger is not available for tests: %s", data);
+    return;
+}
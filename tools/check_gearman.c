@@ -217,7 +217,7 @@ int check_server(char * server, in_port_t port) {
     stats = gm_malloc(sizeof(mod_gm_server_status_t));
     stats->function_num = 0;
     stats->worker_num   = 0;
-    rc = get_gearman_server_data(stats, &message, &version, server, port);
+    rc = get_gearman_server_data(stats, &message, &version, server, port, opt_timeout*1000);
     if( rc == STATE_OK ) {
         for(x=0; x<stats->function_num;x++) {
             if(opt_queue != NULL && strcmp(opt_queue, stats->function[x]->queue))
@@ -206,7 +206,7 @@ void print_stats(char * hostnam) {
     stats = (mod_gm_server_status_t*)gm_malloc(sizeof(mod_gm_server_status_t));
     stats->function_num = 0;
     stats->worker_num   = 0;
-    rc = get_gearman_server_data(stats, &message, &version, server, port);
+    rc = get_gearman_server_data(stats, &message, &version, server, port, con_timeout*1000);
 
     t   = time(NULL);
     now = *(localtime(&t));
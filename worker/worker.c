@@ -26,6 +26,10 @@
 #include "worker.h"
 #include "utils.h"
 #include "worker_client.h"
+#include "worker_registry.h"
+#include "worker_zygote.h"
+#include "worker_monitor.h"
+#include "worker_autoscale.h"
 
 int current_number_of_workers                = 0;
 volatile sig_atomic_t current_number_of_jobs = 0;  /* must be signal safe */
@@ -33,8 +37,11 @@ volatile sig_atomic_t current_number_of_jobs = 0;  /* must be signal safe */
 int     orig_argc;
 char ** orig_argv;
 int     last_time_increased;
+int     monitor_events = FALSE;
+gm_autoscale_t autoscale;
+int     autoscale_last_target = -1;
 volatile sig_atomic_t shmid;
-int   * shm;
+extern gm_worker_registry_t * registry;
 #ifdef EMBEDDEDPERL
 extern char *p1_file;
 char **start_env;
@@ -145,9 +152,9 @@ int main (int argc, char **argv) {
     if(mod_gm_opt->debug_level >= 10) {
         gm_log( GM_LOG_TRACE, "starting standalone worker\n");
 #ifdef EMBEDDEDPERL
-        worker_client(GM_WORKER_STANDALONE, 1, shmid, start_env);
+        worker_client(GM_WORKER_STANDALONE, 1, start_env);
 #else
-        worker_client(GM_WORKER_STANDALONE, 1, shmid);
+        worker_client(GM_WORKER_STANDALONE, 1);
 #endif
         exit(EXIT_SUCCESS);
     }
@@ -155,6 +162,10 @@ int main (int argc, char **argv) {
     /* setup shared memory */
     setup_child_communicator();
 
+    /* wait for worker events instead of polling */
+    if(monitor_init() == GM_OK)
+        monitor_events = TRUE;
+
     /* start status worker */
     make_new_child(GM_WORKER_STATUS);
 
@@ -174,14 +185,28 @@ int main (int argc, char **argv) {
 
 /* main loop for checking worker */
 void monitor_loop() {
+    int events = 0;
+    time_t now, last_check = 0;
 
     /* maintain the population */
     while (1) {
-        /* check number of workers every second */
-        sleep(GM_DEFAULT_WORKER_LOOP_SLEEP);
+        /* wait for worker events, check number of workers at least every second */
+        if(monitor_events == TRUE) {
+            events = monitor_wait(GM_DEFAULT_WORKER_LOOP_SLEEP*1000);
+        } else {
+            sleep(GM_DEFAULT_WORKER_LOOP_SLEEP);
+        }
+
+        /* start more worker right away if all are busy */
+        if(events & GM_MONITOR_BUSY)
+            increase_worker_population();
 
         /* make sure our worker are running */
-        check_worker_population();
+        now = time(NULL);
+        if(events == 0 || events & GM_MONITOR_EXIT || now - last_check >= GM_DEFAULT_WORKER_LOOP_SLEEP) {
+            check_worker_population();
+            last_check = now;
+        }
     }
     return;
 }
@@ -189,50 +214,32 @@ void monitor_loop() {
 
 /* count current worker and jobs */
 void count_current_worker(int restart) {
-    int x;
+    gm_worker_slot_t * slot;
+    int x, pid;
 
     gm_log( GM_LOG_TRACE3, "count_current_worker()\n");
-    gm_log( GM_LOG_TRACE3, "done jobs:     shm[SHM_JOBS_DONE] = %d\n", shm[SHM_JOBS_DONE]);
-
-    /* shm states:
-     *   0 -> undefined
-     *  -1 -> free
-     * <-1 -> used but idle
-     * > 1 -> used and working
-     */
+    gm_log( GM_LOG_TRACE3, "done jobs:     %d\n", registry->jobs_done);
 
-    /* check if status worker died */
-    if( shm[SHM_STATUS_WORKER_PID] != -1 && pid_alive(shm[SHM_STATUS_WORKER_PID]) == FALSE ) {
-        gm_log( GM_LOG_TRACE, "removed stale status worker, old pid: %d\n", shm[SHM_STATUS_WORKER_PID] );
-        shm[SHM_STATUS_WORKER_PID] = -1;
-    }
-    gm_log( GM_LOG_TRACE3, "status worker: shm[SHM_STATUS_WORKER_PID] = %d\n", shm[SHM_STATUS_WORKER_PID]);
+    /* check all known worker, the status worker uses the first slot */
+    for(x=GM_REGISTRY_STATUS_SLOT; x < registry->num_slots; x++) {
+        slot = &registry->slots[x];
+        if(slot->state == GM_SLOT_FREE)
+            continue;
+        pid = slot->pid;
+        gm_log( GM_LOG_TRACE3, "worker slot:   %d = pid %d, state %d, jobs %d, queue %s\n", x, pid, slot->state, slot->jobs_done, slot->queue);
 
-    /* check all known worker */
-    current_number_of_workers = 0;
-    current_number_of_jobs    = 0;
-    for(x=SHM_SHIFT; x < mod_gm_opt->max_worker+SHM_SHIFT; x++) {
         /* verify worker is alive */
-        gm_log( GM_LOG_TRACE3, "worker slot:   shm[%d] = %d\n", x, shm[x]);
-        if( shm[x] != -1 && pid_alive(shm[x]) == FALSE ) {
-            gm_log( GM_LOG_TRACE, "removed stale worker %d, old pid: %d\n", x, shm[x]);
-            shm[x] = -1;
+        if( pid_alive(pid) == FALSE && registry_release(registry, x, pid) == TRUE ) {
+            gm_log( GM_LOG_TRACE, "removed stale worker %d, old pid: %d\n", x, pid);
             /* immediately start new worker, otherwise the fork rate cannot be guaranteed */
-            if(restart == GM_ENABLED) {
+            if(restart == GM_ENABLED && x != GM_REGISTRY_STATUS_SLOT)
                 make_new_child(GM_WORKER_MULTI);
-                current_number_of_workers++;
-            }
-        }
-        if(shm[x] != -1) {
-            current_number_of_workers++;
-        }
-        if(shm[x] > 0) {
-            current_number_of_jobs++;
         }
     }
 
-    shm[SHM_WORKER_TOTAL]   = current_number_of_workers; /* total worker   */
-    shm[SHM_WORKER_RUNNING] = current_number_of_jobs;    /* running worker */
+    /* counters are maintained by the worker itself */
+    current_number_of_workers = registry->worker_total;
+    current_number_of_jobs    = registry->worker_running;
 
     gm_log( GM_LOG_TRACE3, "worker: %d  -  running: %d\n", current_number_of_workers, current_number_of_jobs);
 
@@ -241,7 +248,7 @@ void count_current_worker(int restart) {
 
 /* start new worker if needed */
 void check_worker_population() {
-    int x, now, status, target_number_of_workers;
+    int x, now, pid, status, target_number_of_workers;
 
     gm_log( GM_LOG_TRACE3, "check_worker_population()\n");
 
@@ -255,21 +262,25 @@ void check_worker_population() {
     count_current_worker(GM_ENABLED);
 
     /* check last check time, force restart all worker if there is no result in 2 minutes */
-    if( shm[SHM_WORKER_LAST_CHECK] < (now - 120) ) {
-        gm_log( GM_LOG_INFO, "no checks in 2minutes, restarting all workers\n", shm[SHM_WORKER_LAST_CHECK]);
-        shm[SHM_WORKER_LAST_CHECK] = now;
-        for(x=SHM_SHIFT; x < mod_gm_opt->max_worker+SHM_SHIFT; x++) {
-            save_kill(shm[x], SIGINT);
+    if( registry->last_check < (now - 120) ) {
+        gm_log( GM_LOG_INFO, "no checks in 2minutes, restarting all workers\n");
+        registry->last_check = now;
+        for(x=GM_REGISTRY_STATUS_SLOT+1; x < registry->num_slots; x++) {
+            if(registry->slots[x].state != GM_SLOT_FREE)
+                save_kill(registry->slots[x].pid, SIGINT);
         }
         sleep(3);
-        for(x=SHM_SHIFT; x < mod_gm_opt->max_worker+SHM_SHIFT; x++) {
-            save_kill(shm[x], SIGKILL);
-            shm[x] = -1;
+        for(x=GM_REGISTRY_STATUS_SLOT+1; x < registry->num_slots; x++) {
+            pid = registry->slots[x].pid;
+            if(registry->slots[x].state != GM_SLOT_FREE && registry_release(registry, x, pid) == TRUE)
+                save_kill(pid, SIGKILL);
         }
+        current_number_of_workers = registry->worker_total;
+        current_number_of_jobs    = registry->worker_running;
     }
 
     /* check if status worker died */
-    if( shm[SHM_STATUS_WORKER_PID] == -1 ) {
+    if( registry->slots[GM_REGISTRY_STATUS_SLOT].state == GM_SLOT_FREE ) {
         make_new_child(GM_WORKER_STATUS);
     }
 
@@ -283,7 +294,17 @@ void check_worker_population() {
     if(last_time_increased >= now)
         return;
 
-    target_number_of_workers = adjust_number_of_worker(mod_gm_opt->min_worker, mod_gm_opt->max_worker, current_number_of_workers, current_number_of_jobs);
+    target_number_of_workers = -1;
+    if(mod_gm_opt->autoscale == GM_ENABLED) {
+        target_number_of_workers = autoscale_number_of_worker(now, current_number_of_workers, current_number_of_jobs);
+
+        /* stop surplus idle worker instead of waiting for their idle timeout */
+        if(target_number_of_workers >= 0 && target_number_of_workers < current_number_of_workers)
+            reduce_worker_population(current_number_of_workers - target_number_of_workers);
+    }
+    if(target_number_of_workers < 0)
+        target_number_of_workers = adjust_number_of_worker(mod_gm_opt->min_worker, mod_gm_opt->max_worker, current_number_of_workers, current_number_of_jobs);
+
     for (x = current_number_of_workers; x < target_number_of_workers; x++) {
         last_time_increased = now;
         /* top up the worker pool */
@@ -293,21 +314,101 @@ void check_worker_population() {
 }
 
 
+/* size the worker population by the gearmand queues */
+int autoscale_number_of_worker(int now, int cur_workers, int cur_jobs) {
+    int backlog;
+
+    if(now - autoscale.last_time < GM_AUTOSCALE_INTERVAL)
+        return autoscale_last_target;
+
+    /* use the local view if gearmand cannot be asked */
+    backlog = autoscale_backlog(mod_gm_opt);
+    if(backlog < 0) {
+        autoscale.samples     = 0;
+        autoscale_last_target = -1;
+        return -1;
+    }
+
+    autoscale_sample(&autoscale, now, backlog, registry->jobs_done, cur_jobs);
+    autoscale_last_target = autoscale_target(&autoscale, cur_workers, mod_gm_opt->min_worker, mod_gm_opt->max_worker);
+
+    /* do not grow beyond the load limits */
+    if(autoscale_last_target > cur_workers && load_limit_reached() == TRUE)
+        autoscale_last_target = cur_workers;
+
+    return autoscale_last_target;
+}
+
+
+/* stop idle worker */
+void reduce_worker_population(int num) {
+    int x;
+
+    for(x=GM_REGISTRY_STATUS_SLOT+1; x < registry->num_slots && num > 0; x++) {
+        /* idle worker only, SIGINT lets a just started job retry */
+        if(registry->slots[x].state == GM_SLOT_IDLE) {
+            gm_log( GM_LOG_TRACE, "stopping idle worker %d\n", registry->slots[x].pid );
+            save_kill(registry->slots[x].pid, SIGINT);
+            num--;
+        }
+    }
+    return;
+}
+
+
+/* start new worker if all worker are busy */
+void increase_worker_population() {
+    int x, target;
+    int workers = registry->worker_total;
+    int jobs    = registry->worker_running;
+
+    /* no need to probe the pids, exited worker are reported separately */
+
+    target = adjust_number_of_worker(mod_gm_opt->min_worker, mod_gm_opt->max_worker, workers, jobs);
+
+    /* the autoscaler sizes the population, busy worker must not grow it beyond its target */
+    if(mod_gm_opt->autoscale == GM_ENABLED && autoscale_last_target >= 0 && target > autoscale_last_target)
+        target = autoscale_last_target;
+
+    for (x = workers; x < target; x++) {
+        last_time_increased = (int)time(NULL);
+        make_new_child(GM_WORKER_MULTI);
+    }
+    return;
+}
+
+
 /* start up new worker */
 int make_new_child(int mode) {
     pid_t pid = 0;
     int next_shm_index;
+    struct timeval start_time, end_time;
 
     gm_log( GM_LOG_TRACE, "make_new_child(%d)\n", mode);
+    gettimeofday(&start_time, NULL);
 
     if(mode == GM_WORKER_STATUS) {
         gm_log( GM_LOG_TRACE, "forking status worker\n");
-        next_shm_index = 3;
+        next_shm_index = GM_REGISTRY_STATUS_SLOT;
+        registry->slots[next_shm_index].pid = 0;
+        __atomic_store_n(&registry->slots[next_shm_index].state, GM_SLOT_RESERVED, __ATOMIC_RELEASE);
     } else {
         gm_log( GM_LOG_TRACE, "forking worker\n");
         next_shm_index = get_next_shm_index();
     }
 
+    /* fork from the prepared zygote, use a normal fork if that fails */
+    if(mod_gm_opt->zygote == GM_ENABLED) {
+        pid = zygote_spawn(mode, next_shm_index);
+        if(pid > 0) {
+            registry->slots[next_shm_index].pid = pid;
+            monitor_watch_worker(next_shm_index, pid);
+            gettimeofday(&end_time, NULL);
+            gm_log( GM_LOG_TRACE, "worker %d spawned by zygote in %.3fms\n", pid, (double)(timeval2double(&end_time)-timeval2double(&start_time))*1000 );
+            return GM_OK;
+        }
+    }
+
     signal(SIGINT,  SIG_DFL);
     signal(SIGTERM, SIG_DFL);
 
@@ -318,20 +419,22 @@ int make_new_child(int mode) {
     if(pid==-1){
         perror("fork");
         gm_log( GM_LOG_ERROR, "fork error\n" );
+        registry_release(registry, next_shm_index, 0);
         return GM_ERROR;
     }
 
     /* we are in the child process */
     else if(pid==0){
 
+        monitor_child_init();
         gm_log( GM_LOG_DEBUG, "child started with pid: %d\n", getpid() );
-        shm[next_shm_index] = -getpid();
+        registry->slots[next_shm_index].pid = getpid();
 
         /* do the real work */
 #ifdef EMBEDDEDPERL
-        worker_client(mode, next_shm_index, shmid, start_env);
+        worker_client(mode, next_shm_index, start_env);
 #else
-        worker_client(mode, next_shm_index, shmid);
+        worker_client(mode, next_shm_index);
 #endif
 
         exit(EXIT_SUCCESS);
@@ -341,7 +444,10 @@ int make_new_child(int mode) {
     else if(pid > 0){
         signal(SIGINT, clean_exit);
         signal(SIGTERM,clean_exit);
-        shm[next_shm_index] = -pid;
+        registry->slots[next_shm_index].pid = pid;
+        monitor_watch_worker(next_shm_index, pid);
+        gettimeofday(&end_time, NULL);
+        gm_log( GM_LOG_TRACE, "worker %d forked in %.3fms\n", pid, (double)(timeval2double(&end_time)-timeval2double(&start_time))*1000 );
     }
 
     return GM_OK;
@@ -542,32 +648,21 @@ void print_usage() {
 
 /* create shared memory segments */
 void setup_child_communicator() {
-    int x;
-    int now = (int)time(NULL);
-
     gm_log( GM_LOG_TRACE, "setup_child_communicator()\n");
 
-    /* Create the segment. */
+    /* Create the segment, one slot per worker plus the status worker */
     mod_gm_shm_key = getpid(); /* use pid as shm key */
-    if ((shmid = shmget(mod_gm_shm_key, GM_SHM_SIZE, IPC_CREAT | 0600)) < 0) {
+    if ((shmid = shmget(mod_gm_shm_key, registry_size(mod_gm_opt->max_worker+1), IPC_CREAT | 0600)) < 0) {
         perror("shmget");
         exit( EXIT_FAILURE );
     }
 
-    /* Now we attach the segment to our data space. */
-    if ((shm = shmat(shmid, NULL, 0)) == (int *) -1) {
+    /* Now we attach the segment to our data space, worker inherit it */
+    if ((registry = shmat(shmid, NULL, 0)) == (void *) -1) {
         perror("shmat");
         exit( EXIT_FAILURE );
     }
-    /* change SHM_SHIFT if more global counters are added */
-    shm[SHM_JOBS_DONE]         = 0;   /* done jobs         */
-    shm[SHM_WORKER_TOTAL]      = 0;   /* total worker      */
-    shm[SHM_WORKER_RUNNING]    = 0;   /* running worker    */
-    shm[SHM_STATUS_WORKER_PID] = -1;  /* status worker pid */
-    shm[SHM_WORKER_LAST_CHECK] = now; /* time of last check */
-    for(x = 0; x < mod_gm_opt->max_worker; x++) {
-        shm[x+SHM_SHIFT] = -1; /* normal worker   */
-    }
+    registry_init(registry, mod_gm_opt->max_worker+1);
 
     return;
 }
@@ -578,7 +673,6 @@ int adjust_number_of_worker(int min, int max, int cur_workers, int cur_jobs) {
     int perc_running;
     int idle;
     int target = min;
-    double load[3];
 
     if(cur_workers == 0) {
         gm_log( GM_LOG_TRACE3, "adjust_number_of_worker(min %d, max %d, worker %d, jobs %d) -> %d\n", min, max, cur_workers, cur_jobs, mod_gm_opt->min_worker);
@@ -595,22 +689,8 @@ int adjust_number_of_worker(int min, int max, int cur_workers, int cur_jobs) {
 
     /* > 90% workers running */
     if(cur_jobs > 0 && ( perc_running > 90 || idle <= 2 )) {
-        if (getloadavg(load, 3) == -1) {
-            gm_log( GM_LOG_ERROR, "failed to get current load\n");
-            perror("getloadavg");
-        }
-        if(mod_gm_opt->load_limit1 > 0 && load[0] >= mod_gm_opt->load_limit1) {
-            gm_log( GM_LOG_TRACE, "load limit 1min hit, not starting any more workers: %1.2f > %1.2f\n", load[0], mod_gm_opt->load_limit1);
-            return cur_workers;
-        }
-        if(mod_gm_opt->load_limit5 > 0 && load[1] >= mod_gm_opt->load_limit5) {
-            gm_log( GM_LOG_TRACE, "load limit 5min hit, not starting any more workers: %1.2f > %1.2f\n", load[1], mod_gm_opt->load_limit5);
-            return cur_workers;
-        }
-        if(mod_gm_opt->load_limit15 > 0 && load[2] >= mod_gm_opt->load_limit15) {
-            gm_log( GM_LOG_TRACE, "load limit 15min hit, not starting any more workers: %1.2f > %1.2f\n", load[2], mod_gm_opt->load_limit15);
+        if(load_limit_reached() == TRUE)
             return cur_workers;
-        }
 
         /* increase target number by spawn rate */
         gm_log( GM_LOG_TRACE, "starting %d new workers\n", mod_gm_opt->spawn_rate);
@@ -627,6 +707,31 @@ int adjust_number_of_worker(int min, int max, int cur_workers, int cur_jobs) {
 }
 
 
+/* returns TRUE if one of the load limits is reached */
+int load_limit_reached() {
+    double load[3];
+
+    if (getloadavg(load, 3) == -1) {
+        gm_log( GM_LOG_ERROR, "failed to get current load\n");
+        perror("getloadavg");
+    }
+    if(mod_gm_opt->load_limit1 > 0 && load[0] >= mod_gm_opt->load_limit1) {
+        gm_log( GM_LOG_TRACE, "load limit 1min hit, not starting any more workers: %1.2f > %1.2f\n", load[0], mod_gm_opt->load_limit1);
+        return TRUE;
+    }
+    if(mod_gm_opt->load_limit5 > 0 && load[1] >= mod_gm_opt->load_limit5) {
+        gm_log( GM_LOG_TRACE, "load limit 5min hit, not starting any more workers: %1.2f > %1.2f\n", load[1], mod_gm_opt->load_limit5);
+        return TRUE;
+    }
+    if(mod_gm_opt->load_limit15 > 0 && load[2] >= mod_gm_opt->load_limit15) {
+        gm_log( GM_LOG_TRACE, "load limit 15min hit, not starting any more workers: %1.2f > %1.2f\n", load[2], mod_gm_opt->load_limit15);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+
 /* do a clean exit */
 void clean_exit(int sig) {
     gm_log( GM_LOG_TRACE, "clean_exit(%d)\n", sig);
@@ -635,10 +740,11 @@ void clean_exit(int sig) {
         unlink(mod_gm_opt->pidfile);
 
     /* stop all children */
+    zygote_stop();
     stop_children(GM_WORKER_STOP);
 
     /* detach shm */
-    if(shmdt(shm) < 0)
+    if(shmdt(registry) < 0)
         perror("shmdt");
 
     /*
@@ -677,9 +783,9 @@ void stop_children(int mode) {
     while(current_number_of_workers > 0) {
 
         gm_log( GM_LOG_TRACE, "send SIGTERM\n");
-        save_kill(shm[SHM_STATUS_WORKER_PID], SIGTERM);
-        for(x=SHM_SHIFT; x < mod_gm_opt->max_worker+SHM_SHIFT; x++) {
-            save_kill(shm[x], SIGTERM);
+        for(x=GM_REGISTRY_STATUS_SLOT; x < registry->num_slots; x++) {
+            if(registry->slots[x].state != GM_SLOT_FREE)
+                save_kill(registry->slots[x].pid, SIGTERM);
         }
         while((chld = waitpid(-1, &status, WNOHANG)) != -1 && chld > 0) {
             gm_log( GM_LOG_TRACE, "wait() %d exited with %d\n", chld, status);
@@ -706,9 +812,9 @@ void stop_children(int mode) {
             return;
 
         gm_log( GM_LOG_TRACE, "sending SIGINT...\n");
-        save_kill(shm[SHM_STATUS_WORKER_PID], SIGINT);
-        for(x=SHM_SHIFT; x < mod_gm_opt->max_worker+SHM_SHIFT; x++) {
-            save_kill(shm[x], SIGINT);
+        for(x=GM_REGISTRY_STATUS_SLOT; x < registry->num_slots; x++) {
+            if(registry->slots[x].state != GM_SLOT_FREE)
+                save_kill(registry->slots[x].pid, SIGINT);
         }
 
         /* wait 3 more seconds*/
@@ -723,9 +829,9 @@ void stop_children(int mode) {
         count_current_worker(GM_DISABLED);
         if(current_number_of_workers == 0)
             return;
-        save_kill(shm[SHM_STATUS_WORKER_PID], SIGKILL);
-        for(x=SHM_SHIFT; x < mod_gm_opt->max_worker+SHM_SHIFT; x++) {
-            save_kill(shm[x], SIGKILL);
+        for(x=GM_REGISTRY_STATUS_SLOT; x < registry->num_slots; x++) {
+            if(registry->slots[x].state != GM_SLOT_FREE)
+                save_kill(registry->slots[x].pid, SIGKILL);
         }
 
         /* count children a last time */
@@ -810,11 +916,21 @@ void reload_config(int sig) {
         return;
     }
 
+    /* the registry cannot grow while worker are attached */
+    if(mod_gm_opt->max_worker > registry->num_slots-1) {
+        gm_log( GM_LOG_INFO, "max-worker cannot be increased beyond %d without a restart\n", registry->num_slots-1);
+        mod_gm_opt->max_worker = registry->num_slots-1;
+        if(mod_gm_opt->min_worker > mod_gm_opt->max_worker)
+            mod_gm_opt->min_worker = mod_gm_opt->max_worker;
+    }
+
     /*
      * restart workers gracefully:
      * send term signal to our children
      * children will finish the current job and exit
+     * the zygote has to be restarted with the new config
      */
+    zygote_stop();
     stop_children(GM_WORKER_RESTART);
 
     /* start status worker */
@@ -831,20 +947,12 @@ void reload_config(int sig) {
 
 /* return and reserve next shm index*/
 int get_next_shm_index() {
-    int x;
-    int next_index = 0;
+    int next_index;
 
     gm_log( GM_LOG_TRACE, "get_next_shm_index()\n" );
 
-    for(x = SHM_SHIFT; x < mod_gm_opt->max_worker+SHM_SHIFT; x++) {
-        if(shm[x] == -1) {
-            next_index      = x;
-            shm[next_index] = 1;
-            break;
-        }
-    }
-
-    if(next_index == 0) {
+    next_index = registry_alloc(registry);
+    if(next_index == GM_REGISTRY_NO_SLOT) {
         gm_log(GM_LOG_ERROR, "unable to get next shm id\n");
         clean_exit(15);
         exit(EXIT_FAILURE);
@@ -0,0 +1,190 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* include header */
+#include "worker_autoscale.h"
+#include "gearman_utils.h"
+#include "utils.h"
+
+static double autoscale_ewma(gm_autoscale_t * as, double avg, double value);
+static int autoscale_is_queue(mod_gm_opt_t * opt, char * queue);
+
+
+/* add a sample to the moving averages */
+void autoscale_sample(gm_autoscale_t * as, double now, int backlog, int jobs_done, int busy) {
+    double elapsed, done, arrivals;
+
+    /* first sample only sets the starting point */
+    if(as->samples == 0 || now <= as->last_time) {
+        as->last_time    = now;
+        as->last_backlog = backlog;
+        as->last_done    = jobs_done;
+        if(as->samples == 0)
+            as->samples = 1;
+        return;
+    }
+
+    elapsed = now - as->last_time;
+
+    /* counter is reset when the shared memory is recreated */
+    done = jobs_done - as->last_done;
+    if(done < 0)
+        done = jobs_done;
+    done = done / elapsed;
+
+    /* everything that did not end up in the backlog has been done */
+    arrivals = done + (backlog - as->last_backlog) / elapsed;
+    if(arrivals < 0)
+        arrivals = 0;
+
+    as->completion_rate = autoscale_ewma(as, as->completion_rate, done);
+    as->arrival_rate    = autoscale_ewma(as, as->arrival_rate, arrivals);
+
+    /* Little's law: busy worker = completion rate * time per job */
+    if(done > 0)
+        as->service_time = autoscale_ewma(as, as->service_time, busy / done);
+
+    as->last_time    = now;
+    as->last_backlog = backlog;
+    as->last_done    = jobs_done;
+    as->samples++;
+
+    gm_log( GM_LOG_TRACE, "autoscale: backlog %d, arrivals %.2f/s, done %.2f/s, time per job %.3fs\n", backlog, as->arrival_rate, as->completion_rate, as->service_time );
+
+    return;
+}
+
+
+/* calculate number of workers for the sampled load */
+int autoscale_target(gm_autoscale_t * as, int cur_workers, int min, int max) {
+    double needed;
+    int target;
+
+    /* need at least one rate and a time per job */
+    if(as->samples < 2)
+        return -1;
+
+    if(as->service_time > 0) {
+        needed = as->arrival_rate * as->service_time * GM_AUTOSCALE_HEADROOM
+               + (double)as->last_backlog * as->service_time / GM_AUTOSCALE_DRAIN;
+        target = (int)needed;
+        if(target < needed)
+            target++;
+    } else if(as->last_backlog > 0) {
+        /* jobs are waiting but none finished yet, nothing to estimate from */
+        target = cur_workers + 1;
+    } else {
+        target = min;
+    }
+
+    /* shrink slowly and never while jobs are waiting */
+    if(target < cur_workers) {
+        if(as->last_backlog > 0)
+            target = cur_workers;
+        else
+            target = cur_workers - (cur_workers - target + 1) / 2;
+    }
+
+    if(target < min)
+        target = min;
+    if(target > max)
+        target = max;
+
+    gm_log( GM_LOG_TRACE, "autoscale: %d workers -> %d\n", cur_workers, target );
+
+    return target;
+}
+
+
+/* get number of waiting jobs in our queues */
+int autoscale_backlog(mod_gm_opt_t * opt) {
+    mod_gm_server_status_t *stats;
+    char * message = NULL;
+    char * version = NULL;
+    int x, y, rc;
+    int backlog = -1;
+
+    for(x = 0; x < opt->server_num; x++) {
+        stats = gm_malloc(sizeof(mod_gm_server_status_t));
+        stats->function_num = 0;
+        stats->worker_num   = 0;
+        rc = get_gearman_server_data(stats, &message, &version, opt->server_list[x]->host, opt->server_list[x]->port, GM_AUTOSCALE_TIMEOUT);
+        if(rc == STATE_OK) {
+            if(backlog < 0)
+                backlog = 0;
+            for(y = 0; y < stats->function_num; y++) {
+                if(autoscale_is_queue(opt, stats->function[y]->queue))
+                    backlog += stats->function[y]->waiting;
+            }
+        } else {
+            gm_log( GM_LOG_DEBUG, "autoscale: cannot get queues from %s:%d: %s\n", opt->server_list[x]->host, opt->server_list[x]->port, message != NULL ? message : "unknown error" );
+        }
+        free(message);
+        free(version);
+        message = NULL;
+        version = NULL;
+        free_mod_gm_status_server(stats);
+    }
+
+    return backlog;
+}
+
+
+/* exponentially weighted moving average */
+static double autoscale_ewma(gm_autoscale_t * as, double avg, double value) {
+    /* first rates are taken as they are */
+    if(as->samples < 2)
+        return value;
+    return GM_AUTOSCALE_ALPHA * value + (1 - GM_AUTOSCALE_ALPHA) * avg;
+}
+
+
+/* returns TRUE if our workers work on this queue */
+static int autoscale_is_queue(mod_gm_opt_t * opt, char * queue) {
+    int x;
+
+    if(opt->hosts == GM_ENABLED && !strcmp(queue, "host"))
+        return TRUE;
+    if(opt->services == GM_ENABLED && !strcmp(queue, "service"))
+        return TRUE;
+    if(opt->events == GM_ENABLED && !strcmp(queue, "eventhandler"))
+        return TRUE;
+    if(opt->notifications == GM_ENABLED && !strcmp(queue, "notification"))
+        return TRUE;
+
+    if(!strncmp(queue, "hostgroup_", 10)) {
+        for(x = 0; opt->hostgroups_list[x] != NULL; x++) {
+            if(!strcmp(queue+10, opt->hostgroups_list[x]))
+                return TRUE;
+        }
+    }
+
+    if(!strncmp(queue, "servicegroup_", 13)) {
+        for(x = 0; opt->servicegroups_list[x] != NULL; x++) {
+            if(!strcmp(queue+13, opt->servicegroups_list[x]))
+                return TRUE;
+        }
+    }
+
+    return FALSE;
+}
@@ -28,6 +28,13 @@
 #include "utils.h"
 #include "check_utils.h"
 #include "gearman_utils.h"
+#include "gm_payload.h"
+#include "check_async.h"
+#include "worker_pool.h"
+#include "gm_result_batch.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #ifdef EMBEDDEDPERL
 #include "epn_utils.h"
 #endif
@@ -37,19 +44,44 @@ gearman_client_st client;
 gearman_client_st client_dup;
 
 pid_t current_pid;
-gm_job_t * exec_job;
 
 int jobs_done = 0;
 int sleep_time_after_error = 1;
 int worker_run_mode;
 int shm_index = 0;
-volatile sig_atomic_t shmid;
+int busy_eventfd = -1;
+extern gm_worker_registry_t * registry;
+
+/* concurrent checks are run by a separate thread */
+gm_async_t * async_checks = NULL;
+pthread_t async_thread;
+pthread_mutex_t async_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t async_cond   = PTHREAD_COND_INITIALIZER;
+gm_job_t * async_queue[GM_MAX_CONCURRENT_CHECKS];
+int async_queue_head = 0;
+int async_queue_num  = 0;
+int async_inflight   = 0;
+int async_shutdown   = 0;
+int async_wakeup[2]  = { -1, -1 };
+time_t async_last_job = 0;
+volatile sig_atomic_t async_signal = 0;
+volatile sig_atomic_t async_stop   = 0;
+
+/* the result sender must be stopped outside of signal handlers */
+int result_batch_running = FALSE;
+volatile sig_atomic_t deferred_exit   = 0;
+volatile sig_atomic_t deferred_signal = 0;
+
+/* arenas of finished jobs are reused by the next jobs */
+gm_arena_t * job_arenas[GM_JOB_ARENA_CACHE];
+int job_arenas_num = 0;
+pthread_mutex_t job_arenas_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* callback for task completed */
 #ifdef EMBEDDEDPERL
-void worker_client(int worker_mode, int indx, int shid, char **env) {
+void worker_client(int worker_mode, int indx, char **env) {
 #else
-void worker_client(int worker_mode, int indx, int shid) {
+void worker_client(int worker_mode, int indx) {
 #endif
 
     gm_log( GM_LOG_TRACE, "%s worker client started\n", (worker_mode == GM_WORKER_STATUS ? "status" : "job" ));
@@ -60,11 +92,40 @@ void worker_client(int worker_mode, int indx, int shid) {
 
     worker_run_mode = worker_mode;
     shm_index       = indx;
-    shmid           = shid;
     current_pid     = getpid();
 
     gethostname(hostname, GM_BUFFERSIZE-1);
 
+#ifdef EMBEDDEDPERL
+    if(init_embedded_perl(env) == GM_ERROR) {
+        _exit( EXIT_FAILURE );
+    }
+#endif
+
+    /* collect results and send them in batches */
+    if(mod_gm_opt->result_batch == GM_ENABLED && worker_mode != GM_WORKER_STATUS) {
+        if(mod_gm_result_batch_start(mod_gm_opt) != GM_OK) {
+            gm_log( GM_LOG_ERROR, "cannot send results in batches, sending them one by one\n" );
+        } else {
+            result_batch_running = TRUE;
+            signal(SIGINT, deferred_exit_sighandler);
+            signal(SIGTERM,deferred_exit_sighandler);
+        }
+    }
+
+    /* run a pool of worker threads, does not return */
+    if(mod_gm_opt->worker_threads > 1 && worker_mode != GM_WORKER_STATUS) {
+        if(mod_gm_opt->concurrent_checks > 1)
+            gm_log( GM_LOG_INFO, "concurrent_checks is ignored when using worker_threads\n" );
+        worker_pool_run(mod_gm_opt->worker_threads);
+    }
+
+    /* run checks concurrently */
+    if(mod_gm_opt->concurrent_checks > 1 && worker_mode != GM_WORKER_STATUS) {
+        if(start_async_checks() != GM_OK)
+            gm_log( GM_LOG_ERROR, "cannot run checks concurrently, running one check at a time\n" );
+    }
+
     /* create worker */
     if(set_worker(&worker) != GM_OK) {
         gm_log( GM_LOG_ERROR, "cannot start worker\n" );
@@ -89,12 +150,6 @@ void worker_client(int worker_mode, int indx, int shid) {
         current_client_dup = &client_dup;
     }
 
-#ifdef EMBEDDEDPERL
-    if(init_embedded_perl(env) == GM_ERROR) {
-        _exit( EXIT_FAILURE );
-    }
-#endif
-
     worker_loop();
 
     return;
@@ -107,8 +162,16 @@ void worker_loop() {
     while ( 1 ) {
         gearman_return_t ret;
 
+        /* wait for a free check slot, exit when idle or told to do so */
+        if(async_checks != NULL) {
+            if(wait_for_async_slot() != GM_OK) {
+                clean_worker_exit(0);
+                _exit( EXIT_SUCCESS );
+            }
+        }
+
         /* wait for a job, otherwise exit when hit the idle timeout */
-        if(mod_gm_opt->idle_timeout > 0 && ( worker_run_mode == GM_WORKER_MULTI || worker_run_mode == GM_WORKER_STATUS )) {
+        else if(mod_gm_opt->idle_timeout > 0 && ( worker_run_mode == GM_WORKER_MULTI || worker_run_mode == GM_WORKER_STATUS )) {
             signal(SIGALRM, idle_sighandler);
             alarm(mod_gm_opt->idle_timeout);
         }
@@ -116,19 +179,33 @@ void worker_loop() {
         signal(SIGPIPE, SIG_IGN);
         ret = gearman_worker_work( &worker );
 
+        /* exit requested by a signal while sending results in batches */
+        if ( deferred_exit ) {
+            clean_worker_exit(deferred_signal);
+            _exit( EXIT_SUCCESS );
+        }
+
         if (mod_gm_opt->max_jobs > 0 && jobs_done >= mod_gm_opt->max_jobs) {
             gm_log( GM_LOG_TRACE, "jobs done: %i -> exiting...\n", jobs_done );
             clean_worker_exit(0);
             _exit( EXIT_SUCCESS );
         }
 
+        /* no job within the poll interval, check slots and idle timeout again */
+        if ( ret == GEARMAN_TIMEOUT && ( async_checks != NULL || result_batch_running ) )
+            continue;
+
         if ( ret != GEARMAN_SUCCESS ) {
             gm_log( GM_LOG_ERROR, "worker error: %s\n", gearman_worker_error( &worker ) );
             gearman_job_free_all( &worker );
             gearman_worker_free( &worker );
-            gearman_client_free( &client );
-            if( mod_gm_opt->dupserver_num )
-                gearman_client_free( &client_dup );
+
+            /* the check thread is still sending results with the clients */
+            if(async_checks == NULL) {
+                gearman_client_free( &client );
+                if( mod_gm_opt->dupserver_num )
+                    gearman_client_free( &client_dup );
+            }
 
             /* sleep on error to avoid cpu intensive infinite loops */
             sleep(sleep_time_after_error);
@@ -138,6 +215,8 @@ void worker_loop() {
 
             /* create new connections */
             set_worker( &worker );
+            if(async_checks != NULL)
+                continue;
             create_client( mod_gm_opt->server_list, &client );
             current_client = &client;
             if( mod_gm_opt->dupserver_num ) {
@@ -154,176 +233,145 @@ void worker_loop() {
 /* get a job */
 void *get_job( gearman_job_st *job, void *context, size_t *result_size, gearman_return_t *ret_ptr ) {
     sigset_t block_mask;
-    int wsize, valid_lines;
-    char * workload;
+    gm_job_t * exec_job;
+    int wsize, dsize, valid_lines;
+    const char * workload;
     char * decrypted_data;
-    char * decrypted_data_c;
+#ifdef GM_DEBUG
     char * decrypted_orig;
-    char *ptr;
+#endif
+    gm_payload_t payload;
     int is_notification_job = FALSE;
     int is_eventhandler_job = FALSE;
 
-    /* reset timeout for now, will be set befor execution again */
-    alarm(0);
-    signal(SIGALRM, SIG_IGN);
+    /* context is set for pool threads, which must not touch process wide state */
+    if(context == NULL) {
+        /* reset timeout for now, will be set befor execution again */
+        alarm(0);
+        signal(SIGALRM, SIG_IGN);
 
-    jobs_done++;
+        jobs_done++;
+    }
 
     /* send start signal to parent */
     set_state(GM_JOB_START);
+    set_slot_queue(gearman_job_function_name(job));
 
     gm_log( GM_LOG_TRACE, "get_job()\n" );
 
-    /* contect is unused */
-    context = context;
-
     /* set size of result */
     *result_size = 0;
 
     /* reset sleep time */
     sleep_time_after_error = 1;
 
-    /* ignore sigterms while running job */
+    /* ignore sigterms while running job, they are always blocked in concurrent and pool mode */
     sigemptyset(&block_mask);
-    sigaddset(&block_mask, SIGTERM);
+    if(async_checks == NULL && context == NULL)
+        sigaddset(&block_mask, SIGTERM);
     sigprocmask(SIG_BLOCK, &block_mask, NULL);
 
-    /* get the data */
-    current_gearman_job = job;
+    /* get the data, decoded directly from the gearman buffer */
+    if(context == NULL)
+        current_gearman_job = job;
     wsize = gearman_job_workload_size(job);
-    workload = gm_malloc(sizeof(char*)*wsize+1);
-    strncpy(workload, (const char*)gearman_job_workload(job), wsize);
-    workload[wsize] = '\0';
+    workload = (const char*)gearman_job_workload(job);
     gm_log( GM_LOG_TRACE, "got new job %s\n", gearman_job_handle( job ) );
-    gm_log( GM_LOG_TRACE, "%d +++>\n%s\n<+++\n", strlen(workload), workload );
+    gm_log( GM_LOG_TRACE, "%d +++>\n%.*s\n<+++\n", wsize, wsize, workload );
+
+    /* everything belonging to this job is allocated from its arena */
+    exec_job = alloc_job();
 
     /* decrypt data */
-    decrypted_data = gm_malloc(wsize*2);
-    decrypted_data_c = decrypted_data;
-    mod_gm_decrypt(&decrypted_data, workload, mod_gm_opt->transportmode);
-    decrypted_orig = gm_strdup(decrypted_data);
-    free(workload);
+    decrypted_data = job_alloc(exec_job, wsize+1);
+    dsize = mod_gm_decrypt_len(&decrypted_data, workload, wsize, mod_gm_opt->transportmode);
 
     if(decrypted_data == NULL) {
         *ret_ptr = GEARMAN_WORK_FAIL;
-        free(decrypted_orig);
+        recycle_job(exec_job);
+        set_state(GM_JOB_END);
         return NULL;
     }
-    gm_log( GM_LOG_TRACE, "%d --->\n%s\n<---\n", strlen(decrypted_data), decrypted_data );
+    gm_log( GM_LOG_TRACE, "%d --->\n%s\n<---\n", dsize, decrypted_data );
+#ifdef GM_DEBUG
+    decrypted_orig = gm_strdup(decrypted_data);
+#endif
 
     /* set result pointer to success */
     *ret_ptr= GEARMAN_SUCCESS;
 
-    exec_job = ( gm_job_t * )gm_malloc( sizeof *exec_job );
-    set_default_job(exec_job, mod_gm_opt);
-
-    valid_lines = 0;
-    while ( (ptr = strsep(&decrypted_data, "\n" )) != NULL ) {
-        char *key   = strsep( &ptr, "=" );
-        char *value = strsep( &ptr, "\x0" );
-
-        if ( key == NULL )
-            continue;
-
-        if ( value == NULL || !strcmp( value, "") )
-            break;
-
-        if ( !strcmp( key, "host_name" ) ) {
-            exec_job->host_name = gm_strdup(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "service_description" ) ) {
-            exec_job->service_description = gm_strdup(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "type" ) ) {
-            exec_job->type = gm_strdup(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "result_queue" ) ) {
-            exec_job->result_queue = gm_strdup(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "check_options" ) ) {
-            exec_job->check_options = atoi(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "scheduled_check" ) ) {
-            exec_job->scheduled_check = atoi(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "reschedule_check" ) ) {
-            exec_job->reschedule_check = atoi(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "latency" ) ) {
-            exec_job->latency = atof(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "next_check" ) ) {
-            string2timeval(value, &exec_job->next_check);
-            valid_lines++;
-        } else if ( !strcmp( key, "start_time" ) ) {
-            /* for compatibility reasons... (used by older mod-gearman neb modules) */
-            string2timeval(value, &exec_job->next_check);
-            string2timeval(value, &exec_job->core_time);
-            valid_lines++;
-        } else if ( !strcmp( key, "core_time" ) ) {
-            string2timeval(value, &exec_job->core_time);
-            valid_lines++;
-        } else if ( !strcmp( key, "timeout" ) ) {
-            exec_job->timeout = atoi(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "command_line" ) ) {
-            exec_job->command_line = gm_strdup(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "plugin_output" ) ) {
-            exec_job->output = gm_strdup(value);
-            valid_lines++;
-        } else if ( !strcmp( key, "long_plugin_output" ) ) {
-            exec_job->long_output = gm_strdup(value);
-            valid_lines++;
-        }
-    }
+    /* string values point into the payload, which is owned by the job from now on */
+    valid_lines = mod_gm_parse_payload(&payload, decrypted_data, dsize);
+    exec_job->payload             = decrypted_data;
+    exec_job->host_name           = payload.field[GM_KEY_HOST_NAME].ptr;
+    exec_job->service_description = payload.field[GM_KEY_SERVICE_DESCRIPTION].ptr;
+    exec_job->type                = payload.field[GM_KEY_TYPE].ptr;
+    exec_job->result_queue        = payload.field[GM_KEY_RESULT_QUEUE].ptr;
+    exec_job->command_line        = payload.field[GM_KEY_COMMAND_LINE].ptr;
+    exec_job->output              = payload.field[GM_KEY_PLUGIN_OUTPUT].ptr;
+    exec_job->long_output         = payload.field[GM_KEY_LONG_PLUGIN_OUTPUT].ptr;
+    exec_job->binary_payload      = payload.binary;
+    exec_job->check_options       = mod_gm_payload_int(&payload, GM_KEY_CHECK_OPTIONS, exec_job->check_options);
+    exec_job->scheduled_check     = mod_gm_payload_int(&payload, GM_KEY_SCHEDULED_CHECK, exec_job->scheduled_check);
+    exec_job->reschedule_check    = mod_gm_payload_int(&payload, GM_KEY_RESCHEDULE_CHECK, exec_job->reschedule_check);
+    exec_job->latency             = mod_gm_payload_double(&payload, GM_KEY_LATENCY, exec_job->latency);
+    exec_job->timeout             = mod_gm_payload_int(&payload, GM_KEY_TIMEOUT, exec_job->timeout);
+    /* for compatibility reasons... (used by older mod-gearman neb modules) */
+    mod_gm_payload_timeval(&payload, GM_KEY_START_TIME, &exec_job->next_check);
+    mod_gm_payload_timeval(&payload, GM_KEY_START_TIME, &exec_job->core_time);
+    mod_gm_payload_timeval(&payload, GM_KEY_NEXT_CHECK, &exec_job->next_check);
+    mod_gm_payload_timeval(&payload, GM_KEY_CORE_TIME, &exec_job->core_time);
 
 #ifdef GM_DEBUG
     if(exec_job->next_check.tv_sec < 10000)
         write_debug_file(&decrypted_orig);
 #endif
 
-    if(!strcmp( exec_job->type, "notification")) {
+    if(exec_job->type != NULL && !strcmp( exec_job->type, "notification")) {
         is_notification_job = TRUE;
     }
-    else if ( !strcmp( exec_job->type, "eventhandler" ) ) {
+    else if ( exec_job->type != NULL && !strcmp( exec_job->type, "eventhandler" ) ) {
         is_eventhandler_job = TRUE;
     }
 
-    /* put plugin_output and long_plugin_output into the environment
+    /* put plugin_output and long_plugin_output into the environment of the plugin
      * which is especcially useful for notifications
      */
     if(is_notification_job == TRUE) {
         if(exec_job->service_description != NULL) {
             if(exec_job->output != NULL)
-                setenv("NAGIOS_SERVICEOUTPUT",exec_job->output,1);
+                set_job_env(exec_job, "NAGIOS_SERVICEOUTPUT", exec_job->output);
             if(exec_job->long_output != NULL)
-                setenv("NAGIOS_LONGSERVICEOUTPUT",exec_job->output,1);
+                set_job_env(exec_job, "NAGIOS_LONGSERVICEOUTPUT", exec_job->output);
         } else {
             if(exec_job->output != NULL)
-                setenv("NAGIOS_HOSTOUTPUT",exec_job->output,1);
+                set_job_env(exec_job, "NAGIOS_HOSTOUTPUT", exec_job->output);
             if(exec_job->long_output != NULL)
-                setenv("NAGIOS_LONGHOSTOUTPUT",exec_job->output,1);
+                set_job_env(exec_job, "NAGIOS_LONGHOSTOUTPUT", exec_job->output);
         }
     }
 
-    /* will be overwritten */
-    if(exec_job->output != NULL)
-        free(exec_job->output);
+    /* will be overwritten, plugin_output is part of the payload */
+    exec_job->output = NULL;
 
     if(valid_lines == 0) {
         gm_log( GM_LOG_ERROR, "discarded invalid job (%s), check your encryption settings\n", gearman_job_handle( job ) );
+    } else if(async_checks != NULL && is_notification_job == FALSE && is_eventhandler_job == FALSE) {
+        /* host and service checks are finished by the check thread */
+        queue_async_job(exec_job);
+        exec_job = NULL;
     } else {
-        do_exec_job();
+        do_exec_job(exec_job);
     }
 
-    current_gearman_job = NULL;
+    if(context == NULL)
+        current_gearman_job = NULL;
 
     /* start listening to SIGTERMs */
     sigprocmask(SIG_UNBLOCK, &block_mask, NULL);
 
     /* log errors for notifications and eventhandler */
-    if((is_notification_job || is_eventhandler_job) && exec_job->return_code != 0) {
+    if((is_notification_job || is_eventhandler_job) && exec_job != NULL && exec_job->return_code != 0) {
         gm_log( GM_LOG_ERROR, "%s %s exited with return code %d\n",
                exec_job->service_description != NULL ? "service" : "host",
                exec_job->type,
@@ -333,20 +381,13 @@ void *get_job( gearman_job_st *job, void *context, size_t *result_size, gearman_
         gm_log( GM_LOG_ERROR, "output: %s\n" );
     }
 
+#ifdef GM_DEBUG
     free(decrypted_orig);
-    free(decrypted_data_c);
-    free_job(exec_job);
+#endif
+    if(exec_job == NULL)
+        return NULL;
 
-    if(is_notification_job == TRUE) {
-        /* clear the environment */
-        if(exec_job->service_description != NULL) {
-            unsetenv("NAGIOS_SERVICEOUTPUT");
-            unsetenv("NAGIOS_LONGSERVICEOUTPUT");
-        } else {
-            unsetenv("NAGIOS_HOSTOUTPUT");
-            unsetenv("NAGIOS_LONGHOSTOUTPUT");
-        }
-    }
+    recycle_job(exec_job);
 
     /* send finish signal to parent */
     set_state(GM_JOB_END);
@@ -355,95 +396,398 @@ void *get_job( gearman_job_st *job, void *context, size_t *result_size, gearman_
 }
 
 
+/* create job with an arena from the cache */
+gm_job_t * alloc_job() {
+    gm_arena_t * arena = NULL;
+
+    pthread_mutex_lock(&job_arenas_mutex);
+    if(job_arenas_num > 0)
+        arena = job_arenas[--job_arenas_num];
+    pthread_mutex_unlock(&job_arenas_mutex);
+
+    if(arena == NULL)
+        arena = gm_arena_create(GM_JOB_ARENA_SIZE);
+
+    return create_arena_job(arena, mod_gm_opt);
+}
+
+
+/* free all memory of a finished job at once and keep its arena for the next job */
+void recycle_job(gm_job_t * job) {
+    gm_arena_t * arena = job->arena;
+
+    if(arena == NULL) {
+        free_job(job);
+        return;
+    }
+
+    gm_arena_reset(arena);
+    pthread_mutex_lock(&job_arenas_mutex);
+    if(job_arenas_num < GM_JOB_ARENA_CACHE) {
+        job_arenas[job_arenas_num++] = arena;
+        arena = NULL;
+    }
+    pthread_mutex_unlock(&job_arenas_mutex);
+
+    if(arena != NULL)
+        gm_arena_free(arena);
+
+    return;
+}
+
+
 /* do some job */
-void do_exec_job( ) {
-    struct timeval start_time, end_time;
-    int latency, age;
+void do_exec_job( gm_job_t * exec_job ) {
+    int pool = worker_pool_size() > 0;
 
     gm_log( GM_LOG_TRACE, "do_exec_job()\n" );
 
-    if(exec_job->type == NULL) {
-        gm_log( GM_LOG_ERROR, "discarded invalid job, no type given\n" );
+    if(prepare_exec_job(exec_job) != GM_OK)
         return;
+
+    /* run the command, the worker itself must not run plugins while concurrent checks or other threads are running */
+    gm_log( GM_LOG_TRACE, "command: %s\n", exec_job->command_line);
+    if(!pool)
+        current_job = exec_job;
+    execute_safe_command(exec_job, (async_checks != NULL || pool) ? GM_ENABLED : mod_gm_opt->fork_on_exec, mod_gm_opt->identifier );
+    if(!pool)
+        current_job = NULL;
+
+    /* execute_safe_command resets the signal handlers */
+    if(async_checks != NULL) {
+        signal(SIGINT, async_sighandler);
+        signal(SIGTERM,async_sighandler);
     }
-    if(exec_job->command_line == NULL) {
+    else if(result_batch_running) {
+        signal(SIGINT, deferred_exit_sighandler);
+        signal(SIGTERM,deferred_exit_sighandler);
+    }
+
+    if ( !strcmp( exec_job->type, "service" ) || !strcmp( exec_job->type, "host" ) ) {
+        send_job_result(exec_job);
+    }
+
+    return;
+}
+
+
+/* send result with the process wide clients or a client from the thread pool */
+void send_job_result(gm_job_t * job) {
+    if(worker_pool_size() > 0)
+        worker_pool_send_result(job);
+    else
+        send_result_back(job);
+    return;
+}
+
+
+/* check the job before running it, too old jobs are answered right away */
+int prepare_exec_job(gm_job_t * job) {
+    struct timeval start_time, end_time;
+    int latency, age;
+
+    if(job->type == NULL) {
+        gm_log( GM_LOG_ERROR, "discarded invalid job, no type given\n" );
+        return GM_ERROR;
+    }
+    if(job->command_line == NULL) {
         gm_log( GM_LOG_ERROR, "discarded invalid job, no command line given\n" );
-        return;
+        return GM_ERROR;
     }
 
-    if ( !strcmp( exec_job->type, "service" ) ) {
-        gm_log( GM_LOG_DEBUG, "got service job: %s - %s\n", exec_job->host_name, exec_job->service_description);
+    if ( !strcmp( job->type, "service" ) ) {
+        gm_log( GM_LOG_DEBUG, "got service job: %s - %s\n", job->host_name, job->service_description);
     }
-    else if ( !strcmp( exec_job->type, "host" ) ) {
-        gm_log( GM_LOG_DEBUG, "got host job: %s\n", exec_job->host_name);
+    else if ( !strcmp( job->type, "host" ) ) {
+        gm_log( GM_LOG_DEBUG, "got host job: %s\n", job->host_name);
     }
-    else if ( !strcmp( exec_job->type, "eventhandler" ) ) {
+    else if ( !strcmp( job->type, "eventhandler" ) ) {
         gm_log( GM_LOG_DEBUG, "got eventhandler job\n");
     }
-    else if ( !strcmp( exec_job->type, "notification" ) ) {
+    else if ( !strcmp( job->type, "notification" ) ) {
         gm_log( GM_LOG_DEBUG, "got notification job\n");
     }
 
     /* check proper timeout value */
-    if( exec_job->timeout <= 0 ) {
-        exec_job->timeout = mod_gm_opt->job_timeout;
+    if( job->timeout <= 0 ) {
+        job->timeout = mod_gm_opt->job_timeout;
     }
 
     /* get the check start time */
     gettimeofday(&start_time,NULL);
-    exec_job->start_time = start_time;
-    latency = start_time.tv_sec - exec_job->next_check.tv_sec;
-    age     = start_time.tv_sec - exec_job->core_time.tv_sec;
+    job->start_time = start_time;
+    latency = start_time.tv_sec - job->next_check.tv_sec;
+    age     = start_time.tv_sec - job->core_time.tv_sec;
 
-    gm_log( GM_LOG_TRACE, "timeout: %i, core latency: %i\n", exec_job->timeout, latency);
+    gm_log( GM_LOG_TRACE, "timeout: %i, core latency: %i\n", job->timeout, latency);
 
     /* job is too old */
     if(mod_gm_opt->max_age > 0 && age > mod_gm_opt->max_age) {
-        exec_job->return_code   = 3;
+        job->return_code   = 3;
 
-        if ( !strcmp( exec_job->type, "service" ) ) {
-            gm_log( GM_LOG_INFO, "discarded too old %s job: %i > %i (%s - %s)\n", exec_job->type, (int)age, mod_gm_opt->max_age, exec_job->host_name, exec_job->service_description);
-        } else if ( !strcmp( exec_job->type, "host" ) ) {
-            gm_log( GM_LOG_INFO, "discarded too old %s job: %i > %i (%s)\n", exec_job->type, (int)age, mod_gm_opt->max_age, exec_job->host_name);
+        if ( !strcmp( job->type, "service" ) ) {
+            gm_log( GM_LOG_INFO, "discarded too old %s job: %i > %i (%s - %s)\n", job->type, (int)age, mod_gm_opt->max_age, job->host_name, job->service_description);
+        } else if ( !strcmp( job->type, "host" ) ) {
+            gm_log( GM_LOG_INFO, "discarded too old %s job: %i > %i (%s)\n", job->type, (int)age, mod_gm_opt->max_age, job->host_name);
         } else {
-            gm_log( GM_LOG_INFO, "discarded too old %s job: %i > %i\n", exec_job->type, (int)age, mod_gm_opt->max_age);
+            gm_log( GM_LOG_INFO, "discarded too old %s job: %i > %i\n", job->type, (int)age, mod_gm_opt->max_age);
         }
 
         gettimeofday(&end_time, NULL);
-        exec_job->finish_time = end_time;
+        job->finish_time = end_time;
 
-        if ( !strcmp( exec_job->type, "service" ) || !strcmp( exec_job->type, "host" ) ) {
-            exec_job->output = gm_strdup("(Could Not Start Check In Time)");
-            send_result_back(exec_job);
+        if ( !strcmp( job->type, "service" ) || !strcmp( job->type, "host" ) ) {
+            set_job_string(job, &job->output, "(Could Not Start Check In Time)");
+            send_job_result(job);
         }
 
+        return GM_ERROR;
+    }
+
+    job->early_timeout = 0;
+
+    return GM_OK;
+}
+
+
+/* start thread which runs the checks concurrently */
+int start_async_checks() {
+    sigset_t mask;
+    int x;
+
+    gm_log( GM_LOG_TRACE, "start_async_checks()\n" );
+
+    if(pipe(async_wakeup) != 0) {
+        gm_log( GM_LOG_ERROR, "error creating pipe: %s\n", strerror(errno));
+        return GM_ERROR;
+    }
+    for(x = 0; x < 2; x++) {
+        fcntl(async_wakeup[x], F_SETFL, O_NONBLOCK);
+        fcntl(async_wakeup[x], F_SETFD, FD_CLOEXEC);
+    }
+
+    async_checks = mod_gm_async_create(mod_gm_opt->concurrent_checks, async_check_done, NULL);
+    if(async_checks == NULL || mod_gm_async_watch(async_checks, async_wakeup[0]) != GM_OK) {
+        mod_gm_async_free(async_checks);
+        async_checks = NULL;
+        close(async_wakeup[0]);
+        close(async_wakeup[1]);
+        return GM_ERROR;
+    }
+
+    /* signals are handled by the check thread only */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    signal(SIGINT, async_sighandler);
+    signal(SIGTERM,async_sighandler);
+
+    async_last_job = time(NULL);
+    if(pthread_create(&async_thread, NULL, async_loop, NULL) != 0) {
+        gm_log( GM_LOG_ERROR, "cannot create check thread: %s\n", strerror(errno));
+        mod_gm_async_free(async_checks);
+        async_checks = NULL;
+        close(async_wakeup[0]);
+        close(async_wakeup[1]);
+        signal(SIGINT, result_batch_running ? deferred_exit_sighandler : clean_worker_exit);
+        signal(SIGTERM,result_batch_running ? deferred_exit_sighandler : clean_worker_exit);
+        pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+        return GM_ERROR;
+    }
+
+    gm_log( GM_LOG_DEBUG, "running up to %d checks concurrently\n", async_checks->max );
+
+    return GM_OK;
+}
+
+
+/* wait for the running checks and stop the check thread */
+void stop_async_checks() {
+    if(async_checks == NULL)
         return;
+
+    gm_log( GM_LOG_TRACE, "stop_async_checks()\n" );
+
+    pthread_mutex_lock(&async_mutex);
+    async_shutdown = 1;
+    pthread_mutex_unlock(&async_mutex);
+    if(write(async_wakeup[1], "s", 1) <= 0)
+        perror("write");
+
+    pthread_join(async_thread, NULL);
+    mod_gm_async_free(async_checks);
+    async_checks = NULL;
+    close(async_wakeup[0]);
+    close(async_wakeup[1]);
+
+    return;
+}
+
+
+/* main loop of the check thread */
+void *async_loop(void * data) {
+    sigset_t mask;
+    gm_job_t * job;
+    char buf[64];
+    int finished = FALSE;
+
+    gm_log( GM_LOG_TRACE, "async_loop(%p)\n", data );
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+
+    while(finished == FALSE) {
+        mod_gm_async_wait(async_checks, 1000);
+        while(read(async_wakeup[0], buf, sizeof(buf)) > 0)
+            ;
+
+        if(async_signal != 0)
+            async_exit(async_signal);
+
+        pthread_mutex_lock(&async_mutex);
+        while(async_queue_num > 0) {
+            job = async_queue[async_queue_head];
+            async_queue_head = (async_queue_head + 1) % GM_MAX_CONCURRENT_CHECKS;
+            async_queue_num--;
+            pthread_mutex_unlock(&async_mutex);
+            start_async_check(job);
+            pthread_mutex_lock(&async_mutex);
+        }
+        if(async_shutdown && async_inflight == 0)
+            finished = TRUE;
+        pthread_mutex_unlock(&async_mutex);
     }
 
-    exec_job->early_timeout = 0;
+    return NULL;
+}
+
 
-    /* run the command */
-    gm_log( GM_LOG_TRACE, "command: %s\n", exec_job->command_line);
-    current_job = exec_job;
-    execute_safe_command(exec_job, mod_gm_opt->fork_on_exec, mod_gm_opt->identifier );
-    current_job = NULL;
+/* start a check, runs in the check thread */
+void start_async_check(gm_job_t * job) {
+    if(prepare_exec_job(job) != GM_OK) {
+        async_job_finished(job);
+        return;
+    }
 
-    if ( !strcmp( exec_job->type, "service" ) || !strcmp( exec_job->type, "host" ) ) {
-        send_result_back(exec_job);
+    gm_log( GM_LOG_TRACE, "command: %s\n", job->command_line);
+    if(mod_gm_async_start(async_checks, job) != GM_OK) {
+        gm_log( GM_LOG_ERROR, "no free check slot for %s\n", job->command_line );
+        async_job_finished(job);
     }
 
     return;
 }
 
 
+/* hand job to the check thread */
+void queue_async_job(gm_job_t * job) {
+    pthread_mutex_lock(&async_mutex);
+    async_queue[(async_queue_head + async_queue_num) % GM_MAX_CONCURRENT_CHECKS] = job;
+    async_queue_num++;
+    async_inflight++;
+    async_last_job = time(NULL);
+    pthread_mutex_unlock(&async_mutex);
+
+    if(write(async_wakeup[1], "j", 1) <= 0)
+        perror("write");
+
+    return;
+}
+
+
+/* wait till a check slot is free, returns GM_ERROR when the worker should exit */
+int wait_for_async_slot() {
+    int rc = GM_OK;
+
+    pthread_mutex_lock(&async_mutex);
+    while(async_inflight >= async_checks->max && !async_stop)
+        pthread_cond_wait(&async_cond, &async_mutex);
+
+    if(async_stop) {
+        rc = GM_ERROR;
+    }
+    else if(async_inflight == 0 && mod_gm_opt->idle_timeout > 0 && worker_run_mode == GM_WORKER_MULTI
+            && time(NULL) - async_last_job >= mod_gm_opt->idle_timeout) {
+        gm_log( GM_LOG_TRACE, "idle timeout (%ds) reached\n", mod_gm_opt->idle_timeout );
+        rc = GM_ERROR;
+    }
+    pthread_mutex_unlock(&async_mutex);
+
+    return rc;
+}
+
+
+/* called for each finished concurrent check */
+void async_check_done(gm_job_t * job, void * data) {
+    gm_log( GM_LOG_TRACE, "async_check_done(%p)\n", data );
+    send_job_result(job);
+    async_job_finished(job);
+    return;
+}
+
+
+/* free job and release its slot */
+void async_job_finished(gm_job_t * job) {
+    recycle_job(job);
+
+    pthread_mutex_lock(&async_mutex);
+    async_inflight--;
+    async_last_job = time(NULL);
+    pthread_mutex_unlock(&async_mutex);
+
+    set_state(GM_JOB_END);
+
+    pthread_mutex_lock(&async_mutex);
+    pthread_cond_signal(&async_cond);
+    pthread_mutex_unlock(&async_mutex);
+
+    return;
+}
+
+
+/* signal handler in concurrent mode, wakes up the check thread */
+void async_sighandler(int sig) {
+    async_signal = sig;
+    if(write(async_wakeup[1], "s", 1) <= 0) {
+        /* pipe is full, so the check thread wakes up anyway */
+    }
+}
+
+
+/* kill running checks and exit, runs in the check thread */
+void async_exit(int sig) {
+    gm_log( GM_LOG_TRACE, "async_exit(%d)\n", sig);
+
+    /* the main thread may be waiting for gearman, so leave connections as they are */
+    mod_gm_async_abort(async_checks, sig);
+    mod_gm_result_batch_stop();
+    clear_worker_slot();
+    _exit( EXIT_SUCCESS );
+}
+
+
 /* create the worker */
 int set_worker( gearman_worker_st *w ) {
+    return set_worker_context( w, NULL );
+}
+
+
+/* create the worker, context is passed to each job */
+int set_worker_context( gearman_worker_st *w, void *context ) {
     int x = 0;
 
-    gm_log( GM_LOG_TRACE, "set_worker()\n" );
+    gm_log( GM_LOG_TRACE, "set_worker_context(%p)\n", context );
 
     create_worker( mod_gm_opt->server_list, w );
 
+    /* wake up regularly to check for free slots, stopped pools or exit requests */
+    if(async_checks != NULL || context != NULL || result_batch_running)
+        gearman_worker_set_timeout( w, 1000 );
+
     if(worker_run_mode == GM_WORKER_STATUS) {
         /* register status function */
         char status_queue[GM_BUFFERSIZE];
@@ -453,21 +797,21 @@ int set_worker( gearman_worker_st *w ) {
     else {
         /* normal worker */
         if(mod_gm_opt->hosts == GM_ENABLED)
-            worker_add_function( w, "host", get_job );
+            worker_add_function_context( w, "host", get_job, context );
 
         if(mod_gm_opt->services == GM_ENABLED)
-            worker_add_function( w, "service", get_job );
+            worker_add_function_context( w, "service", get_job, context );
 
         if(mod_gm_opt->events == GM_ENABLED)
-            worker_add_function( w, "eventhandler", get_job );
+            worker_add_function_context( w, "eventhandler", get_job, context );
 
         if(mod_gm_opt->notifications == GM_ENABLED)
-            worker_add_function( w, "notification", get_job );
+            worker_add_function_context( w, "notification", get_job, context );
 
         while ( mod_gm_opt->hostgroups_list[x] != NULL ) {
             char buffer[GM_BUFFERSIZE];
             snprintf( buffer, (sizeof(buffer)-1), "hostgroup_%s", mod_gm_opt->hostgroups_list[x] );
-            worker_add_function( w, buffer, get_job );
+            worker_add_function_context( w, buffer, get_job, context );
             x++;
         }
 
@@ -475,7 +819,7 @@ int set_worker( gearman_worker_st *w ) {
         while ( mod_gm_opt->servicegroups_list[x] != NULL ) {
             char buffer[GM_BUFFERSIZE];
             snprintf( buffer, (sizeof(buffer)-1), "servicegroup_%s", mod_gm_opt->servicegroups_list[x] );
-            worker_add_function( w, buffer, get_job );
+            worker_add_function_context( w, buffer, get_job, context );
             x++;
         }
     }
@@ -495,68 +839,93 @@ void exit_sighandler(int sig) {
 /* called when worker runs into idle timeout */
 void idle_sighandler(int sig) {
     gm_log( GM_LOG_TRACE, "idle_sighandler(%i)\n", sig );
+    if(result_batch_running) {
+        deferred_signal = 0;
+        deferred_exit   = 1;
+        return;
+    }
     clean_worker_exit(0);
     _exit( EXIT_SUCCESS );
 }
 
+/* remember the signal, the main loop exits after the current job */
+void deferred_exit_sighandler(int sig) {
+    deferred_signal = sig;
+    deferred_exit   = 1;
+}
+
 
 /* tell parent our state */
 void set_state(int status) {
-    int *shm;
+    gm_worker_slot_t * slot;
+    int pool_idle, pid;
+    uint64_t busy = 1;
 
     gm_log( GM_LOG_TRACE, "set_state(%d)\n", status );
 
-    if(worker_run_mode == GM_WORKER_STANDALONE)
+    /* pool threads share the status slot of the process */
+    pool_idle = worker_pool_state(status);
+
+    if(worker_run_mode == GM_WORKER_STANDALONE || registry == NULL)
         return;
 
-    /* give us 10 seconds to set state */
-    signal(SIGALRM, exit_sighandler);
-    alarm(10);
+    /* registry stays mapped since the fork */
+    slot = &registry->slots[shm_index];
 
-    /* Now we attach the segment to our data space. */
-    if ((shm = shmat(shmid, NULL, 0)) == (int *) -1) {
-        perror("shmat");
-        gm_log( GM_LOG_TRACE, "worker finished: %d\n", getpid() );
-        clean_worker_exit(0);
-        _exit( EXIT_FAILURE );
-    }
+    if(status == GM_JOB_START) {
+        slot->job_start = time(NULL);
 
-    if(status == GM_JOB_START)
-        shm[shm_index] = current_pid;
+        /* pools are busy when no thread is left */
+        if(pool_idle <= 0 && registry_set_state(registry, shm_index, current_pid, GM_SLOT_BUSY) == TRUE) {
+            /* wake up the main process, it may have to start more worker */
+            if(busy_eventfd >= 0 && write(busy_eventfd, &busy, sizeof(busy)) < 0)
+                gm_log( GM_LOG_TRACE, "cannot notify main process: %s\n", strerror(errno) );
+        }
+    }
     if(status == GM_JOB_END) {
-        shm[SHM_JOBS_DONE]++; /* increase jobs done */
-
-        shm[SHM_WORKER_LAST_CHECK] = (int)time(NULL); /* set last job date */
-
-        /* status slot changed to -1 -> exit */
-        if( shm[shm_index] == -1 ) {
-            gm_log( GM_LOG_TRACE, "worker finished: %d\n", getpid() );
-            clean_worker_exit(0);
-            _exit( EXIT_SUCCESS );
+        __atomic_add_fetch(&registry->jobs_done, 1, __ATOMIC_RELAXED); /* increase jobs done */
+        __atomic_add_fetch(&slot->jobs_done, 1, __ATOMIC_RELAXED);
+
+        registry->last_check = (int)time(NULL); /* set last job date */
+
+        /* slot has been freed or taken over -> exit */
+        pid = slot->pid;
+        if( pid != current_pid ) {
+            if(pid == 0)
+                gm_log( GM_LOG_TRACE, "worker finished: %d\n", getpid() );
+            else
+                gm_log( GM_LOG_ERROR, "double used worker slot: %d != %d\n", current_pid, pid );
+            if(async_checks != NULL) {
+                async_stop = 1;
+            } else if(pool_idle >= 0) {
+                worker_pool_stop();
+            } else {
+                clean_worker_exit(0);
+                _exit( pid == 0 ? EXIT_SUCCESS : EXIT_FAILURE );
+            }
         }
 
-        /* pid in our status slot changed, this should not happen -> exit */
-        if( shm[shm_index] != current_pid && shm[shm_index] != -current_pid ) {
-            gm_log( GM_LOG_ERROR, "double used worker slot: %d != %d\n", current_pid, shm[shm_index] );
-            clean_worker_exit(0);
-            _exit( EXIT_FAILURE );
+        /* concurrent workers are idle when no check is left */
+        else if(async_checks == NULL || async_inflight == 0) {
+            registry_set_state(registry, shm_index, current_pid, GM_SLOT_IDLE);
         }
-        shm[shm_index] = -current_pid;
     }
 
-    /* detach from shared memory */
-    if(shmdt(shm) < 0)
-        perror("shmdt");
+    return;
+}
 
-    alarm(0);
 
+/* show queue of the current job in our slot */
+void set_slot_queue(const char * queue) {
+    if(worker_run_mode == GM_WORKER_STANDALONE || registry == NULL || queue == NULL)
+        return;
+    snprintf(registry->slots[shm_index].queue, GM_SLOT_QUEUE_SIZE, "%s", queue);
     return;
 }
 
 
 /* do a clean exit */
 void clean_worker_exit(int sig) {
-    int *shm;
 
     /* give us 30 seconds to stop */
     signal(SIGALRM, exit_sighandler);
@@ -564,6 +933,9 @@ void clean_worker_exit(int sig) {
 
     gm_log( GM_LOG_TRACE, "clean_worker_exit(%d)\n", sig);
 
+    /* finish concurrent checks first */
+    stop_async_checks();
+
     /* clear gearmans job, otherwise it would be retried and retried */
     if(current_gearman_job != NULL) {
         if(sig == SIGINT) {
@@ -576,6 +948,9 @@ void clean_worker_exit(int sig) {
         kill_child_checks();
     }
 
+    /* send collected results */
+    mod_gm_result_batch_stop();
+
     gm_log( GM_LOG_TRACE, "cleaning worker\n");
     gearman_worker_unregister_all(&worker);
     gearman_job_free_all( &worker );
@@ -590,30 +965,28 @@ void clean_worker_exit(int sig) {
     if(worker_run_mode == GM_WORKER_STANDALONE)
         exit( EXIT_SUCCESS );
 
-    /* Now we attach the segment to our data space. */
-    if((shm = shmat(shmid, NULL, 0)) == (int *) -1) {
-        perror("shmat");
-        gm_log( GM_LOG_TRACE, "worker finished: %d\n", getpid() );
-        _exit( EXIT_FAILURE );
-    }
-    /* clean our pid from worker list */
-    if( shm[shm_index] == current_pid || shm[shm_index] == -current_pid ) {
-        shm[shm_index] = -1;
-    }
-
-    /* detach from shared memory */
-    if(shmdt(shm) < 0)
-        perror("shmdt");
+    clear_worker_slot();
 
     _exit( EXIT_SUCCESS );
 }
 
 
+/* remove our pid from the worker list */
+void clear_worker_slot() {
+    if(worker_run_mode == GM_WORKER_STANDALONE || registry == NULL)
+        return;
+
+    /* clean our pid from worker list */
+    registry_release(registry, shm_index, current_pid);
+
+    return;
+}
+
+
 /* answer status querys */
 void *return_status( gearman_job_st *job, void *context, size_t *result_size, gearman_return_t *ret_ptr ) {
     int wsize;
     char workload[GM_BUFFERSIZE];
-    int *shm;
     char * result;
 
     gm_log( GM_LOG_TRACE, "return_status()\n" );
@@ -626,7 +999,7 @@ void *return_status( gearman_job_st *job, void *context, size_t *result_size, ge
     strncpy(workload, (const char*)gearman_job_workload(job), wsize);
     workload[wsize] = '\0';
     gm_log( GM_LOG_TRACE, "got status job %s\n", gearman_job_handle( job ) );
-    gm_log( GM_LOG_TRACE, "%d +++>\n%s\n<+++\n", strlen(workload), workload );
+    gm_log( GM_LOG_TRACE, "%d +++>\n%s\n<+++\n", wsize, workload );
 
     /* set result pointer to success */
     *ret_ptr= GEARMAN_SUCCESS;
@@ -635,29 +1008,11 @@ void *return_status( gearman_job_st *job, void *context, size_t *result_size, ge
     result = gm_malloc(GM_BUFFERSIZE);
     *result_size = GM_BUFFERSIZE;
 
-    /* give us 10 seconds to get state */
-    signal(SIGALRM, exit_sighandler);
-    alarm(10);
-
-    /* Now we attach the segment to our data space. */
-    if ((shm = shmat(shmid, NULL, 0)) == (int *) -1) {
-        perror("shmat");
-        *result_size = 0;
-        alarm(0);
-        free(result);
-        return NULL;
-    }
-
-    snprintf(result, GM_BUFFERSIZE, "%s has %i worker and is working on %i jobs. Version: %s|worker=%i;;;%i;%i jobs=%ic", hostname, shm[SHM_WORKER_TOTAL], shm[SHM_WORKER_RUNNING], GM_VERSION, shm[SHM_WORKER_TOTAL], mod_gm_opt->min_worker, mod_gm_opt->max_worker, shm[SHM_JOBS_DONE] );
+    snprintf(result, GM_BUFFERSIZE, "%s has %i worker and is working on %i jobs. Version: %s|worker=%i;;;%i;%i jobs=%ic", hostname, registry->worker_total, registry->worker_running, GM_VERSION, registry->worker_total, mod_gm_opt->min_worker, mod_gm_opt->max_worker, registry->jobs_done );
 
     /* and increase job counter */
-    shm[SHM_JOBS_DONE]++;
-
-    /* detach from shared memory */
-    if(shmdt(shm) < 0)
-        perror("shmdt");
+    __atomic_add_fetch(&registry->jobs_done, 1, __ATOMIC_RELAXED);
 
-    alarm(0);
 
     return((void*)result);
 }
@@ -0,0 +1,274 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* include header */
+#include "config.h"
+#include "worker.h"
+#include "common.h"
+#include "worker_monitor.h"
+#include "utils.h"
+
+extern int busy_eventfd;
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+
+/* epoll data is the shm index for pidfds, negative for everything else */
+#define GM_MONITOR_TAG_BUSY     -1
+#define GM_MONITOR_TAG_SIGCHLD  -2
+
+int   monitor_epfd    = -1;
+int   monitor_sigfd   = -1;
+int * monitor_pidfds  = NULL;
+int   monitor_num     = 0;
+int   monitor_pending = 0;
+
+static int monitor_pidfd_open(pid_t pid);
+static int monitor_add_fd(int fd, int tag);
+static void monitor_release(int indx);
+static void monitor_close(void);
+
+
+/* create epoll set and eventfd */
+int monitor_init() {
+    sigset_t mask;
+    int fd, x;
+
+    monitor_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(monitor_epfd < 0) {
+        gm_log( GM_LOG_ERROR, "epoll_create failed: %s\n", strerror(errno) );
+        return GM_ERROR;
+    }
+
+    /* workers tell us when they start a job */
+    busy_eventfd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if(busy_eventfd < 0 || monitor_add_fd(busy_eventfd, GM_MONITOR_TAG_BUSY) != GM_OK) {
+        gm_log( GM_LOG_ERROR, "cannot create eventfd: %s\n", strerror(errno) );
+        monitor_close();
+        return GM_ERROR;
+    }
+
+    /* use pidfds to watch workers, fall back to SIGCHLD for older kernels */
+    fd = monitor_pidfd_open(getpid());
+    if(fd >= 0) {
+        close(fd);
+        monitor_num    = mod_gm_opt->max_worker+1;
+        monitor_pidfds = gm_malloc(monitor_num*sizeof(int));
+        for(x = 0; x < monitor_num; x++)
+            monitor_pidfds[x] = -1;
+    } else {
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &mask, NULL);
+        monitor_sigfd = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC);
+        if(monitor_sigfd < 0 || monitor_add_fd(monitor_sigfd, GM_MONITOR_TAG_SIGCHLD) != GM_OK) {
+            gm_log( GM_LOG_ERROR, "cannot create signalfd: %s\n", strerror(errno) );
+            sigprocmask(SIG_UNBLOCK, &mask, NULL);
+            monitor_close();
+            return GM_ERROR;
+        }
+    }
+
+    gm_log( GM_LOG_DEBUG, "watching workers with %s\n", monitor_pidfds != NULL ? "pidfds" : "signalfd" );
+
+    return GM_OK;
+}
+
+
+/* wait for worker events */
+int monitor_wait(int timeout) {
+    struct epoll_event events[GM_MONITOR_EVENTS];
+    struct signalfd_siginfo info;
+    uint64_t count;
+    int num, x, tag;
+    int result = 0;
+
+    /* a worker exited before we could watch it */
+    if(monitor_pending) {
+        monitor_pending = 0;
+        result  = GM_MONITOR_EXIT;
+        timeout = 0;
+    }
+
+    num = epoll_wait(monitor_epfd, events, GM_MONITOR_EVENTS, timeout);
+    for(x = 0; x < num; x++) {
+        tag = events[x].data.fd;
+        if(tag == GM_MONITOR_TAG_BUSY) {
+            if(read(busy_eventfd, &count, sizeof(count)) > 0)
+                gm_log( GM_LOG_TRACE3, "%d workers started a job\n", (int)count );
+            result |= GM_MONITOR_BUSY;
+        }
+        else if(tag == GM_MONITOR_TAG_SIGCHLD) {
+            while(read(monitor_sigfd, &info, sizeof(info)) > 0)
+                ;
+            result |= GM_MONITOR_EXIT;
+        }
+        else {
+            gm_log( GM_LOG_TRACE, "worker in slot %d exited\n", tag );
+            monitor_release(tag);
+            result |= GM_MONITOR_EXIT;
+        }
+    }
+
+    return result;
+}
+
+
+/* get notified when the worker exits */
+void monitor_watch_worker(int indx, pid_t pid) {
+    int fd, x;
+
+    if(monitor_pidfds == NULL || indx < 0)
+        return;
+
+    /* max_worker may have been raised by a reload */
+    if(indx >= monitor_num) {
+        monitor_pidfds = gm_realloc(monitor_pidfds, (indx+1)*sizeof(int));
+        for(x = monitor_num; x <= indx; x++)
+            monitor_pidfds[x] = -1;
+        monitor_num = indx+1;
+    }
+    monitor_release(indx);
+
+    fd = monitor_pidfd_open(pid);
+    if(fd < 0) {
+        monitor_pending = 1;
+        return;
+    }
+    if(monitor_add_fd(fd, indx) != GM_OK) {
+        close(fd);
+        monitor_pending = 1;
+        return;
+    }
+    monitor_pidfds[indx] = fd;
+
+    return;
+}
+
+
+/* forked processes do not watch anything */
+void monitor_child_init() {
+    sigset_t mask;
+    int x;
+
+    if(monitor_epfd >= 0)
+        close(monitor_epfd);
+    monitor_epfd = -1;
+
+    if(monitor_sigfd >= 0) {
+        close(monitor_sigfd);
+        monitor_sigfd = -1;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    }
+
+    for(x = 0; x < monitor_num; x++) {
+        if(monitor_pidfds[x] >= 0)
+            close(monitor_pidfds[x]);
+    }
+    free(monitor_pidfds);
+    monitor_pidfds = NULL;
+    monitor_num    = 0;
+
+    return;
+}
+
+
+/* get a pidfd for the worker, -1 if the kernel does not support it */
+static int monitor_pidfd_open(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    pid = pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+/* add file descriptor to the epoll set */
+static int monitor_add_fd(int fd, int tag) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = EPOLLIN;
+    ev.data.fd = tag;
+    if(epoll_ctl(monitor_epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        gm_log( GM_LOG_ERROR, "epoll_ctl failed: %s\n", strerror(errno) );
+        return GM_ERROR;
+    }
+    return GM_OK;
+}
+
+
+/* stop watching the worker in this slot */
+static void monitor_release(int indx) {
+    if(indx >= monitor_num || monitor_pidfds[indx] < 0)
+        return;
+
+    /* forked workers may still share the pidfd, so remove it explicitly */
+    epoll_ctl(monitor_epfd, EPOLL_CTL_DEL, monitor_pidfds[indx], NULL);
+    close(monitor_pidfds[indx]);
+    monitor_pidfds[indx] = -1;
+
+    return;
+}
+
+
+/* release everything after errors */
+static void monitor_close() {
+    if(busy_eventfd >= 0)
+        close(busy_eventfd);
+    busy_eventfd = -1;
+    monitor_child_init();
+    return;
+}
+
+#else
+
+/* epoll is linux only, the main process falls back to polling */
+int monitor_init() {
+    return GM_ERROR;
+}
+
+/* wait for worker events */
+int monitor_wait(int timeout) {
+    sleep(timeout/1000);
+    return 0;
+}
+
+/* get notified when the worker exits */
+void monitor_watch_worker(int indx, pid_t pid) {
+    gm_log( GM_LOG_TRACE, "monitor_watch_worker(%d, %d)\n", indx, pid );
+}
+
+/* forked processes do not watch anything */
+void monitor_child_init() {
+    return;
+}
+
+#endif
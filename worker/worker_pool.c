@@ -0,0 +1,318 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* include header */
+#include "worker.h"
+#include "common.h"
+#include "worker_client.h"
+#include "worker_pool.h"
+#include "utils.h"
+#include "gearman_utils.h"
+#include "gm_result_batch.h"
+#ifdef EMBEDDEDPERL
+#include "epn_utils.h"
+#endif
+
+extern int worker_run_mode;
+
+gm_pool_thread_t * pool_threads = NULL;
+gm_pool_client_t * pool_clients = NULL;
+int pool_size         = 0;
+int pool_num_clients  = 0;
+int pool_busy         = 0;
+int pool_jobs_done    = 0;
+int pool_max_jobs     = 0;
+time_t pool_last_job  = 0;
+volatile sig_atomic_t pool_stopped = 0;
+pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  pool_cond  = PTHREAD_COND_INITIALIZER;
+
+static void *pool_thread_loop(void * data);
+static int pool_create_clients(void);
+static void pool_free_clients(void);
+static void pool_exit(int status);
+
+/* start threads and wait till the pool is stopped */
+void worker_pool_run(int size) {
+    sigset_t mask;
+    struct timespec wait;
+    int x, sig, busy;
+    time_t last_job;
+
+    if(size > GM_MAX_WORKER_THREADS)
+        size = GM_MAX_WORKER_THREADS;
+
+    gm_log( GM_LOG_TRACE, "worker_pool_run(%d)\n", size );
+
+    /* signals are handled by the main thread only */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if(pool_create_clients() != GM_OK) {
+        gm_log( GM_LOG_ERROR, "cannot start client\n" );
+        pool_exit( EXIT_FAILURE );
+    }
+
+    pool_last_job = time(NULL);
+    pool_threads  = gm_calloc(size, sizeof(gm_pool_thread_t));
+    for(x = 0; x < size; x++) {
+        pool_threads[x].num = x;
+        set_worker_context(&pool_threads[x].worker, &pool_threads[x]);
+    }
+
+    /* threads must not see a partial pool, max jobs applies to each thread */
+    pool_size     = size;
+    pool_max_jobs = mod_gm_opt->max_jobs * size;
+    for(x = 0; x < size; x++) {
+        if(pthread_create(&pool_threads[x].thread, NULL, pool_thread_loop, &pool_threads[x]) != 0) {
+            gm_log( GM_LOG_ERROR, "cannot create worker thread: %s\n", strerror(errno));
+            pool_stopped = 1;
+            size = x;
+            break;
+        }
+    }
+
+    gm_log( GM_LOG_DEBUG, "started %d worker threads with %d result connections\n", size, pool_num_clients );
+
+    while(!pool_stopped) {
+        wait.tv_sec  = 1;
+        wait.tv_nsec = 0;
+        sig = sigtimedwait(&mask, NULL, &wait);
+
+        /* let running jobs retry */
+        if(sig == SIGINT) {
+            gm_log( GM_LOG_TRACE, "worker pool got signal %d\n", sig );
+            mod_gm_result_batch_stop();
+            clear_worker_slot();
+            _exit( EXIT_SUCCESS );
+        }
+
+        /* finish running jobs */
+        if(sig == SIGTERM) {
+            gm_log( GM_LOG_TRACE, "worker pool got signal %d\n", sig );
+            break;
+        }
+
+        pthread_mutex_lock(&pool_mutex);
+        busy     = pool_busy;
+        last_job = pool_last_job;
+        pthread_mutex_unlock(&pool_mutex);
+
+        if(busy == 0 && mod_gm_opt->idle_timeout > 0 && worker_run_mode == GM_WORKER_MULTI
+           && time(NULL) - last_job >= mod_gm_opt->idle_timeout) {
+            gm_log( GM_LOG_TRACE, "idle timeout (%ds) reached\n", mod_gm_opt->idle_timeout );
+            break;
+        }
+    }
+    pool_stopped = 1;
+
+    /* give us 30 seconds to stop */
+    signal(SIGALRM, exit_sighandler);
+    alarm(30);
+
+    for(x = 0; x < size; x++)
+        pthread_join(pool_threads[x].thread, NULL);
+
+    for(x = 0; x < pool_size; x++) {
+        gearman_worker_unregister_all(&pool_threads[x].worker);
+        gearman_job_free_all(&pool_threads[x].worker);
+        gearman_worker_free(&pool_threads[x].worker);
+    }
+
+    pool_exit( EXIT_SUCCESS );
+}
+
+
+/* number of running worker threads */
+int worker_pool_size() {
+    return pool_size;
+}
+
+
+/* count started and finished jobs, returns number of idle threads */
+int worker_pool_state(int status) {
+    int idle;
+
+    if(pool_size == 0)
+        return -1;
+
+    pthread_mutex_lock(&pool_mutex);
+    if(status == GM_JOB_START) {
+        pool_busy++;
+    }
+    else if(status == GM_JOB_END) {
+        pool_busy--;
+        pool_jobs_done++;
+        if(pool_max_jobs > 0 && pool_jobs_done >= pool_max_jobs && !pool_stopped) {
+            gm_log( GM_LOG_TRACE, "jobs done: %i -> exiting...\n", pool_jobs_done );
+            pool_stopped = 1;
+        }
+    }
+    pool_last_job = time(NULL);
+    idle = pool_size - pool_busy;
+    pthread_mutex_unlock(&pool_mutex);
+
+    return idle;
+}
+
+
+/* let all threads exit after their current job */
+void worker_pool_stop() {
+    pool_stopped = 1;
+    return;
+}
+
+
+/* send result with one of the shared client connections */
+void worker_pool_send_result(gm_job_t * job) {
+    gm_pool_client_t * c = NULL;
+    int x;
+
+    /* lease a free connection */
+    pthread_mutex_lock(&pool_mutex);
+    while(c == NULL) {
+        for(x = 0; x < pool_num_clients; x++) {
+            if(!pool_clients[x].used) {
+                c = &pool_clients[x];
+                c->used = 1;
+                break;
+            }
+        }
+        if(c == NULL)
+            pthread_cond_wait(&pool_cond, &pool_mutex);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    send_result_back_client(job, &c->client, mod_gm_opt->dupserver_num ? &c->client_dup : NULL);
+
+    pthread_mutex_lock(&pool_mutex);
+    c->used = 0;
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_mutex);
+
+    return;
+}
+
+
+/* main loop of a worker thread */
+static void *pool_thread_loop(void * data) {
+    gm_pool_thread_t * t = (gm_pool_thread_t *)data;
+    gearman_return_t ret;
+    int sleep_time = 1;
+
+    gm_log( GM_LOG_TRACE, "pool_thread_loop(%d)\n", t->num );
+
+    while(!pool_stopped) {
+        ret = gearman_worker_work( &t->worker );
+
+        /* no job within the poll interval, check stop flag again */
+        if(ret == GEARMAN_TIMEOUT)
+            continue;
+
+        if(ret != GEARMAN_SUCCESS) {
+            gm_log( GM_LOG_ERROR, "worker error: %s\n", gearman_worker_error( &t->worker ) );
+            gearman_job_free_all( &t->worker );
+            gearman_worker_free( &t->worker );
+
+            /* sleep on error to avoid cpu intensive infinite loops */
+            sleep(sleep_time);
+            sleep_time += 3;
+            if(sleep_time > 60)
+                sleep_time = 60;
+
+            set_worker_context( &t->worker, t );
+            continue;
+        }
+        sleep_time = 1;
+    }
+
+    return NULL;
+}
+
+
+/* create the shared result connections */
+static int pool_create_clients() {
+    int x;
+
+    pool_num_clients = (mod_gm_opt->worker_threads + GM_POOL_THREADS_PER_CLIENT - 1) / GM_POOL_THREADS_PER_CLIENT;
+    if(pool_num_clients > GM_MAX_WORKER_THREADS / GM_POOL_THREADS_PER_CLIENT)
+        pool_num_clients = GM_MAX_WORKER_THREADS / GM_POOL_THREADS_PER_CLIENT;
+
+    pool_clients = gm_calloc(pool_num_clients, sizeof(gm_pool_client_t));
+    for(x = 0; x < pool_num_clients; x++) {
+        if(create_client( mod_gm_opt->server_list, &pool_clients[x].client ) != GM_OK)
+            return GM_ERROR;
+        if(mod_gm_opt->dupserver_num) {
+            if(create_client( mod_gm_opt->dupserver_list, &pool_clients[x].client_dup ) != GM_OK) {
+                gm_log( GM_LOG_ERROR, "cannot start client for duplicate server\n" );
+                return GM_ERROR;
+            }
+        }
+    }
+
+    return GM_OK;
+}
+
+
+/* free the shared result connections */
+static void pool_free_clients() {
+    int x;
+    for(x = 0; x < pool_num_clients; x++) {
+        gearman_client_free( &pool_clients[x].client );
+        if(mod_gm_opt->dupserver_num)
+            gearman_client_free( &pool_clients[x].client_dup );
+    }
+    free(pool_clients);
+    pool_clients     = NULL;
+    pool_num_clients = 0;
+    return;
+}
+
+
+/* clean up and exit the worker process */
+static void pool_exit(int status) {
+    gm_log( GM_LOG_TRACE, "pool_exit(%d)\n", status );
+
+    /* send collected results */
+    mod_gm_result_batch_stop();
+
+    pool_free_clients();
+    free(pool_threads);
+    pool_threads = NULL;
+    pool_size    = 0;
+    mod_gm_free_opt(mod_gm_opt);
+
+#ifdef EMBEDDEDPERL
+    deinit_embedded_perl(0);
+#endif
+
+    if(worker_run_mode == GM_WORKER_STANDALONE)
+        exit( status );
+
+    clear_worker_slot();
+
+    _exit( status );
+}
@@ -0,0 +1,165 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* include header */
+#include "worker_registry.h"
+#include "common.h"
+#include <string.h>
+
+gm_worker_registry_t * registry = NULL;
+
+static void registry_push(gm_worker_registry_t * reg, int indx);
+
+#define REGISTRY_HEAD(tag, indx) (((uint64_t)(tag) << 32) | (uint32_t)(indx))
+
+
+/* size of the registry in bytes */
+size_t registry_size(int num_slots) {
+    return sizeof(gm_worker_registry_t) + (size_t)num_slots * sizeof(gm_worker_slot_t);
+}
+
+
+/* initialize registry */
+void registry_init(gm_worker_registry_t * reg, int num_slots) {
+    int x;
+
+    memset(reg, 0, registry_size(num_slots));
+    reg->version    = GM_REGISTRY_VERSION;
+    reg->slot_size  = sizeof(gm_worker_slot_t);
+    reg->num_slots  = num_slots;
+    reg->last_check = (int)time(NULL);
+
+    /* chain all worker slots, lowest index first */
+    for(x = GM_REGISTRY_STATUS_SLOT+1; x < num_slots; x++)
+        reg->slots[x].next = x+1 < num_slots ? x+1 : GM_REGISTRY_NO_SLOT;
+    reg->free_head = REGISTRY_HEAD(0, num_slots > 1 ? GM_REGISTRY_STATUS_SLOT+1 : GM_REGISTRY_NO_SLOT);
+
+    /* set magic last, workers check it */
+    __atomic_store_n(&reg->magic, GM_REGISTRY_MAGIC, __ATOMIC_RELEASE);
+
+    return;
+}
+
+
+/* verify registry layout */
+int registry_check(gm_worker_registry_t * reg) {
+    if(reg == NULL
+       || __atomic_load_n(&reg->magic, __ATOMIC_ACQUIRE) != GM_REGISTRY_MAGIC
+       || reg->version != GM_REGISTRY_VERSION
+       || reg->slot_size != sizeof(gm_worker_slot_t))
+        return GM_ERROR;
+    return GM_OK;
+}
+
+
+/* take a free slot */
+int registry_alloc(gm_worker_registry_t * reg) {
+    gm_worker_slot_t * slot;
+    uint64_t head, next;
+    int indx;
+
+    head = __atomic_load_n(&reg->free_head, __ATOMIC_ACQUIRE);
+    do {
+        indx = (int)(uint32_t)head;
+        if(indx == GM_REGISTRY_NO_SLOT)
+            return GM_REGISTRY_NO_SLOT;
+        next = REGISTRY_HEAD((head >> 32) + 1, reg->slots[indx].next);
+    } while(!__atomic_compare_exchange_n(&reg->free_head, &head, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    slot = &reg->slots[indx];
+    slot->pid        = 0;
+    slot->jobs_done  = 0;
+    slot->job_start  = 0;
+    slot->queue[0]   = '\x0';
+    __atomic_store_n(&slot->state, GM_SLOT_RESERVED, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&reg->worker_total, 1, __ATOMIC_RELAXED);
+
+    return indx;
+}
+
+
+/* return slot to the free list */
+int registry_release(gm_worker_registry_t * reg, int indx, int pid) {
+    gm_worker_slot_t * slot;
+    int old;
+
+    if(reg == NULL || indx < 0 || indx >= reg->num_slots)
+        return FALSE;
+    slot = &reg->slots[indx];
+
+    /* slot has been taken over by someone else */
+    if(!__atomic_compare_exchange_n(&slot->pid, &pid, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return FALSE;
+
+    /* only one of concurrent releases gets here with a used slot */
+    old = __atomic_exchange_n(&slot->state, GM_SLOT_FREE, __ATOMIC_ACQ_REL);
+    if(old == GM_SLOT_FREE)
+        return FALSE;
+    if(old == GM_SLOT_BUSY)
+        __atomic_sub_fetch(&reg->worker_running, 1, __ATOMIC_RELAXED);
+
+    if(indx != GM_REGISTRY_STATUS_SLOT) {
+        __atomic_sub_fetch(&reg->worker_total, 1, __ATOMIC_RELAXED);
+        registry_push(reg, indx);
+    }
+
+    return TRUE;
+}
+
+
+/* change slot state */
+int registry_set_state(gm_worker_registry_t * reg, int indx, int pid, int state) {
+    gm_worker_slot_t * slot;
+    int old;
+
+    if(reg == NULL || indx < 0 || indx >= reg->num_slots)
+        return FALSE;
+    slot = &reg->slots[indx];
+
+    old = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+    do {
+        if(old == GM_SLOT_FREE || slot->pid != pid)
+            return FALSE;
+    } while(!__atomic_compare_exchange_n(&slot->state, &old, state, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    if(old != GM_SLOT_BUSY && state == GM_SLOT_BUSY)
+        __atomic_add_fetch(&reg->worker_running, 1, __ATOMIC_RELAXED);
+    else if(old == GM_SLOT_BUSY && state != GM_SLOT_BUSY)
+        __atomic_sub_fetch(&reg->worker_running, 1, __ATOMIC_RELAXED);
+
+    return TRUE;
+}
+
+
+/* put slot on top of the free list */
+static void registry_push(gm_worker_registry_t * reg, int indx) {
+    uint64_t head, next;
+
+    head = __atomic_load_n(&reg->free_head, __ATOMIC_ACQUIRE);
+    do {
+        reg->slots[indx].next = (int)(uint32_t)head;
+        next = REGISTRY_HEAD((head >> 32) + 1, indx);
+    } while(!__atomic_compare_exchange_n(&reg->free_head, &head, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    return;
+}
@@ -0,0 +1,213 @@
+/******************************************************************************
+ *
+ * mod_gearman - distribute checks with gearman
+ *
+ * Copyright (c) 2010 Sven Nierlein - sven.nierlein@consol.de
+ *
+ * This file is part of mod_gearman.
+ *
+ *  mod_gearman is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  mod_gearman is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with mod_gearman.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* include header */
+#include "worker.h"
+#include "common.h"
+#include "worker_client.h"
+#include "worker_zygote.h"
+#include "worker_monitor.h"
+#include "utils.h"
+#ifdef EMBEDDEDPERL
+#include "epn_utils.h"
+#endif
+#include <poll.h>
+#include <sys/socket.h>
+
+extern gm_worker_registry_t * registry;
+#ifdef EMBEDDEDPERL
+extern char **start_env;
+#endif
+
+pid_t zygote_pid = -1;
+int   zygote_fd  = -1;
+
+static int zygote_start(void);
+static void zygote_loop(int fd, pid_t parent);
+static int zygote_wait(int fd, int timeout);
+
+/* fork a new worker from the zygote */
+pid_t zygote_spawn(int mode, int indx) {
+    gm_zygote_request_t req;
+    pid_t pid = -1;
+    int status;
+
+    gm_log( GM_LOG_TRACE, "zygote_spawn(%d, %d)\n", mode, indx );
+
+    /* zygote died, start a new one */
+    if(zygote_pid > 0 && waitpid(zygote_pid, &status, WNOHANG) != 0) {
+        gm_log( GM_LOG_DEBUG, "zygote %d exited, restarting\n", zygote_pid );
+        zygote_stop();
+    }
+    if(zygote_pid <= 0 && zygote_start() != GM_OK)
+        return -1;
+
+    req.mode      = mode;
+    req.shm_index = indx;
+    if(write(zygote_fd, &req, sizeof(req)) != sizeof(req)
+       || zygote_wait(zygote_fd, GM_ZYGOTE_TIMEOUT) != GM_OK
+       || read(zygote_fd, &pid, sizeof(pid)) != sizeof(pid)
+       || pid <= 0) {
+        gm_log( GM_LOG_ERROR, "zygote failed to start worker\n" );
+        zygote_stop();
+        return -1;
+    }
+
+    return pid;
+}
+
+
+/* stop the zygote */
+void zygote_stop() {
+    int status;
+
+    if(zygote_fd != -1)
+        close(zygote_fd);
+    zygote_fd = -1;
+
+    /* may have been collected by the main loop already */
+    if(zygote_pid > 0 && waitpid(zygote_pid, &status, WNOHANG) == 0) {
+        gm_log( GM_LOG_TRACE, "stopping zygote %d\n", zygote_pid );
+        kill(zygote_pid, SIGTERM);
+        waitpid(zygote_pid, &status, 0);
+    }
+    zygote_pid = -1;
+
+    return;
+}
+
+
+/* fork the zygote process */
+static int zygote_start() {
+    int fds[2];
+    pid_t parent = getpid();
+
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        gm_log( GM_LOG_ERROR, "socketpair failed: %s\n", strerror(errno) );
+        return GM_ERROR;
+    }
+
+    signal(SIGINT,  SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    zygote_pid = fork();
+
+    /* we are the zygote */
+    if(zygote_pid == 0) {
+        monitor_child_init();
+        close(fds[0]);
+        zygote_loop(fds[1], parent);
+        _exit( EXIT_SUCCESS );
+    }
+
+    signal(SIGINT, clean_exit);
+    signal(SIGTERM,clean_exit);
+    close(fds[1]);
+
+    if(zygote_pid == -1) {
+        perror("fork");
+        close(fds[0]);
+        return GM_ERROR;
+    }
+
+    zygote_fd = fds[0];
+    gm_log( GM_LOG_DEBUG, "zygote started with pid: %d\n", zygote_pid );
+
+    return GM_OK;
+}
+
+
+/* wait for spawn requests and fork new workers */
+static void zygote_loop(int fd, pid_t parent) {
+    gm_zygote_request_t req;
+    pid_t pid;
+    int rc;
+
+    signal(SIGHUP,  SIG_IGN);
+
+    /* let the kernel collect our finished workers */
+    signal(SIGCHLD, SIG_IGN);
+
+#ifdef EMBEDDEDPERL
+    if(init_embedded_perl(start_env) == GM_ERROR) {
+        _exit( EXIT_FAILURE );
+    }
+#endif
+
+    while(1) {
+        rc = zygote_wait(fd, 1000);
+
+        /* main process is gone */
+        if(getppid() != parent)
+            _exit( EXIT_SUCCESS );
+
+        if(rc != GM_OK)
+            continue;
+
+        rc = read(fd, &req, sizeof(req));
+        if(rc < 0 && errno == EINTR)
+            continue;
+        if(rc != sizeof(req))
+            _exit( rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE );
+
+        pid = fork();
+
+        /* we are the new worker */
+        if(pid == 0) {
+            close(fd);
+            signal(SIGCHLD, SIG_DFL);
+
+            gm_log( GM_LOG_DEBUG, "child started with pid: %d\n", getpid() );
+            registry->slots[req.shm_index].pid = getpid();
+
+#ifdef EMBEDDEDPERL
+            worker_client(req.mode, req.shm_index, start_env);
+#else
+            worker_client(req.mode, req.shm_index);
+#endif
+
+            exit(EXIT_SUCCESS);
+        }
+
+        if(pid == -1)
+            perror("fork");
+
+        if(write(fd, &pid, sizeof(pid)) != sizeof(pid))
+            _exit( EXIT_FAILURE );
+    }
+
+    return;
+}
+
+
+/* wait till fd is readable, returns GM_OK if there is something to read */
+static int zygote_wait(int fd, int timeout) {
+    struct pollfd pfd;
+
+    pfd.fd     = fd;
+    pfd.events = POLLIN;
+    if(poll(&pfd, 1, timeout) > 0)
+        return GM_OK;
+
+    return GM_ERROR;
+}